@@ -0,0 +1,88 @@
+#version 450
+
+// Bins the point lights into the clusters of the view frustum. The screen is split into CLUSTER_X x CLUSTER_Y tiles and
+// the view depth into CLUSTER_Z exponential slices: the projection has reversed Z with an infinite far plane, so the
+// first slice reaches from the near plane to clusterNear and the last slice to infinity.
+// Every invocation tests one cluster against all lights, which the workgroup loads into shared memory in batches
+
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define MAX_LIGHTS_PER_CLUSTER 256
+#define GROUP_SIZE 64
+
+struct Light {
+    // View space position and radius
+    vec4 positionRadius;
+    vec4 color;
+};
+
+// Matches LightingParams in main.cpp
+layout(set = 0, binding = 0) readonly buffer lightBuffer {
+    vec2 screenSize;
+    // proj[0][0] and proj[1][1]
+    vec2 projScale;
+    float zNear;
+    float clusterNear;
+    // Slices per e-fold of depth, the slices from 1 to CLUSTER_Z - 2 cover clusterNear to clusterFar
+    float sliceScale;
+    uint lightCount;
+    uint naive;
+    Light lights[];
+};
+layout(set = 0, binding = 1) writeonly buffer clusterBuffer {
+    uint clusterLightCounts[CLUSTER_COUNT];
+    uint clusterLightIndices[];
+};
+
+layout(local_size_x = GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+shared vec4 sharedLights[GROUP_SIZE];
+
+float getSliceDepth(uint slice) {
+    if(slice == 0) {
+        return zNear;
+    }
+    if(slice >= CLUSTER_Z) {
+        return 1e30;
+    }
+    return clusterNear * exp(float(slice - 1) / sliceScale);
+}
+
+void main() {
+    const uint clusterIndex = gl_GlobalInvocationID.x;
+    const bool valid = clusterIndex < CLUSTER_COUNT;
+    const uvec3 cluster = uvec3(clusterIndex % CLUSTER_X, (clusterIndex / CLUSTER_X) % CLUSTER_Y, clusterIndex / (CLUSTER_X * CLUSTER_Y));
+
+    // View space bounds of the cluster, from the corners of its tile at the near and far depth of its slice
+    vec2 ndcMin = vec2(cluster.xy) / vec2(CLUSTER_X, CLUSTER_Y) * 2.0 - 1.0;
+    vec2 ndcMax = vec2(cluster.xy + 1) / vec2(CLUSTER_X, CLUSTER_Y) * 2.0 - 1.0;
+    float depthMin = getSliceDepth(cluster.z);
+    float depthMax = getSliceDepth(cluster.z + 1);
+    vec2 a = ndcMin / projScale;
+    vec2 b = ndcMax / projScale;
+    vec3 boundsMin = vec3(min(min(a * depthMin, a * depthMax), min(b * depthMin, b * depthMax)), depthMin);
+    vec3 boundsMax = vec3(max(max(a * depthMin, a * depthMax), max(b * depthMin, b * depthMax)), depthMax);
+
+    uint count = 0;
+    for(uint base = 0; base < lightCount; base += GROUP_SIZE) {
+        uint lightIndex = base + gl_LocalInvocationIndex;
+        sharedLights[gl_LocalInvocationIndex] = (lightIndex < lightCount) ? lights[lightIndex].positionRadius : vec4(0.0, 0.0, 0.0, -1.0);
+        barrier();
+        uint batchCount = min(lightCount - base, GROUP_SIZE);
+        for(uint i = 0; i < batchCount; ++i) {
+            vec4 light = sharedLights[i];
+            vec3 closest = clamp(light.xyz, boundsMin, boundsMax);
+            vec3 offset = closest - light.xyz;
+            if(valid && dot(offset, offset) <= light.w * light.w && count < MAX_LIGHTS_PER_CLUSTER) {
+                clusterLightIndices[clusterIndex * MAX_LIGHTS_PER_CLUSTER + count] = base + i;
+                count++;
+            }
+        }
+        barrier();
+    }
+    if(valid) {
+        clusterLightCounts[clusterIndex] = count;
+    }
+}
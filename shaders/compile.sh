@@ -1,4 +1,5 @@
 #!/bin/sh
+set -e
 glslc -fshader-stage=vert triangle_vert.glsl -o triangle_vert.spv
 glslc -fshader-stage=frag triangle_frag.glsl -o triangle_frag.spv
 glslc -fshader-stage=vert color_vert.glsl -o color_vert.spv
@@ -7,8 +8,17 @@ glslc -fshader-stage=vert texture_vert.glsl -o texture_vert.spv
 glslc -fshader-stage=frag texture_frag.glsl -o texture_frag.spv
 glslc -fshader-stage=vert model_vert.glsl -o model_vert.spv
 glslc -fshader-stage=frag model_frag.glsl -o model_frag.spv
+glslc -fshader-stage=vert model_depth_vert.glsl -o model_depth_vert.spv
 glslc -fshader-stage=vert postprocess_vert.glsl -o postprocess_vert.spv
 glslc -fshader-stage=frag postprocess_frag.glsl -o postprocess_frag.spv
 glslc -fshader-stage=vert gaussian_vert.glsl -o gaussian_vert.spv
 glslc -fshader-stage=frag gaussian_frag.glsl -o gaussian_frag.spv
-glslc -fshader-stage=comp compute_comp.glsl -o compute_comp.spv
\ No newline at end of file
+glslc -fshader-stage=comp compute_comp.glsl -o compute_comp.spv
+glslc -fshader-stage=frag dual_filter_frag.glsl -o dual_filter_frag.spv
+glslc -fshader-stage=comp hiz_depth_comp.glsl -o hiz_depth_comp.spv
+glslc -fshader-stage=comp -DSINGLE_SAMPLE hiz_depth_comp.glsl -o hiz_depth_single_comp.spv
+glslc -fshader-stage=comp hiz_reduce_comp.glsl -o hiz_reduce_comp.spv
+glslc -fshader-stage=comp occlusion_cull_comp.glsl -o occlusion_cull_comp.spv
+glslc -fshader-stage=comp cluster_lights_comp.glsl -o cluster_lights_comp.spv
+glslc -fshader-stage=comp fxaa_comp.glsl -o fxaa_comp.spv
+glslc -fshader-stage=comp taa_comp.glsl -o taa_comp.spv
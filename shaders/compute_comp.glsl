@@ -1,58 +1,71 @@
 #version 460
 
+// Separable box blur. Dispatched twice: horizontal into an intermediate image, then vertical.
+// Every workgroup filters GROUP_SIZE pixels of one row (or column) and first loads the
+// GROUP_SIZE + 2 * RADIUS texels it needs into shared memory. Each pixel then costs
+// 2 * RADIUS + 1 shared memory reads instead of (2 * RADIUS)^2 image loads.
+// With dynamic resolution only the top left sourceSize of the source holds the image. The vertical
+// pass writes the whole destination and upscales with nearest filtering, the tile then holds the
+// source texels that the GROUP_SIZE destination pixels map to.
+
 layout(set = 0, binding = 0, rgba8) uniform writeonly image2D destinationImage;
 layout(set = 0, binding = 1, rgba8) uniform readonly image2D sourceImage;
 
-#define RADIUS 4
-#define GROUP_SIZE 8
-#define TILE_DIM (2 * RADIUS + GROUP_SIZE)
+layout(push_constant) uniform pushConstants {
+    ivec2 sourceSize;
+    ivec2 destinationSize;
+};
+
+layout(constant_id = 0) const bool VERTICAL = false;
+layout(constant_id = 1) const uint RADIUS = 4;
+// GROUP_SIZE is specialized through constant_id 2
+layout(local_size_x_id = 2, local_size_y = 1, local_size_z = 1) in;
+
+#define GROUP_SIZE gl_WorkGroupSize.x
+#define TILE_DIM (GROUP_SIZE + 2 * RADIUS)
 
 // Storage shared for this local invocation
-shared vec3 tile[TILE_DIM * TILE_DIM];
+shared vec3 tile[TILE_DIM];
+
+// Maps a position along the filter axis and the line index to image coordinates
+ivec2 texel(int position, int line) {
+    return VERTICAL ? ivec2(line, position) : ivec2(position, line);
+}
 
-vec3 tap(ivec2 pos) {
-    return tile[pos.x + TILE_DIM * pos.y];
+// Source position of a destination position along one axis
+int sourcePosition(int position, int sourceLength, int destinationLength) {
+    return (position * sourceLength + sourceLength / 2) / destinationLength;
 }
 
-layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE, local_size_z = 1) in;
 void main() {
-    ivec2 iuv = ivec2(gl_GlobalInvocationID.xy);
-
-    // Populate local memory
-    if(gl_LocalInvocationIndex < TILE_DIM * TILE_DIM / 4) {
-        const ivec2 anchor = ivec2(gl_WorkGroupID.xy * GROUP_SIZE - RADIUS);
-
-        const ivec2 coord1 = anchor + ivec2(gl_LocalInvocationIndex % TILE_DIM, gl_LocalInvocationIndex / TILE_DIM);
-        const ivec2 coord2 = anchor + ivec2((gl_LocalInvocationIndex + TILE_DIM * TILE_DIM / 4) % TILE_DIM, (gl_LocalInvocationIndex + TILE_DIM * TILE_DIM / 4) / TILE_DIM);
-        const ivec2 coord3 = anchor + ivec2((gl_LocalInvocationIndex + TILE_DIM * TILE_DIM / 2) % TILE_DIM, (gl_LocalInvocationIndex + TILE_DIM * TILE_DIM / 2) / TILE_DIM);
-        const ivec2 coord4 = anchor + ivec2((gl_LocalInvocationIndex + TILE_DIM * TILE_DIM * 3 / 4) % TILE_DIM, (gl_LocalInvocationIndex + TILE_DIM * TILE_DIM * 3 / 4) / TILE_DIM);
-
-        const vec3 color0 = imageLoad(sourceImage, coord1).xyz;
-        const vec3 color1 = imageLoad(sourceImage, coord2).xyz;
-        const vec3 color2 = imageLoad(sourceImage, coord3).xyz;
-        const vec3 color3 = imageLoad(sourceImage, coord4).xyz;
-
-        tile[gl_LocalInvocationIndex] = color0;
-        tile[gl_LocalInvocationIndex + TILE_DIM * TILE_DIM / 4] = color1;
-        tile[gl_LocalInvocationIndex + TILE_DIM * TILE_DIM / 2] = color2;
-        tile[gl_LocalInvocationIndex + TILE_DIM * TILE_DIM * 3 / 4] = color3;
+    const int axisLength = VERTICAL ? destinationSize.y : destinationSize.x;
+    const int sourceAxisLength = VERTICAL ? sourceSize.y : sourceSize.x;
+    const int line = int(gl_WorkGroupID.y);
+    const int sourceLine = VERTICAL ? sourcePosition(line, sourceSize.x, destinationSize.x) : sourcePosition(line, sourceSize.y, destinationSize.y);
+    const int groupStart = int(gl_WorkGroupID.x * GROUP_SIZE);
+    const int sourceGroupStart = sourcePosition(groupStart, sourceAxisLength, axisLength);
+
+    // Populate local memory. Reads are clamped to the image border
+    for(uint i = gl_LocalInvocationID.x; i < TILE_DIM; i += GROUP_SIZE) {
+        const int position = clamp(sourceGroupStart + int(i) - int(RADIUS), 0, sourceAxisLength - 1);
+        tile[i] = imageLoad(sourceImage, texel(position, sourceLine)).rgb;
     }
     // Make fetches available to all threads
-    groupMemoryBarrier();
+    memoryBarrierShared();
     barrier();
 
-    ivec2 tapBase = ivec2(gl_LocalInvocationID.xy);
-    vec4 rgba = imageLoad(sourceImage, iuv);
-    //vec4 rgba = vec4(tap(tapBase + ivec2(RADIUS)), 1.0);
-    
-    rgba.rgb = vec3(0.0);
-    for(int i = 0; i < RADIUS*2; ++i) {
-        for(int j = 0; j < RADIUS*2; ++j) {
-            rgba.rgb += imageLoad(sourceImage, (iuv - ivec2(RADIUS) + ivec2(i, j))).rgb;
-            //rgba.rgb += tap(tapBase + ivec2(i, j));
-        }
+    const int position = groupStart + int(gl_LocalInvocationID.x);
+    if(position >= axisLength) {
+        return;
+    }
+
+    const int source = sourcePosition(position, sourceAxisLength, axisLength);
+    const uint tileStart = uint(source - sourceGroupStart);
+    vec3 sum = vec3(0.0);
+    for(uint i = 0; i <= 2 * RADIUS; ++i) {
+        sum += tile[tileStart + i];
     }
-    rgba.rgb /= vec3(RADIUS*RADIUS*4);
 
-    imageStore(destinationImage, iuv, rgba);
-}
\ No newline at end of file
+    const float alpha = imageLoad(sourceImage, texel(source, sourceLine)).a;
+    imageStore(destinationImage, texel(position, line), vec4(sum / float(2 * RADIUS + 1), alpha));
+}
@@ -0,0 +1,41 @@
+#version 450 core
+
+// Dual filter blur (downsample / upsample chain)
+// https://community.arm.com/cfs-file/__key/communityserver-blogs-components-weblogfiles/00-00-00-20-66/siggraph2015_2D00_mmg_2D00_marius_2D00_notes.pdf
+
+layout(binding = 0) uniform sampler2D colorTex;
+
+layout(location = 0) in vec2 texCoord;
+layout (location = 0) out vec4 outColor;
+
+layout(constant_id = 0) const bool UPSAMPLE = false;
+
+layout(push_constant) uniform pushConstants {
+	vec2 halfPixel; // half pixel size of the render target eg. 0.5 / targetSize
+	vec2 uvScale; // part of colorTex that holds the image, below 1 with dynamic resolution
+	float offset; // spread of the taps in half pixels
+} u_pushConstants;
+
+void main(void) {
+    vec2 uv = texCoord * u_pushConstants.uvScale;
+    vec2 o = u_pushConstants.halfPixel * u_pushConstants.offset;
+    if(UPSAMPLE) {
+        outColor  = texture(colorTex, uv + vec2(-o.x * 2.0, 0.0));
+        outColor += texture(colorTex, uv + vec2(-o.x, o.y)) * 2.0;
+        outColor += texture(colorTex, uv + vec2(0.0, o.y * 2.0));
+        outColor += texture(colorTex, uv + vec2(o.x, o.y)) * 2.0;
+        outColor += texture(colorTex, uv + vec2(o.x * 2.0, 0.0));
+        outColor += texture(colorTex, uv + vec2(o.x, -o.y)) * 2.0;
+        outColor += texture(colorTex, uv + vec2(0.0, -o.y * 2.0));
+        outColor += texture(colorTex, uv + vec2(-o.x, -o.y)) * 2.0;
+        outColor /= 12.0;
+    } else {
+        // Downsample
+        outColor  = texture(colorTex, uv) * 4.0;
+        outColor += texture(colorTex, uv - o);
+        outColor += texture(colorTex, uv + o);
+        outColor += texture(colorTex, uv + vec2(o.x, -o.y));
+        outColor += texture(colorTex, uv - vec2(o.x, -o.y));
+        outColor /= 8.0;
+    }
+}
@@ -0,0 +1,68 @@
+#version 450
+
+// Fast approximate anti-aliasing after Timothy Lottes. The luma of the four diagonal neighbors gives the direction of an
+// edge through the pixel, the pixel is then blended with bilinear samples along that edge. Pixels below the contrast
+// threshold are copied. With dynamic resolution only the top left size of the source holds the image, the samples are
+// clamped to it
+
+layout(set = 0, binding = 0) uniform sampler2D sourceImage;
+layout(set = 0, binding = 3, rgba8) uniform writeonly image2D destinationImage;
+
+layout(push_constant) uniform pushConstants {
+    ivec2 size;
+};
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+#define EDGE_THRESHOLD 0.125
+#define EDGE_THRESHOLD_MIN 0.0312
+#define REDUCE_MUL (1.0 / 8.0)
+#define REDUCE_MIN (1.0 / 128.0)
+#define SPAN_MAX 8.0
+
+float luma(vec3 color) {
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+vec3 sampleClamped(vec2 uv, vec2 uvMax) {
+    return textureLod(sourceImage, min(uv, uvMax), 0.0).rgb;
+}
+
+void main() {
+    const ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+    if(any(greaterThanEqual(position, size))) {
+        return;
+    }
+    const vec2 texelSize = 1.0 / vec2(textureSize(sourceImage, 0));
+    // Center of the last rendered texel
+    const vec2 uvMax = (vec2(size) - 0.5) * texelSize;
+    const vec2 uv = (vec2(position) + 0.5) * texelSize;
+
+    const vec3 colorM = texelFetch(sourceImage, position, 0).rgb;
+    const float lumaM = luma(colorM);
+    const float lumaNW = luma(sampleClamped(uv + vec2(-1.0, -1.0) * texelSize, uvMax));
+    const float lumaNE = luma(sampleClamped(uv + vec2(1.0, -1.0) * texelSize, uvMax));
+    const float lumaSW = luma(sampleClamped(uv + vec2(-1.0, 1.0) * texelSize, uvMax));
+    const float lumaSE = luma(sampleClamped(uv + vec2(1.0, 1.0) * texelSize, uvMax));
+    const float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    const float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+    if(lumaMax - lumaMin < max(EDGE_THRESHOLD_MIN, lumaMax * EDGE_THRESHOLD)) {
+        imageStore(destinationImage, position, vec4(colorM, 1.0));
+        return;
+    }
+
+    // Perpendicular to the luma gradient, the shorter axis scaled to one texel
+    vec2 direction = vec2(-((lumaNW + lumaNE) - (lumaSW + lumaSE)), (lumaNW + lumaSW) - (lumaNE + lumaSE));
+    const float directionReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * 0.25 * REDUCE_MUL, REDUCE_MIN);
+    const float rcpDirectionMin = 1.0 / (min(abs(direction.x), abs(direction.y)) + directionReduce);
+    direction = clamp(direction * rcpDirectionMin, vec2(-SPAN_MAX), vec2(SPAN_MAX)) * texelSize;
+
+    const vec3 colorA = 0.5 * (sampleClamped(uv + direction * (1.0 / 3.0 - 0.5), uvMax) +
+                               sampleClamped(uv + direction * (2.0 / 3.0 - 0.5), uvMax));
+    const vec3 colorB = colorA * 0.5 + 0.25 * (sampleClamped(uv - direction * 0.5, uvMax) +
+                                               sampleClamped(uv + direction * 0.5, uvMax));
+    // The wider blend may reach past the edge, then the result leaves the local luma range
+    const float lumaB = luma(colorB);
+    const vec3 color = (lumaB < lumaMin || lumaB > lumaMax) ? colorA : colorB;
+    imageStore(destinationImage, position, vec4(color, 1.0));
+}
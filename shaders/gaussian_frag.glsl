@@ -11,6 +11,7 @@ layout (location = 0) out vec4 outColor;
 layout(constant_id = 0) const bool VERTICAL = false;
 
 layout(push_constant) uniform pushConstants {
+	vec2 uvScale; // part of colorTex that holds the image, below 1 with dynamic resolution
 	float pixelSize; // pixel size eg. 1 / screenWidth and 1 / screenHeight
 } u_pushConstants;
 
@@ -18,16 +19,17 @@ float offset[3] = float[](0.0, 1.3846153846, 3.2307692308);
 float weight[3] = float[](0.2270270270, 0.3162162162, 0.0702702703);
 
 void main(void) {
-    outColor = texture(colorTex, texCoord) * weight[0];
+    vec2 uv = texCoord * u_pushConstants.uvScale;
+    outColor = texture(colorTex, uv) * weight[0];
     for (int i=1; i<3; i++) {
         
         if(VERTICAL) {
-            outColor += texture(colorTex, (vec2(texCoord) + vec2(0.0, offset[i] * u_pushConstants.pixelSize))) * weight[i];
-            outColor += texture(colorTex, (vec2(texCoord) - vec2(0.0, offset[i] * u_pushConstants.pixelSize))) * weight[i];
+            outColor += texture(colorTex, (uv + vec2(0.0, offset[i] * u_pushConstants.pixelSize))) * weight[i];
+            outColor += texture(colorTex, (uv - vec2(0.0, offset[i] * u_pushConstants.pixelSize))) * weight[i];
         } else {
             // Horizontal
-            outColor += texture(colorTex, (vec2(texCoord) + vec2(offset[i] * u_pushConstants.pixelSize, 0.0))) * weight[i];
-            outColor += texture(colorTex, (vec2(texCoord) - vec2(offset[i] * u_pushConstants.pixelSize, 0.0))) * weight[i];
+            outColor += texture(colorTex, (uv + vec2(offset[i] * u_pushConstants.pixelSize, 0.0))) * weight[i];
+            outColor += texture(colorTex, (uv - vec2(offset[i] * u_pushConstants.pixelSize, 0.0))) * weight[i];
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,46 @@
+#version 450
+
+// First level of the hierarchical depth pyramid. With reversed Z the farthest depth is the minimum, so every texel
+// stores the minimum over all samples of the pixels it covers. The pyramid has power of two dimensions below the
+// depth buffer size, so a texel can cover up to three pixels per axis. With dynamic resolution the pyramid covers the
+// rendered part of the depth buffer, so it is addressed like the screen independent of the render scale
+
+// Compiled a second time with SINGLE_SAMPLE for depth buffers without multisampling
+#ifdef SINGLE_SAMPLE
+layout(set = 0, binding = 0) uniform sampler2D depthImage;
+#define SAMPLE_COUNT 1
+#define FETCH_DEPTH(position, s) texelFetch(depthImage, position, 0).r
+#else
+layout(set = 0, binding = 0) uniform sampler2DMS depthImage;
+#define SAMPLE_COUNT textureSamples(depthImage)
+#define FETCH_DEPTH(position, s) texelFetch(depthImage, position, s).r
+#endif
+layout(set = 0, binding = 1, r32f) uniform writeonly image2D destinationImage;
+
+layout(push_constant) uniform pushConstants {
+    ivec2 sourceSize;
+};
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+void main() {
+    const ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+    const ivec2 destinationSize = imageSize(destinationImage);
+    if(any(greaterThanEqual(position, destinationSize))) {
+        return;
+    }
+    // Rounded outwards, a partially covered pixel still counts
+    const ivec2 begin = position * sourceSize / destinationSize;
+    const ivec2 end = ((position + 1) * sourceSize + destinationSize - 1) / destinationSize;
+    const int sampleCount = SAMPLE_COUNT;
+
+    float depth = 1.0;
+    for(int y = begin.y; y < end.y; ++y) {
+        for(int x = begin.x; x < end.x; ++x) {
+            for(int s = 0; s < sampleCount; ++s) {
+                depth = min(depth, FETCH_DEPTH(ivec2(x, y), s));
+            }
+        }
+    }
+    imageStore(destinationImage, position, vec4(depth));
+}
@@ -0,0 +1,28 @@
+#version 450
+
+// Further levels of the hierarchical depth pyramid, the minimum of the 2x2 texels of the level above.
+// Once one axis has reached a single texel it is no longer halved, so some texels only read one row or column
+
+layout(set = 0, binding = 0) uniform sampler2D sourceImage;
+layout(set = 0, binding = 1, r32f) uniform writeonly image2D destinationImage;
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+void main() {
+    const ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+    const ivec2 destinationSize = imageSize(destinationImage);
+    if(any(greaterThanEqual(position, destinationSize))) {
+        return;
+    }
+    const ivec2 sourceSize = textureSize(sourceImage, 0);
+    const ivec2 begin = position * sourceSize / destinationSize;
+    const ivec2 end = (position + 1) * sourceSize / destinationSize;
+
+    float depth = 1.0;
+    for(int y = begin.y; y < end.y; ++y) {
+        for(int x = begin.x; x < end.x; ++x) {
+            depth = min(depth, texelFetch(sourceImage, ivec2(x, y), 0).r);
+        }
+    }
+    imageStore(destinationImage, position, vec4(depth));
+}
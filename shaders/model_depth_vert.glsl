@@ -0,0 +1,28 @@
+#version 450 core
+
+// Depth prepass of the model pipeline. Reads only the position stream and has no fragment shader.
+// gl_Position is invariant and computed exactly like in model_vert.glsl, the main pass tests for equal depth
+
+layout(location = 0) in vec3 in_position;
+
+// Matches InstanceData in main.cpp
+struct Instance {
+	mat4 modelViewProj;
+	mat4 previousModelViewProj;
+	mat4 modelView;
+	vec4 boundsMin;
+	vec4 boundsMax;
+	uint indexCount;
+	uint flags;
+};
+
+layout(set = 0, binding = 0) readonly buffer instanceBuffer {
+	Instance instances[];
+};
+
+invariant gl_Position;
+
+void main() {
+	mat4 modelViewProj = instances[gl_InstanceIndex].modelViewProj;
+	gl_Position = modelViewProj * vec4(in_position, 1.0);
+}
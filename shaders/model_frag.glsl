@@ -3,10 +3,61 @@
 layout(location = 0) in vec3 in_normal;
 layout(location = 1) in vec2 in_texcoord;
 layout(location = 2) in vec3 in_position;
+layout(location = 3) in vec4 in_currentClip;
+layout(location = 4) in vec4 in_previousClip;
 
 layout(set = 0, binding = 1) uniform sampler2D in_albedoSampledTexture;
 
+// See cluster_lights_comp.glsl
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define MAX_LIGHTS_PER_CLUSTER 256
+
+struct Light {
+	// View space position and radius
+	vec4 positionRadius;
+	vec4 color;
+};
+
+layout(set = 1, binding = 0) readonly buffer lightBuffer {
+	vec2 screenSize;
+	vec2 projScale;
+	float zNear;
+	float clusterNear;
+	float sliceScale;
+	uint lightCount;
+	// Loops over all lights instead of those of the cluster, for comparison
+	uint naive;
+	Light lights[];
+};
+layout(set = 1, binding = 1) readonly buffer clusterBuffer {
+	uint clusterLightCounts[CLUSTER_COUNT];
+	uint clusterLightIndices[];
+};
+
 layout(location = 0) out vec4 out_color;
+// NDC motion since the last frame, only written to an attachment with TAA, see taa_comp.glsl
+layout(location = 1) out vec2 out_velocity;
+
+vec3 shadeLight(vec3 light, vec3 radiance, vec3 normal, vec3 view, vec3 albedo) {
+	vec3 reflection = reflect(-light, normal);
+	float shininess = 16.0f;
+	vec3 diffuse = max(dot(normal, light), 0.0) * albedo;
+	vec3 specular = pow(max(dot(view, reflection), 0.0), shininess) * vec3(1.0);
+	return (0.5 * diffuse + 0.4 * specular) * radiance;
+}
+
+vec3 shadePointLight(uint lightIndex, vec3 normal, vec3 view, vec3 albedo) {
+	vec4 positionRadius = lights[lightIndex].positionRadius;
+	vec3 toLight = positionRadius.xyz - in_position;
+	float distanceSquared = dot(toLight, toLight);
+	// Inverse square falloff, windowed to reach zero at the radius
+	float window = clamp(1.0 - distanceSquared / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+	float attenuation = window * window / (1.0 + distanceSquared);
+	return shadeLight(toLight * inversesqrt(distanceSquared), lights[lightIndex].color.rgb * attenuation, normal, view, albedo);
+}
 
 void main() {
 	vec3 view = normalize(-in_position);
@@ -14,16 +65,29 @@ void main() {
 	vec4 texSample = texture(in_albedoSampledTexture, in_texcoord);
 	vec3 normal = normalize(in_normal);
 
-	vec3 light = normalize(vec3(1, 1, -1));
-	vec3 reflection = reflect(-light, normal);
-	float shininess = 16.0f;
-
-	vec3 diffuse = max(dot(normal, light), 0.0) * texSample.rgb;
-	vec3 specular = pow(max(dot(view, reflection), 0.0), shininess) * vec3(1.0);
 	vec3 ambient = 0.2f * texSample.rgb;
+	vec3 combined = ambient + shadeLight(normalize(vec3(1, 1, -1)), vec3(1.0), normal, view, texSample.rgb);
 
-	vec3 combined = 0.5 * diffuse + ambient + 0.4 * specular;
+	if(naive != 0) {
+		for(uint i = 0; i < lightCount; ++i) {
+			combined += shadePointLight(i, normal, view, texSample.rgb);
+		}
+	} else {
+		// Reversed Z with an infinite far plane, the depth is zNear / z
+		float depth = zNear / gl_FragCoord.z;
+		uint slice = 0;
+		if(depth > clusterNear) {
+			slice = min(uint(log(depth / clusterNear) * sliceScale) + 1, CLUSTER_Z - 1);
+		}
+		uvec2 tile = min(uvec2(gl_FragCoord.xy / screenSize * vec2(CLUSTER_X, CLUSTER_Y)), uvec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+		uint cluster = (slice * CLUSTER_Y + tile.y) * CLUSTER_X + tile.x;
+		uint count = clusterLightCounts[cluster];
+		for(uint i = 0; i < count; ++i) {
+			combined += shadePointLight(clusterLightIndices[cluster * MAX_LIGHTS_PER_CLUSTER + i], normal, view, texSample.rgb);
+		}
+	}
 
 	//out_color = vec4(normal * 0.5 + 0.5, 1.0);
 	out_color = vec4(combined, texSample.a);
-}
\ No newline at end of file
+	out_velocity = in_currentClip.xy / in_currentClip.w - in_previousClip.xy / in_previousClip.w;
+}
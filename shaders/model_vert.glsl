@@ -4,19 +4,38 @@ layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_normal;
 layout(location = 2) in vec2 in_texcoord;
 
-layout(set = 0, binding = 0) uniform transform {
+// Matches InstanceData in main.cpp. Draws pass the instance index as firstInstance
+struct Instance {
 	mat4 modelViewProj;
+	mat4 previousModelViewProj;
 	mat4 modelView;
-} u_transforms;
+	vec4 boundsMin;
+	vec4 boundsMax;
+	uint indexCount;
+	uint flags;
+};
+
+layout(set = 0, binding = 0) readonly buffer instanceBuffer {
+	Instance instances[];
+};
 
 layout(location = 0) out vec3 out_normal;
 layout(location = 1) out vec2 out_texcoord;
 layout(location = 2) out vec3 out_position;
+// Clip space position of this frame with the jitter and of the previous frame without, for the motion vectors
+layout(location = 3) out vec4 out_currentClip;
+layout(location = 4) out vec4 out_previousClip;
+
+// Must match the depth prepass in model_depth_vert.glsl exactly
+invariant gl_Position;
 
 void main() {
-	mat4 modelViewProj = u_transforms.modelViewProj;
+	mat4 modelViewProj = instances[gl_InstanceIndex].modelViewProj;
+	mat4 modelView = instances[gl_InstanceIndex].modelView;
 	gl_Position = modelViewProj * vec4(in_position, 1.0);
 	out_texcoord = in_texcoord;
-	out_normal = mat3(transpose(inverse(u_transforms.modelView))) * in_normal;
-	out_position = (u_transforms.modelView * vec4(in_position, 1.0)).xyz;
-}
\ No newline at end of file
+	out_normal = mat3(transpose(inverse(modelView))) * in_normal;
+	out_position = (modelView * vec4(in_position, 1.0)).xyz;
+	out_currentClip = gl_Position;
+	out_previousClip = instances[gl_InstanceIndex].previousModelViewProj * vec4(in_position, 1.0);
+}
@@ -0,0 +1,119 @@
+#version 450
+
+// Two phase occlusion culling with one indirect draw per instance.
+// Early phase: draw the instances that were visible last frame, without any test.
+// Late phase: after the hierarchical depth pyramid was built from the early depth, test every instance in the frustum
+// against it. Instances that are visible now but were not drawn early are drawn by the late draws, and the visibility
+// is remembered for the next frame. The frustum test itself already happened on the CPU with the BVH
+
+struct Instance {
+    mat4 modelViewProj;
+    mat4 previousModelViewProj;
+    mat4 modelView;
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uint indexCount;
+    uint flags;
+};
+
+// VkDrawIndexedIndirectCommand
+struct DrawCommand {
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+#define INSTANCE_IN_FRUSTUM 1
+
+layout(set = 0, binding = 0) readonly buffer instanceBuffer {
+    Instance instances[];
+};
+layout(set = 0, binding = 1) writeonly buffer drawCommandBuffer {
+    DrawCommand drawCommands[];
+};
+layout(set = 0, binding = 2) buffer visibilityBuffer {
+    uint visibility[];
+};
+layout(set = 0, binding = 3) uniform sampler2D depthPyramid;
+// Matches OcclusionStats in main.cpp
+layout(set = 0, binding = 4) buffer statsBuffer {
+    uint drawnEarly;
+    uint drawnLate;
+    uint occluded;
+    uint inFrustum;
+} stats;
+
+layout(push_constant) uniform constants {
+    mat4 viewProj;
+    // Size of the first pyramid level
+    vec2 pyramidSize;
+    uint instanceCount;
+    uint late;
+} u_constants;
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+// Conservative: boxes that cross the near plane are never occluded
+bool isOccluded(vec3 boundsMin, vec3 boundsMax) {
+    vec2 screenMin = vec2(1.0);
+    vec2 screenMax = vec2(0.0);
+    // Reversed Z, the largest depth is the nearest
+    float nearestDepth = 0.0;
+    for(int i = 0; i < 8; ++i) {
+        vec3 corner = mix(boundsMin, boundsMax, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+        vec4 clip = u_constants.viewProj * vec4(corner, 1.0);
+        if(clip.w <= 0.0 || clip.z > clip.w) {
+            return false;
+        }
+        vec3 ndc = clip.xyz / clip.w;
+        screenMin = min(screenMin, ndc.xy * 0.5 + 0.5);
+        screenMax = max(screenMax, ndc.xy * 0.5 + 0.5);
+        nearestDepth = max(nearestDepth, ndc.z);
+    }
+    screenMin = clamp(screenMin, 0.0, 1.0);
+    screenMax = clamp(screenMax, 0.0, 1.0);
+
+    // The level where the box covers at most 2x2 texels, then the farthest depth of those
+    vec2 size = (screenMax - screenMin) * u_constants.pyramidSize;
+    int level = int(ceil(log2(max(max(size.x, size.y), 1.0))));
+    level = min(level, textureQueryLevels(depthPyramid) - 1);
+    ivec2 levelSize = textureSize(depthPyramid, level);
+    ivec2 texelMin = min(ivec2(screenMin * levelSize), levelSize - 1);
+    ivec2 texelMax = min(ivec2(screenMax * levelSize), levelSize - 1);
+    float depth = min(min(texelFetch(depthPyramid, texelMin, level).r, texelFetch(depthPyramid, ivec2(texelMax.x, texelMin.y), level).r),
+                      min(texelFetch(depthPyramid, ivec2(texelMin.x, texelMax.y), level).r, texelFetch(depthPyramid, texelMax, level).r));
+    return nearestDepth < depth;
+}
+
+void main() {
+    const uint i = gl_GlobalInvocationID.x;
+    if(i >= u_constants.instanceCount) {
+        return;
+    }
+    const bool inFrustum = (instances[i].flags & INSTANCE_IN_FRUSTUM) != 0;
+    const bool wasVisible = inFrustum && visibility[i] != 0;
+
+    bool draw;
+    if(u_constants.late == 0) {
+        draw = wasVisible;
+        if(draw) {
+            atomicAdd(stats.drawnEarly, 1u);
+        }
+    } else {
+        const bool visible = inFrustum && !isOccluded(instances[i].boundsMin.xyz, instances[i].boundsMax.xyz);
+        draw = visible && !wasVisible;
+        visibility[i] = visible ? 1u : 0u;
+        if(inFrustum) {
+            atomicAdd(stats.inFrustum, 1u);
+        }
+        if(inFrustum && !visible) {
+            atomicAdd(stats.occluded, 1u);
+        }
+        if(draw) {
+            atomicAdd(stats.drawnLate, 1u);
+        }
+    }
+    drawCommands[i] = DrawCommand(instances[i].indexCount, draw ? 1u : 0u, 0u, 0, i);
+}
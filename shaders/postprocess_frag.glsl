@@ -1,10 +1,21 @@
 #version 450 core
 
+// Runs as second subpass of the scene render pass. Only the pixel at the own location is read
 layout(set = 0, input_attachment_index = 0, binding = 0) uniform subpassInput in_color;
 
+layout(push_constant) uniform pushConstants {
+    float exposure;
+    float contrast;
+    float saturation; // 0 gives the luminance only
+} u_pushConstants;
+
 layout(location = 0) out vec4 out_color;
 
 void main() {
     vec4 color = subpassLoad(in_color);
-    out_color = vec4(vec3(length(color.rgb)/sqrt(3.0)), color.a);
-}
\ No newline at end of file
+    vec3 graded = color.rgb * u_pushConstants.exposure;
+    graded = (graded - 0.5) * u_pushConstants.contrast + 0.5;
+    float luminance = dot(graded, vec3(0.2126, 0.7152, 0.0722));
+    graded = mix(vec3(luminance), graded, u_pushConstants.saturation);
+    out_color = vec4(clamp(graded, 0.0, 1.0), color.a);
+}
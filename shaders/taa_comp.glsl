@@ -0,0 +1,72 @@
+#version 450
+
+// Temporal anti-aliasing. Every frame is rendered with a different subpixel jitter and blended into the history of the
+// previous frames. The scene writes the motion of every pixel since the last frame, which covers moving objects as
+// well as the camera. The background has no motion vectors, it is reprojected with its depth and the camera instead.
+// The history is clamped to the color range of the 3x3 neighborhood, which rejects disoccluded pixels.
+// The result goes to the destination and into the history of the next frame
+
+layout(set = 0, binding = 0) uniform sampler2D currentImage;
+layout(set = 0, binding = 1) uniform sampler2D historyImage;
+layout(set = 0, binding = 2) uniform sampler2D depthImage;
+layout(set = 0, binding = 3, rgba8) uniform writeonly image2D destinationImage;
+layout(set = 0, binding = 4, rgba8) uniform writeonly image2D historyOutImage;
+// NDC motion since the last frame, see model_frag.glsl
+layout(set = 0, binding = 5) uniform sampler2D velocityImage;
+
+// Matches TaaConstants in main.cpp
+layout(push_constant) uniform pushConstants {
+    // Previous view projection times the inverse of this one, both without jitter
+    mat4 reprojection;
+    // Jitter of this frame in NDC
+    vec2 jitter;
+    // Part of the history image that holds the previous frame, it may have had another render scale
+    vec2 historyUvScale;
+    // Rendered size of this frame
+    ivec2 size;
+    float feedback;
+    uint historyValid;
+};
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+void main() {
+    const ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+    if(any(greaterThanEqual(position, size))) {
+        return;
+    }
+    const vec3 current = texelFetch(currentImage, position, 0).rgb;
+    vec3 color = current;
+
+    if(historyValid != 0) {
+        vec3 neighborhoodMin = current;
+        vec3 neighborhoodMax = current;
+        for(int y = -1; y <= 1; ++y) {
+            for(int x = -1; x <= 1; ++x) {
+                const vec3 neighbor = texelFetch(currentImage, clamp(position + ivec2(x, y), ivec2(0), size - 1), 0).rgb;
+                neighborhoodMin = min(neighborhoodMin, neighbor);
+                neighborhoodMax = max(neighborhoodMax, neighbor);
+            }
+        }
+
+        const float depth = texelFetch(depthImage, position, 0).r;
+        const vec2 ndc = (vec2(position) + 0.5) / vec2(size) * 2.0 - 1.0;
+        vec4 previousClip;
+        if(depth > 0.0) {
+            // The motion vectors go from the jittered position of this frame to the one without jitter of the last
+            previousClip = vec4(ndc - texelFetch(velocityImage, position, 0).xy, 0.0, 1.0);
+        } else {
+            // The reprojection expects the position without jitter. Homogeneous all the way, with the infinite far
+            // plane a depth of 0 reprojects as a direction
+            previousClip = reprojection * vec4(ndc - jitter, depth, 1.0);
+        }
+        const vec2 previousUv = previousClip.xy / previousClip.w * 0.5 + 0.5;
+        if(previousClip.w > 0.0 && all(greaterThanEqual(previousUv, vec2(0.0))) && all(lessThanEqual(previousUv, vec2(1.0)))) {
+            vec3 history = textureLod(historyImage, previousUv * historyUvScale, 0.0).rgb;
+            history = clamp(history, neighborhoodMin, neighborhoodMax);
+            color = mix(current, history, feedback);
+        }
+    }
+    imageStore(destinationImage, position, vec4(color, 1.0));
+    imageStore(historyOutImage, position, vec4(color, 1.0));
+}
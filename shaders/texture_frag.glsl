@@ -4,6 +4,8 @@ layout(location = 0) in vec3 in_color;
 layout(location = 1) in vec2 in_uv;
 
 layout(location = 0) out vec4 out_color;
+// Drawn in screen space, it does not move
+layout(location = 1) out vec2 out_velocity;
 
 layout(set = 0, binding = 0) uniform sampler2D in_sampledTexture;
 
@@ -11,4 +13,5 @@ void main() {
 	vec4 texSample = texture(in_sampledTexture, in_uv);
 	//out_color = texSample * vec4(in_color, 1.0);
 	out_color = texSample;
+	out_velocity = vec2(0.0);
 }
\ No newline at end of file
@@ -0,0 +1,405 @@
+#include "logger.h"
+#include "binary_log.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <thread>
+
+// Messages are formatted on the calling thread and pushed onto a bounded lock-free MPSC queue.
+// A background thread drains the queue in batches, every LOG_FLUSH_INTERVAL_MS or as soon as the queue
+// is half full. If the queue is full the message is dropped, logging never blocks the caller.
+// Set LOG_FILE to write into a file instead of stdout.
+//
+// Binary records (LOGGING_BINARY) go into a per-thread single producer byte ring instead and are
+// formatted by the writer thread. If LOG_BINARY_FILE is set, the writer stores them unformatted
+// in that file and log_decoder turns it into text later. The writer frees the ring of a thread
+// once the thread exited and the ring is drained, so its slot goes to the next thread. Threads
+// that log binary records have to be finished or idle when exitLogger is called.
+
+// Holds a few milliseconds of logging from several threads, so the writer catches up before it drops
+#define LOG_QUEUE_SIZE 8192
+#define LOG_MESSAGE_SIZE 256
+#define LOG_FLUSH_INTERVAL_MS 5
+// Threads with a binary ring at the same time, like CPU_PROFILER_MAX_THREADS
+#define LOG_MAX_THREADS 80
+// Must be a power of two
+#define LOG_BINARY_RING_SIZE (64 * 1024)
+
+// Sequence numbers as in Dmitry Vyukov's bounded queue. A slot is free for position p if sequence == p
+// and holds a message for position p if sequence == p + 1
+struct LogSlot {
+    std::atomic<size_t> sequence;
+    uint32_t level;
+    uint32_t length;
+    char text[LOG_MESSAGE_SIZE];
+};
+
+static LogSlot queue[LOG_QUEUE_SIZE];
+static std::atomic<size_t> enqueuePosition(0);
+static size_t dequeuePosition = 0;
+static std::atomic<uint64_t> droppedMessages(0);
+// Totals for getLoggerStats
+static uint64_t writtenTotal = 0;
+static uint64_t droppedTotal = 0;
+static std::atomic<bool> running(false);
+static std::thread writerThread;
+static std::mutex wakeMutex;
+static std::condition_variable wakeCondition;
+// Set by producers under wakeMutex, so a wake up between draining and waiting is not lost
+static bool wakeRequested = false;
+static FILE* output = 0;
+static bool binaryOutput = false;
+
+// Entries start with a uint64_t of the entry size including itself, 0 marks padding up to the end of the ring
+struct LogBinaryRing {
+    std::atomic<uint64_t> writePosition;
+    std::atomic<uint64_t> readPosition;
+    std::atomic<uint64_t> dropped;
+    // Set when the owning thread exits
+    std::atomic<bool> released;
+    uint64_t reservedPosition;
+    alignas(8) uint8_t data[LOG_BINARY_RING_SIZE];
+};
+
+// A slot is taken by a thread with a compare exchange and cleared by the writer
+static std::atomic<LogBinaryRing*> binaryRings[LOG_MAX_THREADS];
+// Incremented by initLogger, rings of an earlier run were freed by exitLogger
+static std::atomic<uint32_t> loggerGeneration(0);
+
+static void releaseThreadRing();
+
+struct ThreadRing {
+    LogBinaryRing* ring = 0;
+    uint32_t generation = 0;
+    ~ThreadRing() {
+        releaseThreadRing();
+    }
+};
+static thread_local ThreadRing threadRing;
+// Site ids in the binary output, keyed by site and type string
+static std::map<std::pair<const LogSite*, const char*>, uint32_t> binarySites;
+
+static thread_local char formatBuffer[LOG_MESSAGE_SIZE];
+
+static const char* levelColors[] = {"", "\033[33m", "\033[31m"};
+
+static void writeMessage(std::string& batch, uint32_t level, const char* text, size_t length) {
+    if(binaryOutput) {
+        writeBinaryLogText(output, level, text, (uint32_t)length);
+        return;
+    }
+    bool color = output == stdout && level != LOG_LEVEL_INFO;
+    if(color) {
+        batch.append(levelColors[level]);
+    }
+    batch.append(text, length);
+    if(color) {
+        batch.append("\033[0m");
+    }
+    batch.push_back('\n');
+}
+
+static void writeRecord(std::string& batch, const LogRecord* record) {
+    const uint8_t* arguments = (const uint8_t*)(record + 1);
+    if(binaryOutput) {
+        std::pair<const LogSite*, const char*> key(record->site, record->types);
+        std::map<std::pair<const LogSite*, const char*>, uint32_t>::iterator it = binarySites.find(key);
+        if(it == binarySites.end()) {
+            it = binarySites.insert(std::make_pair(key, (uint32_t)binarySites.size())).first;
+            writeBinaryLogSite(output, it->second, record->site, record->types);
+        }
+        writeBinaryLogMessage(output, it->second, arguments, record->size);
+        return;
+    }
+    std::string text;
+    if(!formatLogRecord(text, record->site->file, record->site->line, record->types, arguments, record->size)) {
+        text.append(" [malformed record]");
+    }
+    writeMessage(batch, record->site->level, text.c_str(), text.size());
+}
+
+// Returns false if no ring had records
+static bool drainBinaryRings(std::string& batch) {
+    bool any = false;
+    for(uint32_t i = 0; i < LOG_MAX_THREADS; ++i) {
+        LogBinaryRing* ring = binaryRings[i].load(std::memory_order_acquire);
+        if(!ring) {
+            continue;
+        }
+        // Before the write position, so every record of a released ring is seen below
+        bool released = ring->released.load(std::memory_order_acquire);
+        uint64_t readPosition = ring->readPosition.load(std::memory_order_relaxed);
+        uint64_t writePosition = ring->writePosition.load(std::memory_order_acquire);
+        while(readPosition < writePosition) {
+            uint64_t offset = readPosition & (LOG_BINARY_RING_SIZE - 1);
+            uint64_t entrySize;
+            memcpy(&entrySize, ring->data + offset, sizeof(entrySize));
+            if(entrySize == 0) {
+                readPosition += LOG_BINARY_RING_SIZE - offset;
+                continue;
+            }
+            writeRecord(batch, (const LogRecord*)(ring->data + offset + sizeof(uint64_t)));
+            readPosition += entrySize;
+            writtenTotal++;
+            any = true;
+        }
+        ring->readPosition.store(readPosition, std::memory_order_release);
+        droppedMessages.fetch_add(ring->dropped.exchange(0), std::memory_order_relaxed);
+        if(released) {
+            binaryRings[i].store(0, std::memory_order_release);
+            delete ring;
+        }
+    }
+    return any;
+}
+
+// Returns false if the queue was empty
+static bool drainQueue(std::string& batch) {
+    bool any = drainBinaryRings(batch);
+    for(;;) {
+        LogSlot* slot = &queue[dequeuePosition % LOG_QUEUE_SIZE];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if(sequence != dequeuePosition + 1) {
+            break;
+        }
+        writeMessage(batch, slot->level, slot->text, slot->length);
+        slot->sequence.store(dequeuePosition + LOG_QUEUE_SIZE, std::memory_order_release);
+        dequeuePosition++;
+        writtenTotal++;
+        any = true;
+    }
+
+    uint64_t dropped = droppedMessages.exchange(0);
+    if(dropped) {
+        droppedTotal += dropped;
+        char text[64];
+        int length = snprintf(text, sizeof(text), "[logger]: %llu messages dropped", (unsigned long long)dropped);
+        writeMessage(batch, LOG_LEVEL_WARN, text, length);
+    }
+
+    if(!batch.empty()) {
+        fwrite(batch.data(), 1, batch.size(), output);
+        batch.clear();
+    }
+    if(any || dropped) {
+        fflush(output);
+    }
+    return any;
+}
+
+static void writerMain() {
+    std::string batch;
+    batch.reserve(LOG_QUEUE_SIZE * 64);
+    while(running.load(std::memory_order_acquire)) {
+        if(!drainQueue(batch)) {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wakeCondition.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS), [] { return wakeRequested; });
+            wakeRequested = false;
+        }
+    }
+    // Flush everything that was logged before exitLogger
+    drainQueue(batch);
+}
+
+static void wakeWriter() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wakeRequested = true;
+    }
+    wakeCondition.notify_one();
+}
+
+static void pushMessage(uint32_t level, size_t lineNumber, const char* file, const char* message, size_t messageLength) {
+    int prefixLength = snprintf(formatBuffer, LOG_MESSAGE_SIZE, "[%s:%zu]: ", file, lineNumber);
+    if(prefixLength < 0 || prefixLength >= LOG_MESSAGE_SIZE) {
+        prefixLength = LOG_MESSAGE_SIZE - 1;
+    }
+    // Long messages are truncated to the slot size
+    size_t length = prefixLength + messageLength;
+    if(length > LOG_MESSAGE_SIZE) {
+        length = LOG_MESSAGE_SIZE;
+    }
+    memcpy(formatBuffer + prefixLength, message, length - prefixLength);
+
+    if(!running.load(std::memory_order_acquire)) {
+        // Before initLogger and after exitLogger messages are written synchronously
+        FILE* file = output ? output : stdout;
+        fprintf(file, "%s%.*s%s\n", (file == stdout) ? levelColors[level] : "", (int)length, formatBuffer, (file == stdout && level != LOG_LEVEL_INFO) ? "\033[0m" : "");
+        return;
+    }
+
+    size_t position = enqueuePosition.load(std::memory_order_relaxed);
+    LogSlot* slot;
+    for(;;) {
+        slot = &queue[position % LOG_QUEUE_SIZE];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if(difference == 0) {
+            if(enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(difference < 0) {
+            // Queue is full
+            droppedMessages.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+    slot->level = level;
+    slot->length = (uint32_t)length;
+    memcpy(slot->text, formatBuffer, length);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    // Get errors out quickly in case we are about to crash. Once per half queue, so bursts are drained before the queue is full
+    if(level == LOG_LEVEL_ERROR || (position + 1) % (LOG_QUEUE_SIZE / 2) == 0) {
+        wakeWriter();
+    }
+}
+
+void initLogger() {
+    output = stdout;
+    const char* filename = getenv("LOG_FILE");
+    if(filename) {
+        FILE* file = fopen(filename, "w");
+        if(file) {
+            output = file;
+        }
+    }
+    const char* binaryFilename = getenv("LOG_BINARY_FILE");
+    if(binaryFilename) {
+        FILE* file = fopen(binaryFilename, "wb");
+        if(file) {
+            if(output != stdout) {
+                fclose(output);
+            }
+            output = file;
+            binaryOutput = true;
+            writeBinaryLogHeader(output);
+        }
+    }
+    for(size_t i = 0; i < LOG_QUEUE_SIZE; ++i) {
+        queue[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    enqueuePosition.store(0);
+    dequeuePosition = 0;
+    writtenTotal = 0;
+    droppedTotal = 0;
+    wakeRequested = false;
+    loggerGeneration.fetch_add(1);
+    running.store(true, std::memory_order_release);
+    writerThread = std::thread(writerMain);
+}
+
+void exitLogger() {
+    if(!running.exchange(false)) {
+        return;
+    }
+    wakeWriter();
+    writerThread.join();
+    // The writer drained them, threads still holding one get a new ring after the next initLogger
+    for(uint32_t i = 0; i < LOG_MAX_THREADS; ++i) {
+        delete binaryRings[i].exchange(0);
+    }
+    if(output != stdout) {
+        fclose(output);
+    }
+    output = 0;
+    binaryOutput = false;
+    binarySites.clear();
+}
+
+static void releaseThreadRing() {
+    if(threadRing.ring && threadRing.generation == loggerGeneration.load() && running.load(std::memory_order_acquire)) {
+        threadRing.ring->released.store(true, std::memory_order_release);
+    }
+    threadRing.ring = 0;
+}
+
+// Takes a free slot, or returns 0 if all LOG_MAX_THREADS are used by live threads
+static LogBinaryRing* acquireThreadRing() {
+    LogBinaryRing* ring = 0;
+    for(uint32_t i = 0; i < LOG_MAX_THREADS; ++i) {
+        if(binaryRings[i].load(std::memory_order_relaxed)) {
+            continue;
+        }
+        if(!ring) {
+            ring = new LogBinaryRing();
+        }
+        LogBinaryRing* expected = 0;
+        if(binaryRings[i].compare_exchange_strong(expected, ring, std::memory_order_release, std::memory_order_relaxed)) {
+            threadRing.ring = ring;
+            threadRing.generation = loggerGeneration.load();
+            return ring;
+        }
+    }
+    delete ring;
+    return 0;
+}
+
+uint8_t* logBinaryReserve(size_t size) {
+    if(!running.load(std::memory_order_acquire)) {
+        // Nothing drains the rings before initLogger and after exitLogger
+        droppedMessages.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    LogBinaryRing* ring = threadRing.ring;
+    if(!ring || threadRing.generation != loggerGeneration.load()) {
+        ring = acquireThreadRing();
+        if(!ring) {
+            droppedMessages.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+    }
+
+    uint64_t entrySize = sizeof(uint64_t) + ((size + 7) & ~(uint64_t)7);
+    uint64_t position = ring->writePosition.load(std::memory_order_relaxed);
+    uint64_t offset = position & (LOG_BINARY_RING_SIZE - 1);
+    uint64_t padding = (offset + entrySize > LOG_BINARY_RING_SIZE) ? LOG_BINARY_RING_SIZE - offset : 0;
+    uint64_t used = position - ring->readPosition.load(std::memory_order_acquire);
+    if(used + padding + entrySize > LOG_BINARY_RING_SIZE) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    if(padding) {
+        memset(ring->data + offset, 0, sizeof(uint64_t));
+        position += padding;
+        offset = 0;
+    }
+    memcpy(ring->data + offset, &entrySize, sizeof(entrySize));
+    ring->reservedPosition = position + entrySize;
+    return ring->data + offset + sizeof(uint64_t);
+}
+
+void logBinaryCommit(uint8_t* record) {
+    LogBinaryRing* ring = threadRing.ring;
+    uint64_t readPosition = ring->readPosition.load(std::memory_order_relaxed);
+    bool wasBelowHalf = ring->writePosition.load(std::memory_order_relaxed) - readPosition < LOG_BINARY_RING_SIZE / 2;
+    ring->writePosition.store(ring->reservedPosition, std::memory_order_release);
+    // Like pushMessage, on errors and when the ring gets half full
+    bool halfFull = wasBelowHalf && ring->reservedPosition - readPosition >= LOG_BINARY_RING_SIZE / 2;
+    if(((LogRecord*)record)->site->level == LOG_LEVEL_ERROR || halfFull) {
+        wakeWriter();
+    }
+}
+
+void getLoggerStats(uint64_t* written, uint64_t* dropped) {
+    *written = writtenTotal;
+    *dropped = droppedTotal;
+}
+
+void logInfo(size_t lineNumber, const char* file, const char* message, size_t messageLength) {
+    pushMessage(LOG_LEVEL_INFO, lineNumber, file, message, messageLength);
+}
+
+void logWarn(size_t lineNumber, const char* file, const char* message, size_t messageLength) {
+    pushMessage(LOG_LEVEL_WARN, lineNumber, file, message, messageLength);
+}
+
+void logError(size_t lineNumber, const char* file, const char* message, size_t messageLength) {
+    pushMessage(LOG_LEVEL_ERROR, lineNumber, file, message, messageLength);
+}
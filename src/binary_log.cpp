@@ -0,0 +1,101 @@
+#include "binary_log.h"
+
+template<typename T>
+static bool readValue(const uint8_t*& arguments, const uint8_t* end, T* value) {
+    if(arguments + sizeof(T) > end) {
+        return false;
+    }
+    memcpy(value, arguments, sizeof(T));
+    arguments += sizeof(T);
+    return true;
+}
+
+bool formatLogArguments(std::string& out, const char* types, const uint8_t* arguments, size_t size) {
+    const uint8_t* end = arguments + size;
+    char buffer[64];
+    for(const char* type = types; *type; ++type) {
+        int64_t intValue;
+        uint64_t uintValue;
+        double doubleValue;
+        uint32_t length;
+        switch(*type) {
+        case LOG_TYPE_INT:
+            if(!readValue(arguments, end, &intValue)) return false;
+            snprintf(buffer, sizeof(buffer), "%lld", (long long)intValue);
+            out.append(buffer);
+            break;
+        case LOG_TYPE_UINT:
+            if(!readValue(arguments, end, &uintValue)) return false;
+            snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)uintValue);
+            out.append(buffer);
+            break;
+        case LOG_TYPE_DOUBLE:
+            // Same output as std::to_string
+            if(!readValue(arguments, end, &doubleValue)) return false;
+            snprintf(buffer, sizeof(buffer), "%f", doubleValue);
+            out.append(buffer);
+            break;
+        case LOG_TYPE_CHAR:
+            if(!readValue(arguments, end, &intValue)) return false;
+            out.push_back((char)intValue);
+            break;
+        case LOG_TYPE_POINTER:
+            if(!readValue(arguments, end, &uintValue)) return false;
+            snprintf(buffer, sizeof(buffer), "0x%llx", (unsigned long long)uintValue);
+            out.append(buffer);
+            break;
+        case LOG_TYPE_STRING:
+            if(!readValue(arguments, end, &length) || arguments + length > end) return false;
+            out.append((const char*)arguments, length);
+            arguments += length;
+            break;
+        default:
+            return false;
+        }
+    }
+    return arguments == end;
+}
+
+bool formatLogRecord(std::string& out, const char* file, uint32_t line, const char* types, const uint8_t* arguments, size_t size) {
+    out.push_back('[');
+    out.append(file);
+    out.push_back(':');
+    out.append(std::to_string(line));
+    out.append("]: ");
+    return formatLogArguments(out, types, arguments, size);
+}
+
+static void writeUint32(FILE* file, uint32_t value) {
+    fwrite(&value, sizeof(value), 1, file);
+}
+
+void writeBinaryLogHeader(FILE* file) {
+    fwrite(BINARY_LOG_MAGIC, 1, 8, file);
+}
+
+void writeBinaryLogSite(FILE* file, uint32_t id, const LogSite* site, const char* types) {
+    fputc(BINARY_LOG_SITE, file);
+    writeUint32(file, id);
+    writeUint32(file, site->line);
+    writeUint32(file, site->level);
+    uint32_t fileLength = (uint32_t)strlen(site->file);
+    writeUint32(file, fileLength);
+    fwrite(site->file, 1, fileLength, file);
+    uint32_t typesLength = (uint32_t)strlen(types);
+    writeUint32(file, typesLength);
+    fwrite(types, 1, typesLength, file);
+}
+
+void writeBinaryLogMessage(FILE* file, uint32_t siteId, const uint8_t* arguments, uint32_t size) {
+    fputc(BINARY_LOG_MESSAGE, file);
+    writeUint32(file, siteId);
+    writeUint32(file, size);
+    fwrite(arguments, 1, size, file);
+}
+
+void writeBinaryLogText(FILE* file, uint32_t level, const char* text, uint32_t length) {
+    fputc(BINARY_LOG_TEXT, file);
+    writeUint32(file, level);
+    writeUint32(file, length);
+    fwrite(text, 1, length, file);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "logger.h"
+
+#include <cstdio>
+
+// Decoding of binary log records, shared by the logger backends and the log_decoder tool.
+//
+// Binary log file layout: BINARY_LOG_MAGIC, then a sequence of entries that start with a uint8_t kind:
+//   BINARY_LOG_SITE:    uint32_t id, uint32_t line, uint32_t level, uint32_t fileLength, file, uint32_t typesLength, types
+//   BINARY_LOG_MESSAGE: uint32_t site id, uint32_t size, size bytes of arguments
+//   BINARY_LOG_TEXT:    uint32_t level, uint32_t length, already formatted text
+// A site entry is written before the first message that references it.
+
+#define BINARY_LOG_MAGIC "VKTLOG01"
+#define BINARY_LOG_SITE 1
+#define BINARY_LOG_MESSAGE 2
+#define BINARY_LOG_TEXT 3
+
+// Appends the formatted arguments. Returns false if the arguments do not match the types
+bool formatLogArguments(std::string& out, const char* types, const uint8_t* arguments, size_t size);
+// "[file:line]: " followed by the formatted arguments, like the text logging path
+bool formatLogRecord(std::string& out, const char* file, uint32_t line, const char* types, const uint8_t* arguments, size_t size);
+
+void writeBinaryLogHeader(FILE* file);
+void writeBinaryLogSite(FILE* file, uint32_t id, const LogSite* site, const char* types);
+void writeBinaryLogMessage(FILE* file, uint32_t siteId, const uint8_t* arguments, uint32_t size);
+void writeBinaryLogText(FILE* file, uint32_t level, const char* text, uint32_t length);
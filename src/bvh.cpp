@@ -0,0 +1,387 @@
+#include "bvh.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define BVH_SSE
+#include <xmmintrin.h>
+#endif
+
+// Relative to the cost of testing one item box, nodes are tested the same way
+#define BVH_TRAVERSAL_COST 1.0f
+// Smallest ray direction component. Zero components give infinite slab distances and 0 * inf = NaN at the slab planes
+#define BVH_RAY_EPSILON 1e-20f
+
+static Aabb emptyAabb() {
+    Aabb result = {glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)};
+    return result;
+}
+
+static void growAabb(Aabb* box, const Aabb& other) {
+    box->min = glm::min(box->min, other.min);
+    box->max = glm::max(box->max, other.max);
+}
+
+static float getSurfaceArea(const Aabb& box) {
+    glm::vec3 size = box.max - box.min;
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+Aabb transformAabb(Aabb box, const glm::mat4& matrix) {
+    glm::vec3 center = (box.min + box.max) * 0.5f;
+    glm::vec3 extent = (box.max - box.min) * 0.5f;
+    glm::mat3 absolute = glm::mat3(glm::abs(glm::vec3(matrix[0])), glm::abs(glm::vec3(matrix[1])), glm::abs(glm::vec3(matrix[2])));
+    glm::vec3 newCenter = glm::vec3(matrix * glm::vec4(center, 1.0f));
+    glm::vec3 newExtent = absolute * extent;
+    Aabb result = {newCenter - newExtent, newCenter + newExtent};
+    return result;
+}
+
+struct BvhBin {
+    Aabb bounds;
+    uint32_t count;
+};
+
+struct BvhSplit {
+    float cost;
+    uint32_t axis;
+    uint32_t bin;
+};
+
+static uint32_t getBin(float center, float centerMin, float scale) {
+    return std::min((uint32_t)((center - centerMin) * scale), (uint32_t)BVH_SAH_BINS - 1);
+}
+
+// Binned surface area heuristic. Costs are not divided by the node area, which is the same for every split
+static BvhSplit findSplit(Bvh* bvh, const std::vector<glm::vec3>& centers, uint32_t first, uint32_t count, const Aabb& centerBounds) {
+    BvhSplit best = {FLT_MAX, 0, 0};
+    for(uint32_t axis = 0; axis < 3; ++axis) {
+        float extent = centerBounds.max[axis] - centerBounds.min[axis];
+        if(extent <= 0.0f) {
+            continue;
+        }
+        BvhBin bins[BVH_SAH_BINS];
+        for(uint32_t b = 0; b < BVH_SAH_BINS; ++b) {
+            bins[b].bounds = emptyAabb();
+            bins[b].count = 0;
+        }
+        float scale = BVH_SAH_BINS / extent;
+        for(uint32_t i = first; i < first + count; ++i) {
+            uint32_t item = bvh->items[i];
+            BvhBin* bin = &bins[getBin(centers[item][axis], centerBounds.min[axis], scale)];
+            growAabb(&bin->bounds, bvh->itemBounds[item]);
+            bin->count++;
+        }
+
+        // Right side costs from the back, then the left side from the front
+        float rightCosts[BVH_SAH_BINS];
+        Aabb rightBounds = emptyAabb();
+        uint32_t rightCount = 0;
+        for(uint32_t b = BVH_SAH_BINS - 1; b > 0; --b) {
+            growAabb(&rightBounds, bins[b].bounds);
+            rightCount += bins[b].count;
+            rightCosts[b] = rightCount ? getSurfaceArea(rightBounds) * rightCount : 0.0f;
+        }
+        Aabb leftBounds = emptyAabb();
+        uint32_t leftCount = 0;
+        for(uint32_t b = 0; b < BVH_SAH_BINS - 1; ++b) {
+            growAabb(&leftBounds, bins[b].bounds);
+            leftCount += bins[b].count;
+            if(leftCount == 0 || leftCount == count) {
+                continue;
+            }
+            float cost = getSurfaceArea(leftBounds) * leftCount + rightCosts[b + 1];
+            if(cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = b;
+            }
+        }
+    }
+    return best;
+}
+
+void buildBvh(Bvh* bvh, const Aabb* bounds, uint32_t count) {
+    PROFILE_ZONE("buildBvh");
+    bvh->nodes.clear();
+    bvh->parents.clear();
+    bvh->itemBounds.assign(bounds, bounds + count);
+    bvh->items.resize(count);
+    bvh->itemLeaves.resize(count);
+    if(!count) {
+        bvh->dirty.clear();
+        return;
+    }
+
+    std::vector<glm::vec3> centers(count);
+    for(uint32_t i = 0; i < count; ++i) {
+        bvh->items[i] = i;
+        centers[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+    }
+
+    bvh->nodes.reserve(count * 2);
+    bvh->parents.reserve(count * 2);
+    BvhNode root = {emptyAabb(), 0, 0, count};
+    bvh->nodes.push_back(root);
+    bvh->parents.push_back(UINT32_MAX);
+    std::vector<uint32_t> stack(1, 0);
+    while(!stack.empty()) {
+        uint32_t nodeIndex = stack.back();
+        stack.pop_back();
+        uint32_t first = bvh->nodes[nodeIndex].itemFirst;
+        uint32_t itemCount = bvh->nodes[nodeIndex].itemCount;
+
+        Aabb nodeBounds = emptyAabb();
+        Aabb centerBounds = emptyAabb();
+        for(uint32_t i = first; i < first + itemCount; ++i) {
+            uint32_t item = bvh->items[i];
+            growAabb(&nodeBounds, bvh->itemBounds[item]);
+            centerBounds.min = glm::min(centerBounds.min, centers[item]);
+            centerBounds.max = glm::max(centerBounds.max, centers[item]);
+        }
+        bvh->nodes[nodeIndex].bounds = nodeBounds;
+        if(itemCount == 1) {
+            continue;
+        }
+
+        BvhSplit split = findSplit(bvh, centers, first, itemCount, centerBounds);
+        float leafCost = getSurfaceArea(nodeBounds) * itemCount;
+        float splitCost = getSurfaceArea(nodeBounds) * BVH_TRAVERSAL_COST + split.cost;
+        // Large leaves are split even when the heuristic disagrees, to bound the work per leaf
+        if(itemCount <= BVH_MAX_LEAF_ITEMS && splitCost >= leafCost) {
+            continue;
+        }
+
+        uint32_t leftCount;
+        if(split.cost < FLT_MAX) {
+            uint32_t axis = split.axis;
+            float scale = BVH_SAH_BINS / (centerBounds.max[axis] - centerBounds.min[axis]);
+            uint32_t* middle = std::partition(&bvh->items[first], &bvh->items[first] + itemCount, [&](uint32_t item) {
+                return getBin(centers[item][axis], centerBounds.min[axis], scale) <= split.bin;
+            });
+            leftCount = (uint32_t)(middle - &bvh->items[first]);
+        } else {
+            // All centers are in one place, any split is as good as another
+            leftCount = itemCount / 2;
+        }
+
+        uint32_t child = (uint32_t)bvh->nodes.size();
+        BvhNode left = {emptyAabb(), 0, first, leftCount};
+        BvhNode right = {emptyAabb(), 0, first + leftCount, itemCount - leftCount};
+        bvh->nodes.push_back(left);
+        bvh->nodes.push_back(right);
+        bvh->parents.push_back(nodeIndex);
+        bvh->parents.push_back(nodeIndex);
+        bvh->nodes[nodeIndex].child = child;
+        stack.push_back(child + 1);
+        stack.push_back(child);
+    }
+
+    for(uint32_t n = 0; n < bvh->nodes.size(); ++n) {
+        BvhNode* node = &bvh->nodes[n];
+        if(node->child) {
+            continue;
+        }
+        for(uint32_t i = node->itemFirst; i < node->itemFirst + node->itemCount; ++i) {
+            bvh->itemLeaves[bvh->items[i]] = n;
+        }
+    }
+    bvh->dirty.assign(bvh->nodes.size(), 0);
+}
+
+void setBvhItemBounds(Bvh* bvh, uint32_t item, Aabb bounds) {
+    bvh->itemBounds[item] = bounds;
+    // Ancestors of an already dirty node are dirty as well
+    for(uint32_t n = bvh->itemLeaves[item]; n != UINT32_MAX && !bvh->dirty[n]; n = bvh->parents[n]) {
+        bvh->dirty[n] = 1;
+    }
+}
+
+uint32_t refitBvh(Bvh* bvh) {
+    PROFILE_ZONE("refitBvh");
+    uint32_t updatedCount = 0;
+    // Children come after their parents, so a backwards sweep updates bottom up
+    for(uint32_t n = (uint32_t)bvh->nodes.size(); n-- > 0;) {
+        if(!bvh->dirty[n]) {
+            continue;
+        }
+        bvh->dirty[n] = 0;
+        BvhNode* node = &bvh->nodes[n];
+        if(node->child) {
+            node->bounds = bvh->nodes[node->child].bounds;
+            growAabb(&node->bounds, bvh->nodes[node->child + 1].bounds);
+        } else {
+            node->bounds = emptyAabb();
+            for(uint32_t i = node->itemFirst; i < node->itemFirst + node->itemCount; ++i) {
+                growAabb(&node->bounds, bvh->itemBounds[bvh->items[i]]);
+            }
+        }
+        updatedCount++;
+    }
+    return updatedCount;
+}
+
+Frustum getFrustum(const glm::mat4& viewProj) {
+    glm::vec4 rows[4];
+    for(uint32_t i = 0; i < 4; ++i) {
+        rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+    }
+    // -w <= x <= w, -w <= y <= w and 0 <= z <= w in clip space
+    glm::vec4 planes[8] = {
+        rows[3] + rows[0], rows[3] - rows[0],
+        rows[3] + rows[1], rows[3] - rows[1],
+        rows[2], rows[3] - rows[2],
+        glm::vec4(0.0f), glm::vec4(0.0f),
+    };
+    Frustum result;
+    for(uint32_t i = 0; i < 8; ++i) {
+        glm::vec4 plane = planes[i];
+        float length = glm::length(glm::vec3(plane));
+        plane = (length > 1e-6f) ? plane / length : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        result.x[i] = plane.x;
+        result.y[i] = plane.y;
+        result.z[i] = plane.z;
+        result.w[i] = plane.w;
+    }
+    return result;
+}
+
+enum FrustumTest {
+    FRUSTUM_OUTSIDE,
+    FRUSTUM_INTERSECTING,
+    FRUSTUM_INSIDE,
+};
+
+// Signed distance of the box center to every plane against the projected box extent
+static FrustumTest testFrustum(const Frustum* frustum, const Aabb& box) {
+    glm::vec3 center = (box.min + box.max) * 0.5f;
+    glm::vec3 extent = (box.max - box.min) * 0.5f;
+#ifdef BVH_SSE
+    __m128 centerX = _mm_set1_ps(center.x), centerY = _mm_set1_ps(center.y), centerZ = _mm_set1_ps(center.z);
+    __m128 extentX = _mm_set1_ps(extent.x), extentY = _mm_set1_ps(extent.y), extentZ = _mm_set1_ps(extent.z);
+    __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 zero = _mm_setzero_ps();
+    __m128 outside = zero;
+    __m128 intersecting = zero;
+    for(uint32_t i = 0; i < 8; i += 4) {
+        __m128 x = _mm_load_ps(frustum->x + i);
+        __m128 y = _mm_load_ps(frustum->y + i);
+        __m128 z = _mm_load_ps(frustum->z + i);
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, centerX), _mm_mul_ps(y, centerY)), _mm_add_ps(_mm_mul_ps(z, centerZ), _mm_load_ps(frustum->w + i)));
+        __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, x), extentX), _mm_mul_ps(_mm_andnot_ps(signMask, y), extentY)), _mm_mul_ps(_mm_andnot_ps(signMask, z), extentZ));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+        intersecting = _mm_or_ps(intersecting, _mm_cmplt_ps(_mm_sub_ps(distance, radius), zero));
+    }
+    if(_mm_movemask_ps(outside)) {
+        return FRUSTUM_OUTSIDE;
+    }
+    return _mm_movemask_ps(intersecting) ? FRUSTUM_INTERSECTING : FRUSTUM_INSIDE;
+#else
+    FrustumTest result = FRUSTUM_INSIDE;
+    for(uint32_t i = 0; i < 8; ++i) {
+        float distance = frustum->x[i] * center.x + frustum->y[i] * center.y + frustum->z[i] * center.z + frustum->w[i];
+        float radius = fabsf(frustum->x[i]) * extent.x + fabsf(frustum->y[i]) * extent.y + fabsf(frustum->z[i]) * extent.z;
+        if(distance + radius < 0.0f) {
+            return FRUSTUM_OUTSIDE;
+        }
+        if(distance - radius < 0.0f) {
+            result = FRUSTUM_INTERSECTING;
+        }
+    }
+    return result;
+#endif
+}
+
+void cullBvh(Bvh* bvh, const Frustum* frustum, std::vector<uint32_t>* visibleItems) {
+    PROFILE_ZONE("cullBvh");
+    visibleItems->clear();
+    if(bvh->nodes.empty()) {
+        return;
+    }
+    std::vector<uint32_t> stack(1, 0);
+    while(!stack.empty()) {
+        BvhNode* node = &bvh->nodes[stack.back()];
+        stack.pop_back();
+        FrustumTest test = testFrustum(frustum, node->bounds);
+        if(test == FRUSTUM_OUTSIDE) {
+            continue;
+        }
+        if(test == FRUSTUM_INSIDE) {
+            // The whole subtree is visible, its items are next to each other
+            visibleItems->insert(visibleItems->end(), &bvh->items[node->itemFirst], &bvh->items[node->itemFirst] + node->itemCount);
+        } else if(node->child) {
+            stack.push_back(node->child + 1);
+            stack.push_back(node->child);
+        } else {
+            for(uint32_t i = node->itemFirst; i < node->itemFirst + node->itemCount; ++i) {
+                uint32_t item = bvh->items[i];
+                if(node->itemCount == 1 || testFrustum(frustum, bvh->itemBounds[item]) != FRUSTUM_OUTSIDE) {
+                    visibleItems->push_back(item);
+                }
+            }
+        }
+    }
+}
+
+// Entry distance of the ray into the box or FLT_MAX
+static float intersectRay(const Aabb& box, glm::vec3 origin, glm::vec3 inverseDirection, float maxDistance) {
+    glm::vec3 t0 = (box.min - origin) * inverseDirection;
+    glm::vec3 t1 = (box.max - origin) * inverseDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    float enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+    float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, maxDistance));
+    return (enter <= exit) ? enter : FLT_MAX;
+}
+
+uint32_t raycastBvh(Bvh* bvh, glm::vec3 origin, glm::vec3 direction, float maxDistance, float* hitDistance) {
+    PROFILE_ZONE("raycastBvh");
+    uint32_t hitItem = BVH_NO_ITEM;
+    float nearest = maxDistance;
+    if(bvh->nodes.empty()) {
+        return hitItem;
+    }
+    for(int i = 0; i < 3; ++i) {
+        if(glm::abs(direction[i]) < BVH_RAY_EPSILON) {
+            direction[i] = (direction[i] < 0.0f) ? -BVH_RAY_EPSILON : BVH_RAY_EPSILON;
+        }
+    }
+    glm::vec3 inverseDirection = 1.0f / direction;
+    std::vector<uint32_t> stack(1, 0);
+    while(!stack.empty()) {
+        BvhNode* node = &bvh->nodes[stack.back()];
+        stack.pop_back();
+        if(intersectRay(node->bounds, origin, inverseDirection, nearest) == FLT_MAX) {
+            continue;
+        }
+        if(node->child) {
+            // Nearer child on top of the stack, so it shortens the ray before the other one is visited
+            float left = intersectRay(bvh->nodes[node->child].bounds, origin, inverseDirection, nearest);
+            float right = intersectRay(bvh->nodes[node->child + 1].bounds, origin, inverseDirection, nearest);
+            uint32_t nearChild = (left <= right) ? node->child : node->child + 1;
+            uint32_t farChild = (left <= right) ? node->child + 1 : node->child;
+            if(glm::max(left, right) < FLT_MAX) {
+                stack.push_back(farChild);
+            }
+            if(glm::min(left, right) < FLT_MAX) {
+                stack.push_back(nearChild);
+            }
+            continue;
+        }
+        for(uint32_t i = node->itemFirst; i < node->itemFirst + node->itemCount; ++i) {
+            uint32_t item = bvh->items[i];
+            float distance = intersectRay(bvh->itemBounds[item], origin, inverseDirection, nearest);
+            if(distance < nearest) {
+                nearest = distance;
+                hitItem = item;
+            }
+        }
+    }
+    if(hitItem != BVH_NO_ITEM && hitDistance) {
+        *hitDistance = nearest;
+    }
+    return hitItem;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <glm/glm/glm.hpp>
+
+#include <stdint.h>
+#include <vector>
+
+// Bounding volume hierarchy over the bounding boxes of items, for example scene instances. It is built once with the
+// surface area heuristic and afterwards only refitted when items move, so the tree quality degrades if items travel far
+
+#define BVH_NO_ITEM UINT32_MAX
+#define BVH_MAX_LEAF_ITEMS 4
+#define BVH_SAH_BINS 16
+
+struct Aabb {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// Every node covers items[itemFirst] to items[itemFirst + itemCount - 1]. Inner nodes have their children at child and
+// child + 1, leaves have child 0. Children always come after their parent
+struct BvhNode {
+    Aabb bounds;
+    uint32_t child;
+    uint32_t itemFirst;
+    uint32_t itemCount;
+};
+
+struct Bvh {
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> parents;
+    // Node bounds need to be recomputed by refitBvh
+    std::vector<uint8_t> dirty;
+    // Item indices in leaf order
+    std::vector<uint32_t> items;
+    std::vector<Aabb> itemBounds;
+    std::vector<uint32_t> itemLeaves;
+};
+
+// Planes point inwards and are stored as structure of arrays for the SIMD box test. Unused and degenerate planes, like
+// the far plane of an infinite reversed Z projection, are replaced by planes that contain everything
+struct Frustum {
+    alignas(16) float x[8];
+    alignas(16) float y[8];
+    alignas(16) float z[8];
+    alignas(16) float w[8];
+};
+
+Aabb transformAabb(Aabb box, const glm::mat4& matrix);
+void buildBvh(Bvh* bvh, const Aabb* bounds, uint32_t count);
+// Only marks the item, the nodes above it are updated by the next refitBvh
+void setBvhItemBounds(Bvh* bvh, uint32_t item, Aabb bounds);
+// Recomputes the bounds of all nodes above changed items. Returns the number of updated nodes
+uint32_t refitBvh(Bvh* bvh);
+// Works for any Vulkan style projection with depth in [0, w], including reversed and infinite Z
+Frustum getFrustum(const glm::mat4& viewProj);
+void cullBvh(Bvh* bvh, const Frustum* frustum, std::vector<uint32_t>* visibleItems);
+// Nearest item whose bounding box the ray hits, or BVH_NO_ITEM. direction does not need to be normalized, distances are in multiples of it
+uint32_t raycastBvh(Bvh* bvh, glm::vec3 origin, glm::vec3 direction, float maxDistance, float* hitDistance);
@@ -0,0 +1,122 @@
+#include "bvh.h"
+#include "profiler.h"
+
+#include <glm/glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+// Build, refit and query times of a BVH over 100k boxes scattered over a large flat area, like instances of a city.
+// The camera uses the same infinite reversed Z projection as the renderer
+
+#define BENCHMARK_OBJECTS 100000
+#define BENCHMARK_MOVING 10000
+#define BENCHMARK_RUNS 50
+#define BENCHMARK_RAYS 1000
+#define WORLD_SIZE 2000.0f
+
+static uint32_t randomState = 1;
+
+static float randomFloat() {
+    // xorshift32, the same boxes on every run
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return (randomState & 0xFFFFFF) / (float)0x1000000;
+}
+
+static Aabb randomBox() {
+    glm::vec3 center(randomFloat() * WORLD_SIZE, randomFloat() * 20.0f, randomFloat() * WORLD_SIZE);
+    glm::vec3 extent = glm::vec3(0.5f) + glm::vec3(randomFloat(), randomFloat(), randomFloat()) * 2.0f;
+    Aabb result = {center - extent, center + extent};
+    return result;
+}
+
+static void report(const char* name, std::vector<double>& times, uint32_t count) {
+    std::sort(times.begin(), times.end());
+    double sum = 0.0;
+    for(size_t i = 0; i < times.size(); ++i) {
+        sum += times[i];
+    }
+    size_t runs = times.size();
+    fprintf(stderr, "%s: %u, avg %.3fms, p50 %.3fms, p99 %.3fms, max %.3fms\n", name, count,
+            sum / runs, times[runs / 2], times[(runs * 99) / 100], times[runs - 1]);
+}
+
+static double elapsed(uint64_t begin) {
+    return (cpuProfilerNow() - begin) * 1e-6;
+}
+
+int main() {
+    std::vector<Aabb> boxes(BENCHMARK_OBJECTS);
+    for(uint32_t i = 0; i < BENCHMARK_OBJECTS; ++i) {
+        boxes[i] = randomBox();
+    }
+
+    Bvh bvh;
+    std::vector<double> times(BENCHMARK_RUNS);
+    for(uint32_t run = 0; run < BENCHMARK_RUNS; ++run) {
+        uint64_t begin = cpuProfilerNow();
+        buildBvh(&bvh, boxes.data(), BENCHMARK_OBJECTS);
+        times[run] = elapsed(begin);
+    }
+    report("Build, nodes", times, (uint32_t)bvh.nodes.size());
+
+    // Small moves, like animated objects between two frames
+    uint32_t updated = 0;
+    for(uint32_t run = 0; run < BENCHMARK_RUNS; ++run) {
+        for(uint32_t i = 0; i < BENCHMARK_MOVING; ++i) {
+            uint32_t item = (uint32_t)(randomFloat() * BENCHMARK_OBJECTS);
+            glm::vec3 offset = (glm::vec3(randomFloat(), 0.0f, randomFloat()) - 0.5f) * 0.1f;
+            Aabb box = {bvh.itemBounds[item].min + offset, bvh.itemBounds[item].max + offset};
+            setBvhItemBounds(&bvh, item, box);
+        }
+        uint64_t begin = cpuProfilerNow();
+        updated = refitBvh(&bvh);
+        times[run] = elapsed(begin);
+    }
+    report("Refit of 10k moved objects, nodes updated", times, updated);
+
+    for(uint32_t run = 0; run < BENCHMARK_RUNS; ++run) {
+        for(uint32_t i = 0; i < BENCHMARK_OBJECTS; ++i) {
+            setBvhItemBounds(&bvh, i, bvh.itemBounds[i]);
+        }
+        uint64_t begin = cpuProfilerNow();
+        updated = refitBvh(&bvh);
+        times[run] = elapsed(begin);
+    }
+    report("Refit of all objects, nodes updated", times, updated);
+
+    // Infinite reversed Z projection, looking over the area from one corner and from the center
+    float f = 1.0f / tanf(glm::radians(45.0f) / 2.0f);
+    glm::mat4 proj(f / (16.0f / 9.0f), 0.0f, 0.0f, 0.0f, 0.0f, -f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.01f, 0.0f);
+    glm::vec3 up(0.0f, 1.0f, 0.0f);
+    std::vector<uint32_t> visible;
+    glm::vec3 eyes[] = {glm::vec3(0.0f, 50.0f, 0.0f), glm::vec3(WORLD_SIZE * 0.5f, 10.0f, WORLD_SIZE * 0.5f)};
+    const char* names[] = {"Frustum cull from the corner, visible", "Frustum cull from the center, visible"};
+    for(uint32_t e = 0; e < 2; ++e) {
+        for(uint32_t run = 0; run < BENCHMARK_RUNS; ++run) {
+            float angle = run * (6.2831853f / BENCHMARK_RUNS);
+            glm::vec3 target = eyes[e] + glm::vec3(sinf(angle), -0.1f, cosf(angle));
+            Frustum frustum = getFrustum(proj * glm::lookAtLH(eyes[e], target, up));
+            uint64_t begin = cpuProfilerNow();
+            cullBvh(&bvh, &frustum, &visible);
+            times[run] = elapsed(begin);
+        }
+        report(names[e], times, (uint32_t)visible.size());
+    }
+
+    std::vector<double> rayTimes(BENCHMARK_RAYS);
+    uint32_t hits = 0;
+    for(uint32_t i = 0; i < BENCHMARK_RAYS; ++i) {
+        glm::vec3 origin(randomFloat() * WORLD_SIZE, 10.0f, randomFloat() * WORLD_SIZE);
+        glm::vec3 direction = glm::normalize(glm::vec3(randomFloat() - 0.5f, -0.2f, randomFloat() - 0.5f));
+        float distance;
+        uint64_t begin = cpuProfilerNow();
+        hits += raycastBvh(&bvh, origin, direction, WORLD_SIZE, &distance) != BVH_NO_ITEM;
+        rayTimes[i] = elapsed(begin);
+    }
+    report("Ray picks, hits", rayTimes, hits);
+    return 0;
+}
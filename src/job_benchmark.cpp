@@ -0,0 +1,188 @@
+#include "job_system.h"
+#include "profiler.h"
+
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// Checks the job system, then measures how recursive fork/join jobs and a flat parallelFor over transforms scale from
+// one thread up to one per core. Exits with 1 if a check fails
+
+#define FIB_N 30
+// Below this fib runs serially, so a job does around a microsecond of work
+#define FIB_CUTOFF 12
+#define TRANSFORM_COUNT 1000000
+#define TRANSFORM_BATCH 1024
+#define BENCHMARK_RUNS 20
+
+static uint64_t fibSerial(uint32_t n) {
+    return n < 2 ? n : fibSerial(n - 1) + fibSerial(n - 2);
+}
+
+struct FibJob {
+    uint32_t n;
+    uint64_t result;
+};
+
+static void runFibJob(void* data) {
+    FibJob* fib = (FibJob*)data;
+    if(fib->n < FIB_CUTOFF) {
+        fib->result = fibSerial(fib->n);
+        return;
+    }
+    FibJob children[2] = {{fib->n - 1, 0}, {fib->n - 2, 0}};
+    Job jobs[2] = {{runFibJob, &children[0], 0}, {runFibJob, &children[1], 0}};
+    JobCounter counter;
+    runJobs(jobs, 2, &counter);
+    waitForCounter(&counter);
+    fib->result = children[0].result + children[1].result;
+}
+
+static uint64_t fibJobs(uint32_t n) {
+    FibJob fib = {n, 0};
+    Job job = {runFibJob, &fib, 0};
+    JobCounter counter;
+    runJobs(&job, 1, &counter);
+    waitForCounter(&counter);
+    return fib.result;
+}
+
+struct Transforms {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::mat4> matrices;
+};
+
+static void composeTransforms(uint32_t begin, uint32_t end, void* data) {
+    Transforms* transforms = (Transforms*)data;
+    for(uint32_t i = begin; i < end; ++i) {
+        glm::mat3 rotation = glm::mat3_cast(transforms->rotations[i]);
+        glm::mat4& result = transforms->matrices[i];
+        result[0] = glm::vec4(rotation[0], 0.0f);
+        result[1] = glm::vec4(rotation[1], 0.0f);
+        result[2] = glm::vec4(rotation[2], 0.0f);
+        result[3] = glm::vec4(transforms->positions[i], 1.0f);
+    }
+}
+
+static void addOne(void* data) {
+    ((std::atomic<uint32_t>*)data)->fetch_add(1, std::memory_order_relaxed);
+}
+
+static void markIndices(uint32_t begin, uint32_t end, void* data) {
+    uint32_t* marks = (uint32_t*)data;
+    for(uint32_t i = begin; i < end; ++i) {
+        marks[i]++;
+    }
+}
+
+struct MainThreadCheck {
+    std::thread::id mainThread;
+    bool onMainThread;
+};
+
+static void checkMainThread(void* data) {
+    MainThreadCheck* check = (MainThreadCheck*)data;
+    check->onMainThread = std::this_thread::get_id() == check->mainThread;
+}
+
+static bool check(bool condition, const char* name) {
+    if(!condition) {
+        fprintf(stderr, "Check failed: %s\n", name);
+    }
+    return condition;
+}
+
+static bool runChecks() {
+    bool passed = true;
+    passed &= check(fibJobs(FIB_N) == fibSerial(FIB_N), "fib jobs match the serial result");
+
+    // Many tiny jobs, most of them stolen
+    std::atomic<uint32_t> sum(0);
+    std::vector<Job> jobs(100000, Job{addOne, &sum, 0});
+    JobCounter counter;
+    runJobs(jobs.data(), (uint32_t)jobs.size(), &counter);
+    waitForCounter(&counter);
+    passed &= check(sum.load() == jobs.size(), "every job ran once");
+
+    // Uneven last batch
+    std::vector<uint32_t> marks(100003, 0);
+    parallelFor((uint32_t)marks.size(), 100, markIndices, marks.data());
+    passed &= check(std::count(marks.begin(), marks.end(), 1u) == (long)marks.size(), "parallelFor covers every index once");
+
+    MainThreadCheck mainThreadCheck = {std::this_thread::get_id(), false};
+    Job mainThreadJob = {checkMainThread, &mainThreadCheck, 0};
+    JobCounter mainThreadCounter;
+    runJobsOnMainThread(&mainThreadJob, 1, &mainThreadCounter);
+    waitForCounter(&mainThreadCounter);
+    passed &= check(mainThreadCheck.onMainThread, "main thread jobs run on the main thread");
+    return passed;
+}
+
+// Returns the average
+static double report(const char* name, uint32_t threadCount, std::vector<double>& times, double singleThreadAverage) {
+    std::sort(times.begin(), times.end());
+    double sum = 0.0;
+    for(size_t i = 0; i < times.size(); ++i) {
+        sum += times[i];
+    }
+    double average = sum / times.size();
+    fprintf(stderr, "%s, %2u threads: avg %.3fms, p50 %.3fms, max %.3fms, speedup %.2fx\n", name, threadCount, average,
+            times[times.size() / 2], times[times.size() - 1], singleThreadAverage > 0.0 ? singleThreadAverage / average : 1.0);
+    return average;
+}
+
+int main() {
+    PROFILE_THREAD("Main thread");
+    uint32_t maxThreads = std::min((uint32_t)std::max(std::thread::hardware_concurrency(), 1u), (uint32_t)JOB_MAX_THREADS);
+
+    initJobSystem(maxThreads);
+    bool passed = runChecks();
+    shutdownJobSystem();
+    if(!passed) {
+        return 1;
+    }
+    fprintf(stderr, "All checks passed on %u threads\n", maxThreads);
+
+    Transforms transforms;
+    transforms.positions.resize(TRANSFORM_COUNT);
+    transforms.rotations.resize(TRANSFORM_COUNT);
+    transforms.matrices.resize(TRANSFORM_COUNT);
+    for(uint32_t i = 0; i < TRANSFORM_COUNT; ++i) {
+        transforms.positions[i] = glm::vec3((float)(i % 1000), 0.0f, (float)(i / 1000));
+        transforms.rotations[i] = glm::angleAxis(i * 0.001f, glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    double fibSingle = 0.0;
+    double transformsSingle = 0.0;
+    std::vector<double> times(BENCHMARK_RUNS);
+    for(uint32_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+        initJobSystem(threadCount);
+        for(uint32_t run = 0; run < BENCHMARK_RUNS; ++run) {
+            uint64_t begin = cpuProfilerNow();
+            fibJobs(FIB_N);
+            times[run] = (cpuProfilerNow() - begin) * 1e-6;
+        }
+        double average = report("fib jobs", threadCount, times, fibSingle);
+        fibSingle = fibSingle > 0.0 ? fibSingle : average;
+
+        for(uint32_t run = 0; run < BENCHMARK_RUNS; ++run) {
+            uint64_t begin = cpuProfilerNow();
+            parallelFor(TRANSFORM_COUNT, TRANSFORM_BATCH, composeTransforms, &transforms);
+            times[run] = (cpuProfilerNow() - begin) * 1e-6;
+        }
+        average = report("parallelFor transforms", threadCount, times, transformsSingle);
+        transformsSingle = transformsSingle > 0.0 ? transformsSingle : average;
+        shutdownJobSystem();
+
+        // Also measure the maximum when it is not a power of two
+        if(threadCount < maxThreads && threadCount * 2 > maxThreads) {
+            threadCount = maxThreads / 2;
+        }
+    }
+    return 0;
+}
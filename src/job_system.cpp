@@ -0,0 +1,284 @@
+#include "job_system.h"
+#include "profiler.h"
+
+#include <cassert>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define JOB_NO_THREAD UINT32_MAX
+
+// Chase-Lev deque with the memory orders of Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models".
+// Only the owner calls pushJob and popJob, any thread calls stealJob
+struct JobDeque {
+    alignas(64) std::atomic<int64_t> top;
+    alignas(64) std::atomic<int64_t> bottom;
+    alignas(64) std::atomic<Job*> jobs[JOB_DEQUE_SIZE];
+};
+
+static JobDeque deques[JOB_MAX_THREADS];
+static std::thread workers[JOB_MAX_THREADS];
+static uint32_t threadCount = 0;
+static std::atomic<bool> running(false);
+// Index into deques, 0 is the main thread
+static thread_local uint32_t threadIndex = JOB_NO_THREAD;
+static thread_local uint32_t randomState = 0;
+static char workerNames[JOB_MAX_THREADS][16];
+
+// Idle workers sleep until the generation changes, it is incremented whenever jobs are queued
+static std::mutex sleepMutex;
+static std::condition_variable sleepCondition;
+static std::atomic<uint64_t> wakeGeneration(0);
+static std::atomic<uint32_t> sleepingWorkers(0);
+
+static std::mutex mainThreadMutex;
+static std::vector<Job*> mainThreadJobs;
+
+static bool pushJob(JobDeque* deque, Job* job) {
+    int64_t bottom = deque->bottom.load(std::memory_order_relaxed);
+    int64_t top = deque->top.load(std::memory_order_acquire);
+    if(bottom - top >= JOB_DEQUE_SIZE) {
+        return false;
+    }
+    deque->jobs[bottom & (JOB_DEQUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+    // Publishes the job to thieves that acquire bottom
+    deque->bottom.store(bottom + 1, std::memory_order_release);
+    return true;
+}
+
+static Job* popJob(JobDeque* deque) {
+    int64_t bottom = deque->bottom.load(std::memory_order_relaxed) - 1;
+    deque->bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = deque->top.load(std::memory_order_relaxed);
+    if(top > bottom) {
+        // Empty
+        deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+        return 0;
+    }
+    Job* job = deque->jobs[bottom & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+    if(top == bottom) {
+        // The last job, a thief may take it at the same time
+        if(!deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            job = 0;
+        }
+        deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+static Job* stealJob(JobDeque* deque) {
+    int64_t top = deque->top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = deque->bottom.load(std::memory_order_acquire);
+    if(top >= bottom) {
+        return 0;
+    }
+    Job* job = deque->jobs[top & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+    if(!deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        // Lost against the owner or another thief
+        return 0;
+    }
+    return job;
+}
+
+static void executeJob(Job* job) {
+    // The job may be gone once its counter is decremented
+    JobCounter* counter = job->counter;
+    job->function(job->data);
+    if(counter) {
+        counter->value.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+// xorshift32, only picks the first victim
+static uint32_t randomVictim() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState % threadCount;
+}
+
+// Own deque first, then the others starting at a random one
+static bool runNextJob() {
+    Job* job = popJob(&deques[threadIndex]);
+    if(!job) {
+        uint32_t first = randomVictim();
+        for(uint32_t i = 0; i < threadCount && !job; ++i) {
+            uint32_t victim = (first + i) % threadCount;
+            if(victim != threadIndex) {
+                job = stealJob(&deques[victim]);
+            }
+        }
+    }
+    if(!job) {
+        return false;
+    }
+    executeJob(job);
+    return true;
+}
+
+static bool runMainThreadJob() {
+    Job* job = 0;
+    {
+        std::lock_guard<std::mutex> lock(mainThreadMutex);
+        if(!mainThreadJobs.empty()) {
+            job = mainThreadJobs.back();
+            mainThreadJobs.pop_back();
+        }
+    }
+    if(!job) {
+        return false;
+    }
+    executeJob(job);
+    return true;
+}
+
+static void wakeWorkers() {
+    wakeGeneration.fetch_add(1);
+    if(sleepingWorkers.load()) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        sleepCondition.notify_all();
+    }
+}
+
+static void runWorker(uint32_t index) {
+    threadIndex = index;
+    randomState = index * 0x9E3779B9u + 1;
+    snprintf(workerNames[index], sizeof(workerNames[index]), "Job worker %u", index);
+    PROFILE_THREAD(workerNames[index]);
+    while(running.load(std::memory_order_relaxed)) {
+        // Read before looking for jobs, so jobs queued after the last attempt are not slept through
+        uint64_t generation = wakeGeneration.load();
+        bool ran = false;
+        for(uint32_t spin = 0; spin < JOB_IDLE_SPINS && !ran; ++spin) {
+            ran = runNextJob();
+            if(!ran) {
+                std::this_thread::yield();
+            }
+        }
+        if(ran) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepingWorkers.fetch_add(1);
+        while(wakeGeneration.load() == generation && running.load()) {
+            sleepCondition.wait(lock);
+        }
+        sleepingWorkers.fetch_sub(1);
+    }
+}
+
+void initJobSystem(uint32_t requestedThreadCount) {
+    assert(!running.load());
+    if(!requestedThreadCount) {
+        requestedThreadCount = std::thread::hardware_concurrency();
+    }
+    threadCount = requestedThreadCount < 1 ? 1 : (requestedThreadCount > JOB_MAX_THREADS ? JOB_MAX_THREADS : requestedThreadCount);
+    for(uint32_t i = 0; i < threadCount; ++i) {
+        deques[i].top.store(0);
+        deques[i].bottom.store(0);
+    }
+    threadIndex = 0;
+    randomState = 1;
+    running.store(true);
+    for(uint32_t i = 1; i < threadCount; ++i) {
+        workers[i] = std::thread(runWorker, i);
+    }
+}
+
+void shutdownJobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        running.store(false);
+    }
+    sleepCondition.notify_all();
+    for(uint32_t i = 1; i < threadCount; ++i) {
+        workers[i].join();
+    }
+    threadIndex = JOB_NO_THREAD;
+    threadCount = 0;
+}
+
+uint32_t getJobThreadCount() {
+    return threadCount;
+}
+
+void runJobs(Job* jobs, uint32_t count, JobCounter* counter) {
+    counter->value.fetch_add(count, std::memory_order_relaxed);
+    bool queued = false;
+    for(uint32_t i = 0; i < count; ++i) {
+        jobs[i].counter = counter;
+        if(threadIndex != JOB_NO_THREAD && pushJob(&deques[threadIndex], &jobs[i])) {
+            queued = true;
+        } else {
+            executeJob(&jobs[i]);
+        }
+    }
+    if(queued) {
+        wakeWorkers();
+    }
+}
+
+void runJobsOnMainThread(Job* jobs, uint32_t count, JobCounter* counter) {
+    counter->value.fetch_add(count, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mainThreadMutex);
+    for(uint32_t i = 0; i < count; ++i) {
+        jobs[i].counter = counter;
+        mainThreadJobs.push_back(&jobs[i]);
+    }
+}
+
+void waitForCounter(JobCounter* counter) {
+    while(counter->value.load(std::memory_order_acquire) != 0) {
+        if(threadIndex == 0 && runMainThreadJob()) {
+            continue;
+        }
+        if(threadIndex == JOB_NO_THREAD || !runNextJob()) {
+            // The remaining jobs are running on other threads
+            std::this_thread::yield();
+        }
+    }
+}
+
+void runMainThreadJobs() {
+    assert(threadIndex == 0);
+    while(runMainThreadJob()) {
+    }
+}
+
+struct ParallelForBatch {
+    ParallelForFunction function;
+    void* data;
+    uint32_t begin;
+    uint32_t end;
+};
+
+static void runParallelForBatch(void* data) {
+    ParallelForBatch* batch = (ParallelForBatch*)data;
+    batch->function(batch->begin, batch->end, batch->data);
+}
+
+void parallelFor(uint32_t count, uint32_t batchSize, ParallelForFunction function, void* data) {
+    assert(batchSize > 0);
+    uint32_t batchCount = (count + batchSize - 1) / batchSize;
+    if(batchCount <= 1 || threadCount <= 1) {
+        if(count) {
+            function(0, count, data);
+        }
+        return;
+    }
+    std::vector<ParallelForBatch> batches(batchCount);
+    std::vector<Job> jobs(batchCount);
+    for(uint32_t i = 0; i < batchCount; ++i) {
+        batches[i] = {function, data, i * batchSize, (i + 1 == batchCount) ? count : (i + 1) * batchSize};
+        jobs[i] = {runParallelForBatch, &batches[i], 0};
+    }
+    JobCounter counter;
+    // The first batch runs on this thread right away, the others are up for stealing
+    runJobs(jobs.data() + 1, batchCount - 1, &counter);
+    runParallelForBatch(&batches[0]);
+    waitForCounter(&counter);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+
+// Work stealing job system. The main thread and every worker own a Chase-Lev deque, they push and pop their jobs at its
+// bottom while idle threads steal from the top of the others, so a thread works depth first on its own jobs and the
+// others take the oldest, usually largest ones. Jobs run to completion. A job depends on others by waiting on their
+// counter, waitForCounter runs other jobs meanwhile instead of blocking.
+// Main thread jobs (SDL calls, anything with thread affinity) go into a separate queue that only the main thread runs,
+// in runMainThreadJobs and while it waits on a counter
+
+// Also bounds the thread counts job_benchmark measures. The profiler and the logger have room for these and the other threads
+#define JOB_MAX_THREADS 64
+// Jobs per deque, must be a power of two. runJobs runs jobs inline once the deque of the thread is full
+#define JOB_DEQUE_SIZE 4096
+// Steal attempts over all deques before an idle worker goes to sleep
+#define JOB_IDLE_SPINS 64
+
+typedef void (*JobFunction)(void* data);
+typedef void (*ParallelForFunction)(uint32_t begin, uint32_t end, void* data);
+
+// Number of jobs passed with it that have not finished yet
+struct JobCounter {
+    std::atomic<uint32_t> value{0};
+};
+
+// The job and its data have to stay alive until its counter reached 0
+struct Job {
+    JobFunction function;
+    void* data;
+    // Set by runJobs
+    JobCounter* counter;
+};
+
+// threadCount includes the calling thread, which becomes the main thread. 0 uses one thread per core, at most JOB_MAX_THREADS
+void initJobSystem(uint32_t threadCount);
+// Every counter has to be waited on
+void shutdownJobSystem();
+uint32_t getJobThreadCount();
+// Adds count to counter and queues the jobs on the deque of the calling thread. Threads outside of the job system run them inline
+void runJobs(Job* jobs, uint32_t count, JobCounter* counter);
+// Queues the jobs for the main thread
+void runJobsOnMainThread(Job* jobs, uint32_t count, JobCounter* counter);
+// Runs other jobs until the counter reaches 0
+void waitForCounter(JobCounter* counter);
+// Runs all queued main thread jobs. Call once per frame on the main thread
+void runMainThreadJobs();
+// Calls function for batches of batchSize indices of [0, count) on all threads and returns once all are done
+void parallelFor(uint32_t count, uint32_t batchSize, ParallelForFunction function, void* data);
@@ -0,0 +1,119 @@
+#include "binary_log.h"
+
+#include <string>
+#include <vector>
+
+// Turns a binary log written with LOG_BINARY_FILE into text.
+// Usage: log_decoder <binary log> [output]
+
+struct DecodedSite {
+    std::string file;
+    uint32_t line;
+    uint32_t level;
+    std::string types;
+};
+
+static bool readUint32(FILE* file, uint32_t* value) {
+    return fread(value, sizeof(*value), 1, file) == 1;
+}
+
+static bool readString(FILE* file, std::string* string) {
+    uint32_t length;
+    if(!readUint32(file, &length)) {
+        return false;
+    }
+    string->resize(length);
+    return length == 0 || fread(&(*string)[0], 1, length, file) == length;
+}
+
+static void writeLine(FILE* output, uint32_t level, const std::string& text) {
+    const char* levelNames[] = {"", "[warn]", "[error]"};
+    fprintf(output, "%s%s\n", (level < 3) ? levelNames[level] : "", text.c_str());
+}
+
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s <binary log> [output]\n", argv[0]);
+        return 1;
+    }
+    FILE* file = fopen(argv[1], "rb");
+    if(!file) {
+        fprintf(stderr, "Could not open %s\n", argv[1]);
+        return 1;
+    }
+    FILE* output = stdout;
+    if(argc > 2) {
+        output = fopen(argv[2], "w");
+        if(!output) {
+            fprintf(stderr, "Could not open %s\n", argv[2]);
+            fclose(file);
+            return 1;
+        }
+    }
+
+    char magic[8];
+    if(fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, BINARY_LOG_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s is not a binary log\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    std::vector<DecodedSite> sites;
+    std::vector<uint8_t> arguments;
+    std::string text;
+    uint32_t messageCount = 0;
+    bool valid = true;
+    int kind;
+    while(valid && (kind = fgetc(file)) != EOF) {
+        uint32_t id, size, level;
+        switch(kind) {
+        case BINARY_LOG_SITE: {
+            DecodedSite site;
+            valid = readUint32(file, &id) && readUint32(file, &site.line) && readUint32(file, &site.level) &&
+                    readString(file, &site.file) && readString(file, &site.types);
+            if(valid) {
+                if(id >= sites.size()) {
+                    sites.resize(id + 1);
+                }
+                sites[id] = site;
+            }
+            break;
+        }
+        case BINARY_LOG_MESSAGE:
+            valid = readUint32(file, &id) && readUint32(file, &size) && id < sites.size();
+            if(valid) {
+                arguments.resize(size);
+                valid = size == 0 || fread(arguments.data(), 1, size, file) == size;
+            }
+            if(valid) {
+                DecodedSite* site = &sites[id];
+                text.clear();
+                if(!formatLogRecord(text, site->file.c_str(), site->line, site->types.c_str(), arguments.data(), size)) {
+                    text.append(" [malformed record]");
+                }
+                writeLine(output, site->level, text);
+                messageCount++;
+            }
+            break;
+        case BINARY_LOG_TEXT:
+            valid = readUint32(file, &level) && readString(file, &text);
+            if(valid) {
+                writeLine(output, level, text);
+                messageCount++;
+            }
+            break;
+        default:
+            valid = false;
+            break;
+        }
+    }
+    if(!valid) {
+        fprintf(stderr, "Binary log is truncated or corrupt after %u messages\n", messageCount);
+    }
+
+    fclose(file);
+    if(output != stdout) {
+        fclose(output);
+    }
+    return valid ? 0 : 1;
+}
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <sstream>
 #include <string>
+#include <type_traits>
 
 //TODO: Windows UTF-16 to UTF-8
 //TODO: Variadic args
@@ -12,27 +13,57 @@
 //#define LOGGING_DISABLE_INFO
 //#define LOGGING_DISABLE_WARN
 //#define LOGGING_DISABLE_ERROR
+// Call sites only store their arguments as raw bytes, formatting is deferred to the logger backend or log_decoder
+//#define LOGGING_BINARY
 
 //#define LOG_DEBUG(message) logDebug(message, __LINE__, __FILE__)
 
+enum LogLevel {
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+};
+
+#define LOG_BINARY(level, ...) do { static const LogSite logSite = {__FILE__, __LINE__, level}; _logBinary(&logSite, __VA_ARGS__); } while(0)
+
 #ifdef LOGGING_DISABLE_INFO
 #define LOG_INFO(...)
+#elif defined(LOGGING_BINARY)
+#define LOG_INFO(...) LOG_BINARY(LOG_LEVEL_INFO, __VA_ARGS__)
 #else
 #define LOG_INFO(...) _logInfo(__LINE__, __FILE__, __VA_ARGS__)
 #endif
 
 #ifdef LOGGING_DISABLE_WARN
 #define LOG_WARN(...)
+#elif defined(LOGGING_BINARY)
+#define LOG_WARN(...) LOG_BINARY(LOG_LEVEL_WARN, __VA_ARGS__)
 #else
 #define LOG_WARN(...) _logWarn(__LINE__, __FILE__, __VA_ARGS__)
 #endif
 
 #ifdef LOGGING_DISABLE_ERROR
 #define LOG_ERROR(...)
+#elif defined(LOGGING_BINARY)
+#define LOG_ERROR(...) LOG_BINARY(LOG_LEVEL_ERROR, __VA_ARGS__)
 #else
 #define LOG_ERROR(...) _logError(__LINE__, __FILE__, __VA_ARGS__)
 #endif
 
+// Static descriptor of a binary log call site
+struct LogSite {
+    const char* file;
+    uint32_t line;
+    uint32_t level;
+};
+
+// Header of a binary record. Followed by size bytes of arguments, encoded as described by types
+struct LogRecord {
+    const LogSite* site;
+    const char* types;
+    uint32_t size;
+};
+
 // Logger backends only have to supply these functions:
 void initLogger(void);
 //void log(const char* message, size_t messageLength, size_t lineNumber, const char* file);
@@ -41,6 +72,11 @@ void logInfo(size_t lineNumber, const char* file, const char* message, size_t me
 void logWarn(size_t lineNumber, const char* file, const char* message, size_t messageLength);
 void logError(size_t lineNumber, const char* file, const char* message, size_t messageLength);
 void exitLogger(void);
+// For binary logging. Returns space for a LogRecord plus its arguments, or 0 if the message has to be dropped
+uint8_t* logBinaryReserve(size_t size);
+void logBinaryCommit(uint8_t* record);
+// Messages written and dropped since initLogger, complete once exitLogger returned
+void getLoggerStats(uint64_t* written, uint64_t* dropped);
 
 // int, long, long long, float, double, long double
 
@@ -197,3 +233,113 @@ inline void _logError(size_t lineNumber, const char* file, const char (& message
     //logInfo(0, 0, "Correct", 0);
     logError(lineNumber, file, message, N-1);
 }
+
+// Binary argument encoding. Integers and pointers take 8 bytes, floating point values are stored as double,
+// strings as a uint32_t length followed by the characters. Types without a specialization are formatted
+// with operator<< at the call site and stored as string.
+// LogArg<T>::value turns an argument into what is measured and written, so such types are only formatted once.
+#define LOG_TYPE_INT 'i'
+#define LOG_TYPE_UINT 'u'
+#define LOG_TYPE_DOUBLE 'f'
+#define LOG_TYPE_CHAR 'c'
+#define LOG_TYPE_POINTER 'p'
+#define LOG_TYPE_STRING 's'
+
+inline uint8_t* logWriteString(uint8_t* out, const char* string, uint32_t length) {
+    memcpy(out, &length, sizeof(length));
+    memcpy(out + sizeof(length), string, length);
+    return out + sizeof(length) + length;
+}
+
+template<typename T>
+struct LogArg {
+    static const char code = LOG_TYPE_STRING;
+    static std::string value(const T& arg) {
+        std::ostringstream oss;
+        oss << arg;
+        return oss.str();
+    }
+};
+
+template<>
+struct LogArg<std::string> {
+    static const char code = LOG_TYPE_STRING;
+    static const std::string& value(const std::string& arg) { return arg; }
+    static size_t size(const std::string& arg) { return sizeof(uint32_t) + arg.size(); }
+    static uint8_t* write(uint8_t* out, const std::string& arg) { return logWriteString(out, arg.c_str(), (uint32_t)arg.size()); }
+};
+
+#define LOG_ARG_SCALAR(type, typeCode, storage) \
+template<> \
+struct LogArg<type> { \
+    static const char code = typeCode; \
+    static type value(type arg) { return arg; } \
+    static size_t size(type) { return sizeof(storage); } \
+    static uint8_t* write(uint8_t* out, type arg) { \
+        storage value = (storage)arg; \
+        memcpy(out, &value, sizeof(value)); \
+        return out + sizeof(value); \
+    } \
+};
+
+LOG_ARG_SCALAR(bool, LOG_TYPE_INT, int64_t)
+LOG_ARG_SCALAR(char, LOG_TYPE_CHAR, int64_t)
+LOG_ARG_SCALAR(short, LOG_TYPE_INT, int64_t)
+LOG_ARG_SCALAR(unsigned short, LOG_TYPE_UINT, uint64_t)
+LOG_ARG_SCALAR(int, LOG_TYPE_INT, int64_t)
+LOG_ARG_SCALAR(unsigned, LOG_TYPE_UINT, uint64_t)
+LOG_ARG_SCALAR(long, LOG_TYPE_INT, int64_t)
+LOG_ARG_SCALAR(unsigned long, LOG_TYPE_UINT, uint64_t)
+LOG_ARG_SCALAR(long long, LOG_TYPE_INT, int64_t)
+LOG_ARG_SCALAR(unsigned long long, LOG_TYPE_UINT, uint64_t)
+LOG_ARG_SCALAR(float, LOG_TYPE_DOUBLE, double)
+LOG_ARG_SCALAR(double, LOG_TYPE_DOUBLE, double)
+LOG_ARG_SCALAR(long double, LOG_TYPE_DOUBLE, double)
+LOG_ARG_SCALAR(void*, LOG_TYPE_POINTER, uint64_t)
+LOG_ARG_SCALAR(const void*, LOG_TYPE_POINTER, uint64_t)
+
+template<>
+struct LogArg<const char*> {
+    static const char code = LOG_TYPE_STRING;
+    static const char* value(const char* arg) { return arg; }
+    static size_t size(const char* arg) { return sizeof(uint32_t) + strlen(arg); }
+    static uint8_t* write(uint8_t* out, const char* arg) { return logWriteString(out, arg, (uint32_t)strlen(arg)); }
+};
+
+template<>
+struct LogArg<char*> : LogArg<const char*> {};
+
+// One static type string per argument list, e.g. "sisf"
+template<typename... Args>
+struct LogTypes {
+    static const char value[sizeof...(Args) + 1];
+};
+template<typename... Args>
+const char LogTypes<Args...>::value[sizeof...(Args) + 1] = { LogArg<typename std::decay<Args>::type>::code..., 0 };
+
+// Values are the results of LogArg<T>::value
+template<typename... Values>
+inline void _logBinaryValues(const LogSite* site, const char* types, const Values &... values) {
+    size_t sizes[] = { LogArg<Values>::size(values)... };
+    size_t size = 0;
+    for(size_t i = 0; i < sizeof...(Values); ++i) {
+        size += sizes[i];
+    }
+
+    uint8_t* record = logBinaryReserve(sizeof(LogRecord) + size);
+    if(!record) {
+        return;
+    }
+    LogRecord header = { site, types, (uint32_t)size };
+    memcpy(record, &header, sizeof(header));
+    uint8_t* out = record + sizeof(LogRecord);
+    // Braced initializers are evaluated in order
+    int unpack[] = { (out = LogArg<Values>::write(out, values), 0)... };
+    (void)unpack;
+    logBinaryCommit(record);
+}
+
+template<typename... Args>
+inline void _logBinary(const LogSite* site, const Args &... args) {
+    _logBinaryValues(site, LogTypes<Args...>::value, LogArg<typename std::decay<Args>::type>::value(args)...);
+}
@@ -0,0 +1,71 @@
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// Measures the latency of a log call on the producer side. Built once per logger backend and once with LOGGING_BINARY.
+// Redirect the log output (or set LOG_FILE / LOG_BINARY_FILE for the async backend) so the terminal does not dominate the results.
+// Calls are timed in batches of BENCHMARK_BATCH so the clock overhead does not hide calls that only take a few nanoseconds.
+// A dropped message is much cheaper than a written one, so the benchmark fails if the backend dropped any.
+
+#define BENCHMARK_ITERATIONS 100000
+#define BENCHMARK_BATCH 16
+#define BENCHMARK_THREADS 4
+
+static void measure(std::vector<double>* latencies, uint32_t thread) {
+    latencies->resize(BENCHMARK_ITERATIONS / BENCHMARK_BATCH);
+    for(uint32_t i = 0; i < BENCHMARK_ITERATIONS; i += BENCHMARK_BATCH) {
+        auto begin = std::chrono::steady_clock::now();
+        for(uint32_t j = i; j < i + BENCHMARK_BATCH; ++j) {
+            LOG_INFO("Benchmark thread ", thread, " message ", j, " value ", j * 0.5f);
+        }
+        auto end = std::chrono::steady_clock::now();
+        (*latencies)[i / BENCHMARK_BATCH] = std::chrono::duration<double, std::nano>(end - begin).count() / BENCHMARK_BATCH;
+        if((i & 63) == 0) {
+            // Roughly a frame worth of messages, then give the writer some time
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+}
+
+static void report(const char* name, std::vector<double>& latencies) {
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0.0;
+    for(size_t i = 0; i < latencies.size(); ++i) {
+        sum += latencies[i];
+    }
+    size_t count = latencies.size();
+    fprintf(stderr, "%s: %zu batches of %u calls, per call avg %.1fns, p50 %.1fns, p99 %.1fns, max %.1fns\n", name, count, BENCHMARK_BATCH,
+            sum / count, latencies[count / 2], latencies[(count * 99) / 100], latencies[count - 1]);
+}
+
+int main() {
+    initLogger();
+
+    std::vector<double> latencies;
+    measure(&latencies, 0);
+    report("1 thread", latencies);
+
+    std::vector<double> threadLatencies[BENCHMARK_THREADS];
+    std::thread threads[BENCHMARK_THREADS];
+    for(uint32_t i = 0; i < BENCHMARK_THREADS; ++i) {
+        threads[i] = std::thread(measure, &threadLatencies[i], i);
+    }
+    latencies.clear();
+    for(uint32_t i = 0; i < BENCHMARK_THREADS; ++i) {
+        threads[i].join();
+        latencies.insert(latencies.end(), threadLatencies[i].begin(), threadLatencies[i].end());
+    }
+    report("4 threads", latencies);
+
+    exitLogger();
+    uint64_t written;
+    uint64_t dropped;
+    getLoggerStats(&written, &dropped);
+    uint64_t logged = (uint64_t)BENCHMARK_ITERATIONS * (1 + BENCHMARK_THREADS);
+    fprintf(stderr, "%llu of %llu messages written, %llu dropped\n", (unsigned long long)written, (unsigned long long)logged, (unsigned long long)dropped);
+    return (dropped || written != logged) ? 1 : 0;
+}
@@ -8,33 +8,97 @@
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm/ext/matrix_transform.hpp>
 #include <glm/glm/gtc/matrix_transform.hpp>
+#include <glm/glm/gtc/constants.hpp>
 
 #include "logger.h"
+#include "profiler.h"
 #include "vulkan_base/vulkan_base.h"
-#include "model.h"
+#include "model_loader.h"
+#include "job_system.h"
+#include "resolution_scaling.h"
 
 #include <imgui.h>
 #include <backends/imgui_impl_sdl.h>
 #include <backends/imgui_impl_vulkan.h>
 
-#define FRAMES_IN_FLIGHT 2
+#include <algorithm>
+#include <cfloat>
+#include <thread>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Number of frames the CPU may record ahead of the GPU, set at startup with --frames-in-flight
+#define MAX_FRAMES_IN_FLIGHT GPU_PROFILER_MAX_FRAMES
+uint32_t framesInFlight = 2;
 
 VulkanContext* context;
 VkSurfaceKHR surface;
 VulkanSwapchain swapchain;
 VkRenderPass renderPass;
+// Counts submitted frames, the frame being recorded uses frameIndex = frameNumber % framesInFlight
+uint64_t frameNumber = 0;
+// Keyed by scheduler values, see submitWithValue
+VulkanDeletionQueue deletionQueue;
+
+// Headless mode renders into an offscreen image ring without SDL video, a surface or presentation
+bool headless = false;
+uint32_t headlessWidth = 1240;
+uint32_t headlessHeight = 720;
+uint32_t headlessImageIndex = 0;
+const char* headlessDumpFilename = 0;
+
+// Swapchain configuration, editing it in the "Swapchain" window recreates the swapchain
+VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+uint32_t requestedImageCount = 3;
+// Frames per second, 0 disables the frame limiter
+int frameRateLimit = 0;
+// Host time when the input of the current frame was sampled
+uint64_t frameInputTime;
+std::vector<uint64_t> inputTimePerFrame;
+// Milliseconds from sampling input to the GPU finishing the frame. Negative if no frame was resolved
+double lastFrameLatency = -1.0;
+double frameLatencyAvg;
+
+// Headless and benchmark runs render warmupFrameCount frames and then measure runFrameCount frames
+uint32_t warmupFrameCount = 60;
+uint32_t runFrameCount = 1000;
+// Benchmark mode replaces input by a scripted camera and advances the simulation by a fixed timestep
+const char* benchmarkFilename = 0;
+#define BENCHMARK_TIMESTEP (1.0f / 60.0f)
+// Seconds for one orbit of the scripted camera
+#define BENCHMARK_CAMERA_PERIOD 10.0f
+// Simulated seconds, drives all animation
+float sceneTime = 0.0f;
+
 std::vector<VulkanImage> depthBuffers;
 std::vector<VulkanImage> colorBuffers;
+std::vector<VulkanImage> resolveBuffers;
+// Output of the scene render pass after the post process subpass
 std::vector<VulkanImage> multisampleTargetBuffers;
 std::vector<VulkanImage> gaussBuffers;
+std::vector<VulkanImage> computeBuffers;
+std::vector<VulkanImage> blurPyramidBuffers;
+std::vector<VkImageView> blurPyramidViews;
+std::vector<VkFramebuffer> blurPyramidFramebuffers;
 std::vector<VkFramebuffer> sceneFramebuffers;
 std::vector<VkFramebuffer> gaussFramebuffers;
 std::vector<VkFramebuffer> swapchainFramebuffers;
-VkCommandPool commandPools[FRAMES_IN_FLIGHT];
-VkCommandBuffer commandBuffers[FRAMES_IN_FLIGHT];
-VkFence fences[FRAMES_IN_FLIGHT];
-VkSemaphore acquireSemaphores[FRAMES_IN_FLIGHT];
-VkSemaphore releaseSemaphores[FRAMES_IN_FLIGHT];
+std::vector<VkCommandPool> commandPools;
+std::vector<VkCommandBuffer> commandBuffers;
+// Scheduler value of the last submission of each frame in flight
+std::vector<uint64_t> frameValues;
+std::vector<VkSemaphore> acquireSemaphores;
+std::vector<VkSemaphore> releaseSemaphores;
+// Async compute: the compute blur of a frame runs on the compute queue while the graphics queue already renders the next frame
+bool asyncCompute = true;
+std::vector<bool> asyncComputePerFrame;
+std::vector<VkCommandPool> computeCommandPools;
+std::vector<VkCommandBuffer> computeCommandBuffers;
+std::vector<VkSemaphore> graphicsDoneSemaphores;
+// GPU time from the first graphics command to the end of the compute blur. Indexed by asyncComputePerFrame
+double gpuFrameTimeAvg[2];
+double gpuComputeTimeAvg[2];
 VkPipelineCache pipelineCache;
 
 VulkanBuffer spriteVertexBuffer;
@@ -46,32 +110,345 @@ VkDescriptorSet spriteDescriptorSet;
 VkDescriptorSetLayout spriteDescriptorLayout;
 VulkanPipeline spritePipeline;
 
-Model model;
+#define MAX_SCENE_MODELS 4
+#define SCENE_GRID_SPACING 3.0f
+// Instance i draws models[i % modelCount], placed on a grid in front of the camera
+Model models[MAX_SCENE_MODELS];
+const char* modelFilenames[MAX_SCENE_MODELS] = {"../libs/glTF-Sample-Models/2.0/BoomBox/glTF-Binary/BoomBox.glb"};
+uint32_t modelCount = 1;
+// Models load on worker threads while the frames run, their instances stay empty until they are resident
+ModelLoader modelLoader;
+ModelHandle modelHandles[MAX_SCENE_MODELS];
+bool modelResident[MAX_SCENE_MODELS];
+// Waits for every model before the first frame, to compare the time to the first frame with
+bool syncModelLoading = false;
+// Threads of the job system including the main thread, 0 uses the cores the model loader workers leave
+uint32_t jobThreadCount = 0;
+// One per core next to the main thread, at most MODEL_LOADER_MAX_WORKERS
+uint32_t modelLoaderWorkerCount;
+static_assert(CPU_PROFILER_MAX_THREADS >= JOB_MAX_THREADS + MODEL_LOADER_MAX_WORKERS + 1, "Every job, loader and log writer thread needs a profiler slot");
+// cpuProfilerNow at the start of main, after the first frame and when the last load finished
+uint64_t startTime;
+uint64_t firstFrameTime;
+uint64_t modelsLoadedTime;
+uint32_t sceneInstanceCount = 2;
+Scene scene;
+std::vector<uint32_t> sceneRoots;
+SceneInstances sceneInstances;
+// Bounding boxes of the entities in sceneInstances, items are indices into sceneInstances.entities
+Bvh sceneBvh;
+// Incremented whenever sceneInstances is collected again, which changes the instance indices
+uint32_t sceneInstancesVersion = 1;
+bool frustumCulling = true;
+std::vector<uint32_t> visibleInstances;
+std::vector<uint8_t> instanceVisible;
+// Right click picks the instance under the cursor, or in the center while the mouse is captured
+bool pickRequested = false;
+glm::vec2 pickPosition;
+uint32_t pickedInstance = BVH_NO_ITEM;
 VulkanPipeline modelPipeline;
+// Depth only draws over the position stream before the shaded draws, which then test for equal depth without writing it
+bool depthPrepass = false;
+VulkanPipeline depthPrepassPipeline;
+VulkanPipeline modelPipelineEqual;
 VkDescriptorSetLayout modelDescriptorSetLayout;
 VkDescriptorPool modelDescriptorPool;
-VkDescriptorSet modelDescriptorSets[FRAMES_IN_FLIGHT];
-uint64_t singleElementSize;
-VulkanBuffer modelUniformBuffers[FRAMES_IN_FLIGHT];
+// MAX_SCENE_MODELS per frame
+std::vector<VkDescriptorSet> modelDescriptorSets;
+// Generation of the albedo texture each model descriptor set references, see StreamedTexture.
+// MODEL_DESCRIPTORS_STALE until the set is written for the current instance buffer of its frame
+#define MODEL_DESCRIPTORS_STALE UINT32_MAX
+std::vector<uint32_t> modelTextureGenerations;
+// Trilinear, the model textures have mips
+VkSampler textureSampler;
+TextureStreamer textureStreamer;
+int textureBudgetMb = 256;
+// Read by the model vertex shader with gl_InstanceIndex and by occlusion culling, see model_vert.glsl
+struct InstanceData {
+	glm::mat4 modelViewProj;
+	// Model and view projection of the last frame, both without jitter, for the motion vectors of TAA
+	glm::mat4 previousModelViewProj;
+	glm::mat4 modelView;
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+	uint32_t indexCount;
+	uint32_t flags;
+	uint32_t padding[2];
+};
+#define INSTANCE_IN_FRUSTUM 1
+// One entry per entry of sceneInstances.entities. They grow with the scene, see updateInstanceBuffers
+std::vector<VulkanBuffer> instanceBuffers;
+std::vector<uint32_t> instanceBufferCapacities;
+// Instance sized buffers that were replaced while recording this frame, retired with it
+std::vector<VulkanBuffer> retiredInstanceBuffers;
+// World matrix of every instance in the last frame, the current one again after the instances changed
+std::vector<glm::mat4> previousWorldMatrices;
+uint32_t previousWorldMatricesVersion = 0;
+
+// Two phase occlusion culling against a hierarchical depth pyramid (Hi-Z) of the previous draws, see occlusion_cull_comp.glsl.
+// Every instance has its own indirect draw with the instance index as firstInstance, which needs drawIndirectFirstInstance
+#define HIZ_MAX_LEVELS 16
+#define HIZ_GROUP_SIZE 8
+#define OCCLUSION_CULL_GROUP_SIZE 64
+bool occlusionCulling = true;
+bool occlusionCullingSupported = false;
+std::vector<bool> occlusionCullingPerFrame;
+// Matches the stats buffer in occlusion_cull_comp.glsl
+struct OcclusionStats {
+	uint32_t drawnEarly;
+	uint32_t drawnLate;
+	uint32_t occluded;
+	uint32_t inFrustum;
+};
+// Matches the push constants of occlusion_cull_comp.glsl
+struct OcclusionCullConstants {
+	glm::mat4 viewProj;
+	glm::vec2 pyramidSize;
+	uint32_t instanceCount;
+	uint32_t late;
+};
+// Of the frame that was resolved at the start of this one
+OcclusionStats occlusionStats;
+bool occlusionStatsValid = false;
+struct OcclusionTotals {
+	uint64_t frames;
+	uint64_t drawnEarly;
+	uint64_t drawnLate;
+	uint64_t occluded;
+	uint64_t inFrustum;
+} occlusionTotals;
+// Scales every fourth row of instances up into a wall that hides the rows behind it
+bool occluderScene = false;
+VkRenderPass earlyRenderPass;
+// Same as renderPass, but continues with the color and depth of the early pass
+VkRenderPass renderPassLoad;
+std::vector<VkFramebuffer> earlySceneFramebuffers;
+VulkanPipeline modelPipelineEarly;
+VulkanPipeline depthPrepassPipelineEarly;
+VulkanPipeline modelPipelineEqualEarly;
+VulkanPipeline occlusionCullPipeline;
+VulkanPipeline hizDepthPipeline;
+// Reads a single sampled depth buffer
+VulkanPipeline hizDepthPipelineSingle;
+VulkanPipeline hizReducePipeline;
+VkDescriptorSetLayout occlusionCullDescriptorSetLayout;
+VkDescriptorSetLayout hizDescriptorSetLayout;
+VkDescriptorPool occlusionDescriptorPool;
+std::vector<VkDescriptorSet> occlusionCullDescriptorSets;
+// HIZ_MAX_LEVELS per frame
+std::vector<VkDescriptorSet> hizDescriptorSets;
+// VkDrawIndexedIndirectCommand per instance, written by the early and again by the late cull
+VulkanBuffer drawCommandBuffer;
+// Per instance, nonzero if it was visible after the late cull of the last frame
+VulkanBuffer visibilityBuffer;
+// Instances that drawCommandBuffer and visibilityBuffer have room for
+uint32_t cullBufferCapacity = 0;
+// sceneInstancesVersion that visibilityBuffer was last reset for
+uint32_t visibilityVersion = 0;
+std::vector<VulkanBuffer> occlusionStatsBuffers;
+// Single pyramid, frames on the graphics queue do not overlap. Power of two size below the swapchain size
+VulkanImage hizImage;
+std::vector<VkImageView> hizViews;
+uint32_t hizWidth;
+uint32_t hizHeight;
+uint32_t hizLevels;
+
+// Clustered forward lighting, see cluster_lights_comp.glsl. The cluster grid matches the defines there and in model_frag.glsl
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define MAX_LIGHTS_PER_CLUSTER 256
+#define CLUSTER_GROUP_SIZE 64
+// The first depth slice ends at CLUSTER_NEAR, the last one starts at CLUSTER_FAR
+#define CLUSTER_NEAR 1.0f
+#define CLUSTER_FAR 500.0f
+#define MAX_LIGHTS 16384
+struct Light {
+	glm::vec4 positionRadius;
+	glm::vec4 color;
+};
+// Header of the light buffer, followed by the lights in view space
+struct LightingParams {
+	glm::vec2 screenSize;
+	glm::vec2 projScale;
+	float zNear;
+	float clusterNear;
+	float sliceScale;
+	uint32_t lightCount;
+	uint32_t naive;
+	uint32_t padding[3];
+};
+int lightCount = 256;
+// Every fragment loops over all lights, for comparison with the clustered lookup
+bool naiveLighting = false;
+// MAX_LIGHTS in world space, lightCount of them are used. They circle around these positions
+std::vector<Light> sceneLights;
+// Written every frame through a persistent mapping
+std::vector<VulkanBuffer> lightBuffers;
+std::vector<uint8_t*> mappedLightBuffers;
+// Light count per cluster, then MAX_LIGHTS_PER_CLUSTER light indices per cluster
+VulkanBuffer clusterBuffer;
+VkDescriptorSetLayout lightingDescriptorSetLayout;
+VkDescriptorPool lightingDescriptorPool;
+std::vector<VkDescriptorSet> lightingDescriptorSets;
+VulkanPipeline clusterLightsPipeline;
 
 VulkanPipeline gaussPipelineVertical;
 VulkanPipeline gaussPipelineHorizontal;
 VkDescriptorSetLayout gaussDescriptorSetLayout;
 VkDescriptorPool gaussDescriptorPool;
-VkDescriptorSet gaussDescriptorSetsVertical[FRAMES_IN_FLIGHT];
-VkDescriptorSet gaussDescriptorSetsHorizontal[FRAMES_IN_FLIGHT];
+std::vector<VkDescriptorSet> gaussDescriptorSetsVertical;
+std::vector<VkDescriptorSet> gaussDescriptorSetsHorizontal;
 VkRenderPass gaussRenderPass;
 VkRenderPass gaussRenderPassFinal;
 VkSampler linearSampler;
 
-VulkanPipeline computePipeline;
+// Dynamic resolution: the scene and blur targets keep the swapchain size, only their top left renderWidth x renderHeight
+// is rendered and the final blur pass upscales it to the swapchain. The scale follows the GPU frame time
+#define MIN_RENDER_SCALE 0.5f
+bool dynamicResolution = false;
+float gpuBudgetMs = 16.0f;
+ResolutionScaler resolutionScaler;
+// Scale used when dynamic resolution is off, set with --render-scale
+float fixedRenderScale = 1.0f;
+float renderScale = 1.0f;
+uint32_t renderWidth;
+uint32_t renderHeight;
+// Part of the scene and blur targets that holds the rendered image, for texture coordinates
+glm::vec2 renderUvScale;
+std::vector<float> renderScalePerFrame;
+// GPU time and render scale of the frame resolved last, negative time if there is none. --gpu-times records them for resolution_replay
+float lastGpuFrameTime = -1.0f;
+float lastGpuFrameScale;
+const char* gpuTimesFilename = 0;
+
+// Anti-aliasing. MSAA renders the scene with up to 8 samples and resolves it in the scene pass. FXAA and TAA render it
+// with a single sample into aaInputBuffers and filter it with a compute pass into multisampleTargetBuffers, see
+// fxaa_comp.glsl and taa_comp.glsl. A different sample count or switching TAA on or off rebuilds the scene pass, its
+// pipelines and the UI renderer
+enum AntiAliasingMode {
+	AA_MODE_MSAA,
+	AA_MODE_FXAA,
+	AA_MODE_TAA,
+};
+const char* aaModeNames[] = {"msaa", "fxaa", "taa"};
+int aaMode = AA_MODE_MSAA;
+int msaaSamples = 4;
+// What the render targets and scene pipelines were created with
+int activeAaMode;
+VkSampleCountFlagBits sceneSamples;
+// With TAA the first subpass also writes the screen space motion of every pixel into velocityBuffers. The UI has a
+// single color output, it moves to the post process subpass then
+bool sceneVelocity;
+#define VELOCITY_FORMAT VK_FORMAT_R16G16_SFLOAT
+std::vector<VulkanImage> velocityBuffers;
+#define AA_GROUP_SIZE 8
+std::vector<VulkanImage> aaInputBuffers;
+VulkanPipeline fxaaPipeline;
+VulkanPipeline taaPipeline;
+VkDescriptorSetLayout aaDescriptorSetLayout;
+VkDescriptorPool aaDescriptorPool;
+std::vector<VkDescriptorSet> aaDescriptorSets;
+// TAA offsets the projection by a different subpixel jitter every frame and blends the frames into a history. The history
+// is reprojected with the motion vectors of the scene, one image is read while the other is written
+#define TAA_JITTER_PHASES 8
+float taaFeedback = 0.9f;
+VulkanImage taaHistoryBuffers[2];
+uint32_t taaHistoryIndex = 0;
+bool taaHistoryValid = false;
+// Jitter in NDC and the view projection without it, of this and the previous frame
+glm::vec2 taaJitter;
+glm::mat4 taaViewProj;
+glm::mat4 taaPreviousViewProj;
+glm::vec2 taaPreviousUvScale;
+// Matches the push constants of taa_comp.glsl
+struct TaaConstants {
+	glm::mat4 reprojection;
+	glm::vec2 jitter;
+	glm::vec2 historyUvScale;
+	int32_t size[2];
+	float feedback;
+	uint32_t historyValid;
+};
+
+// How passes are begun. The legacy path has a framebuffer per swapchain image for every pass. Imageless framebuffers only
+// fix the size, usage and format of the attachments, so one per pass serves all images. Dynamic rendering begins the
+// single subpass passes from image views without render pass or framebuffer objects and creates their pipelines against
+// formats. The scene pass keeps its render pass for the post process subpass and the UI renderer. Set with --rendering
+// and lowered to what the device supports
+enum RenderingPath {
+	RENDERING_PATH_LEGACY,
+	RENDERING_PATH_IMAGELESS,
+	RENDERING_PATH_DYNAMIC,
+};
+const char* renderingPathNames[] = {"legacy", "imageless", "dynamic"};
+int renderingPath = RENDERING_PATH_DYNAMIC;
+bool useDynamicRendering;
+bool useImagelessFramebuffers;
+// Imageless framebuffers need the exact usage of the swapchain images
+VkImageUsageFlags swapchainUsage;
+
+#define DUAL_FILTER_MAX_LEVELS 6
+enum BlurMode {
+	BLUR_MODE_GAUSS,
+	BLUR_MODE_DUAL_FILTER,
+};
+int blurMode = BLUR_MODE_GAUSS;
+int dualFilterLevels = 4;
+float dualFilterOffset = 1.0f;
+uint32_t blurPyramidLevels;
+VulkanPipeline dualFilterPipelineDown;
+VulkanPipeline dualFilterPipelineUp;
+VkDescriptorPool dualFilterDescriptorPool;
+// DUAL_FILTER_MAX_LEVELS * 2 per frame
+std::vector<VkDescriptorSet> dualFilterDescriptorSets;
+
+#define COMPUTE_GROUP_SIZE 64
+uint32_t computeBlurRadii[] = {2, 4, 8, 16, 32};
+uint32_t computeRadiusIndex = 1;
+std::vector<uint32_t> computeRadiusPerFrame;
+VulkanPipeline computePipelinesHorizontal[ARRAY_COUNT(computeBlurRadii)];
+VulkanPipeline computePipelinesVertical[ARRAY_COUNT(computeBlurRadii)];
 VkDescriptorSetLayout computeDescriptorSetLayout;
-VkDescriptorSet computeDescriptorSets[FRAMES_IN_FLIGHT];
+std::vector<VkDescriptorSet> computeDescriptorSetsHorizontal;
+std::vector<VkDescriptorSet> computeDescriptorSetsVertical;
+
+// Steps through a set of configurations and averages a GPU time for each of them
+#define BENCHMARK_FRAMES 256
+#define BENCHMARK_MAX_STEPS 8
+struct GpuBenchmark {
+	bool running;
+	uint32_t step;
+	uint32_t stepCount;
+	uint32_t frameCount;
+	double accumulatedTime;
+	double results[BENCHMARK_MAX_STEPS];
+};
+// Sweeps all compute blur radii
+GpuBenchmark computeBenchmark;
+// Step 0 is the gaussian blur, step n the dual filter with n levels
+GpuBenchmark blurBenchmark;
+std::vector<uint32_t> blurStepPerFrame;
 
-VkQueryPool timestampQueryPools[FRAMES_IN_FLIGHT];
+VulkanPipeline postprocessPipeline;
+VkDescriptorSetLayout postprocessDescriptorSetLayout;
+VkDescriptorPool postprocessDescriptorPool;
+std::vector<VkDescriptorSet> postprocessDescriptorSets;
+struct PostprocessSettings {
+	float exposure;
+	float contrast;
+	float saturation;
+} postprocessSettings = {1.0f, 1.0f, 1.0f};
+
+GpuProfiler gpuProfiler;
+bool showProfiler = true;
+bool showCpuProfiler = true;
 
 VkDescriptorPool imguiDescriptorPool;
 
+#define CAMERA_NEAR 0.01f
+#define CAMERA_FOVY 45.0f
 struct Camera {
 	glm::vec3 cameraPosition;
 	glm::vec3 cameraDirection;
@@ -84,6 +461,10 @@ struct Camera {
 } camera;
 
 bool handleMessage() {
+	PROFILE_ZONE("handleMessage");
+	if(headless) {
+		return true;
+	}
 	ImGuiIO& io = ImGui::GetIO();
 
 	SDL_Event event;
@@ -97,102 +478,420 @@ bool handleMessage() {
 			if(event.key.keysym.scancode == SDL_SCANCODE_ESCAPE && !io.WantCaptureKeyboard) {
 				SDL_SetRelativeMouseMode(SDL_FALSE);
 			}
+			break;
 		case SDL_MOUSEBUTTONDOWN:
 			if(event.button.button == SDL_BUTTON_LEFT && !io.WantCaptureMouse) {
 				SDL_SetRelativeMouseMode(SDL_TRUE);
 			}
+			if(event.button.button == SDL_BUTTON_RIGHT && !io.WantCaptureMouse) {
+				pickRequested = true;
+				pickPosition = SDL_GetRelativeMouseMode() ? glm::vec2(swapchain.width, swapchain.height) * 0.5f : glm::vec2(event.button.x, event.button.y);
+			}
 			break;
 		}
 	}
 	return true;
 }
 
-void recreateRenderPass() {
-	if(renderPass) {
-		for (uint32_t i = 0; i < sceneFramebuffers.size(); ++i) {
-			VK(vkDestroyFramebuffer(context->device, sceneFramebuffers[i], 0));
-		}
-		for (uint32_t i = 0; i < sceneFramebuffers.size(); ++i) {
-			VK(vkDestroyFramebuffer(context->device, gaussFramebuffers[i], 0));
-		}
-		for (uint32_t i = 0; i < sceneFramebuffers.size(); ++i) {
-			VK(vkDestroyFramebuffer(context->device, swapchainFramebuffers[i], 0));
-		}
-		for(uint32_t i = 0; i < depthBuffers.size(); ++i) {
-			destroyImage(context, &depthBuffers[i]);
-		}
-		for(uint32_t i = 0; i < colorBuffers.size(); ++i) {
-			destroyImage(context, &colorBuffers[i]);
-		}
-		for(uint32_t i = 0; i < multisampleTargetBuffers.size(); ++i) {
-			destroyImage(context, &multisampleTargetBuffers[i]);
-		}
-		for(uint32_t i = 0; i < gaussBuffers.size(); ++i) {
-			destroyImage(context, &gaussBuffers[i]);
+// Subpass 0 renders the scene multisampled and resolves it. Subpass 1 applies per pixel post effects to the resolved image
+// which it reads as input attachment. Only the post processed result is stored.
+// With a single sample there is nothing to resolve, subpass 1 reads the color attachment of subpass 0 directly.
+// With velocity subpass 0 also writes the motion vectors into a fourth attachment, only at 1x.
+// With loadScene the color and depth of the early occlusion culling pass are continued instead of cleared
+VkRenderPass createSceneRenderPass(VkFormat format, VkSampleCountFlagBits sampleCount, bool velocity, bool loadScene) {
+	VkAttachmentDescription attachments[4];
+	attachments[0] = {};
+	attachments[0].format = format;
+	attachments[0].samples = sampleCount;
+	attachments[0].loadOp = loadScene ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[0].initialLayout = loadScene ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	attachments[1] = {};
+	attachments[1].format = VK_FORMAT_D32_SFLOAT;
+	attachments[1].samples = sampleCount;
+	attachments[1].loadOp = loadScene ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[1].initialLayout = loadScene ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	attachments[2] = {};
+	attachments[2].format = format;
+	attachments[2].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[2].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[2].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	attachments[3] = attachments[2];
+	attachments[3].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+	VulkanSubpass subpasses[2] = {};
+	subpasses[0].colorAttachment = 0;
+	subpasses[0].secondColorAttachment = VK_ATTACHMENT_UNUSED;
+	subpasses[0].depthAttachment = 1;
+	subpasses[0].resolveAttachment = 2;
+	subpasses[1].colorAttachment = 3;
+	subpasses[1].secondColorAttachment = VK_ATTACHMENT_UNUSED;
+	subpasses[1].depthAttachment = VK_ATTACHMENT_UNUSED;
+	subpasses[1].resolveAttachment = VK_ATTACHMENT_UNUSED;
+	subpasses[1].inputAttachmentCount = 1;
+	subpasses[1].inputAttachments[0] = 2;
+	if(sampleCount == VK_SAMPLE_COUNT_1_BIT) {
+		attachments[0].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		attachments[2] = attachments[3];
+		subpasses[0].resolveAttachment = VK_ATTACHMENT_UNUSED;
+		subpasses[1].colorAttachment = 2;
+		subpasses[1].inputAttachments[0] = 0;
+		if(velocity) {
+			// Read by TAA
+			attachments[3] = attachments[0];
+			attachments[3].format = VELOCITY_FORMAT;
+			attachments[3].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			subpasses[0].secondColorAttachment = 3;
+			return createRenderPass(context, attachments, ARRAY_COUNT(attachments), subpasses, ARRAY_COUNT(subpasses), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		}
-		destroyRenderpass(context, renderPass);
-		destroyRenderpass(context, gaussRenderPass);
-		destroyRenderpass(context, gaussRenderPassFinal);
+		return createRenderPass(context, attachments, 3, subpasses, ARRAY_COUNT(subpasses), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	}
+	return createRenderPass(context, attachments, ARRAY_COUNT(attachments), subpasses, ARRAY_COUNT(subpasses), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+// Draws the instances that were visible last frame into the multisampled color and depth of the scene pass.
+// Both are stored, the depth is reduced into the Hi-Z pyramid and the scene pass continues on both. So does it on the
+// motion vectors with velocity
+VkRenderPass createEarlySceneRenderPass(VkFormat format, VkSampleCountFlagBits sampleCount, bool velocity) {
+	VkAttachmentDescription attachments[3];
+	attachments[0] = {};
+	attachments[0].format = format;
+	attachments[0].samples = sampleCount;
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	attachments[1] = {};
+	attachments[1].format = VK_FORMAT_D32_SFLOAT;
+	attachments[1].samples = sampleCount;
+	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	attachments[2] = attachments[0];
+	attachments[2].format = VELOCITY_FORMAT;
+
+	VulkanSubpass subpass = {};
+	subpass.colorAttachment = 0;
+	subpass.secondColorAttachment = velocity ? 2 : VK_ATTACHMENT_UNUSED;
+	subpass.depthAttachment = 1;
+	subpass.resolveAttachment = VK_ATTACHMENT_UNUSED;
+	return createRenderPass(context, attachments, velocity ? 3 : 2, &subpass, 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+}
+
+// Render targets of the previous swapchain may still be used by frames in flight, they are destroyed with the deletion queue
+void retireRenderTargets() {
+	// Everything submitted so far may still use them
+	uint64_t value = context->scheduler.submittedValue;
+	for (uint32_t i = 0; i < sceneFramebuffers.size(); ++i) {
+		retireHandle(&deletionQueue, VULKAN_DELETION_FRAMEBUFFER, (uint64_t)sceneFramebuffers[i], value);
+	}
+	// None of these with dynamic rendering
+	for (uint32_t i = 0; i < earlySceneFramebuffers.size(); ++i) {
+		retireHandle(&deletionQueue, VULKAN_DELETION_FRAMEBUFFER, (uint64_t)earlySceneFramebuffers[i], value);
+		retireHandle(&deletionQueue, VULKAN_DELETION_FRAMEBUFFER, (uint64_t)gaussFramebuffers[i], value);
+		retireHandle(&deletionQueue, VULKAN_DELETION_FRAMEBUFFER, (uint64_t)swapchainFramebuffers[i], value);
+	}
+	for(uint32_t i = 0; i < blurPyramidFramebuffers.size(); ++i) {
+		retireHandle(&deletionQueue, VULKAN_DELETION_FRAMEBUFFER, (uint64_t)blurPyramidFramebuffers[i], value);
+	}
+	for(uint32_t i = 0; i < depthBuffers.size(); ++i) {
+		retireImage(&deletionQueue, &depthBuffers[i], value);
+		retireImage(&deletionQueue, &colorBuffers[i], value);
+		retireImage(&deletionQueue, &resolveBuffers[i], value);
+		retireImage(&deletionQueue, &multisampleTargetBuffers[i], value);
+		retireImage(&deletionQueue, &gaussBuffers[i], value);
+		retireImage(&deletionQueue, &computeBuffers[i], value);
+		retireImage(&deletionQueue, &aaInputBuffers[i], value);
+		retireImage(&deletionQueue, &velocityBuffers[i], value);
+	}
+	for(uint32_t i = 0; i < ARRAY_COUNT(taaHistoryBuffers); ++i) {
+		retireImage(&deletionQueue, &taaHistoryBuffers[i], value);
+	}
+	for(uint32_t i = 0; i < blurPyramidViews.size(); ++i) {
+		retireHandle(&deletionQueue, VULKAN_DELETION_IMAGE_VIEW, (uint64_t)blurPyramidViews[i], value);
 	}
+	for(uint32_t i = 0; i < blurPyramidBuffers.size(); ++i) {
+		retireImage(&deletionQueue, &blurPyramidBuffers[i], value);
+	}
+	for(uint32_t i = 0; i < hizViews.size(); ++i) {
+		retireHandle(&deletionQueue, VULKAN_DELETION_IMAGE_VIEW, (uint64_t)hizViews[i], value);
+	}
+	retireImage(&deletionQueue, &hizImage, value);
 	sceneFramebuffers.clear();
+	earlySceneFramebuffers.clear();
 	gaussFramebuffers.clear();
 	swapchainFramebuffers.clear();
 	depthBuffers.clear();
 	colorBuffers.clear();
+	resolveBuffers.clear();
 	multisampleTargetBuffers.clear();
 	gaussBuffers.clear();
+	computeBuffers.clear();
+	aaInputBuffers.clear();
+	velocityBuffers.clear();
+	blurPyramidFramebuffers.clear();
+	blurPyramidViews.clear();
+	blurPyramidBuffers.clear();
+	hizViews.clear();
+}
+
+// The render passes only depend on the swapchain format, the scene sample count and velocity, a resize keeps them.
+// With dynamic rendering only the scene pass is left
+void createRenderPasses() {
+	PROFILE_ZONE("createRenderPasses");
+	renderPass = createSceneRenderPass(swapchain.format, sceneSamples, sceneVelocity, false);
+	renderPassLoad = createSceneRenderPass(swapchain.format, sceneSamples, sceneVelocity, true);
+	if(!useDynamicRendering) {
+		earlyRenderPass = createEarlySceneRenderPass(swapchain.format, sceneSamples, sceneVelocity);
+		gaussRenderPass = createRenderPass(context, swapchain.format, VK_SAMPLE_COUNT_1_BIT, false, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		gaussRenderPassFinal = createRenderPass(context, swapchain.format, VK_SAMPLE_COUNT_1_BIT, false, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+	}
+}
+
+void retireRenderPasses() {
+	uint64_t value = context->scheduler.submittedValue;
+	retireHandle(&deletionQueue, VULKAN_DELETION_RENDER_PASS, (uint64_t)renderPass, value);
+	retireHandle(&deletionQueue, VULKAN_DELETION_RENDER_PASS, (uint64_t)renderPassLoad, value);
+	if(!useDynamicRendering) {
+		retireHandle(&deletionQueue, VULKAN_DELETION_RENDER_PASS, (uint64_t)earlyRenderPass, value);
+		retireHandle(&deletionQueue, VULKAN_DELETION_RENDER_PASS, (uint64_t)gaussRenderPass, value);
+		retireHandle(&deletionQueue, VULKAN_DELETION_RENDER_PASS, (uint64_t)gaussRenderPassFinal, value);
+	}
+	renderPass = VK_NULL_HANDLE;
+	renderPassLoad = VK_NULL_HANDLE;
+	earlyRenderPass = VK_NULL_HANDLE;
+	gaussRenderPass = VK_NULL_HANDLE;
+	gaussRenderPassFinal = VK_NULL_HANDLE;
+}
+
+// Framebuffers of the legacy path are per swapchain image, imageless ones are shared by all images
+uint32_t getFramebufferIndex(uint32_t imageIndex) {
+	return useImagelessFramebuffers ? 0 : imageIndex;
+}
+
+// Views of the scene pass attachments in render pass order. Returns their count, at 1x there is no resolve attachment
+// but the motion vectors may follow
+uint32_t getSceneAttachmentViews(uint32_t imageIndex, VkImageView* views) {
+	// The post process subpass writes the input of the anti-aliasing pass if there is one
+	VkImageView target = (activeAaMode == AA_MODE_MSAA) ? multisampleTargetBuffers[imageIndex].view : aaInputBuffers[imageIndex].view;
+	views[0] = colorBuffers[imageIndex].view;
+	views[1] = depthBuffers[imageIndex].view;
+	if(sceneSamples == VK_SAMPLE_COUNT_1_BIT) {
+		views[2] = target;
+		if(sceneVelocity) {
+			views[3] = velocityBuffers[imageIndex].view;
+			return 4;
+		}
+		return 3;
+	}
+	views[2] = resolveBuffers[imageIndex].view;
+	views[3] = target;
+	return 4;
+}
+
+// The requested MSAA sample count, lowered until the color and depth attachments and the sampled depth of the Hi-Z pass
+// support it. FXAA and TAA use a single sample
+VkSampleCountFlagBits getSceneSampleCount() {
+	if(aaMode != AA_MODE_MSAA) {
+		return VK_SAMPLE_COUNT_1_BIT;
+	}
+	VkPhysicalDeviceLimits* limits = &context->physicalDeviceProperties.limits;
+	VkSampleCountFlags supported = limits->framebufferColorSampleCounts & limits->framebufferDepthSampleCounts & limits->sampledImageDepthSampleCounts;
+	uint32_t samples = (uint32_t)msaaSamples;
+	while(samples > 1 && !(supported & samples)) {
+		samples >>= 1;
+	}
+	return (VkSampleCountFlagBits)samples;
+}
+
+// Creates the render targets for the swapchain size and the active anti-aliasing mode and sample count
+void recreateRenderTargets() {
+	PROFILE_ZONE("recreateRenderTargets");
+	if(!depthBuffers.empty()) {
+		retireRenderTargets();
+	}
 
-	renderPass = createRenderPass(context, swapchain.format, VK_SAMPLE_COUNT_4_BIT, true, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-	gaussRenderPass = createRenderPass(context, swapchain.format, VK_SAMPLE_COUNT_1_BIT, false, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-	gaussRenderPassFinal = createRenderPass(context, swapchain.format, VK_SAMPLE_COUNT_1_BIT, false, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
-	sceneFramebuffers.resize(swapchain.images.size());
-	gaussFramebuffers.resize(swapchain.images.size());
-	swapchainFramebuffers.resize(swapchain.images.size());
 	depthBuffers.resize(swapchain.images.size());
 	colorBuffers.resize(swapchain.images.size());
+	resolveBuffers.resize(swapchain.images.size());
 	multisampleTargetBuffers.resize(swapchain.images.size());
 	gaussBuffers.resize(swapchain.images.size());
+	computeBuffers.resize(swapchain.images.size());
+	aaInputBuffers.resize(swapchain.images.size());
+	velocityBuffers.resize(swapchain.images.size());
+	blurPyramidBuffers.resize(swapchain.images.size());
+
+	// The first pyramid level has half the swapchain resolution. Every further level halves it again
+	uint32_t pyramidWidth = glm::max(swapchain.width / 2, 1u);
+	uint32_t pyramidHeight = glm::max(swapchain.height / 2, 1u);
+	blurPyramidLevels = 1;
+	while(blurPyramidLevels < DUAL_FILTER_MAX_LEVELS && (glm::max(pyramidWidth, pyramidHeight) >> blurPyramidLevels) > 0) {
+		blurPyramidLevels++;
+	}
+	blurPyramidViews.resize(swapchain.images.size() * blurPyramidLevels);
+
+	// The largest power of two that fits, so every level halves exactly. Every texel of the first level covers up to 3x3 pixels
+	hizWidth = 1;
+	hizHeight = 1;
+	while(hizWidth * 2 <= swapchain.width) {
+		hizWidth *= 2;
+	}
+	while(hizHeight * 2 <= swapchain.height) {
+		hizHeight *= 2;
+	}
+	hizLevels = 1;
+	while(hizLevels < HIZ_MAX_LEVELS && (glm::max(hizWidth, hizHeight) >> hizLevels) > 0) {
+		hizLevels++;
+	}
+	createImage(context, &hizImage, hizWidth, hizHeight, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_SAMPLE_COUNT_1_BIT, hizLevels);
+	hizViews.resize(hizLevels);
+	for(uint32_t level = 0; level < hizLevels; ++level) {
+		VkImageViewCreateInfo viewCreateInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+		viewCreateInfo.image = hizImage.image;
+		viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+		viewCreateInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1};
+		VKA(vkCreateImageView(context->device, &viewCreateInfo, 0, &hizViews[level]));
+	}
 
+	// Imageless framebuffers are created from the usage, so every kind of target keeps it in one place
+	bool singleSample = sceneSamples == VK_SAMPLE_COUNT_1_BIT;
+	VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	// Stored by the early pass and read in place by the post process subpass at 1x, so it can not be transient
+	VkImageUsageFlags colorUsage = singleSample ? (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT) : (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+	VkImageUsageFlags resolveUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+	VkImageUsageFlags multisampleTargetUsage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	VkImageUsageFlags aaInputUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	VkImageUsageFlags velocityUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	VkImageUsageFlags gaussUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 	for (uint32_t i = 0; i < swapchain.images.size(); ++i) {
-		createImage(context, &depthBuffers.data()[i], swapchain.width, swapchain.height, VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_SAMPLE_COUNT_4_BIT);
-		createImage(context, &colorBuffers.data()[i], swapchain.width, swapchain.height, swapchain.format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_SAMPLE_COUNT_4_BIT);
-		createImage(context, &multisampleTargetBuffers.data()[i], swapchain.width, swapchain.height, swapchain.format, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
-		createImage(context, &gaussBuffers.data()[i], swapchain.width, swapchain.height, swapchain.format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
-		
-		VkFramebufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
-		createInfo.width = swapchain.width;
-		createInfo.height = swapchain.height;
-		createInfo.layers = 1;
-		{
-			VkImageView attachments[] = {
-				colorBuffers[i].view,
-				depthBuffers[i].view,
-				multisampleTargetBuffers[i].view,
-			};
-			createInfo.renderPass = renderPass;
-			createInfo.attachmentCount = ARRAY_COUNT(attachments);
-			createInfo.pAttachments = attachments;
-			VKA(vkCreateFramebuffer(context->device, &createInfo, 0, &sceneFramebuffers[i]));
+		createImage(context, &depthBuffers.data()[i], swapchain.width, swapchain.height, VK_FORMAT_D32_SFLOAT, depthUsage, sceneSamples);
+		createImage(context, &colorBuffers.data()[i], swapchain.width, swapchain.height, swapchain.format, colorUsage, sceneSamples);
+		if(!singleSample) {
+			createImage(context, &resolveBuffers.data()[i], swapchain.width, swapchain.height, swapchain.format, resolveUsage);
 		}
-		{
-			VkImageView attachments[] = {
-				gaussBuffers[i].view,
-			};
-			createInfo.renderPass = gaussRenderPass;
-			createInfo.attachmentCount = ARRAY_COUNT(attachments);
-			createInfo.pAttachments = attachments;
-			VKA(vkCreateFramebuffer(context->device, &createInfo, 0, &gaussFramebuffers[i]));
+		createImage(context, &multisampleTargetBuffers.data()[i], swapchain.width, swapchain.height, swapchain.format, multisampleTargetUsage);
+		if(activeAaMode != AA_MODE_MSAA) {
+			createImage(context, &aaInputBuffers.data()[i], swapchain.width, swapchain.height, swapchain.format, aaInputUsage);
 		}
-		{
-			VkImageView attachments[] = {
-				swapchain.imageViews[i],
-			};
-			createInfo.renderPass = gaussRenderPassFinal;
-			createInfo.attachmentCount = ARRAY_COUNT(attachments);
-			createInfo.pAttachments = attachments;
-			VKA(vkCreateFramebuffer(context->device, &createInfo, 0, &swapchainFramebuffers[i]));
+		if(sceneVelocity) {
+			createImage(context, &velocityBuffers.data()[i], swapchain.width, swapchain.height, VELOCITY_FORMAT, velocityUsage);
+		}
+		createImage(context, &gaussBuffers.data()[i], swapchain.width, swapchain.height, swapchain.format, gaussUsage);
+		createImage(context, &computeBuffers.data()[i], swapchain.width, swapchain.height, swapchain.format, VK_IMAGE_USAGE_STORAGE_BIT);
+		createImage(context, &blurPyramidBuffers.data()[i], pyramidWidth, pyramidHeight, swapchain.format, gaussUsage, VK_SAMPLE_COUNT_1_BIT, blurPyramidLevels);
+		for(uint32_t level = 0; level < blurPyramidLevels; ++level) {
+			VkImageViewCreateInfo viewCreateInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+			viewCreateInfo.image = blurPyramidBuffers[i].image;
+			viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewCreateInfo.format = swapchain.format;
+			viewCreateInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1};
+			VKA(vkCreateImageView(context->device, &viewCreateInfo, 0, &blurPyramidViews[i * blurPyramidLevels + level]));
+		}
+	}
+
+	uint32_t framebufferCount = useImagelessFramebuffers ? 1 : (uint32_t)swapchain.images.size();
+	sceneFramebuffers.resize(framebufferCount);
+	if(!useDynamicRendering) {
+		earlySceneFramebuffers.resize(framebufferCount);
+		gaussFramebuffers.resize(framebufferCount);
+		swapchainFramebuffers.resize(framebufferCount);
+		blurPyramidFramebuffers.resize(framebufferCount * blurPyramidLevels);
+	}
+
+	if(useImagelessFramebuffers) {
+		// Same order as getSceneAttachmentViews
+		uint32_t sceneAttachmentCount = singleSample ? 3 : 4;
+		VkFormat formats[] = {swapchain.format, VK_FORMAT_D32_SFLOAT, swapchain.format, swapchain.format};
+		VkImageUsageFlags usages[] = {colorUsage, depthUsage, resolveUsage, multisampleTargetUsage};
+		usages[sceneAttachmentCount - 1] = (activeAaMode == AA_MODE_MSAA) ? multisampleTargetUsage : aaInputUsage;
+		if(sceneVelocity) {
+			formats[3] = VELOCITY_FORMAT;
+			usages[3] = velocityUsage;
+			sceneAttachmentCount = 4;
+		}
+		sceneFramebuffers[0] = createImagelessFramebuffer(context, renderPass, swapchain.width, swapchain.height, sceneAttachmentCount, formats, usages);
+		if(!useDynamicRendering) {
+			// Color, depth and the motion vectors
+			VkFormat earlyFormats[] = {swapchain.format, VK_FORMAT_D32_SFLOAT, VELOCITY_FORMAT};
+			VkImageUsageFlags earlyUsages[] = {colorUsage, depthUsage, velocityUsage};
+			earlySceneFramebuffers[0] = createImagelessFramebuffer(context, earlyRenderPass, swapchain.width, swapchain.height, sceneVelocity ? 3 : 2, earlyFormats, earlyUsages);
+			gaussFramebuffers[0] = createImagelessFramebuffer(context, gaussRenderPass, swapchain.width, swapchain.height, 1, &swapchain.format, &gaussUsage);
+			swapchainFramebuffers[0] = createImagelessFramebuffer(context, gaussRenderPassFinal, swapchain.width, swapchain.height, 1, &swapchain.format, &swapchainUsage);
+			for(uint32_t level = 0; level < blurPyramidLevels; ++level) {
+				blurPyramidFramebuffers[level] = createImagelessFramebuffer(context, gaussRenderPass, glm::max(pyramidWidth >> level, 1u), glm::max(pyramidHeight >> level, 1u),
+																			1, &swapchain.format, &gaussUsage);
+			}
+		}
+	} else {
+		for (uint32_t i = 0; i < swapchain.images.size(); ++i) {
+			VkFramebufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
+			createInfo.width = swapchain.width;
+			createInfo.height = swapchain.height;
+			createInfo.layers = 1;
+			{
+				VkImageView attachments[4];
+				createInfo.renderPass = renderPass;
+				createInfo.attachmentCount = getSceneAttachmentViews(i, attachments);
+				createInfo.pAttachments = attachments;
+				VKA(vkCreateFramebuffer(context->device, &createInfo, 0, &sceneFramebuffers[i]));
+			}
+			if(useDynamicRendering) {
+				continue;
+			}
+			{
+				VkImageView attachments[] = {
+					colorBuffers[i].view,
+					depthBuffers[i].view,
+					velocityBuffers[i].view,
+				};
+				createInfo.renderPass = earlyRenderPass;
+				createInfo.attachmentCount = sceneVelocity ? 3 : 2;
+				createInfo.pAttachments = attachments;
+				VKA(vkCreateFramebuffer(context->device, &createInfo, 0, &earlySceneFramebuffers[i]));
+			}
+			{
+				VkImageView attachments[] = {
+					gaussBuffers[i].view,
+				};
+				createInfo.renderPass = gaussRenderPass;
+				createInfo.attachmentCount = ARRAY_COUNT(attachments);
+				createInfo.pAttachments = attachments;
+				VKA(vkCreateFramebuffer(context->device, &createInfo, 0, &gaussFramebuffers[i]));
+			}
+			{
+				VkImageView attachments[] = {
+					swapchain.imageViews[i],
+				};
+				createInfo.renderPass = gaussRenderPassFinal;
+				createInfo.attachmentCount = ARRAY_COUNT(attachments);
+				createInfo.pAttachments = attachments;
+				VKA(vkCreateFramebuffer(context->device, &createInfo, 0, &swapchainFramebuffers[i]));
+			}
+			for(uint32_t level = 0; level < blurPyramidLevels; ++level) {
+				uint32_t index = i * blurPyramidLevels + level;
+				createInfo.width = glm::max(pyramidWidth >> level, 1u);
+				createInfo.height = glm::max(pyramidHeight >> level, 1u);
+				createInfo.renderPass = gaussRenderPass;
+				createInfo.attachmentCount = 1;
+				createInfo.pAttachments = &blurPyramidViews[index];
+				VKA(vkCreateFramebuffer(context->device, &createInfo, 0, &blurPyramidFramebuffers[index]));
+			}
+		}
+	}
+
+	if(activeAaMode == AA_MODE_TAA) {
+		for(uint32_t i = 0; i < ARRAY_COUNT(taaHistoryBuffers); ++i) {
+			createImage(context, &taaHistoryBuffers[i], swapchain.width, swapchain.height, swapchain.format, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
 		}
 	}
+	taaHistoryValid = false;
 }
 
 float vertexData[] = {
@@ -218,31 +917,389 @@ uint32_t indexData[] = {
 	3, 0, 2,
 };
 
+// Instances fill rows along the view direction with the columns centered. Two instances are at z 2 and 5
+glm::vec3 getInstancePosition(uint32_t instance) {
+	uint32_t rowLength = (uint32_t)ceilf(sqrtf((float)sceneInstanceCount));
+	uint32_t rowCount = (sceneInstanceCount + rowLength - 1) / rowLength;
+	float x = ((float)(instance / rowLength) - (rowCount - 1) * 0.5f) * SCENE_GRID_SPACING;
+	float z = 2.0f + (instance % rowLength) * SCENE_GRID_SPACING;
+	return glm::vec3(x, 0.0f, z);
+}
+
+Aabb getInstanceBounds(uint32_t instance, uint32_t model) {
+	return transformAabb(models[model].bounds, getEntityWorldMatrix(&scene, sceneInstances.entities[instance]));
+}
+
+// Every instance is a root entity that carries its grid position, the scale and the animation. The nodes of its model
+// are added below it by addModelToScene once the model is resident
+void createScene() {
+	initScene(&scene);
+	sceneRoots.resize(sceneInstanceCount);
+	// Every fourth instance along the view direction becomes part of a wall with --occluders
+	uint32_t rowLength = (uint32_t)ceilf(sqrtf((float)sceneInstanceCount));
+	for(uint32_t i = 0; i < sceneInstanceCount; ++i) {
+		float scale = (occluderScene && (i % rowLength) % 4 == 0) ? 400.0f : 100.0f;
+		sceneRoots[i] = createEntity(&scene, SCENE_NO_PARENT, SCENE_NO_MODEL, getInstancePosition(i), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(scale));
+	}
+	collectSceneInstances(&scene, modelCount, &sceneInstances);
+}
+
+// Renderable entities are only created here. The instances are collected again and the BVH is rebuilt for their new indices
+void addModelToScene(uint32_t model) {
+	PROFILE_ZONE("addModelToScene");
+	for(uint32_t i = model; i < sceneRoots.size(); i += modelCount) {
+		instantiateNodes(&scene, models[model].nodes.data(), (uint32_t)models[model].nodes.size(), sceneRoots[i], model);
+	}
+	updateScene(&scene);
+	collectSceneInstances(&scene, modelCount, &sceneInstances);
+	sceneInstancesVersion++;
+	pickedInstance = BVH_NO_ITEM;
+
+	uint64_t beginTime = cpuProfilerNow();
+	std::vector<Aabb> bounds(sceneInstances.entities.size());
+	for(uint32_t m = 0; m < modelCount; ++m) {
+		for(uint32_t i = sceneInstances.modelOffsets[m]; i < sceneInstances.modelOffsets[m + 1]; ++i) {
+			bounds[i] = getInstanceBounds(i, m);
+		}
+	}
+	buildBvh(&sceneBvh, bounds.data(), (uint32_t)bounds.size());
+	LOG_INFO("Scene BVH with ", sceneBvh.nodes.size(), " nodes for ", bounds.size(), " instances built in ", (cpuProfilerNow() - beginTime) * 1e-6, "ms");
+}
+
+// Takes the models of loads that finished into the scene
+void addLoadedModels(std::vector<ModelHandle>& finished) {
+	for(uint32_t i = 0; i < finished.size(); ++i) {
+		uint32_t m = 0;
+		while(modelHandles[m] != finished[i]) {
+			m++;
+		}
+		if(getModelLoadState(&modelLoader, finished[i]) != MODEL_LOAD_RESIDENT) {
+			LOG_WARN("Could not load ", modelFilenames[m], ", its instances stay empty");
+			continue;
+		}
+		models[m] = std::move(*getLoadedModel(&modelLoader, finished[i]));
+		modelResident[m] = true;
+		addModelToScene(m);
+	}
+	if(!finished.empty() && !modelLoader.pendingCount) {
+		modelsLoadedTime = cpuProfilerNow();
+		LOG_INFO("All models loaded ", (modelsLoadedTime - startTime) * 1e-6, "ms after start");
+	}
+}
+
+float randomFloat(uint32_t* state) {
+	// xorshift32
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return (*state & 0xFFFFFF) / (float)0x1000000;
+}
+
+// Radical inverse of index in the given base, a low discrepancy sequence in [0, 1)
+float halton(uint32_t index, uint32_t base) {
+	float result = 0.0f;
+	float fraction = 1.0f;
+	while(index > 0) {
+		fraction /= base;
+		result += fraction * (index % base);
+		index /= base;
+	}
+	return result;
+}
+
+// Scattered over the instance grid with a fixed seed, so every run sees the same lights
+void createLights() {
+	uint32_t rowLength = (uint32_t)ceilf(sqrtf((float)sceneInstanceCount));
+	uint32_t rowCount = (sceneInstanceCount + rowLength - 1) / rowLength;
+	glm::vec3 areaMin(-(rowCount * 0.5f + 1.0f) * SCENE_GRID_SPACING, 0.2f, 2.0f - SCENE_GRID_SPACING);
+	glm::vec3 areaSize((rowCount + 2) * SCENE_GRID_SPACING, 3.0f, (rowLength + 2) * SCENE_GRID_SPACING);
+	uint32_t state = 1;
+	sceneLights.resize(MAX_LIGHTS);
+	for(uint32_t i = 0; i < MAX_LIGHTS; ++i) {
+		glm::vec3 position = areaMin + glm::vec3(randomFloat(&state), randomFloat(&state), randomFloat(&state)) * areaSize;
+		float radius = 2.0f + randomFloat(&state) * 4.0f;
+		glm::vec3 color = glm::vec3(randomFloat(&state), randomFloat(&state), randomFloat(&state)) * 4.0f;
+		sceneLights[i].positionRadius = glm::vec4(position, radius);
+		sceneLights[i].color = glm::vec4(color, 1.0f);
+	}
+}
+
+// Everything that is drawn in the scene pass depends on its sample count and is rebuilt when it changes
+void createScenePipelines() {
+	VkVertexInputAttributeDescription vertexAttributeDescriptions[3] = {};
+	vertexAttributeDescriptions[0].binding = 0;
+	vertexAttributeDescriptions[0].location = 0;
+	vertexAttributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+	vertexAttributeDescriptions[0].offset = 0;
+	vertexAttributeDescriptions[1].binding = 0;
+	vertexAttributeDescriptions[1].location = 1;
+	vertexAttributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+	vertexAttributeDescriptions[1].offset = sizeof(float) * 2;
+	vertexAttributeDescriptions[2].binding = 0;
+	vertexAttributeDescriptions[2].location = 2;
+	vertexAttributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
+	vertexAttributeDescriptions[2].offset = sizeof(float) * 5;
+	VkVertexInputBindingDescription vertexInputBinding = {};
+	vertexInputBinding.binding = 0;
+	vertexInputBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	vertexInputBinding.stride = sizeof(float) * 7;
+	// Everything in the first subpass also writes the motion vectors with velocity
+	VulkanPipelineState sceneState = getDefaultPipelineState();
+	sceneState.secondColorFormat = sceneVelocity ? VELOCITY_FORMAT : VK_FORMAT_UNDEFINED;
+	spritePipeline = createPipeline(context, "../shaders/texture_vert.spv", "../shaders/texture_frag.spv", renderPass, swapchain.width, swapchain.height, 
+									vertexAttributeDescriptions, ARRAY_COUNT(vertexAttributeDescriptions), &vertexInputBinding, 1, &spriteDescriptorLayout, 0, 0, sceneSamples, 0, pipelineCache, &sceneState);
+
+
+	VkVertexInputAttributeDescription modelAttributeDescriptions[3] = {};
+	modelAttributeDescriptions[0].binding = 0;
+	modelAttributeDescriptions[0].location = 0;
+	modelAttributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+	modelAttributeDescriptions[0].offset = 0;
+	modelAttributeDescriptions[1].binding = 0;
+	modelAttributeDescriptions[1].location = 1;
+	modelAttributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+	modelAttributeDescriptions[1].offset = sizeof(float) * 3;
+	modelAttributeDescriptions[2].binding = 0;
+	modelAttributeDescriptions[2].location = 2;
+	modelAttributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
+	modelAttributeDescriptions[2].offset = sizeof(float) * 6;
+	VkVertexInputBindingDescription modelInputBinding = {};
+	modelInputBinding.binding = 0;
+	modelInputBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	modelInputBinding.stride = sizeof(float) * 8;
+	// The depth only pipelines below get along without the lights
+	VkDescriptorSetLayout modelSetLayouts[] = {modelDescriptorSetLayout, lightingDescriptorSetLayout};
+	modelPipeline = createPipeline(context, "../shaders/model_vert.spv", "../shaders/model_frag.spv", renderPass, swapchain.width, swapchain.height,
+									modelAttributeDescriptions, ARRAY_COUNT(modelAttributeDescriptions), &modelInputBinding, ARRAY_COUNT(modelSetLayouts), modelSetLayouts, 0, 0, sceneSamples, 0, pipelineCache, &sceneState);
+	// The early pass has a single subpass and is not compatible with the scene pass. With dynamic rendering it has no render pass,
+	// its pipelines are created against the attachment formats
+	VkRenderPass earlyPass = useDynamicRendering ? VK_NULL_HANDLE : earlyRenderPass;
+	VulkanPipelineState earlyState = sceneState;
+	earlyState.colorFormat = swapchain.format;
+	earlyState.depthFormat = VK_FORMAT_D32_SFLOAT;
+	modelPipelineEarly = createPipeline(context, "../shaders/model_vert.spv", "../shaders/model_frag.spv", earlyPass, swapchain.width, swapchain.height,
+										modelAttributeDescriptions, ARRAY_COUNT(modelAttributeDescriptions), &modelInputBinding, ARRAY_COUNT(modelSetLayouts), modelSetLayouts, 0, 0, sceneSamples, 0, pipelineCache, &earlyState);
+
+	// Depth prepass
+	{
+		VulkanPipelineState equalState = earlyState;
+		equalState.depthStencil.depthWriteEnable = VK_FALSE;
+		equalState.depthStencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+		modelPipelineEqual = createPipeline(context, "../shaders/model_vert.spv", "../shaders/model_frag.spv", renderPass, swapchain.width, swapchain.height,
+											modelAttributeDescriptions, ARRAY_COUNT(modelAttributeDescriptions), &modelInputBinding, ARRAY_COUNT(modelSetLayouts), modelSetLayouts, 0, 0, sceneSamples, 0, pipelineCache, &equalState);
+		modelPipelineEqualEarly = createPipeline(context, "../shaders/model_vert.spv", "../shaders/model_frag.spv", earlyPass, swapchain.width, swapchain.height,
+												 modelAttributeDescriptions, ARRAY_COUNT(modelAttributeDescriptions), &modelInputBinding, ARRAY_COUNT(modelSetLayouts), modelSetLayouts, 0, 0, sceneSamples, 0, pipelineCache, &equalState);
+
+		VulkanPipelineState depthOnlyState = earlyState;
+		depthOnlyState.colorBlend.blendEnable = VK_FALSE;
+		depthOnlyState.colorBlend.colorWriteMask = 0;
+		VkVertexInputAttributeDescription positionAttribute = {};
+		positionAttribute.binding = 0;
+		positionAttribute.location = 0;
+		positionAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+		positionAttribute.offset = 0;
+		VkVertexInputBindingDescription positionInputBinding = {};
+		positionInputBinding.binding = 0;
+		positionInputBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		positionInputBinding.stride = sizeof(float) * 3;
+		depthPrepassPipeline = createPipeline(context, "../shaders/model_depth_vert.spv", 0, renderPass, swapchain.width, swapchain.height,
+											  &positionAttribute, 1, &positionInputBinding, 1, &modelDescriptorSetLayout, 0, 0, sceneSamples, 0, pipelineCache, &depthOnlyState);
+		depthPrepassPipelineEarly = createPipeline(context, "../shaders/model_depth_vert.spv", 0, earlyPass, swapchain.width, swapchain.height,
+												   &positionAttribute, 1, &positionInputBinding, 1, &modelDescriptorSetLayout, 0, 0, sceneSamples, 0, pipelineCache, &depthOnlyState);
+	}
+
+	{
+		VkPushConstantRange postprocessPushConstants = {};
+		postprocessPushConstants.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		postprocessPushConstants.offset = 0;
+		postprocessPushConstants.size = sizeof(PostprocessSettings);
+		postprocessPipeline = createPipeline(context, "../shaders/postprocess_vert.spv", "../shaders/postprocess_frag.spv", renderPass, swapchain.width, swapchain.height,
+											 0, 0, 0, 1, &postprocessDescriptorSetLayout, &postprocessPushConstants, 1, VK_SAMPLE_COUNT_1_BIT, 0, pipelineCache);
+	}
+}
+
+void destroyScenePipelines() {
+	destroyPipeline(context, &spritePipeline);
+	destroyPipeline(context, &modelPipeline);
+	destroyPipeline(context, &modelPipelineEarly);
+	destroyPipeline(context, &modelPipelineEqual);
+	destroyPipeline(context, &modelPipelineEqualEarly);
+	destroyPipeline(context, &depthPrepassPipeline);
+	destroyPipeline(context, &depthPrepassPipelineEarly);
+	destroyPipeline(context, &postprocessPipeline);
+}
+
+// The UI is drawn in the first subpass of the scene pass, or in the second one with velocity. So it has to be recreated
+// when the sample count or velocity changes
+void initImGuiVulkan() {
+	ImGui_ImplVulkan_InitInfo initInfo = {};
+	initInfo.Instance = context->instance;
+	initInfo.PhysicalDevice = context->physicalDevice;
+	initInfo.Device = context->device;
+	initInfo.QueueFamily = context->graphicsQueue.familyIndex;
+	initInfo.Queue = context->graphicsQueue.queue;
+	initInfo.DescriptorPool = imguiDescriptorPool;
+	initInfo.MinImageCount = 2;
+	// ImGui cycles through its buffers independent of the swapchain, so it needs one per frame in flight
+	initInfo.ImageCount = glm::max((uint32_t)swapchain.images.size(), framesInFlight);
+	initInfo.MSAASamples = sceneVelocity ? VK_SAMPLE_COUNT_1_BIT : sceneSamples;
+	initInfo.Subpass = sceneVelocity ? 1 : 0;
+	ImGui_ImplVulkan_Init(&initInfo, renderPass);
+	// Upload Fonts
+    {
+        // Use any command queue
+        VkCommandPool commandPool = commandPools[0];
+        VkCommandBuffer commandBuffer = commandBuffers[0];
+
+        VKA(vkResetCommandPool(context->device, commandPool, 0));
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VKA(vkBeginCommandBuffer(commandBuffer, &begin_info));
+
+        ImGui_ImplVulkan_CreateFontsTexture(commandBuffer);
+
+		VKA(vkEndCommandBuffer(commandBuffer));
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        VKA(vkQueueSubmit(context->graphicsQueue.queue, 1, &submitInfo, VK_NULL_HANDLE));
+
+        VKA(vkDeviceWaitIdle(context->device));
+        ImGui_ImplVulkan_DestroyFontUploadObjects();
+    }
+}
+
+// Rebuilds the render targets if the anti-aliasing mode or the sample count changed. Has to run before the UI of the
+// frame is built, as the UI renderer and its font texture are recreated with the sample count and velocity
+void applyAntiAliasingMode() {
+	VkSampleCountFlagBits samples = getSceneSampleCount();
+	if(aaMode == activeAaMode && samples == sceneSamples) {
+		return;
+	}
+	PROFILE_ZONE("applyAntiAliasingMode");
+	activeAaMode = aaMode;
+	bool velocity = activeAaMode == AA_MODE_TAA;
+	if(samples != sceneSamples || velocity != sceneVelocity) {
+		// The UI renderer can only be replaced while the device is idle, so the pipelines are destroyed right away
+		VKA(vkDeviceWaitIdle(context->device));
+		sceneSamples = samples;
+		sceneVelocity = velocity;
+		destroyScenePipelines();
+		ImGui_ImplVulkan_Shutdown();
+		retireRenderPasses();
+		createRenderPasses();
+		recreateRenderTargets();
+		createScenePipelines();
+		initImGuiVulkan();
+	} else {
+		recreateRenderTargets();
+	}
+	LOG_INFO("Anti-aliasing ", aaModeNames[activeAaMode], " with ", (uint32_t)sceneSamples, " samples");
+}
+
 void initApplication(SDL_Window* window) {
+	PROFILE_ZONE("initApplication");
 	const char* additionalInstanceExtensions[] = {
 		VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
 		VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME,
+		// Required by VK_EXT_calibrated_timestamps on Vulkan 1.0
+		VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
 	};
-	uint32_t instanceExtensionCount;
-	SDL_Vulkan_GetInstanceExtensions(window, &instanceExtensionCount, 0);
+	uint32_t instanceExtensionCount = 0;
+	if(window) {
+		SDL_Vulkan_GetInstanceExtensions(window, &instanceExtensionCount, 0);
+	}
 	const char** enabledInstanceExtensions = new const char* [instanceExtensionCount + ARRAY_COUNT(additionalInstanceExtensions)];
-	SDL_Vulkan_GetInstanceExtensions(window, &instanceExtensionCount, enabledInstanceExtensions);
+	if(window) {
+		SDL_Vulkan_GetInstanceExtensions(window, &instanceExtensionCount, enabledInstanceExtensions);
+	}
 	for (uint32_t i = 0; i < ARRAY_COUNT(additionalInstanceExtensions); ++i) {
 		enabledInstanceExtensions[instanceExtensionCount++] = additionalInstanceExtensions[i];
 	}
 
+	// Also enabled in headless mode, the offscreen images end up in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR like the real ones
 	const char* enabledDeviceExtensions[]{ VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 	context = initVulkan(instanceExtensionCount, enabledInstanceExtensions, ARRAY_COUNT(enabledDeviceExtensions), enabledDeviceExtensions);
+	delete[] enabledInstanceExtensions;
 	
-	SDL_Vulkan_CreateSurface(window, context->instance, &surface);
-	swapchain = createSwapchain(context, surface, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
+	if(window) {
+		SDL_Vulkan_CreateSurface(window, context->instance, &surface);
+		swapchainUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+		swapchain = createSwapchain(context, surface, swapchainUsage, 0, requestedPresentMode, requestedImageCount);
+	} else {
+		// Round robin reuse is only safe with at least as many images as frames in flight
+		swapchainUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		swapchain = createOffscreenSwapchain(context, headlessWidth, headlessHeight, swapchainUsage, glm::max(requestedImageCount, framesInFlight));
+	}
+
+	commandPools.resize(framesInFlight);
+	commandBuffers.resize(framesInFlight);
+	frameValues.resize(framesInFlight);
+	acquireSemaphores.resize(framesInFlight);
+	releaseSemaphores.resize(framesInFlight);
+	asyncComputePerFrame.resize(framesInFlight);
+	renderScalePerFrame.resize(framesInFlight, 1.0f);
+	initResolutionScaler(&resolutionScaler, gpuBudgetMs, MIN_RENDER_SCALE, 1.0f);
+	computeCommandPools.resize(framesInFlight);
+	computeCommandBuffers.resize(framesInFlight);
+	graphicsDoneSemaphores.resize(framesInFlight);
+	modelDescriptorSets.resize(framesInFlight * MAX_SCENE_MODELS);
+	modelTextureGenerations.resize(framesInFlight * MAX_SCENE_MODELS, MODEL_DESCRIPTORS_STALE);
+	lightBuffers.resize(framesInFlight);
+	mappedLightBuffers.resize(framesInFlight);
+	lightingDescriptorSets.resize(framesInFlight);
+	instanceBuffers.resize(framesInFlight);
+	instanceBufferCapacities.resize(framesInFlight);
+	occlusionCullingPerFrame.resize(framesInFlight);
+	occlusionStatsBuffers.resize(framesInFlight);
+	occlusionCullDescriptorSets.resize(framesInFlight);
+	hizDescriptorSets.resize(framesInFlight * HIZ_MAX_LEVELS);
+	gaussDescriptorSetsVertical.resize(framesInFlight);
+	gaussDescriptorSetsHorizontal.resize(framesInFlight);
+	dualFilterDescriptorSets.resize(framesInFlight * DUAL_FILTER_MAX_LEVELS * 2);
+	computeRadiusPerFrame.resize(framesInFlight);
+	computeDescriptorSetsHorizontal.resize(framesInFlight);
+	computeDescriptorSetsVertical.resize(framesInFlight);
+	blurStepPerFrame.resize(framesInFlight);
+	postprocessDescriptorSets.resize(framesInFlight);
+	aaDescriptorSets.resize(framesInFlight);
+	inputTimePerFrame.resize(framesInFlight);
 
 	pipelineCache = createPipelineCache(context, "../shaders/pipeline_cache.bin");
 
-	recreateRenderPass();
+	activeAaMode = aaMode;
+	sceneSamples = getSceneSampleCount();
+	sceneVelocity = activeAaMode == AA_MODE_TAA;
+	if(renderingPath == RENDERING_PATH_DYNAMIC && !context->capabilities.dynamicRendering) {
+		LOG_WARN("Dynamic rendering not supported, using imageless framebuffers");
+		renderingPath = RENDERING_PATH_IMAGELESS;
+	}
+	if(renderingPath == RENDERING_PATH_IMAGELESS && !context->capabilities.imagelessFramebuffer) {
+		LOG_WARN("Imageless framebuffers not supported, using the legacy render passes");
+		renderingPath = RENDERING_PATH_LEGACY;
+	}
+	useDynamicRendering = renderingPath == RENDERING_PATH_DYNAMIC;
+	// The scene pass of the dynamic path still needs a framebuffer
+	useImagelessFramebuffers = renderingPath != RENDERING_PATH_LEGACY && context->capabilities.imagelessFramebuffer;
+	uint64_t renderTargetsBeginTime = cpuProfilerNow();
+	createRenderPasses();
+	recreateRenderTargets();
+	LOG_INFO("Rendering path ", renderingPathNames[renderingPath], ", render passes and targets created in ", (cpuProfilerNow() - renderTargetsBeginTime) * 1e-6, "ms");
 
-	//model = createModel(context, "../data/models/monkey.glb");
-	model = createModel(context, "../libs/glTF-Sample-Models/2.0/BoomBox/glTF-Binary/BoomBox.glb");
+	createModelLoader(context, &modelLoader, modelLoaderWorkerCount);
+	for(uint32_t i = 0; i < modelCount; ++i) {
+		modelHandles[i] = loadModelAsync(&modelLoader, modelFilenames[i]);
+	}
+	createScene();
+	if(syncModelLoading) {
+		std::vector<ModelHandle> finished;
+		finishModelLoads(&modelLoader, &finished);
+		addLoadedModels(finished);
+	}
+	createLights();
 
 	{
 		VkSamplerCreateInfo createInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
@@ -274,6 +1331,23 @@ void initApplication(SDL_Window* window) {
 		VKA(vkCreateSampler(context->device, &createInfo, 0, &linearSampler));
 	}
 
+	{
+		VkSamplerCreateInfo createInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+		createInfo.magFilter = VK_FILTER_LINEAR;
+		createInfo.minFilter = VK_FILTER_LINEAR;
+		createInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		createInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		createInfo.addressModeV = createInfo.addressModeU;
+		createInfo.addressModeW = createInfo.addressModeU;
+		createInfo.anisotropyEnable = context->capabilities.samplerAnisotropy;
+		createInfo.maxAnisotropy = context->capabilities.samplerAnisotropy ? glm::min(8.0f, context->physicalDeviceProperties.limits.maxSamplerAnisotropy) : 1.0f;
+		// Every texture image starts at its finest resident level, so no clamp is needed for streaming
+		createInfo.minLod = 0.0f;
+		createInfo.maxLod = VK_LOD_CLAMP_NONE;
+		VKA(vkCreateSampler(context->device, &createInfo, 0, &textureSampler));
+	}
+	textureStreamer.budgetBytes = (uint64_t)textureBudgetMb << 20;
+
 	{
 		int width, height, channels;
 		uint8_t* data = stbi_load("../data/images/logo.png", &width, &height, &channels, 4);
@@ -324,103 +1398,241 @@ void initApplication(SDL_Window* window) {
 
 	{
 		VkDescriptorPoolSize poolSizes[] = {
-			{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, FRAMES_IN_FLIGHT},
-			{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, FRAMES_IN_FLIGHT},
-			{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, FRAMES_IN_FLIGHT * 2},
+			{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, framesInFlight * MAX_SCENE_MODELS},
+			{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, framesInFlight * MAX_SCENE_MODELS},
+			{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, framesInFlight * 4},
 		};
 		VkDescriptorPoolCreateInfo createInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
-		createInfo.maxSets = FRAMES_IN_FLIGHT * 2;
+		createInfo.maxSets = framesInFlight * (MAX_SCENE_MODELS + 2);
 		createInfo.poolSizeCount = ARRAY_COUNT(poolSizes);
 		createInfo.pPoolSizes = poolSizes;
 		VKA(vkCreateDescriptorPool(context->device, &createInfo, 0, &modelDescriptorPool));
 	}
-	for(uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
-		uint64_t minUniformAlignment = context->physicalDeviceProperties.limits.minUniformBufferOffsetAlignment;
-		singleElementSize = ALIGN_UP_POW2(sizeof(glm::mat4)*2, minUniformAlignment);
-		createBuffer(context, &modelUniformBuffers[i], singleElementSize*2, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	}
 	{
 		VkDescriptorSetLayoutBinding bindings[] = {
-			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT, 0},
-			{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, &sampler},
+			{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, 0},
+			{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, &textureSampler},
 		};
 		VkDescriptorSetLayoutCreateInfo createInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
 		createInfo.bindingCount = ARRAY_COUNT(bindings);
 		createInfo.pBindings = bindings;
 		VKA(vkCreateDescriptorSetLayout(context->device, &createInfo, 0, &modelDescriptorSetLayout));
 
-		for(uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		// Written by updateModelDescriptors once the model is resident
+		for(uint32_t i = 0; i < framesInFlight * modelCount; ++i) {
+			uint32_t frame = i / modelCount;
+			uint32_t modelIndex = i % modelCount;
 			VkDescriptorSetAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
 			allocateInfo.descriptorPool = modelDescriptorPool;
 			allocateInfo.descriptorSetCount = 1;
 			allocateInfo.pSetLayouts = &modelDescriptorSetLayout;
-			VKA(vkAllocateDescriptorSets(context->device, &allocateInfo, &modelDescriptorSets[i]));
-
-			VkDescriptorBufferInfo bufferInfo = {modelUniformBuffers[i].buffer, 0, sizeof(glm::mat4)*2};
-			VkDescriptorImageInfo imageInfo = {sampler, model.albedoTexture.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
-			VkWriteDescriptorSet descriptorWrites[2];
-			descriptorWrites[0] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
-			descriptorWrites[0].dstSet = modelDescriptorSets[i];
-			descriptorWrites[0].dstBinding = 0;
-			descriptorWrites[0].descriptorCount = 1;
-			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-			descriptorWrites[0].pBufferInfo = &bufferInfo;
-			descriptorWrites[1] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
-			descriptorWrites[1].dstSet = modelDescriptorSets[i];
-			descriptorWrites[1].dstBinding = 1;
-			descriptorWrites[1].descriptorCount = 1;
-			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-			descriptorWrites[1].pImageInfo = &imageInfo;
-			VK(vkUpdateDescriptorSets(context->device, ARRAY_COUNT(descriptorWrites), descriptorWrites, 0, 0));
+			VKA(vkAllocateDescriptorSets(context->device, &allocateInfo, &modelDescriptorSets[frame * MAX_SCENE_MODELS + modelIndex]));
 		}
 	}
-	for(uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
-		VkQueryPoolCreateInfo createInfo = {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
-		createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
-		createInfo.queryCount = 64;
-		VKA(vkCreateQueryPool(context->device, &createInfo, 0, &timestampQueryPools[i]));
-	}
 
-	VkVertexInputAttributeDescription vertexAttributeDescriptions[3] = {};
-	vertexAttributeDescriptions[0].binding = 0;
-	vertexAttributeDescriptions[0].location = 0;
-	vertexAttributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
-	vertexAttributeDescriptions[0].offset = 0;
-	vertexAttributeDescriptions[1].binding = 0;
-	vertexAttributeDescriptions[1].location = 1;
-	vertexAttributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-	vertexAttributeDescriptions[1].offset = sizeof(float) * 2;
-	vertexAttributeDescriptions[2].binding = 0;
-	vertexAttributeDescriptions[2].location = 2;
-	vertexAttributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-	vertexAttributeDescriptions[2].offset = sizeof(float) * 5;
-	VkVertexInputBindingDescription vertexInputBinding = {};
-	vertexInputBinding.binding = 0;
-	vertexInputBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-	vertexInputBinding.stride = sizeof(float) * 7;
-	spritePipeline = createPipeline(context, "../shaders/texture_vert.spv", "../shaders/texture_frag.spv", renderPass, swapchain.width, swapchain.height, 
-									vertexAttributeDescriptions, ARRAY_COUNT(vertexAttributeDescriptions), &vertexInputBinding, 1, &spriteDescriptorLayout, 0, 0, VK_SAMPLE_COUNT_4_BIT, 0, pipelineCache);
+	// Clustered lighting
+	{
+		uint64_t lightBufferSize = sizeof(LightingParams) + sizeof(Light) * MAX_LIGHTS;
+		for(uint32_t i = 0; i < framesInFlight; ++i) {
+			createBuffer(context, &lightBuffers[i], lightBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+			VKA(vkMapMemory(context->device, lightBuffers[i].memory, 0, lightBufferSize, 0, (void**)&mappedLightBuffers[i]));
+		}
+		createBuffer(context, &clusterBuffer, sizeof(uint32_t) * CLUSTER_COUNT * (1 + MAX_LIGHTS_PER_CLUSTER), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
+		VkDescriptorSetLayoutBinding bindings[] = {
+			{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0},
+			{1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0},
+		};
+		VkDescriptorSetLayoutCreateInfo createInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+		createInfo.bindingCount = ARRAY_COUNT(bindings);
+		createInfo.pBindings = bindings;
+		VKA(vkCreateDescriptorSetLayout(context->device, &createInfo, 0, &lightingDescriptorSetLayout));
 
-	VkVertexInputAttributeDescription modelAttributeDescriptions[3] = {};
-	modelAttributeDescriptions[0].binding = 0;
-	modelAttributeDescriptions[0].location = 0;
-	modelAttributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-	modelAttributeDescriptions[0].offset = 0;
-	modelAttributeDescriptions[1].binding = 0;
-	modelAttributeDescriptions[1].location = 1;
-	modelAttributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-	modelAttributeDescriptions[1].offset = sizeof(float) * 3;
-	modelAttributeDescriptions[2].binding = 0;
-	modelAttributeDescriptions[2].location = 2;
-	modelAttributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-	modelAttributeDescriptions[2].offset = sizeof(float) * 6;
-	VkVertexInputBindingDescription modelInputBinding = {};
-	modelInputBinding.binding = 0;
-	modelInputBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-	modelInputBinding.stride = sizeof(float) * 8;
-	modelPipeline = createPipeline(context, "../shaders/model_vert.spv", "../shaders/model_frag.spv", renderPass, swapchain.width, swapchain.height,
-									modelAttributeDescriptions, ARRAY_COUNT(modelAttributeDescriptions), &modelInputBinding, 1, &modelDescriptorSetLayout, 0, 0, VK_SAMPLE_COUNT_4_BIT, 0, pipelineCache);
+		VkDescriptorPoolSize poolSizes[] = {
+			{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, framesInFlight * 2},
+		};
+		VkDescriptorPoolCreateInfo poolCreateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+		poolCreateInfo.maxSets = framesInFlight;
+		poolCreateInfo.poolSizeCount = ARRAY_COUNT(poolSizes);
+		poolCreateInfo.pPoolSizes = poolSizes;
+		VKA(vkCreateDescriptorPool(context->device, &poolCreateInfo, 0, &lightingDescriptorPool));
+
+		for(uint32_t i = 0; i < framesInFlight; ++i) {
+			VkDescriptorSetAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+			allocateInfo.descriptorPool = lightingDescriptorPool;
+			allocateInfo.descriptorSetCount = 1;
+			allocateInfo.pSetLayouts = &lightingDescriptorSetLayout;
+			VKA(vkAllocateDescriptorSets(context->device, &allocateInfo, &lightingDescriptorSets[i]));
+
+			VkDescriptorBufferInfo bufferInfos[] = {
+				{lightBuffers[i].buffer, 0, VK_WHOLE_SIZE},
+				{clusterBuffer.buffer, 0, VK_WHOLE_SIZE},
+			};
+			VkWriteDescriptorSet descriptorWrites[ARRAY_COUNT(bufferInfos)];
+			for(uint32_t binding = 0; binding < ARRAY_COUNT(bufferInfos); ++binding) {
+				descriptorWrites[binding] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+				descriptorWrites[binding].dstSet = lightingDescriptorSets[i];
+				descriptorWrites[binding].dstBinding = binding;
+				descriptorWrites[binding].descriptorCount = 1;
+				descriptorWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+			}
+			VK(vkUpdateDescriptorSets(context->device, ARRAY_COUNT(descriptorWrites), descriptorWrites, 0, 0));
+		}
+		clusterLightsPipeline = createComputePipeline(context, "../shaders/cluster_lights_comp.spv", 1, &lightingDescriptorSetLayout, 0, 0, pipelineCache);
+	}
+	createGpuProfiler(context, &gpuProfiler, framesInFlight);
+
+	// Occlusion culling
+	occlusionCullingSupported = context->capabilities.drawIndirectFirstInstance;
+	if(!occlusionCullingSupported) {
+		LOG_WARN("drawIndirectFirstInstance is not supported, occlusion culling is disabled");
+	}
+	{
+		// drawCommandBuffer and visibilityBuffer are created with the instances, see updateInstanceBuffers
+		for(uint32_t i = 0; i < framesInFlight; ++i) {
+			createBuffer(context, &occlusionStatsBuffers[i], sizeof(OcclusionStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		}
+	}
+	{
+		VkDescriptorSetLayoutBinding bindings[] = {
+			{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+			{1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+			{2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+			{3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+			{4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+		};
+		VkDescriptorSetLayoutCreateInfo createInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+		createInfo.bindingCount = ARRAY_COUNT(bindings);
+		createInfo.pBindings = bindings;
+		VKA(vkCreateDescriptorSetLayout(context->device, &createInfo, 0, &occlusionCullDescriptorSetLayout));
+	}
+	{
+		VkDescriptorSetLayoutBinding bindings[] = {
+			{0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+			{1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+		};
+		VkDescriptorSetLayoutCreateInfo createInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+		createInfo.bindingCount = ARRAY_COUNT(bindings);
+		createInfo.pBindings = bindings;
+		VKA(vkCreateDescriptorSetLayout(context->device, &createInfo, 0, &hizDescriptorSetLayout));
+	}
+	{
+		VkDescriptorPoolSize poolSizes[] = {
+			{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, framesInFlight * 4},
+			{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, framesInFlight * (HIZ_MAX_LEVELS + 1)},
+			{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, framesInFlight * HIZ_MAX_LEVELS},
+		};
+		VkDescriptorPoolCreateInfo createInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+		createInfo.maxSets = framesInFlight * (HIZ_MAX_LEVELS + 1);
+		createInfo.poolSizeCount = ARRAY_COUNT(poolSizes);
+		createInfo.pPoolSizes = poolSizes;
+		VKA(vkCreateDescriptorPool(context->device, &createInfo, 0, &occlusionDescriptorPool));
+
+		// Written while recording, the depth buffer and the pyramid change with the swapchain
+		for(uint32_t i = 0; i < framesInFlight; ++i) {
+			VkDescriptorSetAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+			allocateInfo.descriptorPool = occlusionDescriptorPool;
+			allocateInfo.descriptorSetCount = 1;
+			allocateInfo.pSetLayouts = &occlusionCullDescriptorSetLayout;
+			VKA(vkAllocateDescriptorSets(context->device, &allocateInfo, &occlusionCullDescriptorSets[i]));
+			allocateInfo.pSetLayouts = &hizDescriptorSetLayout;
+			for(uint32_t level = 0; level < HIZ_MAX_LEVELS; ++level) {
+				VKA(vkAllocateDescriptorSets(context->device, &allocateInfo, &hizDescriptorSets[i * HIZ_MAX_LEVELS + level]));
+			}
+		}
+	}
+	{
+		VkPushConstantRange cullPushConstants = {};
+		cullPushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		cullPushConstants.offset = 0;
+		cullPushConstants.size = sizeof(OcclusionCullConstants);
+		occlusionCullPipeline = createComputePipeline(context, "../shaders/occlusion_cull_comp.spv", 1, &occlusionCullDescriptorSetLayout, &cullPushConstants, 0, pipelineCache);
+		// Size of the rendered part of the depth buffer
+		VkPushConstantRange hizPushConstants = {};
+		hizPushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		hizPushConstants.offset = 0;
+		hizPushConstants.size = sizeof(int32_t) * 2;
+		hizDepthPipeline = createComputePipeline(context, "../shaders/hiz_depth_comp.spv", 1, &hizDescriptorSetLayout, &hizPushConstants, 0, pipelineCache);
+		hizDepthPipelineSingle = createComputePipeline(context, "../shaders/hiz_depth_single_comp.spv", 1, &hizDescriptorSetLayout, &hizPushConstants, 0, pipelineCache);
+		hizReducePipeline = createComputePipeline(context, "../shaders/hiz_reduce_comp.spv", 1, &hizDescriptorSetLayout, 0, 0, pipelineCache);
+	}
+
+	// Post process subpass
+	{
+		VkDescriptorSetLayoutBinding bindings[] = {
+			{0, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1, VK_SHADER_STAGE_FRAGMENT_BIT, 0},
+		};
+		VkDescriptorSetLayoutCreateInfo createInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+		createInfo.bindingCount = ARRAY_COUNT(bindings);
+		createInfo.pBindings = bindings;
+		VKA(vkCreateDescriptorSetLayout(context->device, &createInfo, 0, &postprocessDescriptorSetLayout));
+	}
+	{
+		VkDescriptorPoolSize poolSizes[] = {
+			{VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, framesInFlight},
+		};
+		VkDescriptorPoolCreateInfo createInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+		createInfo.maxSets = framesInFlight;
+		createInfo.poolSizeCount = ARRAY_COUNT(poolSizes);
+		createInfo.pPoolSizes = poolSizes;
+		VKA(vkCreateDescriptorPool(context->device, &createInfo, 0, &postprocessDescriptorPool));
+
+		for(uint32_t i = 0; i < framesInFlight; ++i) {
+			VkDescriptorSetAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+			allocateInfo.descriptorPool = postprocessDescriptorPool;
+			allocateInfo.descriptorSetCount = 1;
+			allocateInfo.pSetLayouts = &postprocessDescriptorSetLayout;
+			VKA(vkAllocateDescriptorSets(context->device, &allocateInfo, &postprocessDescriptorSets[i]));
+		}
+	}
+	createScenePipelines();
+
+	// Anti-aliasing pass, FXAA only uses the first and the fourth binding
+	{
+		VkDescriptorSetLayoutBinding bindings[] = {
+			{0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+			{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+			{2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+			{3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+			{4, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+			{5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, 0},
+		};
+		VkDescriptorSetLayoutCreateInfo createInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+		createInfo.bindingCount = ARRAY_COUNT(bindings);
+		createInfo.pBindings = bindings;
+		VKA(vkCreateDescriptorSetLayout(context->device, &createInfo, 0, &aaDescriptorSetLayout));
+
+		VkDescriptorPoolSize poolSizes[] = {
+			{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, framesInFlight * 4},
+			{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, framesInFlight * 2},
+		};
+		VkDescriptorPoolCreateInfo poolCreateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+		poolCreateInfo.maxSets = framesInFlight;
+		poolCreateInfo.poolSizeCount = ARRAY_COUNT(poolSizes);
+		poolCreateInfo.pPoolSizes = poolSizes;
+		VKA(vkCreateDescriptorPool(context->device, &poolCreateInfo, 0, &aaDescriptorPool));
+
+		// Written while recording, the images change with the swapchain and the mode
+		for(uint32_t i = 0; i < framesInFlight; ++i) {
+			VkDescriptorSetAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+			allocateInfo.descriptorPool = aaDescriptorPool;
+			allocateInfo.descriptorSetCount = 1;
+			allocateInfo.pSetLayouts = &aaDescriptorSetLayout;
+			VKA(vkAllocateDescriptorSets(context->device, &allocateInfo, &aaDescriptorSets[i]));
+		}
+
+		VkPushConstantRange fxaaPushConstants = {};
+		fxaaPushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		fxaaPushConstants.offset = 0;
+		fxaaPushConstants.size = sizeof(int32_t) * 2;
+		fxaaPipeline = createComputePipeline(context, "../shaders/fxaa_comp.spv", 1, &aaDescriptorSetLayout, &fxaaPushConstants, 0, pipelineCache);
+		VkPushConstantRange taaPushConstants = {};
+		taaPushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		taaPushConstants.offset = 0;
+		taaPushConstants.size = sizeof(TaaConstants);
+		taaPipeline = createComputePipeline(context, "../shaders/taa_comp.spv", 1, &aaDescriptorSetLayout, &taaPushConstants, 0, pipelineCache);
+	}
 
 	
 	// Preparations for Guassian Blur pass
@@ -435,15 +1647,15 @@ void initApplication(SDL_Window* window) {
 	}
 	{
 		VkDescriptorPoolSize poolSizes[] = {
-			{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, FRAMES_IN_FLIGHT * 2},
+			{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, framesInFlight * 2},
 		};
 		VkDescriptorPoolCreateInfo createInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
-		createInfo.maxSets = FRAMES_IN_FLIGHT * 2;
+		createInfo.maxSets = framesInFlight * 2;
 		createInfo.poolSizeCount = ARRAY_COUNT(poolSizes);
 		createInfo.pPoolSizes = poolSizes;
 		VKA(vkCreateDescriptorPool(context->device, &createInfo, 0, &gaussDescriptorPool));
 		
-		for(uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+		for(uint32_t i = 0; i < framesInFlight; ++i) {
 			VkDescriptorSetAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
 			allocateInfo.descriptorPool = gaussDescriptorPool;
 			allocateInfo.descriptorSetCount = 1;
@@ -456,7 +1668,7 @@ void initApplication(SDL_Window* window) {
 	VkPushConstantRange pushConstants = {};
 	pushConstants.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	pushConstants.offset = 0;
-	pushConstants.size = sizeof(float);
+	pushConstants.size = sizeof(float) * 3;
 
 	int vertical = 1;
 	VkSpecializationMapEntry mapEntries[] = {
@@ -468,33 +1680,88 @@ void initApplication(SDL_Window* window) {
 	specializationInfo.dataSize = sizeof(vertical);
 	specializationInfo.pData = &vertical;
 
-	gaussPipelineVertical = createPipeline(context, "../shaders/gaussian_vert.spv", "../shaders/gaussian_frag.spv", gaussRenderPass, swapchain.width, swapchain.height, 0, 0, 0, 1, &gaussDescriptorSetLayout, &pushConstants, 0, VK_SAMPLE_COUNT_1_BIT, &specializationInfo, pipelineCache);
-	gaussPipelineHorizontal = createPipeline(context, "../shaders/gaussian_vert.spv", "../shaders/gaussian_frag.spv", gaussRenderPassFinal, swapchain.width, swapchain.height, 0, 0, 0, 1, &gaussDescriptorSetLayout, &pushConstants, 0, VK_SAMPLE_COUNT_1_BIT, 0, pipelineCache);
+	// Without render passes the blur pipelines only depend on the swapchain format
+	VkRenderPass blurPass = useDynamicRendering ? VK_NULL_HANDLE : gaussRenderPass;
+	VkRenderPass blurPassFinal = useDynamicRendering ? VK_NULL_HANDLE : gaussRenderPassFinal;
+	VulkanPipelineState blurState = getDefaultPipelineState();
+	blurState.colorFormat = swapchain.format;
+	gaussPipelineVertical = createPipeline(context, "../shaders/gaussian_vert.spv", "../shaders/gaussian_frag.spv", blurPass, swapchain.width, swapchain.height, 0, 0, 0, 1, &gaussDescriptorSetLayout, &pushConstants, 0, VK_SAMPLE_COUNT_1_BIT, &specializationInfo, pipelineCache, &blurState);
+	gaussPipelineHorizontal = createPipeline(context, "../shaders/gaussian_vert.spv", "../shaders/gaussian_frag.spv", blurPassFinal, swapchain.width, swapchain.height, 0, 0, 0, 1, &gaussDescriptorSetLayout, &pushConstants, 0, VK_SAMPLE_COUNT_1_BIT, 0, pipelineCache, &blurState);
 
-	for(uint32_t i = 0; i < ARRAY_COUNT(fences); ++i) {
-		VkFenceCreateInfo createInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
-		createInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-		VKA(vkCreateFence(context->device, &createInfo, 0, &fences[i]));
+	// Dual filter blur. Both pipelines are compatible with gaussRenderPass and gaussRenderPassFinal as these only differ in their final layout
+	{
+		VkDescriptorPoolSize poolSizes[] = {
+			{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, framesInFlight * DUAL_FILTER_MAX_LEVELS * 2},
+		};
+		VkDescriptorPoolCreateInfo createInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+		createInfo.maxSets = framesInFlight * DUAL_FILTER_MAX_LEVELS * 2;
+		createInfo.poolSizeCount = ARRAY_COUNT(poolSizes);
+		createInfo.pPoolSizes = poolSizes;
+		VKA(vkCreateDescriptorPool(context->device, &createInfo, 0, &dualFilterDescriptorPool));
+
+		for(uint32_t i = 0; i < framesInFlight; ++i) {
+			for(uint32_t j = 0; j < DUAL_FILTER_MAX_LEVELS * 2; ++j) {
+				VkDescriptorSetAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+				allocateInfo.descriptorPool = dualFilterDescriptorPool;
+				allocateInfo.descriptorSetCount = 1;
+				allocateInfo.pSetLayouts = &gaussDescriptorSetLayout;
+				VKA(vkAllocateDescriptorSets(context->device, &allocateInfo, &dualFilterDescriptorSets[i * DUAL_FILTER_MAX_LEVELS * 2 + j]));
+			}
+		}
 	}
-	for(uint32_t i = 0; i < ARRAY_COUNT(acquireSemaphores); ++i) {
+	{
+		VkPushConstantRange dualFilterPushConstants = {};
+		dualFilterPushConstants.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		dualFilterPushConstants.offset = 0;
+		dualFilterPushConstants.size = sizeof(float) * 5;
+
+		VkBool32 upsample = VK_FALSE;
+		VkSpecializationMapEntry dualFilterMapEntries[] = {
+			{0, 0, sizeof(upsample)},
+		};
+		VkSpecializationInfo dualFilterSpecializationInfo = {};
+		dualFilterSpecializationInfo.mapEntryCount = ARRAY_COUNT(dualFilterMapEntries);
+		dualFilterSpecializationInfo.pMapEntries = dualFilterMapEntries;
+		dualFilterSpecializationInfo.dataSize = sizeof(upsample);
+		dualFilterSpecializationInfo.pData = &upsample;
+
+		dualFilterPipelineDown = createPipeline(context, "../shaders/gaussian_vert.spv", "../shaders/dual_filter_frag.spv", blurPass, swapchain.width, swapchain.height, 0, 0, 0, 1, &gaussDescriptorSetLayout, &dualFilterPushConstants, 0, VK_SAMPLE_COUNT_1_BIT, &dualFilterSpecializationInfo, pipelineCache, &blurState);
+		upsample = VK_TRUE;
+		dualFilterPipelineUp = createPipeline(context, "../shaders/gaussian_vert.spv", "../shaders/dual_filter_frag.spv", blurPass, swapchain.width, swapchain.height, 0, 0, 0, 1, &gaussDescriptorSetLayout, &dualFilterPushConstants, 0, VK_SAMPLE_COUNT_1_BIT, &dualFilterSpecializationInfo, pipelineCache, &blurState);
+	}
+
+	for(uint32_t i = 0; i < framesInFlight; ++i) {
 		VkSemaphoreCreateInfo createInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
 		VKA(vkCreateSemaphore(context->device, &createInfo, 0, &acquireSemaphores[i]));
 		VKA(vkCreateSemaphore(context->device, &createInfo, 0, &releaseSemaphores[i]));
+		VKA(vkCreateSemaphore(context->device, &createInfo, 0, &graphicsDoneSemaphores[i]));
 	}
 
-	for(uint32_t i = 0; i < ARRAY_COUNT(commandPools); ++i) {
+	for(uint32_t i = 0; i < framesInFlight; ++i) {
 		VkCommandPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
 		createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 		createInfo.queueFamilyIndex = context->graphicsQueue.familyIndex;
 		VKA(vkCreateCommandPool(context->device, &createInfo, 0, &commandPools[i]));
 	}
-	for(uint32_t i = 0; i < ARRAY_COUNT(commandPools); ++i) {
+	for(uint32_t i = 0; i < framesInFlight; ++i) {
 		VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
 		allocateInfo.commandPool = commandPools[i];
 		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 		allocateInfo.commandBufferCount = 1;
 		VKA(vkAllocateCommandBuffers(context->device, &allocateInfo, &commandBuffers[i]));
 	}
+	for(uint32_t i = 0; i < framesInFlight; ++i) {
+		VkCommandPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+		createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		createInfo.queueFamilyIndex = context->computeQueue.familyIndex;
+		VKA(vkCreateCommandPool(context->device, &createInfo, 0, &computeCommandPools[i]));
+
+		VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+		allocateInfo.commandPool = computeCommandPools[i];
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = 1;
+		VKA(vkAllocateCommandBuffers(context->device, &allocateInfo, &computeCommandBuffers[i]));
+	}
 
 	createBuffer(context, &spriteVertexBuffer, sizeof(vertexData), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	uploadDataToBuffer(context, &spriteVertexBuffer, vertexData, sizeof(vertexData));
@@ -535,43 +1802,10 @@ void initApplication(SDL_Window* window) {
 	}
 	ImGui::CreateContext();
 	ImGui::StyleColorsDark();
-	ImGui_ImplSDL2_InitForVulkan(window);
-	ImGui_ImplVulkan_InitInfo initInfo = {};
-	initInfo.Instance = context->instance;
-	initInfo.PhysicalDevice = context->physicalDevice;
-	initInfo.Device = context->device;
-	initInfo.QueueFamily = context->graphicsQueue.familyIndex;
-	initInfo.Queue = context->graphicsQueue.queue;
-	initInfo.DescriptorPool = imguiDescriptorPool;
-	initInfo.MinImageCount = 2;
-	initInfo.ImageCount = swapchain.images.size();
-	initInfo.MSAASamples = VK_SAMPLE_COUNT_4_BIT;
-	ImGui_ImplVulkan_Init(&initInfo, renderPass);
-	// Upload Fonts
-    {
-        // Use any command queue
-        VkCommandPool commandPool = commandPools[0];
-        VkCommandBuffer commandBuffer = commandBuffers[0];
-
-        VKA(vkResetCommandPool(context->device, commandPool, 0));
-        VkCommandBufferBeginInfo begin_info = {};
-        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        begin_info.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-        VKA(vkBeginCommandBuffer(commandBuffer, &begin_info));
-
-        ImGui_ImplVulkan_CreateFontsTexture(commandBuffer);
-
-		VKA(vkEndCommandBuffer(commandBuffer));
-
-        VkSubmitInfo submitInfo = {};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
-        VKA(vkQueueSubmit(context->graphicsQueue.queue, 1, &submitInfo, VK_NULL_HANDLE));
-
-        VKA(vkDeviceWaitIdle(context->device));
-        ImGui_ImplVulkan_DestroyFontUploadObjects();
-    }
+	if(window) {
+		ImGui_ImplSDL2_InitForVulkan(window);
+	}
+	initImGuiVulkan();
 
 	{
 		VkDescriptorSetLayoutBinding bindings[] = {
@@ -583,112 +1817,1236 @@ void initApplication(SDL_Window* window) {
 		createInfo.pBindings = bindings;
 		VK(vkCreateDescriptorSetLayout(context->device, &createInfo, 0, &computeDescriptorSetLayout));
 	}
-	for(uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
-		VkDescriptorSetAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
-		allocateInfo.descriptorPool = modelDescriptorPool;
-		allocateInfo.descriptorSetCount = 1;
-		allocateInfo.pSetLayouts = &computeDescriptorSetLayout;
-		VKA(vkAllocateDescriptorSets(context->device, &allocateInfo, &computeDescriptorSets[i]));
+	for(uint32_t i = 0; i < framesInFlight; ++i) {
+		VkDescriptorSetAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+		allocateInfo.descriptorPool = modelDescriptorPool;
+		allocateInfo.descriptorSetCount = 1;
+		allocateInfo.pSetLayouts = &computeDescriptorSetLayout;
+		VKA(vkAllocateDescriptorSets(context->device, &allocateInfo, &computeDescriptorSetsHorizontal[i]));
+		VKA(vkAllocateDescriptorSets(context->device, &allocateInfo, &computeDescriptorSetsVertical[i]));
+	}
+	{
+		struct {
+			VkBool32 vertical;
+			uint32_t radius;
+			uint32_t groupSize;
+		} computeConstants;
+		VkSpecializationMapEntry computeMapEntries[] = {
+			{0, offsetof(decltype(computeConstants), vertical), sizeof(computeConstants.vertical)},
+			{1, offsetof(decltype(computeConstants), radius), sizeof(computeConstants.radius)},
+			{2, offsetof(decltype(computeConstants), groupSize), sizeof(computeConstants.groupSize)},
+		};
+		VkSpecializationInfo computeSpecializationInfo = {};
+		computeSpecializationInfo.mapEntryCount = ARRAY_COUNT(computeMapEntries);
+		computeSpecializationInfo.pMapEntries = computeMapEntries;
+		computeSpecializationInfo.dataSize = sizeof(computeConstants);
+		computeSpecializationInfo.pData = &computeConstants;
+
+		// Source and destination size
+		VkPushConstantRange computePushConstants = {};
+		computePushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		computePushConstants.offset = 0;
+		computePushConstants.size = sizeof(int32_t) * 4;
+
+		computeConstants.groupSize = COMPUTE_GROUP_SIZE;
+		for(uint32_t i = 0; i < ARRAY_COUNT(computeBlurRadii); ++i) {
+			computeConstants.radius = computeBlurRadii[i];
+			computeConstants.vertical = VK_FALSE;
+			computePipelinesHorizontal[i] = createComputePipeline(context, "../shaders/compute_comp.spv", 1, &computeDescriptorSetLayout, &computePushConstants, &computeSpecializationInfo, pipelineCache);
+			computeConstants.vertical = VK_TRUE;
+			computePipelinesVertical[i] = createComputePipeline(context, "../shaders/compute_comp.spv", 1, &computeDescriptorSetLayout, &computePushConstants, &computeSpecializationInfo, pipelineCache);
+		}
+	}
+}
+
+void recreateSwapchain() {
+	PROFILE_ZONE("recreateSwapchain");
+	if(headless) {
+		// The offscreen images never go out of date
+		return;
+	}
+	VulkanSwapchain oldSwapchain = swapchain;
+
+	VkSurfaceCapabilitiesKHR surfaceCapabilities;
+	VKA(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(context->physicalDevice, surface, &surfaceCapabilities));
+	if(surfaceCapabilities.currentExtent.width == 0 || surfaceCapabilities.currentExtent.height == 0) {
+		return;
+	}
+
+
+	// No vkDeviceWaitIdle. Frames in flight keep using the old swapchain and render targets until they are retired
+	uint64_t beginTime = cpuProfilerNow();
+	swapchain = createSwapchain(context, surface, swapchainUsage, &oldSwapchain, requestedPresentMode, requestedImageCount);
+
+	retireSwapchain(&deletionQueue, &oldSwapchain, context->scheduler.submittedValue);
+	recreateRenderTargets();
+	LOG_INFO("Swapchain recreated at ", swapchain.width, "x", swapchain.height, " in ", (cpuProfilerNow() - beginTime) * 1e-6, "ms");
+}
+
+// https://nlguillemot.wordpress.com/2016/12/07/reversed-z-in-opengl/
+glm::mat4 getProjectionInverseZ(float fovy, float width, float height, float zNear) {
+	float f = 1.0f / tanf(fovy / 2.0f);
+	float aspect = width / height;
+	return glm::mat4(
+		f / aspect, 0.0f,  0.0f,  0.0f,
+		0.0f,   -f,  0.0f,  0.0f,	// -f to flip y axis
+		0.0f, 0.0f,  0.0f, 1.0f,
+		0.0f, 0.0f, zNear,  0.0f
+	);
+}
+
+// Ray from the near plane through a pixel. With reversed Z the near plane is at depth 1 and infinity at 0, so the second point is at depth 0.5
+void pickInstance(glm::vec2 position) {
+	glm::mat4 inverseViewProj = glm::inverse(camera.viewProj);
+	glm::vec2 ndc = position / glm::vec2(swapchain.width, swapchain.height) * 2.0f - 1.0f;
+	glm::vec4 nearPoint = inverseViewProj * glm::vec4(ndc, 1.0f, 1.0f);
+	glm::vec4 farPoint = inverseViewProj * glm::vec4(ndc, 0.5f, 1.0f);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+	float distance = 0.0f;
+	pickedInstance = raycastBvh(&sceneBvh, origin, direction, FLT_MAX, &distance);
+	if(pickedInstance != BVH_NO_ITEM) {
+		LOG_INFO("Picked entity ", sceneInstances.entities[pickedInstance], " at distance ", distance);
+	}
+}
+
+void startBenchmark(GpuBenchmark* benchmark, uint32_t stepCount) {
+	assert(stepCount <= BENCHMARK_MAX_STEPS);
+	*benchmark = {};
+	benchmark->running = true;
+	benchmark->stepCount = stepCount;
+}
+
+// Returns true if this sample completed a step. Its average is then in results[step - 1]
+bool addBenchmarkSample(GpuBenchmark* benchmark, uint32_t sampleStep, double time) {
+	// Results arrive framesInFlight frames late, so only count frames that actually ran the current step
+	if(!benchmark->running || sampleStep != benchmark->step) {
+		return false;
+	}
+	benchmark->accumulatedTime += time;
+	if(++benchmark->frameCount < BENCHMARK_FRAMES) {
+		return false;
+	}
+	benchmark->results[benchmark->step] = benchmark->accumulatedTime / benchmark->frameCount;
+	benchmark->accumulatedTime = 0.0;
+	benchmark->frameCount = 0;
+	if(++benchmark->step == benchmark->stepCount) {
+		benchmark->running = false;
+	}
+	return true;
+}
+
+// Single color attachment pass of the blur, cleared and left in finalLayout. Only the image and view are used with dynamic
+// rendering, the render pass and framebuffer otherwise. The view is also passed to imageless framebuffers
+struct ColorPass {
+	VkRenderPass renderPass;
+	VkFramebuffer framebuffer;
+	VkImage image;
+	VkImageView view;
+	uint32_t mipLevel;
+	// The final layout of the render pass, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL or VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+	VkImageLayout finalLayout;
+};
+
+void beginColorPass(VkCommandBuffer commandBuffer, ColorPass* pass, VkRect2D renderArea) {
+	VkClearValue clearValue = {};
+	if(useDynamicRendering) {
+		// The transition the render pass did. The old contents are discarded, it only has to wait for the last reads and writes
+		VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+		imageBarrier.srcAccessMask = 0;
+		imageBarrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = pass->image;
+		imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, pass->mipLevel, 1, 0, 1};
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+							 0, 0, 0, 0, 0, 1, &imageBarrier);
+		beginRendering(context, commandBuffer, pass->view, VK_NULL_HANDLE, renderArea, &clearValue);
+		return;
+	}
+	VkRenderPassAttachmentBeginInfoKHR attachmentBeginInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_ATTACHMENT_BEGIN_INFO_KHR};
+	attachmentBeginInfo.attachmentCount = 1;
+	attachmentBeginInfo.pAttachments = &pass->view;
+	VkRenderPassBeginInfo beginInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+	if(useImagelessFramebuffers) {
+		beginInfo.pNext = &attachmentBeginInfo;
+	}
+	beginInfo.renderPass = pass->renderPass;
+	beginInfo.framebuffer = pass->framebuffer;
+	beginInfo.renderArea = renderArea;
+	beginInfo.clearValueCount = 1;
+	beginInfo.pClearValues = &clearValue;
+	vkCmdBeginRenderPass(commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+}
+
+void endColorPass(VkCommandBuffer commandBuffer, ColorPass* pass) {
+	if(!useDynamicRendering) {
+		vkCmdEndRenderPass(commandBuffer);
+		return;
+	}
+	endRendering(context, commandBuffer);
+	// Matches the external dependency of the render pass, see createRenderPass
+	bool present = pass->finalLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+	imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	imageBarrier.dstAccessMask = present ? 0 : VK_ACCESS_SHADER_READ_BIT;
+	imageBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	imageBarrier.newLayout = pass->finalLayout;
+	imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.image = pass->image;
+	imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, pass->mipLevel, 1, 0, 1};
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, present ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+						 0, 0, 0, 0, 0, 1, &imageBarrier);
+}
+
+// Level of the blur pyramid of a swapchain image
+ColorPass getBlurPyramidPass(uint32_t imageIndex, uint32_t level) {
+	ColorPass pass = {};
+	if(!useDynamicRendering) {
+		pass.renderPass = gaussRenderPass;
+		pass.framebuffer = blurPyramidFramebuffers[getFramebufferIndex(imageIndex) * blurPyramidLevels + level];
+	}
+	pass.image = blurPyramidBuffers[imageIndex].image;
+	pass.view = blurPyramidViews[imageIndex * blurPyramidLevels + level];
+	pass.mipLevel = level;
+	pass.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	return pass;
+}
+
+ColorPass getSwapchainPass(uint32_t imageIndex) {
+	ColorPass pass = {};
+	if(!useDynamicRendering) {
+		pass.renderPass = gaussRenderPassFinal;
+		pass.framebuffer = swapchainFramebuffers[getFramebufferIndex(imageIndex)];
+	}
+	pass.image = swapchain.images[imageIndex];
+	pass.view = swapchain.imageViews[imageIndex];
+	pass.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	return pass;
+}
+
+// Renders the top left regionScale part of the width x height target. The source is read in its renderUvScale part
+void recordDualFilterPass(VkCommandBuffer commandBuffer, VulkanPipeline* pipeline, ColorPass pass, uint32_t width, uint32_t height,
+						  float regionScale, VkDescriptorSet descriptorSet, VkImageView source) {
+	VkDescriptorImageInfo imageInfo = {linearSampler, source, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+	VkWriteDescriptorSet descriptorWrite = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+	descriptorWrite.dstSet = descriptorSet;
+	descriptorWrite.dstBinding = 0;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrite.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(context->device, 1, &descriptorWrite, 0, 0);
+
+	uint32_t regionWidth = glm::max((uint32_t)(width * regionScale + 0.5f), 1u);
+	uint32_t regionHeight = glm::max((uint32_t)(height * regionScale + 0.5f), 1u);
+	beginColorPass(commandBuffer, &pass, { {0, 0}, {regionWidth, regionHeight} });
+
+	VkViewport viewport = { 0.0f, 0.0f, (float)regionWidth, (float)regionHeight, 0.0f, 1.0f};
+	VkRect2D scissor = { {0, 0}, {regionWidth, regionHeight} };
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+	float pushConstants[5] = {0.5f / width, 0.5f / height, renderUvScale.x, renderUvScale.y, dualFilterOffset};
+	vkCmdPushConstants(commandBuffer, pipeline->pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), pushConstants);
+	vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+	endColorPass(commandBuffer, &pass);
+}
+
+// Downsamples the resolved scene through the blur pyramid and upsamples it back into the swapchain image.
+// Every level has a quarter of the pixels of the previous one, so wider blurs only add very cheap passes
+void recordDualFilterBlur(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frameIndex) {
+	uint32_t levels = glm::min((uint32_t)dualFilterLevels, blurPyramidLevels);
+	uint32_t pyramidWidth = glm::max(swapchain.width / 2, 1u);
+	uint32_t pyramidHeight = glm::max(swapchain.height / 2, 1u);
+	VkImageView* views = &blurPyramidViews[imageIndex * blurPyramidLevels];
+	VkDescriptorSet* descriptorSets = &dualFilterDescriptorSets[frameIndex * DUAL_FILTER_MAX_LEVELS * 2];
+	uint32_t passIndex = 0;
+
+	for(uint32_t level = 0; level < levels; ++level) {
+		VkImageView source = (level == 0) ? multisampleTargetBuffers[imageIndex].view : views[level - 1];
+		recordDualFilterPass(commandBuffer, &dualFilterPipelineDown, getBlurPyramidPass(imageIndex, level),
+							 glm::max(pyramidWidth >> level, 1u), glm::max(pyramidHeight >> level, 1u), renderScale, descriptorSets[passIndex++], source);
+	}
+	for(int32_t level = (int32_t)levels - 2; level >= 0; --level) {
+		// The level was read by the previous downsample pass before it gets overwritten
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, 0, 0, 0, 0, 0);
+		recordDualFilterPass(commandBuffer, &dualFilterPipelineUp, getBlurPyramidPass(imageIndex, level),
+							 glm::max(pyramidWidth >> level, 1u), glm::max(pyramidHeight >> level, 1u), renderScale, descriptorSets[passIndex++], views[level + 1]);
+	}
+	// Upscales to the whole swapchain image
+	recordDualFilterPass(commandBuffer, &dualFilterPipelineUp, getSwapchainPass(imageIndex),
+						 swapchain.width, swapchain.height, 1.0f, descriptorSets[passIndex++], views[0]);
+}
+
+// Separable compute blur of the scene image into the swapchain image.
+// On the async compute queue the semaphore wait already orders this after the graphics work and makes its writes visible,
+// so the barriers only have to chain onto the compute stage. Graphics stages are not available on compute only queues
+void recordComputeBlur(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frameIndex, bool asyncCompute) {
+	VkPipelineStageFlags srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	if(asyncCompute) {
+		srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	}
+
+	beginGpuScope(&gpuProfiler, commandBuffer, "Compute blur", asyncCompute ? 1 : 0);
+
+	{ // Swapchain Attachment Output -> Compute Write
+		VkImageSubresourceRange subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+		VkImageMemoryBarrier imageBarriers[3];
+		imageBarriers[0] = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+		imageBarriers[0].srcAccessMask = asyncCompute ? 0 : VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		imageBarriers[0].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		imageBarriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageBarriers[0].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarriers[0].image = swapchain.images[imageIndex];
+		imageBarriers[0].subresourceRange = subresourceRange;
+		// Intermediate image of the separable blur. Its previous contents are not needed
+		imageBarriers[1] = imageBarriers[0];
+		imageBarriers[1].srcAccessMask = 0;
+		imageBarriers[1].image = computeBuffers[imageIndex].image;
+		// MultisampleTarget Shader Read -> Compute Read
+		imageBarriers[2] = imageBarriers[0];
+		imageBarriers[2].srcAccessMask = asyncCompute ? 0 : VK_ACCESS_SHADER_READ_BIT;
+		imageBarriers[2].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		imageBarriers[2].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageBarriers[2].image = multisampleTargetBuffers[imageIndex].image;
+		if(asyncCompute && context->computeQueue.familyIndex != context->graphicsQueue.familyIndex) {
+			// Acquire the scene image released by the graphics queue
+			imageBarriers[2].srcQueueFamilyIndex = context->graphicsQueue.familyIndex;
+			imageBarriers[2].dstQueueFamilyIndex = context->computeQueue.familyIndex;
+		}
+		vkCmdPipelineBarrier(commandBuffer, srcStageMask, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, ARRAY_COUNT(imageBarriers), imageBarriers);
+	}
+
+	VkDescriptorImageInfo computeImageInfos[3] = {
+		{0, multisampleTargetBuffers[imageIndex].view, VK_IMAGE_LAYOUT_GENERAL},
+		{0, computeBuffers[imageIndex].view, VK_IMAGE_LAYOUT_GENERAL},
+		{0, swapchain.imageViews[imageIndex], VK_IMAGE_LAYOUT_GENERAL},
+	};
+	VkWriteDescriptorSet descriptorWrites[4];
+	for(uint32_t i = 0; i < ARRAY_COUNT(descriptorWrites); ++i) {
+		descriptorWrites[i] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+		descriptorWrites[i].dstSet = (i < 2) ? computeDescriptorSetsHorizontal[frameIndex] : computeDescriptorSetsVertical[frameIndex];
+		descriptorWrites[i].dstBinding = i % 2;
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	}
+	// Horizontal: multisampleTarget -> computeBuffer, Vertical: computeBuffer -> swapchain
+	descriptorWrites[0].pImageInfo = &computeImageInfos[1];
+	descriptorWrites[1].pImageInfo = &computeImageInfos[0];
+	descriptorWrites[2].pImageInfo = &computeImageInfos[2];
+	descriptorWrites[3].pImageInfo = &computeImageInfos[1];
+	vkUpdateDescriptorSets(context->device, ARRAY_COUNT(descriptorWrites), descriptorWrites, 0, 0);
+
+	// Every workgroup covers COMPUTE_GROUP_SIZE pixels of a single row or column
+	VulkanPipeline* computePipeline = &computePipelinesHorizontal[computeRadiusIndex];
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline->pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline->pipelineLayout, 0, 1, &computeDescriptorSetsHorizontal[frameIndex], 0, 0);
+	// Source and destination size. The horizontal pass stays at the render resolution
+	int32_t sizes[4] = {(int32_t)renderWidth, (int32_t)renderHeight, (int32_t)renderWidth, (int32_t)renderHeight};
+	vkCmdPushConstants(commandBuffer, computePipeline->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sizes), sizes);
+	beginGpuScope(&gpuProfiler, commandBuffer, "Horizontal", asyncCompute ? 1 : 0);
+	vkCmdDispatch(commandBuffer, (renderWidth + (COMPUTE_GROUP_SIZE-1)) / COMPUTE_GROUP_SIZE, renderHeight, 1);
+	endGpuScope(&gpuProfiler, commandBuffer);
+
+	{ // ComputeBuffer Compute Write -> Compute Read
+		VkImageSubresourceRange subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+		VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+		imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = computeBuffers[imageIndex].image;
+		imageBarrier.subresourceRange = subresourceRange;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
+	}
+
+	computePipeline = &computePipelinesVertical[computeRadiusIndex];
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline->pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline->pipelineLayout, 0, 1, &computeDescriptorSetsVertical[frameIndex], 0, 0);
+	// The vertical pass upscales to the swapchain
+	sizes[2] = (int32_t)swapchain.width;
+	sizes[3] = (int32_t)swapchain.height;
+	vkCmdPushConstants(commandBuffer, computePipeline->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sizes), sizes);
+	beginGpuScope(&gpuProfiler, commandBuffer, "Vertical", asyncCompute ? 1 : 0);
+	vkCmdDispatch(commandBuffer, (swapchain.height + (COMPUTE_GROUP_SIZE-1)) / COMPUTE_GROUP_SIZE, swapchain.width, 1);
+	endGpuScope(&gpuProfiler, commandBuffer);
+
+	{ // Swapchain Compute Write -> Present
+		VkImageSubresourceRange subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+		VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+		imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		imageBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = swapchain.images[imageIndex];
+		imageBarrier.subresourceRange = subresourceRange;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
+	}
+
+	endGpuScope(&gpuProfiler, commandBuffer);
+}
+
+// Feeds the GPU timings of the frame just resolved by beginGpuProfilerFrame into the benchmarks
+void updateGpuTimings(uint32_t frameIndex) {
+	GpuProfilerStats* frameStats = getGpuProfilerStats(&gpuProfiler, "Frame");
+	GpuProfilerStats* computeStats = getGpuProfilerStats(&gpuProfiler, "Compute blur");
+	GpuProfilerStats* blurStats = getGpuProfilerStats(&gpuProfiler, "Blur");
+	lastGpuFrameTime = -1.0f;
+	if(!frameStats || !computeStats || !blurStats || frameStats->lastTime < 0.0 || computeStats->lastTime < 0.0) {
+		return;
+	}
+
+	double gpuFrameTime = computeStats->lastEnd - frameStats->lastBegin;
+	uint32_t async = asyncComputePerFrame[frameIndex] ? 1 : 0;
+	gpuFrameTimeAvg[async] = gpuFrameTimeAvg[async] * 0.95 + gpuFrameTime * 0.05;
+	gpuComputeTimeAvg[async] = gpuComputeTimeAvg[async] * 0.95 + computeStats->lastTime * 0.05;
+
+	// The frame was rendered framesInFlight frames ago, at the scale it was recorded with
+	lastGpuFrameTime = (float)gpuFrameTime;
+	lastGpuFrameScale = renderScalePerFrame[frameIndex];
+	if(dynamicResolution) {
+		resolutionScaler.targetMs = gpuBudgetMs;
+		updateResolutionScaler(&resolutionScaler, lastGpuFrameTime, lastGpuFrameScale);
+	}
+
+	if(addBenchmarkSample(&computeBenchmark, computeRadiusPerFrame[frameIndex], computeStats->lastTime)) {
+		uint32_t step = computeBenchmark.step - 1;
+		LOG_INFO("Compute blur radius ", computeBlurRadii[step], ": ", computeBenchmark.results[step], "ms");
+	}
+	if(addBenchmarkSample(&blurBenchmark, blurStepPerFrame[frameIndex], blurStats->lastTime)) {
+		uint32_t step = blurBenchmark.step - 1;
+		if(step == 0) {
+			LOG_INFO("Gaussian blur at ", swapchain.width, "x", swapchain.height, ": ", blurBenchmark.results[step], "ms");
+		} else {
+			LOG_INFO("Dual filter blur with ", step, " levels at ", swapchain.width, "x", swapchain.height, ": ", blurBenchmark.results[step], "ms");
+		}
+	}
+}
+
+struct PresentModeName {
+	VkPresentModeKHR mode;
+	const char* name;
+} presentModes[] = {
+	{VK_PRESENT_MODE_FIFO_KHR, "fifo"},
+	{VK_PRESENT_MODE_FIFO_RELAXED_KHR, "fifo-relaxed"},
+	{VK_PRESENT_MODE_MAILBOX_KHR, "mailbox"},
+	{VK_PRESENT_MODE_IMMEDIATE_KHR, "immediate"},
+};
+
+const char* getPresentModeName(VkPresentModeKHR mode) {
+	for(uint32_t i = 0; i < ARRAY_COUNT(presentModes); ++i) {
+		if(presentModes[i].mode == mode) {
+			return presentModes[i].name;
+		}
+	}
+	return "unknown";
+}
+
+// Orbits the center of the instance grid
+void updateBenchmarkCamera() {
+	uint32_t rowLength = (uint32_t)ceilf(sqrtf((float)sceneInstanceCount));
+	glm::vec3 center = glm::vec3(0.0f, 0.0f, 2.0f + (rowLength - 1) * SCENE_GRID_SPACING * 0.5f);
+	float radius = rowLength * SCENE_GRID_SPACING + 2.0f;
+	float angle = sceneTime * glm::two_pi<float>() / BENCHMARK_CAMERA_PERIOD;
+	camera.cameraPosition = center + glm::vec3(sinf(angle) * radius, radius * 0.3f, -cosf(angle) * radius);
+	glm::vec3 direction = glm::normalize(center - camera.cameraPosition);
+	camera.yaw = glm::degrees(atan2f(direction.x, direction.z));
+	camera.pitch = glm::degrees(asinf(direction.y));
+}
+
+// Takes in the models that finished loading since the last frame
+void updateModelLoads() {
+	if(!modelLoader.pendingCount) {
+		return;
+	}
+	std::vector<ModelHandle> finished;
+	updateModelLoader(&modelLoader, &finished);
+	addLoadedModels(finished);
+}
+
+// The instance sized buffers grow when models become resident. The buffers of this frame are no longer used by the GPU,
+// the shared ones may still be used by the frames in flight. All replaced buffers are retired with this frame
+void updateInstanceBuffers(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	// Never empty, the descriptor sets need a buffer before the first model is resident
+	uint32_t instanceCount = glm::max((uint32_t)sceneInstances.entities.size(), 1u);
+	if(instanceBufferCapacities[frameIndex] < instanceCount) {
+		if(instanceBufferCapacities[frameIndex]) {
+			retiredInstanceBuffers.push_back(instanceBuffers[frameIndex]);
+		}
+		createBuffer(context, &instanceBuffers[frameIndex], sizeof(InstanceData) * instanceCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		instanceBufferCapacities[frameIndex] = instanceCount;
+		for(uint32_t m = 0; m < MAX_SCENE_MODELS; ++m) {
+			modelTextureGenerations[frameIndex * MAX_SCENE_MODELS + m] = MODEL_DESCRIPTORS_STALE;
+		}
+	}
+	if(cullBufferCapacity < instanceCount) {
+		if(cullBufferCapacity) {
+			retiredInstanceBuffers.push_back(drawCommandBuffer);
+			retiredInstanceBuffers.push_back(visibilityBuffer);
+		}
+		createBuffer(context, &drawCommandBuffer, sizeof(VkDrawIndexedIndirectCommand) * instanceCount, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		createBuffer(context, &visibilityBuffer, sizeof(uint32_t) * instanceCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		cullBufferCapacity = instanceCount;
+	}
+	if(visibilityVersion != sceneInstancesVersion) {
+		// The visibility of the old instance indices means nothing for the new ones. Everything counts as visible,
+		// the late cull of this frame sorts out what is occluded. The late cull of the last frame may still write it
+		VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, 0, 0, 0);
+		vkCmdFillBuffer(commandBuffer, visibilityBuffer.buffer, 0, VK_WHOLE_SIZE, 1);
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, 0, 0, 0);
+		visibilityVersion = sceneInstancesVersion;
+	}
+}
+
+// Instances per job when the instance data is written
+#define INSTANCE_WRITE_BATCH 1024
+
+// Job of updateSceneInstances, data is the mapped instance buffer. Only reads the scene, writes the previous world
+// matrices of its own range
+void writeInstanceData(uint32_t begin, uint32_t end, void* data) {
+	InstanceData* instanceData = (InstanceData*)data;
+	const uint32_t* offsets = sceneInstances.modelOffsets.data();
+	// The model of the first instance, the ranges of models that are not resident are empty
+	uint32_t m = (uint32_t)(std::upper_bound(offsets, offsets + modelCount + 1, begin) - offsets) - 1;
+	for(uint32_t i = begin; i < end; ++i) {
+		while(i >= offsets[m + 1]) {
+			++m;
+		}
+		InstanceData* instance = &instanceData[i];
+		instance->indexCount = models[m].numIndices;
+		instance->flags = instanceVisible[i] ? INSTANCE_IN_FRUSTUM : 0;
+		// Kept for all instances, they may enter the frustum next frame
+		const glm::mat4& modelMatrix = getEntityWorldMatrix(&scene, sceneInstances.entities[i]);
+		glm::mat4 previousModelMatrix = previousWorldMatrices[i];
+		previousWorldMatrices[i] = modelMatrix;
+		if(!instanceVisible[i]) {
+			continue;
+		}
+		instance->modelViewProj = camera.viewProj * modelMatrix;
+		instance->previousModelViewProj = taaPreviousViewProj * previousModelMatrix;
+		instance->modelView = camera.view * modelMatrix;
+		instance->boundsMin = glm::vec4(sceneBvh.itemBounds[i].min, 1.0f);
+		instance->boundsMax = glm::vec4(sceneBvh.itemBounds[i].max, 1.0f);
+	}
+}
+
+// Moves the scene, refits the BVH and culls it against the frustum. Writes the instance data of all instances,
+// the matrices and bounds only for those in the frustum
+void updateSceneInstances(uint32_t frameIndex, float time) {
+	PROFILE_ZONE("updateSceneInstances");
+	// Only the instance roots move, the world matrices of the static model nodes below them follow
+	glm::quat rotation = glm::angleAxis(-time, glm::vec3(0.0f, 1.0f, 0.0f));
+	for(uint32_t i = 0; i < sceneRoots.size(); ++i) {
+		setEntityRotation(&scene, sceneRoots[i], rotation);
+	}
+	updateScene(&scene);
+	for(uint32_t m = 0; m < modelCount; ++m) {
+		for(uint32_t i = sceneInstances.modelOffsets[m]; i < sceneInstances.modelOffsets[m + 1]; ++i) {
+			if(isEntityUpdated(&scene, sceneInstances.entities[i])) {
+				setBvhItemBounds(&sceneBvh, i, getInstanceBounds(i, m));
+			}
+		}
+	}
+	refitBvh(&sceneBvh);
+
+	instanceVisible.assign(sceneInstances.entities.size(), frustumCulling ? 0 : 1);
+	if(frustumCulling) {
+		Frustum frustum = getFrustum(camera.viewProj);
+		cullBvh(&sceneBvh, &frustum, &visibleInstances);
+		for(uint32_t i = 0; i < visibleInstances.size(); ++i) {
+			instanceVisible[visibleInstances[i]] = 1;
+		}
+	} else {
+		visibleInstances.clear();
+	}
+	if(pickRequested) {
+		pickInstance(pickPosition);
+		pickRequested = false;
+	}
+
+	if(previousWorldMatricesVersion != sceneInstancesVersion) {
+		// The old indices mean nothing for the new instances, they start without motion
+		previousWorldMatrices.resize(sceneInstances.entities.size());
+		for(uint32_t i = 0; i < sceneInstances.entities.size(); ++i) {
+			previousWorldMatrices[i] = getEntityWorldMatrix(&scene, sceneInstances.entities[i]);
+		}
+		previousWorldMatricesVersion = sceneInstancesVersion;
+	}
+
+	InstanceData* instanceData;
+	VK(vkMapMemory(context->device, instanceBuffers[frameIndex].memory, 0, VK_WHOLE_SIZE, 0, (void**)&instanceData));
+	parallelFor((uint32_t)sceneInstances.entities.size(), INSTANCE_WRITE_BATCH, writeInstanceData, instanceData);
+	VK(vkUnmapMemory(context->device, instanceBuffers[frameIndex].memory));
+}
+
+// Lights circle slowly around their base position and are uploaded in view space, where the clusters are built
+void updateLights(uint32_t frameIndex) {
+	PROFILE_ZONE("Update lights");
+	uint8_t* mapped = mappedLightBuffers[frameIndex];
+	LightingParams* params = (LightingParams*)mapped;
+	// The scene is rendered into the top left renderWidth x renderHeight, the clusters have to cover only that
+	params->screenSize = glm::vec2((float)renderWidth, (float)renderHeight);
+	params->projScale = glm::vec2(camera.proj[0][0], camera.proj[1][1]);
+	params->zNear = CAMERA_NEAR;
+	params->clusterNear = CLUSTER_NEAR;
+	params->sliceScale = (CLUSTER_Z - 2) / logf(CLUSTER_FAR / CLUSTER_NEAR);
+	params->lightCount = (uint32_t)lightCount;
+	params->naive = naiveLighting;
+
+	Light* lights = (Light*)(mapped + sizeof(LightingParams));
+	for(uint32_t i = 0; i < (uint32_t)lightCount; ++i) {
+		float t = sceneTime * 0.5f + i;
+		glm::vec3 position = glm::vec3(sceneLights[i].positionRadius) + glm::vec3(sinf(t), 0.0f, cosf(t));
+		lights[i].positionRadius = glm::vec4(glm::vec3(camera.view * glm::vec4(position, 1.0f)), sceneLights[i].positionRadius.w);
+		lights[i].color = sceneLights[i].color;
+	}
+}
+
+// Rebuilds the per cluster light lists. The previous frame may still read them in its fragment shaders
+void recordLightCulling(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	if(naiveLighting) {
+		return;
+	}
+	beginGpuScope(&gpuProfiler, commandBuffer, "Light culling");
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, 0, 0);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, clusterLightsPipeline.pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, clusterLightsPipeline.pipelineLayout, 0, 1, &lightingDescriptorSets[frameIndex], 0, 0);
+	vkCmdDispatch(commandBuffer, CLUSTER_COUNT / CLUSTER_GROUP_SIZE, 1, 1);
+
+	VkBufferMemoryBarrier barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = clusterBuffer.buffer;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, 0, 1, &barrier, 0, 0);
+	endGpuScope(&gpuProfiler, commandBuffer);
+}
+
+// Texel density feedback. Every model texture requests the finest level that one of its visible instances needs, from the
+// distance of the instance bounds to the camera and the largest scale of the instance
+void updateTextureFeedback() {
+	PROFILE_ZONE("updateTextureFeedback");
+	// Pixels that one world unit at distance 1 covers, at the rendered size
+	float pixelsPerUnit = renderHeight / (2.0f * tanf(glm::radians(CAMERA_FOVY) * 0.5f));
+	for(uint32_t m = 0; m < modelCount; ++m) {
+		if(!modelResident[m]) {
+			continue;
+		}
+		StreamedTexture* texture = &models[m].albedoTexture;
+		texture->requestedMip = texture->mipCount;
+		for(uint32_t i = sceneInstances.modelOffsets[m]; i < sceneInstances.modelOffsets[m + 1]; ++i) {
+			if(!instanceVisible[i]) {
+				continue;
+			}
+			const Aabb& bounds = sceneBvh.itemBounds[i];
+			glm::vec3 closest = glm::clamp(camera.cameraPosition, bounds.min, bounds.max);
+			float distance = glm::max(glm::length(closest - camera.cameraPosition), CAMERA_NEAR);
+			const glm::mat4& modelMatrix = getEntityWorldMatrix(&scene, sceneInstances.entities[i]);
+			float scale = glm::max(glm::length(glm::vec3(modelMatrix[0])), glm::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+			texture->requestedMip = glm::min(texture->requestedMip, getRequiredMip(texture, pixelsPerUnit * scale / distance));
+		}
+	}
+}
+
+// Points the descriptor sets of this frame at its instance buffer and the current texture images. The sets of the other
+// frames follow when their frame is recorded
+void updateModelDescriptors(uint32_t frameIndex) {
+	for(uint32_t m = 0; m < modelCount; ++m) {
+		if(!modelResident[m]) {
+			continue;
+		}
+		uint32_t index = frameIndex * MAX_SCENE_MODELS + m;
+		StreamedTexture* texture = &models[m].albedoTexture;
+		if(modelTextureGenerations[index] == texture->generation) {
+			continue;
+		}
+		VkDescriptorBufferInfo bufferInfo = {instanceBuffers[frameIndex].buffer, 0, VK_WHOLE_SIZE};
+		VkDescriptorImageInfo imageInfo = {textureSampler, texture->image.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+		VkWriteDescriptorSet descriptorWrites[2];
+		descriptorWrites[0] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+		descriptorWrites[0].dstSet = modelDescriptorSets[index];
+		descriptorWrites[0].dstBinding = 0;
+		descriptorWrites[0].descriptorCount = 1;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[0].pBufferInfo = &bufferInfo;
+		descriptorWrites[1] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+		descriptorWrites[1].dstSet = modelDescriptorSets[index];
+		descriptorWrites[1].dstBinding = 1;
+		descriptorWrites[1].descriptorCount = 1;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[1].pImageInfo = &imageInfo;
+		VK(vkUpdateDescriptorSets(context->device, ARRAY_COUNT(descriptorWrites), descriptorWrites, 0, 0));
+		modelTextureGenerations[index] = texture->generation;
+	}
+}
+
+void bindModel(VkCommandBuffer commandBuffer, VulkanPipeline* pipeline, uint32_t frameIndex, uint32_t modelIndex, bool positionsOnly) {
+	Model* model = &models[modelIndex];
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, positionsOnly ? &model->positionBuffer.buffer : &model->vertexBuffer.buffer, &offset);
+	vkCmdBindIndexBuffer(commandBuffer, model->indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipelineLayout, 0, 1, &modelDescriptorSets[frameIndex * MAX_SCENE_MODELS + modelIndex], 0, 0);
+}
+
+// Without occlusion culling the CPU frustum culling result is drawn directly. Grouped by model to bind each vertex and index buffer only once
+void drawModels(VkCommandBuffer commandBuffer, VulkanPipeline* pipeline, uint32_t frameIndex, bool positionsOnly) {
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+	if(!positionsOnly) {
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipelineLayout, 1, 1, &lightingDescriptorSets[frameIndex], 0, 0);
+	}
+	for(uint32_t m = 0; m < modelCount; ++m) {
+		// Models that are still loading have no instances
+		if(sceneInstances.modelOffsets[m] == sceneInstances.modelOffsets[m + 1]) {
+			continue;
+		}
+		Model* model = &models[m];
+		bindModel(commandBuffer, pipeline, frameIndex, m, positionsOnly);
+		for(uint32_t i = sceneInstances.modelOffsets[m]; i < sceneInstances.modelOffsets[m + 1]; ++i) {
+			if(instanceVisible[i]) {
+				// The instance index selects the instance data
+				vkCmdDrawIndexed(commandBuffer, model->numIndices, 1, 0, 0, i);
+			}
+		}
+	}
+}
+
+// Draws whatever the last cull dispatch wrote to drawCommandBuffer. Culled instances have an instance count of 0
+void drawModelsIndirect(VkCommandBuffer commandBuffer, VulkanPipeline* pipeline, uint32_t frameIndex, bool positionsOnly) {
+	uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+	if(!positionsOnly) {
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipelineLayout, 1, 1, &lightingDescriptorSets[frameIndex], 0, 0);
+	}
+	for(uint32_t m = 0; m < modelCount; ++m) {
+		uint32_t first = sceneInstances.modelOffsets[m];
+		uint32_t end = sceneInstances.modelOffsets[m + 1];
+		if(first == end) {
+			continue;
+		}
+		bindModel(commandBuffer, pipeline, frameIndex, m, positionsOnly);
+		if(context->capabilities.multiDrawIndirect) {
+			uint32_t maxDrawCount = context->physicalDeviceProperties.limits.maxDrawIndirectCount;
+			for(uint32_t i = first; i < end; i += maxDrawCount) {
+				vkCmdDrawIndexedIndirect(commandBuffer, drawCommandBuffer.buffer, i * stride, glm::min(end - i, maxDrawCount), stride);
+			}
+		} else {
+			// One command per draw, at least those outside of the frustum can be skipped
+			for(uint32_t i = first; i < end; ++i) {
+				if(instanceVisible[i]) {
+					vkCmdDrawIndexedIndirect(commandBuffer, drawCommandBuffer.buffer, i * stride, 1, stride);
+				}
+			}
+		}
+	}
+}
+
+// Into the early pass or the scene pass. With the depth prepass every draw runs twice, first depth only and then shaded
+void drawSceneModels(VkCommandBuffer commandBuffer, uint32_t frameIndex, bool indirect, bool early) {
+	VulkanPipeline* pipeline = early ? &modelPipelineEarly : &modelPipeline;
+	if(depthPrepass) {
+		VulkanPipeline* prepassPipeline = early ? &depthPrepassPipelineEarly : &depthPrepassPipeline;
+		if(indirect) {
+			drawModelsIndirect(commandBuffer, prepassPipeline, frameIndex, true);
+		} else {
+			drawModels(commandBuffer, prepassPipeline, frameIndex, true);
+		}
+		pipeline = early ? &modelPipelineEqualEarly : &modelPipelineEqual;
+	}
+	if(indirect) {
+		drawModelsIndirect(commandBuffer, pipeline, frameIndex, false);
+	} else {
+		drawModels(commandBuffer, pipeline, frameIndex, false);
+	}
+}
+
+void updateOcclusionDescriptorSets(uint32_t imageIndex, uint32_t frameIndex) {
+	VkDescriptorBufferInfo bufferInfos[] = {
+		{instanceBuffers[frameIndex].buffer, 0, VK_WHOLE_SIZE},
+		{drawCommandBuffer.buffer, 0, VK_WHOLE_SIZE},
+		{visibilityBuffer.buffer, 0, VK_WHOLE_SIZE},
+		{occlusionStatsBuffers[frameIndex].buffer, 0, VK_WHOLE_SIZE},
+	};
+	uint32_t bufferBindings[] = {0, 1, 2, 4};
+	// texelFetch ignores the sampler
+	VkDescriptorImageInfo pyramidInfo = {sampler, hizImage.view, VK_IMAGE_LAYOUT_GENERAL};
+	VkWriteDescriptorSet descriptorWrites[ARRAY_COUNT(bufferInfos) + 1];
+	for(uint32_t i = 0; i < ARRAY_COUNT(bufferInfos); ++i) {
+		descriptorWrites[i] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+		descriptorWrites[i].dstSet = occlusionCullDescriptorSets[frameIndex];
+		descriptorWrites[i].dstBinding = bufferBindings[i];
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+	descriptorWrites[4] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+	descriptorWrites[4].dstSet = occlusionCullDescriptorSets[frameIndex];
+	descriptorWrites[4].dstBinding = 3;
+	descriptorWrites[4].descriptorCount = 1;
+	descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrites[4].pImageInfo = &pyramidInfo;
+	vkUpdateDescriptorSets(context->device, ARRAY_COUNT(descriptorWrites), descriptorWrites, 0, 0);
+
+	for(uint32_t level = 0; level < hizLevels; ++level) {
+		VkDescriptorSet descriptorSet = hizDescriptorSets[frameIndex * HIZ_MAX_LEVELS + level];
+		// The first level reads the depth buffer, every further level the one above it
+		VkDescriptorImageInfo sourceInfo = {sampler, depthBuffers[imageIndex].view, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL};
+		if(level > 0) {
+			sourceInfo = {sampler, hizViews[level - 1], VK_IMAGE_LAYOUT_GENERAL};
+		}
+		VkDescriptorImageInfo destinationInfo = {0, hizViews[level], VK_IMAGE_LAYOUT_GENERAL};
+		VkWriteDescriptorSet levelWrites[2];
+		levelWrites[0] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+		levelWrites[0].dstSet = descriptorSet;
+		levelWrites[0].dstBinding = 0;
+		levelWrites[0].descriptorCount = 1;
+		levelWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		levelWrites[0].pImageInfo = &sourceInfo;
+		levelWrites[1] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+		levelWrites[1].dstSet = descriptorSet;
+		levelWrites[1].dstBinding = 1;
+		levelWrites[1].descriptorCount = 1;
+		levelWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		levelWrites[1].pImageInfo = &destinationInfo;
+		vkUpdateDescriptorSets(context->device, ARRAY_COUNT(levelWrites), levelWrites, 0, 0);
+	}
+}
+
+void recordOcclusionCull(VkCommandBuffer commandBuffer, uint32_t frameIndex, bool late) {
+	OcclusionCullConstants constants;
+	constants.viewProj = camera.viewProj;
+	constants.pyramidSize = glm::vec2((float)hizWidth, (float)hizHeight);
+	constants.instanceCount = (uint32_t)sceneInstances.entities.size();
+	constants.late = late ? 1 : 0;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, occlusionCullPipeline.pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, occlusionCullPipeline.pipelineLayout, 0, 1, &occlusionCullDescriptorSets[frameIndex], 0, 0);
+	vkCmdPushConstants(commandBuffer, occlusionCullPipeline.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	vkCmdDispatch(commandBuffer, (constants.instanceCount + OCCLUSION_CULL_GROUP_SIZE - 1) / OCCLUSION_CULL_GROUP_SIZE, 1, 1);
+}
+
+// Reduces the depth of the early pass into the pyramid, one dispatch per level
+void recordHizBuild(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	for(uint32_t level = 0; level < hizLevels; ++level) {
+		VulkanPipeline* pipeline = &hizReducePipeline;
+		if(level == 0) {
+			pipeline = (sceneSamples == VK_SAMPLE_COUNT_1_BIT) ? &hizDepthPipelineSingle : &hizDepthPipeline;
+		}
+		uint32_t width = glm::max(hizWidth >> level, 1u);
+		uint32_t height = glm::max(hizHeight >> level, 1u);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipelineLayout, 0, 1, &hizDescriptorSets[frameIndex * HIZ_MAX_LEVELS + level], 0, 0);
+		if(level == 0) {
+			int32_t sourceSize[2] = {(int32_t)renderWidth, (int32_t)renderHeight};
+			vkCmdPushConstants(commandBuffer, pipeline->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sourceSize), sourceSize);
+		}
+		vkCmdDispatch(commandBuffer, (width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+
+		// The next level or the late cull reads this one
+		VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+	}
+}
+
+// Early cull and draws, the Hi-Z pyramid of their depth and the late cull. The scene pass then continues with the late draws
+void recordOcclusionCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frameIndex, VkRenderPassBeginInfo* sceneBeginInfo) {
+	updateOcclusionDescriptorSets(imageIndex, frameIndex);
+	VkImageSubresourceRange depthRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1};
+
+	beginGpuScope(&gpuProfiler, commandBuffer, "Occlusion early");
+	vkCmdFillBuffer(commandBuffer, occlusionStatsBuffers[frameIndex].buffer, 0, VK_WHOLE_SIZE, 0);
+	{
+		// Also orders the cull after the reads of the draw commands, the visibility and the pyramid by the last frame
+		VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+							 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+	}
+	recordOcclusionCull(commandBuffer, frameIndex, false);
+	{
+		VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+	}
+
+	if(useDynamicRendering) {
+		// The transitions the early render pass did. All are cleared, the barrier only waits for the last frame on this image
+		VkImageMemoryBarrier imageBarriers[3];
+		imageBarriers[0] = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+		imageBarriers[0].srcAccessMask = 0;
+		imageBarriers[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		imageBarriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageBarriers[0].newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		imageBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarriers[0].image = colorBuffers[imageIndex].image;
+		imageBarriers[0].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+		imageBarriers[1] = imageBarriers[0];
+		imageBarriers[1].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		imageBarriers[1].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		imageBarriers[1].image = depthBuffers[imageIndex].image;
+		imageBarriers[1].subresourceRange = depthRange;
+		imageBarriers[2] = imageBarriers[0];
+		imageBarriers[2].image = sceneVelocity ? velocityBuffers[imageIndex].image : VK_NULL_HANDLE;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+							 VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+							 0, 0, 0, 0, 0, sceneVelocity ? 3 : 2, imageBarriers);
+		VkImageView velocityView = sceneVelocity ? velocityBuffers[imageIndex].view : VK_NULL_HANDLE;
+		beginRendering(context, commandBuffer, colorBuffers[imageIndex].view, depthBuffers[imageIndex].view, sceneBeginInfo->renderArea, (VkClearValue*)sceneBeginInfo->pClearValues, velocityView);
+		drawSceneModels(commandBuffer, frameIndex, true, true);
+		endRendering(context, commandBuffer);
+	} else {
+		VkRenderPassBeginInfo beginInfo = *sceneBeginInfo;
+		beginInfo.renderPass = earlyRenderPass;
+		beginInfo.framebuffer = earlySceneFramebuffers[getFramebufferIndex(imageIndex)];
+		// The early pass has the first two attachments of the scene pass and then the motion vectors, which are cleared
+		// to zero at both the third and the fourth attachment
+		VkRenderPassAttachmentBeginInfoKHR attachmentBeginInfo;
+		VkImageView attachments[3];
+		if(useImagelessFramebuffers) {
+			attachmentBeginInfo = *(const VkRenderPassAttachmentBeginInfoKHR*)sceneBeginInfo->pNext;
+			attachments[0] = colorBuffers[imageIndex].view;
+			attachments[1] = depthBuffers[imageIndex].view;
+			attachments[2] = sceneVelocity ? velocityBuffers[imageIndex].view : VK_NULL_HANDLE;
+			attachmentBeginInfo.attachmentCount = sceneVelocity ? 3 : 2;
+			attachmentBeginInfo.pAttachments = attachments;
+			beginInfo.pNext = &attachmentBeginInfo;
+		}
+		vkCmdBeginRenderPass(commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		drawSceneModels(commandBuffer, frameIndex, true, true);
+		vkCmdEndRenderPass(commandBuffer);
+	}
+	endGpuScope(&gpuProfiler, commandBuffer);
+
+	beginGpuScope(&gpuProfiler, commandBuffer, "Hi-Z");
+	{
+		// The late cull overwrites the draw commands, the pyramid is rebuilt completely
+		VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+		VkImageMemoryBarrier imageBarriers[2];
+		imageBarriers[0] = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+		imageBarriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		imageBarriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		imageBarriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		imageBarriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		imageBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarriers[0].image = depthBuffers[imageIndex].image;
+		imageBarriers[0].subresourceRange = depthRange;
+		imageBarriers[1] = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+		imageBarriers[1].srcAccessMask = 0;
+		imageBarriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		imageBarriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageBarriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageBarriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarriers[1].image = hizImage.image;
+		imageBarriers[1].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, hizLevels, 0, 1};
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+							 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, 0, ARRAY_COUNT(imageBarriers), imageBarriers);
 	}
-	computePipeline = createComputePipeline(context, "../shaders/compute_comp.spv", 1, &computeDescriptorSetLayout, 0, 0);
-}
+	recordHizBuild(commandBuffer, frameIndex);
+	endGpuScope(&gpuProfiler, commandBuffer);
 
-void recreateSwapchain() {
-	VulkanSwapchain oldSwapchain = swapchain;
+	beginGpuScope(&gpuProfiler, commandBuffer, "Occlusion late");
+	recordOcclusionCull(commandBuffer, frameIndex, true);
+	{
+		// The scene pass continues on the color and depth of the early pass
+		VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+		imageBarrier.srcAccessMask = 0;
+		imageBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = depthBuffers[imageIndex].image;
+		imageBarrier.subresourceRange = depthRange;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+							 VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+							 0, 1, &memoryBarrier, 0, 0, 1, &imageBarrier);
+	}
+	endGpuScope(&gpuProfiler, commandBuffer);
+}
 
-	VkSurfaceCapabilitiesKHR surfaceCapabilities;
-	VKA(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(context->physicalDevice, surface, &surfaceCapabilities));
-	if(surfaceCapabilities.currentExtent.width == 0 || surfaceCapabilities.currentExtent.height == 0) {
-		return;
+// FXAA or TAA of the post processed scene into multisampleTargetBuffers, where the blur passes expect the scene
+void recordAntiAliasing(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frameIndex) {
+	bool taa = activeAaMode == AA_MODE_TAA;
+	VulkanImage* history = &taaHistoryBuffers[taaHistoryIndex ^ 1];
+	VulkanImage* historyOut = &taaHistoryBuffers[taaHistoryIndex];
+	beginGpuScope(&gpuProfiler, commandBuffer, "AA");
+	{
+		// The scene pass left the input and the motion vectors in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, its writes only have to reach compute
+		VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+		memoryBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		VkImageMemoryBarrier imageBarriers[4];
+		imageBarriers[0] = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+		imageBarriers[0].srcAccessMask = 0;
+		imageBarriers[0].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		imageBarriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageBarriers[0].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarriers[0].image = multisampleTargetBuffers[imageIndex].image;
+		imageBarriers[0].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+		uint32_t imageBarrierCount = 1;
+		if(taa) {
+			imageBarriers[1] = imageBarriers[0];
+			imageBarriers[1].image = historyOut->image;
+			// Written by the last frame, undefined after the history was reset
+			imageBarriers[2] = imageBarriers[0];
+			imageBarriers[2].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			imageBarriers[2].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			imageBarriers[2].oldLayout = taaHistoryValid ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED;
+			imageBarriers[2].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageBarriers[2].image = history->image;
+			imageBarriers[3] = imageBarriers[0];
+			imageBarriers[3].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+			imageBarriers[3].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			imageBarriers[3].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+			imageBarriers[3].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+			imageBarriers[3].image = depthBuffers[imageIndex].image;
+			imageBarriers[3].subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1};
+			imageBarrierCount = 4;
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+							 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, 0, imageBarrierCount, imageBarriers);
 	}
 
+	VkDescriptorImageInfo imageInfos[] = {
+		{linearSampler, aaInputBuffers[imageIndex].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+		{linearSampler, history->view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+		{sampler, depthBuffers[imageIndex].view, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL},
+		{0, multisampleTargetBuffers[imageIndex].view, VK_IMAGE_LAYOUT_GENERAL},
+		{0, historyOut->view, VK_IMAGE_LAYOUT_GENERAL},
+		{sampler, taa ? velocityBuffers[imageIndex].view : VK_NULL_HANDLE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+	};
+	// FXAA only reads the input and writes the destination
+	uint32_t bindings[] = {0, 3, 1, 2, 4, 5};
+	uint32_t writeCount = taa ? ARRAY_COUNT(bindings) : 2;
+	VkWriteDescriptorSet descriptorWrites[ARRAY_COUNT(bindings)];
+	for(uint32_t i = 0; i < writeCount; ++i) {
+		descriptorWrites[i] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+		descriptorWrites[i].dstSet = aaDescriptorSets[frameIndex];
+		descriptorWrites[i].dstBinding = bindings[i];
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].descriptorType = (bindings[i] == 3 || bindings[i] == 4) ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[i].pImageInfo = &imageInfos[bindings[i]];
+	}
+	vkUpdateDescriptorSets(context->device, writeCount, descriptorWrites, 0, 0);
 
-	VKA(vkDeviceWaitIdle(context->device));
-	swapchain = createSwapchain(context, surface, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT, &oldSwapchain);
+	VulkanPipeline* pipeline = taa ? &taaPipeline : &fxaaPipeline;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipelineLayout, 0, 1, &aaDescriptorSets[frameIndex], 0, 0);
+	if(taa) {
+		TaaConstants constants;
+		constants.reprojection = taaPreviousViewProj * glm::inverse(taaViewProj);
+		constants.jitter = taaJitter;
+		constants.historyUvScale = taaPreviousUvScale;
+		constants.size[0] = (int32_t)renderWidth;
+		constants.size[1] = (int32_t)renderHeight;
+		constants.feedback = taaFeedback;
+		constants.historyValid = taaHistoryValid ? 1 : 0;
+		vkCmdPushConstants(commandBuffer, pipeline->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	} else {
+		int32_t size[2] = {(int32_t)renderWidth, (int32_t)renderHeight};
+		vkCmdPushConstants(commandBuffer, pipeline->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(size), size);
+	}
+	vkCmdDispatch(commandBuffer, (renderWidth + AA_GROUP_SIZE - 1) / AA_GROUP_SIZE, (renderHeight + AA_GROUP_SIZE - 1) / AA_GROUP_SIZE, 1);
 
-	destroySwapchain(context, &oldSwapchain);
-	recreateRenderPass();
-}
+	{ // Destination Compute Write -> Blur Read
+		VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+		imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = multisampleTargetBuffers[imageIndex].image;
+		imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
+	}
+	endGpuScope(&gpuProfiler, commandBuffer);
 
-// https://nlguillemot.wordpress.com/2016/12/07/reversed-z-in-opengl/
-glm::mat4 getProjectionInverseZ(float fovy, float width, float height, float zNear) {
-	float f = 1.0f / tanf(fovy / 2.0f);
-	float aspect = width / height;
-	return glm::mat4(
-		f / aspect, 0.0f,  0.0f,  0.0f,
-		0.0f,   -f,  0.0f,  0.0f,	// -f to flip y axis
-		0.0f, 0.0f,  0.0f, 1.0f,
-		0.0f, 0.0f, zNear,  0.0f
-	);
+	if(taa) {
+		taaHistoryValid = true;
+		taaHistoryIndex ^= 1;
+		taaPreviousViewProj = taaViewProj;
+		taaPreviousUvScale = renderUvScale;
+	}
 }
 
 void renderApplication() {
-	static float greenChannel = 0.0f;
-	static float time = 0.0f;
-	static double frameGpuAvg = 0.0;
-	static double computeAvg = 0.0;
-	time += 0.01f;
-	greenChannel += 0.01f;
-	if (greenChannel > 1.0f) greenChannel = 0.0f;
+	PROFILE_ZONE("renderApplication");
+	// Same speed as the former per frame increment of 0.01 at 60fps
+	float time = sceneTime * 0.6f;
+	float greenChannel = time - floorf(time);
 	uint32_t imageIndex = 0;
-	static uint32_t frameIndex = 0;
+	uint32_t frameIndex = frameNumber % framesInFlight;
 
-	// Wait for the n-2 frame to finish to be able to reuse its acquireSemaphore in vkAcquireNextImageKHR
-	VKA(vkWaitForFences(context->device, 1, &fences[frameIndex], VK_TRUE, UINT64_MAX));
+	uint64_t waitTime;
+	{
+		PROFILE_ZONE("waitForValue");
+		// Wait for the n-framesInFlight frame to finish to be able to reuse its acquireSemaphore in vkAcquireNextImageKHR
+		waitForValue(context, frameValues[frameIndex]);
+		waitTime = cpuProfilerNow();
+	}
+	flushDeletionQueue(context, &deletionQueue, pollCompletedValue(context));
 
-	VkResult result = VK(vkAcquireNextImageKHR(context->device, swapchain.swapchain, UINT64_MAX, acquireSemaphores[frameIndex], 0, &imageIndex));
+	VkResult result;
+	if(headless) {
+		// Nothing to acquire from. The images are used round robin and there are at least framesInFlight of them,
+		// so the wait above also covers the last use of this image
+		imageIndex = headlessImageIndex;
+		headlessImageIndex = (headlessImageIndex + 1) % swapchain.images.size();
+		result = VK_SUCCESS;
+	} else {
+		PROFILE_ZONE("vkAcquireNextImageKHR");
+		result = VK(vkAcquireNextImageKHR(context->device, swapchain.swapchain, UINT64_MAX, acquireSemaphores[frameIndex], 0, &imageIndex));
+	}
 	if(result == VK_ERROR_OUT_OF_DATE_KHR) {
 		// ImGui still expects us to call render so we still do this here
 		ImGui::Render();
 		// Swapchain is out of date
 		recreateSwapchain();
 		return;
-	} else {
-		VKA(vkResetFences(context->device, 1, &fences[frameIndex]));
-		if(result != VK_SUBOPTIMAL_KHR) {
-			ASSERT_VULKAN(result);
-		}
-	}
-
-	// Query timestamps
-	uint64_t timestamps[3] = {};
-	VkResult timestampsValid = VK(vkGetQueryPoolResults(context->device, timestampQueryPools[frameIndex], 0, ARRAY_COUNT(timestamps), sizeof(timestamps), timestamps, sizeof(timestamps[0]), VK_QUERY_RESULT_64_BIT));
-	if(timestampsValid == VK_SUCCESS) {
-		double frameGpuBegin = double(timestamps[0]) * context->physicalDeviceProperties.limits.timestampPeriod * 1e-6;
-		double frameGpuEnd = double(timestamps[1]) * context->physicalDeviceProperties.limits.timestampPeriod * 1e-6;
-		double comptueEnd = double(timestamps[2]) * context->physicalDeviceProperties.limits.timestampPeriod * 1e-6;
-		frameGpuAvg = frameGpuAvg * 0.95 + (frameGpuEnd - frameGpuBegin) * 0.05;
-		computeAvg = computeAvg * 0.95 + (comptueEnd - frameGpuEnd) * 0.05;
-		//LOG_INFO("GPU frametime: ", frameGpuAvg, "ms");
-		LOG_INFO("Compute time: ", computeAvg, "ms");
+	} else if(result != VK_SUBOPTIMAL_KHR) {
+		ASSERT_VULKAN(result);
 	}
 
 	VKA(vkResetCommandPool(context->device, commandPools[frameIndex], 0));
 
 	VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
 	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VKA(vkBeginCommandBuffer(commandBuffers[frameIndex], &beginInfo));
+	// Resolves the timings of the last use of this frame, it was waited on above
+	beginGpuProfilerFrame(context, &gpuProfiler, commandBuffers[frameIndex], frameIndex);
+	updateGpuTimings(frameIndex);
+	lastFrameLatency = -1.0;
+	if(inputTimePerFrame[frameIndex]) {
+		// Without calibrated timestamps the frame wait is the first time we see the frame finished, an upper bound
+		uint64_t endTime = gpuProfiler.lastFrameEndHostNs ? gpuProfiler.lastFrameEndHostNs : waitTime;
+		lastFrameLatency = (double)(int64_t)(endTime - inputTimePerFrame[frameIndex]) * 1e-6;
+		frameLatencyAvg = frameLatencyAvg * 0.95 + lastFrameLatency * 0.05;
+	}
+	inputTimePerFrame[frameIndex] = frameInputTime;
+	occlusionStatsValid = false;
+	if(occlusionCullingPerFrame[frameIndex]) {
+		// The stats were made visible to the host at the end of the late cull
+		OcclusionStats* mappedStats;
+		VK(vkMapMemory(context->device, occlusionStatsBuffers[frameIndex].memory, 0, sizeof(OcclusionStats), 0, (void**)&mappedStats));
+		occlusionStats = *mappedStats;
+		VK(vkUnmapMemory(context->device, occlusionStatsBuffers[frameIndex].memory));
+		occlusionStatsValid = true;
+	}
+
+	if(blurBenchmark.running) {
+		blurMode = (blurBenchmark.step == 0) ? BLUR_MODE_GAUSS : BLUR_MODE_DUAL_FILTER;
+		dualFilterLevels = glm::max(blurBenchmark.step, 1u);
+	}
+	if(computeBenchmark.running) {
+		computeRadiusIndex = computeBenchmark.step;
+	}
+	computeRadiusPerFrame[frameIndex] = computeRadiusIndex;
+	blurStepPerFrame[frameIndex] = (blurMode == BLUR_MODE_GAUSS) ? 0 : dualFilterLevels;
+	// Falls back to recording the compute blur into the graphics command buffer if there is only one queue
+	bool useAsyncCompute = asyncCompute && context->computeQueue.queue != context->graphicsQueue.queue;
+	asyncComputePerFrame[frameIndex] = useAsyncCompute;
+	renderScale = dynamicResolution ? resolutionScaler.scale : fixedRenderScale;
+	renderScalePerFrame[frameIndex] = renderScale;
+	renderWidth = glm::max((uint32_t)(swapchain.width * renderScale + 0.5f), 1u);
+	renderHeight = glm::max((uint32_t)(swapchain.height * renderScale + 0.5f), 1u);
+	renderUvScale = glm::vec2((float)renderWidth / swapchain.width, (float)renderHeight / swapchain.height);
+	taaViewProj = camera.viewProj;
+	taaJitter = glm::vec2(0.0f);
+	if(activeAaMode == AA_MODE_TAA) {
+		// Subpixel offsets from the Halton sequence in bases 2 and 3, shifted by whole NDC in clip space
+		uint32_t phase = (uint32_t)(frameNumber % TAA_JITTER_PHASES) + 1;
+		glm::vec2 offset(halton(phase, 2) - 0.5f, halton(phase, 3) - 0.5f);
+		taaJitter = offset * 2.0f / glm::vec2((float)renderWidth, (float)renderHeight);
+		camera.viewProj = glm::translate(glm::mat4(1.0f), glm::vec3(taaJitter, 0.0f)) * camera.viewProj;
+	}
+
 	{
+		PROFILE_ZONE("Record");
 		VkCommandBuffer commandBuffer = commandBuffers[frameIndex];
-		VKA(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+		beginGpuScope(&gpuProfiler, commandBuffer, "Frame");
 
-		VK(vkCmdResetQueryPool(commandBuffer, timestampQueryPools[frameIndex], 0, 64));
-		VK(vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, timestampQueryPools[frameIndex], 0));
+		updateModelLoads();
+		updateInstanceBuffers(commandBuffer, frameIndex);
+		updateSceneInstances(frameIndex, time);
+		updateTextureFeedback();
+		{
+			// Uploads go before any render pass of the frame, the replaced images are retired with the frame below
+			StreamedTexture* textures[MAX_SCENE_MODELS];
+			uint32_t textureCount = 0;
+			for(uint32_t m = 0; m < modelCount; ++m) {
+				if(modelResident[m]) {
+					textures[textureCount++] = &models[m].albedoTexture;
+				}
+			}
+			textureStreamer.budgetBytes = (uint64_t)textureBudgetMb << 20;
+			updateTextureStreaming(context, &textureStreamer, textures, textureCount, commandBuffer);
+			updateModelDescriptors(frameIndex);
+		}
+		updateLights(frameIndex);
+		recordLightCulling(commandBuffer, frameIndex);
+		bool useOcclusionCulling = occlusionCulling && occlusionCullingSupported;
+		occlusionCullingPerFrame[frameIndex] = useOcclusionCulling;
 
-		VkViewport viewport = { 0.0f, 0.0f, (float)swapchain.width, (float)swapchain.height, 0.0f, 1.0f};
-		VkRect2D scissor = { {0, 0}, {swapchain.width, swapchain.height} };
+		VkViewport viewport = { 0.0f, 0.0f, (float)renderWidth, (float)renderHeight, 0.0f, 1.0f};
+		VkRect2D scissor = { {0, 0}, {renderWidth, renderHeight} };
 		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-		VkClearValue clearValues[2] = {
+		// The third attachment is not cleared, the motion vectors are the fourth one of the scene pass and the third one
+		// of the early pass
+		VkClearValue clearValues[4] = {
 			{0.0f, greenChannel, 1.0f, 1.0f},
 			{0.0f, 0.0f},
+			{0.0f, 0.0f, 0.0f, 0.0f},
+			{0.0f, 0.0f, 0.0f, 0.0f},
 		};
+		VkImageView sceneAttachments[4];
+		VkRenderPassAttachmentBeginInfoKHR attachmentBeginInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_ATTACHMENT_BEGIN_INFO_KHR};
+		attachmentBeginInfo.attachmentCount = getSceneAttachmentViews(imageIndex, sceneAttachments);
+		attachmentBeginInfo.pAttachments = sceneAttachments;
 		VkRenderPassBeginInfo beginInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+		if(useImagelessFramebuffers) {
+			beginInfo.pNext = &attachmentBeginInfo;
+		}
 		beginInfo.renderPass = renderPass;
-		beginInfo.framebuffer = sceneFramebuffers[imageIndex];
-		beginInfo.renderArea = { {0, 0}, {swapchain.width, swapchain.height} };
+		beginInfo.framebuffer = sceneFramebuffers[getFramebufferIndex(imageIndex)];
+		beginInfo.renderArea = { {0, 0}, {renderWidth, renderHeight} };
 		beginInfo.clearValueCount = ARRAY_COUNT(clearValues);
 		beginInfo.pClearValues = clearValues;
+		if(useOcclusionCulling) {
+			recordOcclusionCulling(commandBuffer, imageIndex, frameIndex, &beginInfo);
+			beginInfo.renderPass = renderPassLoad;
+		}
+		beginGpuScope(&gpuProfiler, commandBuffer, "Scene");
 		vkCmdBeginRenderPass(commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 #if 0
@@ -699,168 +3057,175 @@ void renderApplication() {
 		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, spritePipeline.pipelineLayout, 0, 1, &spriteDescriptorSet, 0, 0);
 		vkCmdDrawIndexed(commandBuffer, ARRAY_COUNT(indexData), 1, 0, 0, 0);
 #else
-		glm::mat4 translationMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 2.0f));
-		glm::mat4 scaleMatrix = glm::scale(glm::mat4(1.0f), glm::vec3(100.0f));
-		glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), -time, glm::vec3(0.0f, 1.0f, 0.0f));
-		glm::mat4 modelMatrix = translationMatrix * scaleMatrix * rotationMatrix;
-
-		glm::mat4 modelViewProj = camera.viewProj * modelMatrix;
-		glm::mat4 modelView = camera.view * modelMatrix;
-
-		void* mapped;
-		VK(vkMapMemory(context->device, modelUniformBuffers[frameIndex].memory, 0, sizeof(glm::mat4)*2, 0, &mapped));
-		memcpy(mapped, &modelViewProj, sizeof(modelViewProj));
-		memcpy(((uint8_t*)mapped)+sizeof(glm::mat4), &modelView, sizeof(modelView));
-
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, modelPipeline.pipeline);
-		VkDeviceSize offset = 0;
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &model.vertexBuffer.buffer, &offset);
-		vkCmdBindIndexBuffer(commandBuffer, model.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
-		uint32_t dynamicOffset = 0;
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, modelPipeline.pipelineLayout, 0, 1, &modelDescriptorSets[frameIndex], 1, &dynamicOffset);
-		vkCmdDrawIndexed(commandBuffer, model.numIndices, 1, 0, 0, 0);
-
-
-		// Second instance
-		modelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 5.0f)) * scaleMatrix * rotationMatrix;
-		modelViewProj = camera.viewProj * modelMatrix;
-		modelView = camera.view * modelMatrix;
-
-		mapped = ((uint8_t*)mapped) + singleElementSize;
-		memcpy(mapped, &modelViewProj, sizeof(modelViewProj));
-		memcpy(((uint8_t*)mapped)+sizeof(glm::mat4), &modelView, sizeof(modelView));
-
-		dynamicOffset = singleElementSize;
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, modelPipeline.pipelineLayout, 0, 1, &modelDescriptorSets[frameIndex], 1, &dynamicOffset);
-		vkCmdDrawIndexed(commandBuffer, model.numIndices, 1, 0, 0, 0);
-
-		VK(vkUnmapMemory(context->device, modelUniformBuffers[frameIndex].memory));
+		// With occlusion culling the late draws, the instances that were found visible but not drawn by the early pass
+		drawSceneModels(commandBuffer, frameIndex, useOcclusionCulling, false);
 #endif
 
 		ImGui::Render();
 		ImDrawData* drawData = ImGui::GetDrawData();
-		ImGui_ImplVulkan_RenderDrawData(drawData, commandBuffer);
-
-		vkCmdEndRenderPass(commandBuffer);
+		// The UI goes through the upscale with the scene
+		drawData->FramebufferScale = ImVec2(renderUvScale.x, renderUvScale.y);
+		if(!sceneVelocity) {
+			ImGui_ImplVulkan_RenderDrawData(drawData, commandBuffer);
+		}
 
-		// Gauss vertical
-		beginInfo.renderPass = gaussRenderPass;
-		beginInfo.framebuffer = gaussFramebuffers[imageIndex];
-		vkCmdBeginRenderPass(commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, gaussPipelineVertical.pipeline);
-		VkDescriptorImageInfo imageInfo = {linearSampler, multisampleTargetBuffers[imageIndex].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
-		VkWriteDescriptorSet descriptorWrite = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
-		descriptorWrite.dstSet = gaussDescriptorSetsVertical[frameIndex];
-		descriptorWrite.dstBinding = 0;
-		descriptorWrite.descriptorCount = 1;
-		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrite.pImageInfo = &imageInfo;
-		vkUpdateDescriptorSets(context->device, 1, &descriptorWrite, 0, 0);
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, gaussPipelineVertical.pipelineLayout, 0, 1, &gaussDescriptorSetsVertical[frameIndex], 0, 0);
-		float pixelSize = 1.0f / swapchain.height;
-		vkCmdPushConstants(commandBuffer, gaussPipelineVertical.pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 4, &pixelSize);
+		// Post process subpass. Reads the resolved scene in place
+		vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+		{
+			VulkanImage* resolved = (sceneSamples == VK_SAMPLE_COUNT_1_BIT) ? &colorBuffers[imageIndex] : &resolveBuffers[imageIndex];
+			VkDescriptorImageInfo imageInfo = {0, resolved->view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+			VkWriteDescriptorSet descriptorWrite = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+			descriptorWrite.dstSet = postprocessDescriptorSets[frameIndex];
+			descriptorWrite.dstBinding = 0;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			descriptorWrite.pImageInfo = &imageInfo;
+			vkUpdateDescriptorSets(context->device, 1, &descriptorWrite, 0, 0);
+		}
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, postprocessPipeline.pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, postprocessPipeline.pipelineLayout, 0, 1, &postprocessDescriptorSets[frameIndex], 0, 0);
+		vkCmdPushConstants(commandBuffer, postprocessPipeline.pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(postprocessSettings), &postprocessSettings);
 		vkCmdDraw(commandBuffer, 3, 1, 0, 0);
-		vkCmdEndRenderPass(commandBuffer);
+		if(sceneVelocity) {
+			ImGui_ImplVulkan_RenderDrawData(drawData, commandBuffer);
+		}
 
-		// Gauss horizontal
-		beginInfo.renderPass = gaussRenderPassFinal;
-		beginInfo.framebuffer = swapchainFramebuffers[imageIndex];
-		beginInfo.renderArea = { {0, 0}, {swapchain.width, swapchain.height} };
-		vkCmdBeginRenderPass(commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, gaussPipelineHorizontal.pipeline);
-		imageInfo = {sampler, gaussBuffers[imageIndex].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
-		descriptorWrite = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
-		descriptorWrite.dstSet = gaussDescriptorSetsHorizontal[frameIndex];
-		descriptorWrite.dstBinding = 0;
-		descriptorWrite.descriptorCount = 1;
-		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrite.pImageInfo = &imageInfo;
-		vkUpdateDescriptorSets(context->device, 1, &descriptorWrite, 0, 0);
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, gaussPipelineHorizontal.pipelineLayout, 0, 1, &gaussDescriptorSetsHorizontal[frameIndex], 0, 0);
-		pixelSize = 1.0f / swapchain.width;
-		vkCmdPushConstants(commandBuffer, gaussPipelineHorizontal.pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 4, &pixelSize);
-		vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 		vkCmdEndRenderPass(commandBuffer);
+		endGpuScope(&gpuProfiler, commandBuffer);
 
-		VK(vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, timestampQueryPools[frameIndex], 1));
-
-		{ // Swapchain Attachment Output -> Compute Write
-			VkImageSubresourceRange subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-			VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
-			imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			imageBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-			imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-			imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			imageBarrier.image = swapchain.images[imageIndex];
-			imageBarrier.subresourceRange = subresourceRange;
-			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
-		}
-		{ // MultisampleTarget Shader Read -> Compute Read
-			VkImageSubresourceRange subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-			VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
-			imageBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-			imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-			imageBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-			imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			imageBarrier.image = multisampleTargetBuffers[imageIndex].image;
-			imageBarrier.subresourceRange = subresourceRange;
-			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
-		}
-
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline.pipeline);
-		imageInfo = {0, swapchain.imageViews[imageIndex], VK_IMAGE_LAYOUT_GENERAL};
-		VkDescriptorImageInfo imageInfo2 = {0, multisampleTargetBuffers[imageIndex].view, VK_IMAGE_LAYOUT_GENERAL};
-		VkWriteDescriptorSet descriptorWrites[2];
-		descriptorWrites[0] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
-		descriptorWrites[0].dstSet = computeDescriptorSets[frameIndex];
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-		descriptorWrites[0].pImageInfo = &imageInfo;
-		descriptorWrites[1] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
-		descriptorWrites[1].dstSet = computeDescriptorSets[frameIndex];
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-		descriptorWrites[1].pImageInfo = &imageInfo2;
-		vkUpdateDescriptorSets(context->device, ARRAY_COUNT(descriptorWrites), descriptorWrites, 0, 0);
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline.pipelineLayout, 0, 1, &computeDescriptorSets[frameIndex], 0, 0);
-		#define GROUP_SIZE 8
-		vkCmdDispatch(commandBuffer, (swapchain.width + (GROUP_SIZE-1)) / GROUP_SIZE, (swapchain.height + (GROUP_SIZE-1)) / GROUP_SIZE, 1);
-
-		{ // Swapchain Compute Write -> Present
-			VkImageSubresourceRange subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-			VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
-			imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-			imageBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-			imageBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-			imageBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-			imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			imageBarrier.image = swapchain.images[imageIndex];
-			imageBarrier.subresourceRange = subresourceRange;
-			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
-		}
-
-		VK(vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, timestampQueryPools[frameIndex], 2));
+		if(activeAaMode != AA_MODE_MSAA) {
+			recordAntiAliasing(commandBuffer, imageIndex, frameIndex);
+		}
+
+		beginGpuScope(&gpuProfiler, commandBuffer, "Blur");
+
+		if(blurMode == BLUR_MODE_DUAL_FILTER) {
+			recordDualFilterBlur(commandBuffer, imageIndex, frameIndex);
+		} else {
+			// Gauss vertical
+			ColorPass gaussPass = {};
+			if(!useDynamicRendering) {
+				gaussPass.renderPass = gaussRenderPass;
+				gaussPass.framebuffer = gaussFramebuffers[getFramebufferIndex(imageIndex)];
+			}
+			gaussPass.image = gaussBuffers[imageIndex].image;
+			gaussPass.view = gaussBuffers[imageIndex].view;
+			gaussPass.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			beginColorPass(commandBuffer, &gaussPass, beginInfo.renderArea);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, gaussPipelineVertical.pipeline);
+			VkDescriptorImageInfo imageInfo = {linearSampler, multisampleTargetBuffers[imageIndex].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+			VkWriteDescriptorSet descriptorWrite = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+			descriptorWrite.dstSet = gaussDescriptorSetsVertical[frameIndex];
+			descriptorWrite.dstBinding = 0;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrite.pImageInfo = &imageInfo;
+			vkUpdateDescriptorSets(context->device, 1, &descriptorWrite, 0, 0);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, gaussPipelineVertical.pipelineLayout, 0, 1, &gaussDescriptorSetsVertical[frameIndex], 0, 0);
+			float gaussConstants[3] = {renderUvScale.x, renderUvScale.y, 1.0f / swapchain.height};
+			vkCmdPushConstants(commandBuffer, gaussPipelineVertical.pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(gaussConstants), gaussConstants);
+			vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+			endColorPass(commandBuffer, &gaussPass);
+
+			// Gauss horizontal, upscales to the swapchain
+			ColorPass swapchainPass = getSwapchainPass(imageIndex);
+			beginColorPass(commandBuffer, &swapchainPass, { {0, 0}, {swapchain.width, swapchain.height} });
+			VkViewport swapchainViewport = { 0.0f, 0.0f, (float)swapchain.width, (float)swapchain.height, 0.0f, 1.0f};
+			VkRect2D swapchainScissor = { {0, 0}, {swapchain.width, swapchain.height} };
+			vkCmdSetViewport(commandBuffer, 0, 1, &swapchainViewport);
+			vkCmdSetScissor(commandBuffer, 0, 1, &swapchainScissor);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, gaussPipelineHorizontal.pipeline);
+			imageInfo = {linearSampler, gaussBuffers[imageIndex].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+			descriptorWrite = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+			descriptorWrite.dstSet = gaussDescriptorSetsHorizontal[frameIndex];
+			descriptorWrite.dstBinding = 0;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrite.pImageInfo = &imageInfo;
+			vkUpdateDescriptorSets(context->device, 1, &descriptorWrite, 0, 0);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, gaussPipelineHorizontal.pipelineLayout, 0, 1, &gaussDescriptorSetsHorizontal[frameIndex], 0, 0);
+			gaussConstants[2] = 1.0f / swapchain.width;
+			vkCmdPushConstants(commandBuffer, gaussPipelineHorizontal.pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(gaussConstants), gaussConstants);
+			vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+			endColorPass(commandBuffer, &swapchainPass);
+		}
+
+		endGpuScope(&gpuProfiler, commandBuffer);
+
+		if(useAsyncCompute) {
+			if(context->computeQueue.familyIndex != context->graphicsQueue.familyIndex) {
+				// Release the scene image to the compute queue family
+				VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+				imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+				imageBarrier.dstAccessMask = 0;
+				imageBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+				imageBarrier.srcQueueFamilyIndex = context->graphicsQueue.familyIndex;
+				imageBarrier.dstQueueFamilyIndex = context->computeQueue.familyIndex;
+				imageBarrier.image = multisampleTargetBuffers[imageIndex].image;
+				imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
+			}
+		} else {
+			recordComputeBlur(commandBuffer, imageIndex, frameIndex, false);
+		}
 
+		endGpuScope(&gpuProfiler, commandBuffer);
+		VKA(vkEndCommandBuffer(commandBuffer));
+	}
+	if(useAsyncCompute) {
+		PROFILE_ZONE("Record compute");
+		VkCommandBuffer commandBuffer = computeCommandBuffers[frameIndex];
+		VKA(vkResetCommandPool(context->device, computeCommandPools[frameIndex], 0));
+		VKA(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+		recordComputeBlur(commandBuffer, imageIndex, frameIndex, true);
 		VKA(vkEndCommandBuffer(commandBuffer));
 	}
 	
-	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffers[frameIndex];
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &acquireSemaphores[frameIndex];
-	VkPipelineStageFlags waitMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	submitInfo.pWaitDstStageMask = &waitMask;
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &releaseSemaphores[frameIndex];
-	VKA(vkQueueSubmit(context->graphicsQueue.queue, 1, &submitInfo, fences[frameIndex]));
+	{
+		PROFILE_ZONE("submitWithValue");
+		VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffers[frameIndex];
+		submitInfo.waitSemaphoreCount = headless ? 0 : 1;
+		submitInfo.pWaitSemaphores = &acquireSemaphores[frameIndex];
+		VkPipelineStageFlags waitMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		submitInfo.pWaitDstStageMask = &waitMask;
+		submitInfo.signalSemaphoreCount = 1;
+		if(useAsyncCompute) {
+			// The compute submission finishes the frame, its value is the one to wait for
+			submitInfo.pSignalSemaphores = &graphicsDoneSemaphores[frameIndex];
+			submitWithValue(context, &context->graphicsQueue, &submitInfo);
+
+			VkSubmitInfo computeSubmitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+			computeSubmitInfo.commandBufferCount = 1;
+			computeSubmitInfo.pCommandBuffers = &computeCommandBuffers[frameIndex];
+			computeSubmitInfo.waitSemaphoreCount = 1;
+			computeSubmitInfo.pWaitSemaphores = &graphicsDoneSemaphores[frameIndex];
+			VkPipelineStageFlags computeWaitMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+			computeSubmitInfo.pWaitDstStageMask = &computeWaitMask;
+			// Without present nobody would wait on the release semaphore
+			computeSubmitInfo.signalSemaphoreCount = headless ? 0 : 1;
+			computeSubmitInfo.pSignalSemaphores = &releaseSemaphores[frameIndex];
+			frameValues[frameIndex] = submitWithValue(context, &context->computeQueue, &computeSubmitInfo);
+		} else {
+			submitInfo.signalSemaphoreCount = headless ? 0 : 1;
+			submitInfo.pSignalSemaphores = &releaseSemaphores[frameIndex];
+			frameValues[frameIndex] = submitWithValue(context, &context->graphicsQueue, &submitInfo);
+		}
+		retireStreamingResources(&textureStreamer, &deletionQueue, frameValues[frameIndex]);
+		for(uint32_t i = 0; i < retiredInstanceBuffers.size(); ++i) {
+			retireBuffer(&deletionQueue, &retiredInstanceBuffers[i], frameValues[frameIndex]);
+		}
+		retiredInstanceBuffers.clear();
+	}
+
+	if(headless) {
+		frameNumber++;
+		return;
+	}
 
 	VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
 	presentInfo.swapchainCount = 1;
@@ -868,7 +3233,10 @@ void renderApplication() {
 	presentInfo.pImageIndices = &imageIndex;
 	presentInfo.waitSemaphoreCount = 1;
 	presentInfo.pWaitSemaphores = &releaseSemaphores[frameIndex];
-	result = VK(vkQueuePresentKHR(context->graphicsQueue.queue, &presentInfo));
+	{
+		PROFILE_ZONE("vkQueuePresentKHR");
+		result = VK(vkQueuePresentKHR(context->graphicsQueue.queue, &presentInfo));
+	}
 	if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
 		// Swapchain is out of date
 		recreateSwapchain();
@@ -876,7 +3244,7 @@ void renderApplication() {
 		ASSERT_VULKAN(result);
 	}
 
-	frameIndex = (frameIndex + 1) % FRAMES_IN_FLIGHT;
+	frameNumber++;
 }
 
 void shutdownApplication() {
@@ -885,91 +3253,167 @@ void shutdownApplication() {
 	// Destroy ImGui
 	ImGui_ImplVulkan_Shutdown();
 	VK(vkDestroyDescriptorPool(context->device, imguiDescriptorPool, 0));
-	ImGui_ImplSDL2_Shutdown();
+	if(!headless) {
+		ImGui_ImplSDL2_Shutdown();
+	}
 	ImGui::DestroyContext();
 
 	VK(vkDestroyDescriptorPool(context->device, modelDescriptorPool, 0));
 	VK(vkDestroyDescriptorSetLayout(context->device, modelDescriptorSetLayout, 0));
-	destroyModel(context, &model);
-	for(uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
-		destroyBuffer(context, &modelUniformBuffers[i]);
+	destroyModelLoader(&modelLoader);
+	for(uint32_t i = 0; i < modelCount; ++i) {
+		if(modelResident[i]) {
+			destroyModel(context, &models[i]);
+		}
 	}
-
-	for(uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
-		vkDestroyQueryPool(context->device, timestampQueryPools[i], 0);
+	destroyScene(&scene);
+	for(uint32_t i = 0; i < framesInFlight; ++i) {
+		destroyBuffer(context, &instanceBuffers[i]);
+		destroyBuffer(context, &occlusionStatsBuffers[i]);
+		VK(vkUnmapMemory(context->device, lightBuffers[i].memory));
+		destroyBuffer(context, &lightBuffers[i]);
 	}
+	destroyBuffer(context, &clusterBuffer);
+	VK(vkDestroyDescriptorPool(context->device, lightingDescriptorPool, 0));
+	VK(vkDestroyDescriptorSetLayout(context->device, lightingDescriptorSetLayout, 0));
+	destroyBuffer(context, &drawCommandBuffer);
+	destroyBuffer(context, &visibilityBuffer);
+	VK(vkDestroyDescriptorPool(context->device, occlusionDescriptorPool, 0));
+	VK(vkDestroyDescriptorSetLayout(context->device, occlusionCullDescriptorSetLayout, 0));
+	VK(vkDestroyDescriptorSetLayout(context->device, hizDescriptorSetLayout, 0));
+
+	destroyGpuProfiler(context, &gpuProfiler);
 
 	VK(vkDestroyDescriptorPool(context->device, spriteDescriptorPool, 0));
 	VK(vkDestroyDescriptorSetLayout(context->device, spriteDescriptorLayout, 0));
 	VK(vkDestroyDescriptorPool(context->device, gaussDescriptorPool, 0));
 	VK(vkDestroyDescriptorSetLayout(context->device, gaussDescriptorSetLayout, 0));
+	VK(vkDestroyDescriptorPool(context->device, dualFilterDescriptorPool, 0));
+	VK(vkDestroyDescriptorPool(context->device, postprocessDescriptorPool, 0));
+	VK(vkDestroyDescriptorSetLayout(context->device, postprocessDescriptorSetLayout, 0));
+	VK(vkDestroyDescriptorPool(context->device, aaDescriptorPool, 0));
+	VK(vkDestroyDescriptorSetLayout(context->device, aaDescriptorSetLayout, 0));
 	VK(vkDestroyDescriptorSetLayout(context->device, computeDescriptorSetLayout, 0));
 	destroyBuffer(context, &spriteVertexBuffer);
 	destroyBuffer(context, &spriteIndexBuffer);
 	destroyImage(context, &image);
 
-	for(uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
-		VK(vkDestroyFence(context->device, fences[i], 0));
+	for(uint32_t i = 0; i < framesInFlight; ++i) {
 		VK(vkDestroySemaphore(context->device, acquireSemaphores[i], 0));
 		VK(vkDestroySemaphore(context->device, releaseSemaphores[i], 0));
+		VK(vkDestroySemaphore(context->device, graphicsDoneSemaphores[i], 0));
 	}
-	for(uint32_t i = 0; i < ARRAY_COUNT(commandPools); ++i) {
+	for(uint32_t i = 0; i < framesInFlight; ++i) {
 		VK(vkDestroyCommandPool(context->device, commandPools[i], 0));
+		VK(vkDestroyCommandPool(context->device, computeCommandPools[i], 0));
 	}
 
-	destroyPipeline(context, &spritePipeline);
-	destroyPipeline(context, &modelPipeline);
+	destroyScenePipelines();
+	destroyPipeline(context, &occlusionCullPipeline);
+	destroyPipeline(context, &hizDepthPipeline);
+	destroyPipeline(context, &hizDepthPipelineSingle);
+	destroyPipeline(context, &hizReducePipeline);
+	destroyPipeline(context, &clusterLightsPipeline);
 	destroyPipeline(context, &gaussPipelineHorizontal);
 	destroyPipeline(context, &gaussPipelineVertical);
-	destroyPipeline(context, &computePipeline);
+	destroyPipeline(context, &dualFilterPipelineDown);
+	destroyPipeline(context, &dualFilterPipelineUp);
+	destroyPipeline(context, &fxaaPipeline);
+	destroyPipeline(context, &taaPipeline);
+	for(uint32_t i = 0; i < ARRAY_COUNT(computeBlurRadii); ++i) {
+		destroyPipeline(context, &computePipelinesHorizontal[i]);
+		destroyPipeline(context, &computePipelinesVertical[i]);
+	}
 
 	vkDestroySampler(context->device, sampler, 0);
+	vkDestroySampler(context->device, textureSampler, 0);
 	vkDestroySampler(context->device, linearSampler, 0);
 
 	destroyPipelineCache(context, pipelineCache, "../shaders/pipeline_cache.bin");
 
-	for (uint32_t i = 0; i < sceneFramebuffers.size(); ++i) {
-		VK(vkDestroyFramebuffer(context->device, sceneFramebuffers[i], 0));
-		VK(vkDestroyFramebuffer(context->device, gaussFramebuffers[i], 0));
-		VK(vkDestroyFramebuffer(context->device, swapchainFramebuffers[i], 0));
-	}
-	sceneFramebuffers.clear();
-	gaussFramebuffers.clear();
-	swapchainFramebuffers.clear();
-	for(uint32_t i = 0; i < depthBuffers.size(); ++i) {
-		destroyImage(context, &depthBuffers[i]);
-	}
-	for(uint32_t i = 0; i < colorBuffers.size(); ++i) {
-		destroyImage(context, &colorBuffers[i]);
-	}
-	for(uint32_t i = 0; i < multisampleTargetBuffers.size(); ++i) {
-		destroyImage(context, &multisampleTargetBuffers[i]);
-	}
-	for(uint32_t i = 0; i < gaussBuffers.size(); ++i) {
-		destroyImage(context, &gaussBuffers[i]);
-	}
-	colorBuffers.clear();
-	depthBuffers.clear();
-	multisampleTargetBuffers.clear();
-	gaussBuffers.clear();
-	destroyRenderpass(context, renderPass);
-	destroyRenderpass(context, gaussRenderPass);
-	destroyRenderpass(context, gaussRenderPassFinal);
+	retireRenderTargets();
+	retireRenderPasses();
+	flushDeletionQueue(context, &deletionQueue, UINT64_MAX);
 	destroySwapchain(context, &swapchain);
-	VK(vkDestroySurfaceKHR(context->instance, surface, 0));
+	if(surface) {
+		VK(vkDestroySurfaceKHR(context->instance, surface, 0));
+	}
 	exitVulkan(context);
 }
 
+// Flame graph of the zones of the last frame. One block of rows per thread, one row per nesting depth
+void drawCpuProfilerWindow() {
+	ImGui::Begin("CPU profiler", &showCpuProfiler);
+	const CpuProfilerFrame* frame = cpuProfilerLastFrame();
+	uint64_t frameBegin = frame->beginNs;
+	uint64_t frameEnd = glm::max(frame->endNs, frameBegin + 1);
+	ImGui::Text("Frame %.3fms, %u zones", double(frameEnd - frameBegin) * 1e-6, frame->zoneCount);
+
+	ImDrawList* drawList = ImGui::GetWindowDrawList();
+	ImVec2 origin = ImGui::GetCursorScreenPos();
+	float width = glm::max(ImGui::GetContentRegionAvail().x, 1.0f);
+	float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+	float scale = width / float(frameEnd - frameBegin);
+	uint32_t thread = ~0u;
+	uint32_t threadRow = 0;
+	uint32_t rowCount = 0;
+	for(uint32_t i = 0; i < frame->zoneCount; ++i) {
+		const CpuProfilerZone* zone = &frame->zones[i];
+		if(zone->thread != thread) {
+			// Thread name above its zones
+			thread = zone->thread;
+			drawList->AddText(ImVec2(origin.x, origin.y + rowCount * rowHeight), IM_COL32(255, 255, 255, 255), cpuProfilerThreadName(thread));
+			threadRow = rowCount + 1;
+		}
+		rowCount = glm::max(rowCount, threadRow + zone->depth + 1);
+
+		uint64_t begin = glm::clamp(zone->beginNs, frameBegin, frameEnd);
+		uint64_t end = glm::clamp(zone->endNs, frameBegin, frameEnd);
+		ImVec2 min(origin.x + (begin - frameBegin) * scale, origin.y + (threadRow + zone->depth) * rowHeight);
+		ImVec2 max(origin.x + (end - frameBegin) * scale, min.y + rowHeight - 1.0f);
+		if(max.x - min.x < 1.0f) {
+			continue;
+		}
+		uint32_t hash = (uint32_t)(((uintptr_t)zone->name * 2654435761u) >> 8);
+		ImU32 color = IM_COL32(80 + (hash & 0x7F), 80 + ((hash >> 8) & 0x7F), 80 + ((hash >> 16) & 0x7F), 255);
+		drawList->AddRectFilled(min, max, color);
+		drawList->PushClipRect(min, max, true);
+		drawList->AddText(ImVec2(min.x + 2.0f, min.y), IM_COL32(0, 0, 0, 255), zone->name);
+		drawList->PopClipRect();
+		if(ImGui::IsMouseHoveringRect(min, max)) {
+			ImGui::SetTooltip("%s: %.3fms", zone->name, double(zone->endNs - zone->beginNs) * 1e-6);
+		}
+	}
+	ImGui::Dummy(ImVec2(width, rowCount * rowHeight));
+	ImGui::End();
+}
+
 void updateApplication(float delta) {
+	PROFILE_ZONE("updateApplication");
+	applyAntiAliasingMode();
 	ImGui_ImplVulkan_NewFrame();
-	ImGui_ImplSDL2_NewFrame();
+	if(headless) {
+		// Normally done by the SDL backend
+		ImGuiIO& io = ImGui::GetIO();
+		io.DisplaySize = ImVec2((float)swapchain.width, (float)swapchain.height);
+		io.DeltaTime = (delta > 0.0f) ? delta : 1.0f / 60.0f;
+	} else {
+		ImGui_ImplSDL2_NewFrame();
+	}
 	ImGui::NewFrame();
 
-	const uint8_t* keys = SDL_GetKeyboardState(0);
-	int mouseX, mouseY;
-	uint32_t mouseButtons = SDL_GetRelativeMouseState(&mouseX, &mouseY);
+	sceneTime += delta;
+
+	const uint8_t* keys = 0;
+	int mouseX = 0, mouseY = 0;
+	if(!headless) {
+		keys = SDL_GetKeyboardState(0);
+		SDL_GetRelativeMouseState(&mouseX, &mouseY);
+	}
 
-	if(SDL_GetRelativeMouseMode()) {
+	if(benchmarkFilename) {
+		updateBenchmarkCamera();
+	} else if(!headless && SDL_GetRelativeMouseMode()) {
 		float cameraSpeed = 5.0f;
 		float mouseSensitivity = 0.27f;
 
@@ -1003,7 +3447,7 @@ void updateApplication(float delta) {
 	front.y = sin(glm::radians(camera.pitch));
 	front.z = cos(glm::radians(camera.pitch)) * cos(glm::radians(camera.yaw));
 	camera.cameraDirection = glm::normalize(front);
-	camera.proj = getProjectionInverseZ(glm::radians(45.0f), swapchain.width, swapchain.height, 0.01f);
+	camera.proj = getProjectionInverseZ(glm::radians(CAMERA_FOVY), swapchain.width, swapchain.height, CAMERA_NEAR);
 	camera.view = glm::lookAtLH(camera.cameraPosition, camera.cameraPosition + camera.cameraDirection, camera.up);
 	camera.viewProj = camera.proj * camera.view;
 
@@ -1011,42 +3455,651 @@ void updateApplication(float delta) {
 	if(showDemoWindow) {
 		ImGui::ShowDemoWindow(&showDemoWindow);
 	}
+
+	ImGui::Begin("Compute blur");
+	int radiusIndex = (int)computeRadiusIndex;
+	for(uint32_t i = 0; i < ARRAY_COUNT(computeBlurRadii); ++i) {
+		ImGui::PushID(i);
+		if(ImGui::RadioButton("##radius", &radiusIndex, i)) {
+			computeRadiusIndex = (uint32_t)radiusIndex;
+		}
+		ImGui::SameLine();
+		ImGui::Text("Radius %u: %.3fms", computeBlurRadii[i], computeBenchmark.results[i]);
+		ImGui::PopID();
+	}
+	if(!computeBenchmark.running && ImGui::Button("Run benchmark")) {
+		startBenchmark(&computeBenchmark, ARRAY_COUNT(computeBlurRadii));
+	}
+	ImGui::Separator();
+	if(context->computeQueue.queue != context->graphicsQueue.queue) {
+		ImGui::Checkbox("Async compute", &asyncCompute);
+		ImGui::Text("Compute queue family %u, graphics queue family %u", context->computeQueue.familyIndex, context->graphicsQueue.familyIndex);
+	} else {
+		ImGui::Text("Async compute unavailable: single queue");
+	}
+	ImGui::Text("Graphics queue only: frame %.3fms, compute %.3fms", gpuFrameTimeAvg[0], gpuComputeTimeAvg[0]);
+	ImGui::Text("Async compute:       frame %.3fms, compute %.3fms", gpuFrameTimeAvg[1], gpuComputeTimeAvg[1]);
+	ImGui::End();
+
+	ImGui::Begin("Scene");
+	ImGui::Checkbox("Frustum culling", &frustumCulling);
+	uint32_t instanceCount = (uint32_t)sceneInstances.entities.size();
+	ImGui::Text("%u of %u instances visible, %u BVH nodes", frustumCulling ? (uint32_t)visibleInstances.size() : instanceCount, instanceCount, (uint32_t)sceneBvh.nodes.size());
+	uint32_t residentCount = 0;
+	for(uint32_t m = 0; m < modelCount; ++m) {
+		residentCount += modelResident[m] ? 1 : 0;
+	}
+	ImGui::Text("%u of %u models resident, %u loading", residentCount, modelCount, modelLoader.pendingCount);
+	ImGui::Checkbox("Depth prepass", &depthPrepass);
+	ImGui::SliderInt("Lights", &lightCount, 0, MAX_LIGHTS);
+	ImGui::Checkbox("Naive lighting", &naiveLighting);
+	if(occlusionCullingSupported) {
+		ImGui::Checkbox("Occlusion culling", &occlusionCulling);
+	} else {
+		ImGui::Text("Occlusion culling unavailable: no drawIndirectFirstInstance");
+	}
+	if(occlusionStatsValid) {
+		ImGui::Text("%u in frustum: %u drawn early, %u drawn late, %u occluded", occlusionStats.inFrustum, occlusionStats.drawnEarly, occlusionStats.drawnLate, occlusionStats.occluded);
+	}
+	if(pickedInstance != BVH_NO_ITEM) {
+		ImGui::Text("Picked entity %u", sceneInstances.entities[pickedInstance]);
+	} else {
+		ImGui::Text("Right click to pick an instance");
+	}
+	ImGui::SliderInt("Texture budget", &textureBudgetMb, 1, 4096, "%dMB");
+	ImGui::Text("Textures: %.1fMB resident, %u streamed in, %u evicted, %.1fMB uploaded", textureStreamer.residentBytes / 1048576.0,
+				textureStreamer.streamedIn, textureStreamer.evicted, textureStreamer.uploadedBytes / 1048576.0);
+	ImGui::End();
+
+	ImGui::Begin("Post process");
+	ImGui::SliderFloat("Exposure", &postprocessSettings.exposure, 0.0f, 4.0f);
+	ImGui::SliderFloat("Contrast", &postprocessSettings.contrast, 0.0f, 2.0f);
+	ImGui::SliderFloat("Saturation", &postprocessSettings.saturation, 0.0f, 2.0f);
+	ImGui::Separator();
+	ImGui::RadioButton("MSAA", &aaMode, AA_MODE_MSAA);
+	ImGui::SameLine();
+	ImGui::RadioButton("FXAA", &aaMode, AA_MODE_FXAA);
+	ImGui::SameLine();
+	ImGui::RadioButton("TAA", &aaMode, AA_MODE_TAA);
+	if(aaMode == AA_MODE_MSAA) {
+		ImGui::RadioButton("1x", &msaaSamples, 1);
+		ImGui::SameLine();
+		ImGui::RadioButton("2x", &msaaSamples, 2);
+		ImGui::SameLine();
+		ImGui::RadioButton("4x", &msaaSamples, 4);
+		ImGui::SameLine();
+		ImGui::RadioButton("8x", &msaaSamples, 8);
+	} else if(aaMode == AA_MODE_TAA) {
+		ImGui::SliderFloat("History feedback", &taaFeedback, 0.5f, 0.98f);
+	}
+	ImGui::Text("Active: %s, %u samples", aaModeNames[activeAaMode], (uint32_t)sceneSamples);
+	ImGui::End();
+
+	ImGui::Begin("Blur");
+	ImGui::RadioButton("Gaussian", &blurMode, BLUR_MODE_GAUSS);
+	ImGui::SameLine();
+	ImGui::RadioButton("Dual filter", &blurMode, BLUR_MODE_DUAL_FILTER);
+	ImGui::SliderInt("Levels", &dualFilterLevels, 1, blurPyramidLevels);
+	ImGui::SliderFloat("Offset", &dualFilterOffset, 0.5f, 4.0f);
+	ImGui::Text("GPU time at %ux%u", swapchain.width, swapchain.height);
+	ImGui::Text("Gaussian: %.3fms", blurBenchmark.results[0]);
+	for(uint32_t i = 1; i <= blurPyramidLevels; ++i) {
+		ImGui::Text("Dual filter %u levels: %.3fms", i, blurBenchmark.results[i]);
+	}
+	if(!blurBenchmark.running && ImGui::Button("Run benchmark")) {
+		startBenchmark(&blurBenchmark, blurPyramidLevels + 1);
+	}
+	ImGui::End();
+
+	ImGui::Begin("Swapchain");
+	bool swapchainChanged = false;
+	int presentMode = (int)requestedPresentMode;
+	for(uint32_t i = 0; i < ARRAY_COUNT(presentModes); ++i) {
+		if(ImGui::RadioButton(presentModes[i].name, &presentMode, presentModes[i].mode)) {
+			requestedPresentMode = (VkPresentModeKHR)presentMode;
+			swapchainChanged = true;
+		}
+	}
+	int imageCount = (int)requestedImageCount;
+	if(ImGui::SliderInt("Images", &imageCount, 2, 8)) {
+		requestedImageCount = (uint32_t)imageCount;
+		swapchainChanged = true;
+	}
+	ImGui::SliderInt("FPS limit", &frameRateLimit, 0, 240, frameRateLimit ? "%d" : "Off");
+	ImGui::Text("Active: %s, %u images, %u frames in flight", getPresentModeName(swapchain.presentMode), (uint32_t)swapchain.images.size(), framesInFlight);
+	ImGui::Text("%.1f fps, latency %.2fms%s", 1.0f / glm::max(delta, 1e-6f), frameLatencyAvg, gpuProfiler.calibrated ? "" : " (upper bound)");
+	ImGui::Text("Rendering path: %s", renderingPathNames[renderingPath]);
+	ImGui::Separator();
+	ImGui::Checkbox("Dynamic resolution", &dynamicResolution);
+	ImGui::SliderFloat("GPU budget", &gpuBudgetMs, 1.0f, 50.0f, "%.1fms");
+	ImGui::Text("Render scale %.2f, %ux%u", renderScale, renderWidth, renderHeight);
+	ImGui::End();
+	if(swapchainChanged) {
+		recreateSwapchain();
+	}
+
+	if(showProfiler) {
+		ImGui::Begin("GPU profiler", &showProfiler);
+		if(ImGui::BeginTable("scopes", 6)) {
+			ImGui::TableSetupColumn("Scope");
+			ImGui::TableSetupColumn("Last");
+			ImGui::TableSetupColumn("Min");
+			ImGui::TableSetupColumn("Avg");
+			ImGui::TableSetupColumn("Max");
+			ImGui::TableSetupColumn("P99");
+			ImGui::TableHeadersRow();
+			for(uint32_t i = 0; i < gpuProfiler.statsCount; ++i) {
+				GpuProfilerStats* stats = &gpuProfiler.stats[i];
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::Indent(stats->depth * 10.0f + 1.0f);
+				ImGui::TextUnformatted(stats->name);
+				ImGui::Unindent(stats->depth * 10.0f + 1.0f);
+				ImGui::TableNextColumn();
+				if(stats->lastTime >= 0.0) {
+					ImGui::Text("%.3f", stats->lastTime);
+				} else {
+					ImGui::TextUnformatted("-");
+				}
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", stats->min);
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", stats->avg);
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", stats->max);
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", stats->p99);
+			}
+			ImGui::EndTable();
+		}
+		ImGui::Text("Times in ms over the last %u frames. %s", GPU_PROFILER_HISTORY, gpuProfiler.calibrated ? "Calibrated timestamps" : "Uncalibrated timestamps");
+		if(gpuProfiler.captureFramesLeft > 0) {
+			ImGui::Text("Capturing, %u frames left", gpuProfiler.captureFramesLeft);
+		} else if(ImGui::Button("Capture trace")) {
+			captureProfilerTrace(&gpuProfiler, 120, "profile_trace.json");
+		}
+		ImGui::End();
+	}
+
+	if(showCpuProfiler) {
+		drawCpuProfilerWindow();
+	}
+}
+
+struct FrameTimeStats {
+	uint32_t count;
+	float min, avg, p50, p90, p99, max;
+};
+
+// Sorts times
+FrameTimeStats computeFrameTimeStats(std::vector<float>& times) {
+	FrameTimeStats result = {};
+	if(times.empty()) {
+		return result;
+	}
+	std::sort(times.begin(), times.end());
+	double sum = 0.0;
+	for(uint32_t i = 0; i < times.size(); ++i) {
+		sum += times[i];
+	}
+	result.count = (uint32_t)times.size();
+	result.min = times.front();
+	result.avg = (float)(sum / times.size());
+	result.p50 = times[times.size() / 2];
+	result.p90 = times[glm::min((size_t)(times.size() * 0.90), times.size() - 1)];
+	result.p99 = times[glm::min((size_t)(times.size() * 0.99), times.size() - 1)];
+	result.max = times.back();
+	return result;
+}
+
+void logFrameTimeStats(const char* name, std::vector<float>& times) {
+	FrameTimeStats stats = computeFrameTimeStats(times);
+	if(!stats.count) {
+		LOG_WARN(name, ": no samples");
+		return;
+	}
+	LOG_INFO(name, " over ", stats.count, " frames: min ", stats.min, "ms, avg ", stats.avg, "ms, p50 ", stats.p50, "ms, p99 ", stats.p99, "ms, max ", stats.max, "ms");
+}
+
+void writeJsonString(FILE* file, const char* text) {
+	fputc('"', file);
+	for(; *text; ++text) {
+		if(*text == '"' || *text == '\\') {
+			fputc('\\', file);
+		}
+		fputc(*text, file);
+	}
+	fputc('"', file);
+}
+
+void writeJsonFrameTimeStats(FILE* file, std::vector<float>& times) {
+	FrameTimeStats stats = computeFrameTimeStats(times);
+	fprintf(file, "{\"samples\": %u, \"min\": %.4f, \"avg\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+			stats.count, stats.min, stats.avg, stats.p50, stats.p90, stats.p99, stats.max);
+}
+
+// Times in milliseconds, gpuPassTimes is indexed like gpuProfiler.stats
+void writeBenchmarkResults(const char* filename, std::vector<float>& cpuFrameTimes, std::vector<float>& gpuFrameTimes, std::vector<std::vector<float>>& gpuPassTimes, std::vector<float>& latencies,
+						   std::vector<float>& renderScales, std::vector<float>& loadingFrameTimes) {
+	FILE* file = fopen(filename, "w");
+	if(!file) {
+		LOG_ERROR("Could not open ", filename);
+		return;
+	}
+	fprintf(file, "{\n");
+	fprintf(file, "\t\"device\": ");
+	writeJsonString(file, context->physicalDeviceProperties.deviceName);
+	// Results of devices with other fast paths enabled are not comparable
+	VulkanCapabilities* capabilities = &context->capabilities;
+	fprintf(file, ",\n\t\"capabilities\": {\"apiVersion\": \"%u.%u\", \"timelineSemaphores\": %s, \"dynamicRendering\": %s, \"imagelessFramebuffer\": %s, \"synchronization2\": %s, \"descriptorIndexing\": %s, \"multiDrawIndirect\": %s}",
+			VK_API_VERSION_MAJOR(capabilities->apiVersion), VK_API_VERSION_MINOR(capabilities->apiVersion), capabilities->timelineSemaphores ? "true" : "false",
+			capabilities->dynamicRendering ? "true" : "false", capabilities->imagelessFramebuffer ? "true" : "false", capabilities->synchronization2 ? "true" : "false",
+			capabilities->descriptorIndexing ? "true" : "false", capabilities->multiDrawIndirect ? "true" : "false");
+	fprintf(file, ",\n\t\"width\": %u,\n\t\"height\": %u,\n", swapchain.width, swapchain.height);
+	fprintf(file, "\t\"warmupFrames\": %u,\n\t\"frames\": %u,\n\t\"timestep\": %.6f,\n", warmupFrameCount, runFrameCount, BENCHMARK_TIMESTEP);
+	fprintf(file, "\t\"instances\": %u,\n\t\"models\": [", sceneInstanceCount);
+	for(uint32_t i = 0; i < modelCount; ++i) {
+		if(i) {
+			fputs(", ", file);
+		}
+		writeJsonString(file, modelFilenames[i]);
+	}
+	fprintf(file, "],\n\t\"asyncCompute\": %s,\n", (asyncCompute && context->computeQueue.queue != context->graphicsQueue.queue) ? "true" : "false");
+	fprintf(file, "\t\"depthPrepass\": %s,\n", depthPrepass ? "true" : "false");
+	fprintf(file, "\t\"lights\": %d,\n\t\"lighting\": \"%s\",\n", lightCount, naiveLighting ? "naive" : "clustered");
+	// The sample count after clamping to what the device supports
+	fprintf(file, "\t\"antiAliasing\": {\"mode\": \"%s\", \"samples\": %u},\n", aaModeNames[activeAaMode], (uint32_t)sceneSamples);
+	fprintf(file, "\t\"renderingPath\": \"%s\",\n", renderingPathNames[renderingPath]);
+	fprintf(file, "\t\"textureStreaming\": {\"budgetMb\": %d, \"residentMb\": %.2f, \"uploadedMb\": %.2f},\n", textureBudgetMb,
+			textureStreamer.residentBytes / 1048576.0, textureStreamer.totalUploadedBytes / 1048576.0);
+	// Times since the start of the process. Every load has finished before the measured frames
+	fprintf(file, "\t\"modelLoading\": {\"sync\": %s, \"timeToFirstFrameMs\": %.2f, \"allModelsLoadedMs\": %.2f, \"frameTimeMsWhileLoading\": ",
+			syncModelLoading ? "true" : "false", (firstFrameTime - startTime) * 1e-6, modelsLoadedTime ? (modelsLoadedTime - startTime) * 1e-6 : 0.0);
+	writeJsonFrameTimeStats(file, loadingFrameTimes);
+	fprintf(file, ", \"models\": [");
+	for(uint32_t i = 0; i < modelCount; ++i) {
+		ModelLoad* load = modelLoader.loads[modelHandles[i]];
+		fprintf(file, "%s{\"resident\": %s, \"parsedMs\": %.2f, \"residentMs\": %.2f}", i ? ", " : "", modelResident[i] ? "true" : "false",
+				(load->parsedTime - load->requestTime) * 1e-6, modelResident[i] ? (load->residentTime - load->requestTime) * 1e-6 : 0.0);
+	}
+	fprintf(file, "]},\n");
+	fprintf(file, "\t\"dynamicResolution\": {\"enabled\": %s, \"gpuBudgetMs\": %.2f, \"renderScale\": ", dynamicResolution ? "true" : "false", gpuBudgetMs);
+	writeJsonFrameTimeStats(file, renderScales);
+	fprintf(file, "},\n");
+	fprintf(file, "\t\"occlusionCulling\": {\"enabled\": %s, \"occluderScene\": %s, \"frames\": %llu",
+			(occlusionCulling && occlusionCullingSupported) ? "true" : "false", occluderScene ? "true" : "false", (unsigned long long)occlusionTotals.frames);
+	if(occlusionTotals.frames) {
+		// Averages per measured frame, the cull rate is the part of the instances in the frustum that was occluded
+		double frames = (double)occlusionTotals.frames;
+		fprintf(file, ", \"avgInFrustum\": %.1f, \"avgDrawnEarly\": %.1f, \"avgDrawnLate\": %.1f, \"avgOccluded\": %.1f, \"cullRate\": %.4f",
+				occlusionTotals.inFrustum / frames, occlusionTotals.drawnEarly / frames, occlusionTotals.drawnLate / frames, occlusionTotals.occluded / frames,
+				occlusionTotals.inFrustum ? (double)occlusionTotals.occluded / occlusionTotals.inFrustum : 0.0);
+	}
+	fprintf(file, "},\n");
+	fprintf(file, "\t\"presentMode\": \"%s\",\n\t\"swapchainImages\": %u,\n\t\"framesInFlight\": %u,\n\t\"frameRateLimit\": %d,\n",
+			headless ? "none" : getPresentModeName(swapchain.presentMode), (uint32_t)swapchain.images.size(), framesInFlight, frameRateLimit);
+	fprintf(file, "\t\"cpuFrameTimeMs\": ");
+	writeJsonFrameTimeStats(file, cpuFrameTimes);
+	FrameTimeStats cpuStats = computeFrameTimeStats(cpuFrameTimes);
+	fprintf(file, ",\n\t\"framesPerSecond\": %.2f", cpuStats.avg > 0.0f ? 1000.0f / cpuStats.avg : 0.0f);
+	// Input to GPU completion. An upper bound measured at the frame wait without calibrated timestamps
+	fprintf(file, ",\n\t\"latencyCalibrated\": %s,\n\t\"latencyMs\": ", gpuProfiler.calibrated ? "true" : "false");
+	writeJsonFrameTimeStats(file, latencies);
+	fprintf(file, ",\n\t\"gpuFrameTimeMs\": ");
+	writeJsonFrameTimeStats(file, gpuFrameTimes);
+	fprintf(file, ",\n\t\"gpuPassTimeMs\": {");
+	for(uint32_t i = 0; i < gpuPassTimes.size(); ++i) {
+		fputs(i ? ",\n\t\t" : "\n\t\t", file);
+		writeJsonString(file, gpuProfiler.stats[i].name);
+		fprintf(file, ": ");
+		writeJsonFrameTimeStats(file, gpuPassTimes[i]);
+	}
+	fprintf(file, "\n\t},\n");
+
+	// Usage and budget are 0 if VK_EXT_memory_budget is not supported
+	VulkanMemoryHeap heaps[VK_MAX_MEMORY_HEAPS];
+	uint32_t heapCount = getMemoryHeaps(context, heaps);
+	fprintf(file, "\t\"memoryHeaps\": [");
+	for(uint32_t i = 0; i < heapCount; ++i) {
+		fprintf(file, "%s{\"deviceLocal\": %s, \"size\": %llu, \"usage\": %llu, \"budget\": %llu}", i ? ",\n\t\t" : "\n\t\t",
+				heaps[i].deviceLocal ? "true" : "false", (unsigned long long)heaps[i].size, (unsigned long long)heaps[i].usage, (unsigned long long)heaps[i].budget);
+	}
+	fprintf(file, "\n\t]");
+#ifndef _WIN32
+	// With a software rasterizer like lavapipe device memory is host memory
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) == 0) {
+		fprintf(file, ",\n\t\"hostPeakResidentBytes\": %llu", (unsigned long long)usage.ru_maxrss * 1024);
+	}
+#endif
+	fprintf(file, "\n}\n");
+	fclose(file);
+	LOG_INFO("Wrote benchmark results to ", filename);
+}
+
+// One line per frame with the GPU time in milliseconds and the render scale, the input of resolution_replay
+void writeGpuTimes(const char* filename, std::vector<float>& gpuTimes, std::vector<float>& renderScales) {
+	FILE* file = fopen(filename, "w");
+	if(!file) {
+		LOG_ERROR("Could not open ", filename);
+		return;
+	}
+	for(uint32_t i = 0; i < gpuTimes.size(); ++i) {
+		fprintf(file, "%.4f %.4f\n", gpuTimes[i], renderScales[i]);
+	}
+	fclose(file);
+	LOG_INFO("Wrote ", gpuTimes.size(), " GPU frame times to ", filename);
+}
+
+// Writes the swapchain image of the last frame as binary PPM
+void dumpSwapchainImage(uint32_t imageIndex, const char* filename) {
+	VKA(vkDeviceWaitIdle(context->device));
+	uint32_t width = swapchain.width;
+	uint32_t height = swapchain.height;
+	std::vector<uint8_t> pixels(width * height * 4);
+	downloadDataFromImage(context, swapchain.images[imageIndex], pixels.data(), pixels.size(), width, height, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+	FILE* file = fopen(filename, "wb");
+	if(!file) {
+		LOG_ERROR("Could not open ", filename);
+		return;
+	}
+	bool bgra = swapchain.format == VK_FORMAT_B8G8R8A8_UNORM || swapchain.format == VK_FORMAT_B8G8R8A8_SRGB;
+	fprintf(file, "P6\n%u %u\n255\n", width, height);
+	std::vector<uint8_t> row(width * 3);
+	for(uint32_t y = 0; y < height; ++y) {
+		uint8_t* source = &pixels[y * width * 4];
+		for(uint32_t x = 0; x < width; ++x) {
+			row[x*3 + 0] = source[x*4 + (bgra ? 2 : 0)];
+			row[x*3 + 1] = source[x*4 + 1];
+			row[x*3 + 2] = source[x*4 + (bgra ? 0 : 2)];
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+	fclose(file);
+	LOG_INFO("Wrote last frame to ", filename);
 }
 
-int main() {
-	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+int main(int argc, char** argv) {
+	startTime = cpuProfilerNow();
+	initLogger();
+	bool customModels = false;
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+		} else if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			runFrameCount = (uint32_t)atoi(argv[++i]);
+		} else if(strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+			warmupFrameCount = (uint32_t)atoi(argv[++i]);
+		} else if(strcmp(argv[i], "--width") == 0 && i + 1 < argc) {
+			headlessWidth = (uint32_t)atoi(argv[++i]);
+		} else if(strcmp(argv[i], "--height") == 0 && i + 1 < argc) {
+			headlessHeight = (uint32_t)atoi(argv[++i]);
+		} else if(strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+			headlessDumpFilename = argv[++i];
+		} else if(strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc) {
+			benchmarkFilename = argv[++i];
+		} else if(strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			bool found = false;
+			for(uint32_t j = 0; j < ARRAY_COUNT(presentModes); ++j) {
+				if(strcmp(name, presentModes[j].name) == 0) {
+					requestedPresentMode = presentModes[j].mode;
+					found = true;
+				}
+			}
+			if(!found) {
+				LOG_WARN("Unknown present mode ", name, ", using fifo");
+			}
+		} else if(strcmp(argv[i], "--images") == 0 && i + 1 < argc) {
+			requestedImageCount = glm::max(atoi(argv[++i]), 1);
+		} else if(strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+			framesInFlight = glm::clamp(atoi(argv[++i]), 1, MAX_FRAMES_IN_FLIGHT);
+		} else if(strcmp(argv[i], "--fps-limit") == 0 && i + 1 < argc) {
+			frameRateLimit = glm::max(atoi(argv[++i]), 0);
+		} else if(strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+			sceneInstanceCount = glm::max(atoi(argv[++i]), 1);
+		} else if(strcmp(argv[i], "--occlusion-culling") == 0 && i + 1 < argc) {
+			occlusionCulling = strcmp(argv[++i], "off") != 0;
+		} else if(strcmp(argv[i], "--depth-prepass") == 0 && i + 1 < argc) {
+			depthPrepass = strcmp(argv[++i], "off") != 0;
+		} else if(strcmp(argv[i], "--dynamic-resolution") == 0 && i + 1 < argc) {
+			gpuBudgetMs = (float)atof(argv[++i]);
+			dynamicResolution = gpuBudgetMs > 0.0f;
+		} else if(strcmp(argv[i], "--render-scale") == 0 && i + 1 < argc) {
+			fixedRenderScale = glm::clamp((float)atof(argv[++i]), MIN_RENDER_SCALE, 1.0f);
+		} else if(strcmp(argv[i], "--gpu-times") == 0 && i + 1 < argc) {
+			gpuTimesFilename = argv[++i];
+		} else if(strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+			lightCount = glm::clamp(atoi(argv[++i]), 0, MAX_LIGHTS);
+		} else if(strcmp(argv[i], "--lighting") == 0 && i + 1 < argc) {
+			naiveLighting = strcmp(argv[++i], "naive") == 0;
+		} else if(strcmp(argv[i], "--aa") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			int samples = (strncmp(name, "msaa", 4) == 0) ? atoi(name + 4) : 0;
+			if(samples == 1 || samples == 2 || samples == 4 || samples == 8) {
+				aaMode = AA_MODE_MSAA;
+				msaaSamples = samples;
+			} else if(strcmp(name, "fxaa") == 0) {
+				aaMode = AA_MODE_FXAA;
+			} else if(strcmp(name, "taa") == 0) {
+				aaMode = AA_MODE_TAA;
+			} else {
+				LOG_WARN("Unknown anti-aliasing mode ", name, ", using msaa4");
+			}
+		} else if(strcmp(argv[i], "--rendering") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			bool found = false;
+			for(uint32_t j = 0; j < ARRAY_COUNT(renderingPathNames); ++j) {
+				if(strcmp(name, renderingPathNames[j]) == 0) {
+					renderingPath = (int)j;
+					found = true;
+				}
+			}
+			if(!found) {
+				LOG_WARN("Unknown rendering path ", name, ", using dynamic");
+			}
+		} else if(strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc) {
+			textureBudgetMb = glm::max(atoi(argv[++i]), 1);
+		} else if(strcmp(argv[i], "--occluders") == 0) {
+			occluderScene = true;
+		} else if(strcmp(argv[i], "--sync-model-loading") == 0) {
+			syncModelLoading = true;
+		} else if(strcmp(argv[i], "--job-threads") == 0 && i + 1 < argc) {
+			jobThreadCount = (uint32_t)glm::max(atoi(argv[++i]), 0);
+		} else if(strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+			// The first --model replaces the default model
+			if(!customModels) {
+				modelCount = 0;
+				customModels = true;
+			}
+			if(modelCount < MAX_SCENE_MODELS) {
+				modelFilenames[modelCount++] = argv[i + 1];
+			} else {
+				LOG_WARN("Only ", MAX_SCENE_MODELS, " models are supported, ignoring ", argv[i + 1]);
+			}
+			++i;
+		} else {
+			LOG_ERROR("Usage: ", argv[0], " [--headless] [--width w] [--height h] [--frames n] [--warmup n] [--dump file.ppm]",
+					  " [--benchmark results.json] [--instances n] [--model file.glb]... [--sync-model-loading] [--job-threads n] [--occlusion-culling on|off] [--occluders] [--depth-prepass on|off]"
+					  " [--lights n] [--lighting clustered|naive] [--dynamic-resolution budget_ms] [--render-scale s] [--gpu-times file.txt] [--aa msaa1|msaa2|msaa4|msaa8|fxaa|taa]",
+					  " [--rendering legacy|imageless|dynamic] [--texture-budget mb]",
+					  " [--present-mode fifo|fifo-relaxed|mailbox|immediate] [--images n] [--frames-in-flight n] [--fps-limit n]");
+			exitLogger();
+			return 1;
+		}
+	}
+
+	// Headless mode only uses the SDL timer
+	if (SDL_Init(headless ? 0 : SDL_INIT_VIDEO) != 0) {
 		LOG_ERROR("Error initializing SDL: ", SDL_GetError());
+		exitLogger();
 		return 1;
 	}
 
-	SDL_Window* window = SDL_CreateWindow("Vulkan Tutorial", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1240, 720, SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
-	if (!window) {
-		LOG_ERROR("Error creating SDL window");
-		return 1;
+	SDL_Window* window = 0;
+	if(!headless) {
+		window = SDL_CreateWindow("Vulkan Tutorial", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1240, 720, SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+		if (!window) {
+			LOG_ERROR("Error creating SDL window");
+			exitLogger();
+			return 1;
+		}
 	}
 
+	PROFILE_THREAD("Main thread");
+	// While models load their workers are busy next to the job threads, so by default the two share the cores
+	uint32_t coreCount = glm::max(std::thread::hardware_concurrency(), 1u);
+	modelLoaderWorkerCount = glm::clamp(coreCount - 1, 1u, (uint32_t)MODEL_LOADER_MAX_WORKERS);
+	if(!jobThreadCount) {
+		jobThreadCount = glm::max(coreCount - modelLoaderWorkerCount, 1u);
+	}
+	initJobSystem(jobThreadCount);
+	LOG_INFO("Job system running on ", getJobThreadCount(), " threads");
 	initApplication(window);
 
+	// Headless and benchmark runs end after a fixed frame count and report frame times
+	bool measure = headless || benchmarkFilename;
+	std::vector<float> cpuFrameTimes;
+	std::vector<float> gpuFrameTimes;
+	std::vector<std::vector<float>> gpuPassTimes;
+	std::vector<float> latencies;
+	// Frame time from the first graphics command to the end of the compute blur, and the render scale of the frame
+	std::vector<float> scaledGpuFrameTimes;
+	std::vector<float> renderScales;
+	// Of the frames while models were loading, which are neither warmup nor measured frames
+	std::vector<float> loadingFrameTimes;
+	if(measure) {
+		LOG_INFO("Rendering ", warmupFrameCount, " warmup and ", runFrameCount, " measured frames at ", swapchain.width, "x", swapchain.height, " with ", sceneInstanceCount, " instances");
+		cpuFrameTimes.reserve(runFrameCount);
+		gpuFrameTimes.reserve(runFrameCount);
+	}
+
 	float delta = 0.0f;
-	double frameCpuAvg = 0.0f;
 	uint64_t perfCounterFrequency = SDL_GetPerformanceFrequency();
 	uint64_t lastCounter = SDL_GetPerformanceCounter();
-	while (handleMessage()) {
-		updateApplication(delta);
-		renderApplication();
+	// Start of the next frame with the frame limiter, advanced by one period per frame so the work of a frame is part of its period
+	uint64_t frameDeadline = lastCounter;
+	uint32_t frameCount = 0;
+	bool running = true;
+	while (running) {
+		if(frameRateLimit > 0) {
+			// Waiting before input is sampled instead of after rendering keeps the latency low
+			PROFILE_ZONE("Frame limiter");
+			frameDeadline += perfCounterFrequency / frameRateLimit;
+			uint64_t counter = SDL_GetPerformanceCounter();
+			if(counter > frameDeadline) {
+				// Fell behind, catching up would run frames back to back
+				frameDeadline = counter;
+			}
+			while(counter < frameDeadline) {
+				// Sleep until about a millisecond before the deadline, then spin
+				uint64_t remainingMs = (frameDeadline - counter) * 1000 / perfCounterFrequency;
+				if(remainingMs > 1) {
+					SDL_Delay((uint32_t)remainingMs - 1);
+				}
+				counter = SDL_GetPerformanceCounter();
+			}
+		} else {
+			frameDeadline = SDL_GetPerformanceCounter();
+		}
+		frameInputTime = cpuProfilerNow();
+		bool modelsLoading = modelLoader.pendingCount > 0;
+		{
+			PROFILE_ZONE("Frame");
+			running = handleMessage();
+			// SDL calls queued by jobs
+			runMainThreadJobs();
+			if(running) {
+				// A fixed timestep makes benchmark runs render the same frames independent of their speed
+				updateApplication(benchmarkFilename ? BENCHMARK_TIMESTEP : delta);
+				renderApplication();
+			}
+		}
+		if(!firstFrameTime) {
+			firstFrameTime = cpuProfilerNow();
+			LOG_INFO("First frame ", (firstFrameTime - startTime) * 1e-6, "ms after start");
+		}
+		cpuProfilerEndFrame();
+		addProfilerCpuFrame(&gpuProfiler, cpuProfilerLastFrame());
 
 		uint64_t endCounter = SDL_GetPerformanceCounter();
 		uint64_t counterElapsed = endCounter - lastCounter;
-		frameCpuAvg = frameCpuAvg * 0.95f + delta * 0.05f * 1000.0f;
-		//LOG_INFO("CPU frametime: ", frameCpuAvg, "ms");
 		delta = ((float)counterElapsed) / (float) perfCounterFrequency;
 		lastCounter = endCounter;
+
+		if(modelsLoading) {
+			// The measurement starts once every model is resident, so runs stay comparable
+			loadingFrameTimes.push_back(delta * 1000.0f);
+			continue;
+		}
+		if(measure) {
+			// GPU timings are those of the frame that was resolved at the start of this one
+			if(frameCount >= warmupFrameCount) {
+				cpuFrameTimes.push_back(delta * 1000.0f);
+				GpuProfilerStats* frameStats = getGpuProfilerStats(&gpuProfiler, "Frame");
+				if(frameStats && frameStats->lastTime >= 0.0) {
+					gpuFrameTimes.push_back((float)frameStats->lastTime);
+				}
+				if(lastFrameLatency >= 0.0) {
+					latencies.push_back((float)lastFrameLatency);
+				}
+				if(lastGpuFrameTime >= 0.0f) {
+					scaledGpuFrameTimes.push_back(lastGpuFrameTime);
+					renderScales.push_back(lastGpuFrameScale);
+				}
+				if(occlusionStatsValid) {
+					occlusionTotals.frames++;
+					occlusionTotals.drawnEarly += occlusionStats.drawnEarly;
+					occlusionTotals.drawnLate += occlusionStats.drawnLate;
+					occlusionTotals.occluded += occlusionStats.occluded;
+					occlusionTotals.inFrustum += occlusionStats.inFrustum;
+				}
+				gpuPassTimes.resize(gpuProfiler.statsCount);
+				for(uint32_t i = 0; i < gpuProfiler.statsCount; ++i) {
+					if(gpuProfiler.stats[i].lastTime >= 0.0) {
+						gpuPassTimes[i].push_back((float)gpuProfiler.stats[i].lastTime);
+					}
+				}
+			}
+			if(frameCount + 1 >= warmupFrameCount + runFrameCount) {
+				running = false;
+			}
+		}
+		frameCount++;
+	}
+
+	if(measure) {
+		if(benchmarkFilename) {
+			writeBenchmarkResults(benchmarkFilename, cpuFrameTimes, gpuFrameTimes, gpuPassTimes, latencies, renderScales, loadingFrameTimes);
+		}
+		if(gpuTimesFilename) {
+			writeGpuTimes(gpuTimesFilename, scaledGpuFrameTimes, renderScales);
+		}
+		logFrameTimeStats("CPU frame time", cpuFrameTimes);
+		logFrameTimeStats("GPU frame time", gpuFrameTimes);
+		for(uint32_t i = 0; i < gpuPassTimes.size(); ++i) {
+			char name[64];
+			snprintf(name, sizeof(name), "GPU pass %s", gpuProfiler.stats[i].name);
+			logFrameTimeStats(name, gpuPassTimes[i]);
+		}
+		logFrameTimeStats("Latency", latencies);
+		if(!loadingFrameTimes.empty()) {
+			logFrameTimeStats("CPU frame time while loading models", loadingFrameTimes);
+		}
+	}
+	if(headless && headlessDumpFilename) {
+		dumpSwapchainImage((headlessImageIndex + swapchain.images.size() - 1) % swapchain.images.size(), headlessDumpFilename);
 	}
 
 	shutdownApplication();
+	shutdownJobSystem();
 
-	SDL_DestroyWindow(window);
+	if(window) {
+		SDL_DestroyWindow(window);
+	}
 	SDL_Quit();
-	
+
+	exitLogger();
 	return 0;
-}
\ No newline at end of file
+}
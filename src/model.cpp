@@ -1,10 +1,16 @@
 #include "model.h"
+#include "profiler.h"
 
 #define CGLTF_IMPLEMENTATION
 #include <cgltf/cgltf.h>
 
 #include <stb/stb_image.h>
 
+#include <glm/glm/gtc/type_ptr.hpp>
+
+#include <cfloat>
+#include <cmath>
+
 // Stride in bytes. Element size in bytes
 void fillBuffer(uint32_t inputStride, void* inputData, uint32_t outputStride, void* outputData, uint32_t numElements, uint32_t elementSize) {
     uint8_t* output = (uint8_t*)outputData;
@@ -18,88 +24,219 @@ void fillBuffer(uint32_t inputStride, void* inputData, uint32_t outputStride, vo
     }
 }
 
-Model createModel(VulkanContext* context, const char* filename) {
-    Model result = {};
+// Texels of a width by height texture per mesh space unit, from the ratio of the texture space to the mesh space area of all triangles
+static float getTexelsPerUnit(const uint8_t* vertexData, uint64_t stride, const uint16_t* indices, uint64_t indexCount, uint32_t width, uint32_t height) {
+    double meshArea = 0.0;
+    double uvArea = 0.0;
+    for(uint64_t i = 0; i + 2 < indexCount; i += 3) {
+        const float* v0 = (const float*)(vertexData + indices[i] * stride);
+        const float* v1 = (const float*)(vertexData + indices[i + 1] * stride);
+        const float* v2 = (const float*)(vertexData + indices[i + 2] * stride);
+        glm::vec3 edge0 = glm::make_vec3(v1) - glm::make_vec3(v0);
+        glm::vec3 edge1 = glm::make_vec3(v2) - glm::make_vec3(v0);
+        meshArea += 0.5 * glm::length(glm::cross(edge0, edge1));
+        glm::vec2 uvEdge0 = glm::make_vec2(v1 + 6) - glm::make_vec2(v0 + 6);
+        glm::vec2 uvEdge1 = glm::make_vec2(v2 + 6) - glm::make_vec2(v0 + 6);
+        uvArea += 0.5 * fabs(uvEdge0.x * uvEdge1.y - uvEdge0.y * uvEdge1.x);
+    }
+    if(meshArea <= 0.0 || uvArea <= 0.0) {
+        // Always the full resolution
+        return 0.0f;
+    }
+    return (float)sqrt(uvArea * width * height / meshArea);
+}
+
+static SceneNode getSceneNode(cgltf_node* node, uint32_t parent, cgltf_mesh* mesh) {
+    SceneNode result;
+    result.parent = parent;
+    result.position = glm::vec3(0.0f);
+    result.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    result.scale = glm::vec3(1.0f);
+    result.hasMesh = node->mesh == mesh;
+    if(node->has_matrix) {
+        // Decomposed without shear, which glTF does not allow for node matrices anyway
+        glm::mat4 matrix = glm::make_mat4(node->matrix);
+        result.position = glm::vec3(matrix[3]);
+        result.scale = glm::vec3(glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2])));
+        result.rotation = glm::quat_cast(glm::mat3(glm::vec3(matrix[0]) / result.scale.x, glm::vec3(matrix[1]) / result.scale.y, glm::vec3(matrix[2]) / result.scale.z));
+        return result;
+    }
+    if(node->has_translation) {
+        result.position = glm::make_vec3(node->translation);
+    }
+    if(node->has_rotation) {
+        // glTF stores x, y, z, w
+        result.rotation = glm::quat(node->rotation[3], node->rotation[0], node->rotation[1], node->rotation[2]);
+    }
+    if(node->has_scale) {
+        result.scale = glm::make_vec3(node->scale);
+    }
+    return result;
+}
+
+// Breadth first, so every parent comes before its children
+static void loadSceneNodes(cgltf_data* data, std::vector<SceneNode>& nodes) {
+    cgltf_scene* scene = data->scene ? data->scene : (data->scenes_count ? &data->scenes[0] : 0);
+    std::vector<cgltf_node*> queue;
+    if(scene) {
+        for(cgltf_size i = 0; i < scene->nodes_count; ++i) {
+            queue.push_back(scene->nodes[i]);
+            nodes.push_back(getSceneNode(scene->nodes[i], SCENE_NO_PARENT, &data->meshes[0]));
+        }
+    }
+    for(uint32_t i = 0; i < queue.size(); ++i) {
+        for(cgltf_size j = 0; j < queue[i]->children_count; ++j) {
+            queue.push_back(queue[i]->children[j]);
+            nodes.push_back(getSceneNode(queue[i]->children[j], i, &data->meshes[0]));
+        }
+    }
+    if(nodes.empty()) {
+        // Files without a scene still show their mesh once
+        SceneNode node = {SCENE_NO_PARENT, glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f), true};
+        nodes.push_back(node);
+    }
+}
+
+bool loadModelData(const char* filename, ModelData* result) {
+    PROFILE_ZONE("loadModelData");
     cgltf_options options = {};
     cgltf_data* data = 0;
     cgltf_result error = cgltf_parse_file(&options, filename, &data);
-    if(error == cgltf_result_success) {
-        error = cgltf_load_buffers(&options, data, "../data/models");
-        if(error == cgltf_result_success) {
-            assert(data->meshes_count == 1);
-            assert(data->meshes[0].primitives_count == 1);
-            assert(data->meshes[0].primitives[0].attributes_count > 0);
-            assert(data->meshes[0].primitives[0].indices->component_type == cgltf_component_type_r_16u);
-            assert(data->meshes[0].primitives[0].indices->stride == sizeof(uint16_t));
-
-            // Indices
-            uint8_t* bufferBase = (uint8_t*)data->meshes[0].primitives[0].indices->buffer_view->buffer->data;
-            uint64_t indexDataSize = data->meshes[0].primitives[0].indices->buffer_view->size;
-            void* indexData = bufferBase + data->meshes[0].primitives[0].indices->buffer_view->offset;
-
-            createBuffer(context, &result.indexBuffer, indexDataSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-            uploadDataToBuffer(context, &result.indexBuffer, indexData, indexDataSize);
-            result.numIndices = data->meshes[0].primitives[0].indices->count;
-
-
-            // Vertices
-            uint64_t outputStride = sizeof(float)*8;
-            uint64_t numVertices = data->meshes[0].primitives[0].attributes->data->count;
-            uint64_t vertexDataSize = outputStride * numVertices;
-            uint8_t* vertexData = new uint8_t[vertexDataSize];
-            for(uint64_t i = 0; i < data->meshes[0].primitives[0].attributes_count; ++i) {
-                cgltf_attribute* attribute = data->meshes[0].primitives[0].attributes + i;
-                bufferBase = (uint8_t*)attribute->data->buffer_view->buffer->data;
-                uint64_t inputStride = attribute->data->stride;
-                if(attribute->type == cgltf_attribute_type_position) {
-                    void* positionData = bufferBase + attribute->data->buffer_view->offset;
-                    fillBuffer(inputStride, positionData, outputStride, vertexData, numVertices, sizeof(float)*3);
-                } else if(attribute->type == cgltf_attribute_type_normal) {
-                    void* normalData = bufferBase + attribute->data->buffer_view->offset;
-                    fillBuffer(inputStride, normalData, outputStride, vertexData+(sizeof(float)*3), numVertices, sizeof(float)*3);
-                } else if(attribute->type == cgltf_attribute_type_texcoord) {
-                    void* texcoordData = bufferBase + attribute->data->buffer_view->offset;
-                    fillBuffer(inputStride, texcoordData, outputStride, vertexData+(sizeof(float)*6), numVertices, sizeof(float)*2);
-                }
-            }
-            createBuffer(context, &result.vertexBuffer, vertexDataSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-            uploadDataToBuffer(context, &result.vertexBuffer, vertexData, vertexDataSize);
-            delete[] vertexData;
-
-            // Material
-            assert(data->materials_count == 1);
-            cgltf_material* material = &data->materials[0];
-            assert(material->has_pbr_metallic_roughness);
-            cgltf_texture_view albedoTextureView = material->pbr_metallic_roughness.base_color_texture;
-            assert(!albedoTextureView.has_transform);
-            assert(albedoTextureView.texcoord == 0);
-            assert(albedoTextureView.texture);
-            cgltf_texture* albedoTexture = albedoTextureView.texture;
-
-            // Load texture
-            cgltf_buffer_view* bufferView = albedoTexture->image->buffer_view;
-            assert(bufferView->size < INT32_MAX);
-            int bpp, width, height;
-            uint8_t* textureData = stbi_load_from_memory((stbi_uc*) bufferView->buffer->data, (int)bufferView->size, &width, &height, &bpp, 4);
-            assert(textureData);
-            bpp = 4;
-            createImage(context, &result.albedoTexture, width, height, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
-            uploadDataToImage(context, &result.albedoTexture, textureData, width * height * bpp, width, height, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT);
-            stbi_image_free(textureData);
-        } else {
-            LOG_ERROR("Could not load additional model buffers");
-        }
+    if(error != cgltf_result_success) {
+        LOG_ERROR("Could not load model file ", filename);
+        return false;
+    }
+    error = cgltf_load_buffers(&options, data, "../data/models");
+    if(error != cgltf_result_success) {
+        LOG_ERROR("Could not load additional model buffers of ", filename);
         cgltf_free(data);
-    } else {
-        LOG_ERROR("Could not load model file");
+        return false;
     }
+    assert(data->meshes_count == 1);
+    assert(data->meshes[0].primitives_count == 1);
+    assert(data->meshes[0].primitives[0].attributes_count > 0);
+    assert(data->meshes[0].primitives[0].indices->component_type == cgltf_component_type_r_16u);
+    assert(data->meshes[0].primitives[0].indices->stride == sizeof(uint16_t));
 
-    return result;
+    // Indices
+    uint8_t* bufferBase = (uint8_t*)data->meshes[0].primitives[0].indices->buffer_view->buffer->data;
+    uint16_t* indexData = (uint16_t*)(bufferBase + data->meshes[0].primitives[0].indices->buffer_view->offset);
+    uint64_t numIndices = data->meshes[0].primitives[0].indices->count;
+    result->indexData.assign(indexData, indexData + numIndices);
+
+    // Vertices
+    uint64_t outputStride = sizeof(float)*8;
+    uint64_t numVertices = data->meshes[0].primitives[0].attributes->data->count;
+    result->vertexData.resize(outputStride * numVertices);
+    uint8_t* vertexData = result->vertexData.data();
+    for(uint64_t i = 0; i < data->meshes[0].primitives[0].attributes_count; ++i) {
+        cgltf_attribute* attribute = data->meshes[0].primitives[0].attributes + i;
+        bufferBase = (uint8_t*)attribute->data->buffer_view->buffer->data;
+        uint64_t inputStride = attribute->data->stride;
+        if(attribute->type == cgltf_attribute_type_position) {
+            void* positionData = bufferBase + attribute->data->buffer_view->offset;
+            fillBuffer(inputStride, positionData, outputStride, vertexData, numVertices, sizeof(float)*3);
+        } else if(attribute->type == cgltf_attribute_type_normal) {
+            void* normalData = bufferBase + attribute->data->buffer_view->offset;
+            fillBuffer(inputStride, normalData, outputStride, vertexData+(sizeof(float)*3), numVertices, sizeof(float)*3);
+        } else if(attribute->type == cgltf_attribute_type_texcoord) {
+            void* texcoordData = bufferBase + attribute->data->buffer_view->offset;
+            fillBuffer(inputStride, texcoordData, outputStride, vertexData+(sizeof(float)*6), numVertices, sizeof(float)*2);
+        }
+    }
+    result->bounds = {glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)};
+    for(uint64_t i = 0; i < numVertices; ++i) {
+        glm::vec3 position = glm::make_vec3((float*)(vertexData + i * outputStride));
+        result->bounds.min = glm::min(result->bounds.min, position);
+        result->bounds.max = glm::max(result->bounds.max, position);
+    }
+
+    // A third of the vertex fetch bandwidth when only the depth is needed
+    uint64_t positionStride = sizeof(float)*3;
+    result->positionData.resize(positionStride * numVertices);
+    fillBuffer(outputStride, vertexData, positionStride, result->positionData.data(), numVertices, positionStride);
+
+    // Material
+    assert(data->materials_count == 1);
+    cgltf_material* material = &data->materials[0];
+    assert(material->has_pbr_metallic_roughness);
+    cgltf_texture_view albedoTextureView = material->pbr_metallic_roughness.base_color_texture;
+    assert(!albedoTextureView.has_transform);
+    assert(albedoTextureView.texcoord == 0);
+    assert(albedoTextureView.texture);
+    cgltf_texture* albedoTexture = albedoTextureView.texture;
+
+    // Load texture
+    cgltf_buffer_view* bufferView = albedoTexture->image->buffer_view;
+    assert(bufferView->size < INT32_MAX);
+    int bpp, width, height;
+    uint8_t* textureData = stbi_load_from_memory((stbi_uc*) bufferView->buffer->data, (int)bufferView->size, &width, &height, &bpp, 4);
+    assert(textureData);
+    float texelsPerUnit = getTexelsPerUnit(vertexData, outputStride, indexData, numIndices, width, height);
+    initStreamedTexture(&result->albedoTexture, textureData, width, height, VK_FORMAT_R8G8B8A8_SRGB, texelsPerUnit);
+    stbi_image_free(textureData);
+
+    loadSceneNodes(data, result->nodes);
+    cgltf_free(data);
+    return true;
+}
+
+// Offsets into the staging buffer stay 16 byte aligned, which covers the texel size of the texture copy
+static uint64_t alignStagingOffset(uint64_t offset) {
+    return (offset + 15) & ~15ull;
+}
+
+void createModelResources(VulkanContext* context, ModelData* data, Model* model, ModelUpload* upload) {
+    PROFILE_ZONE("createModelResources");
+    *model = {};
+    uint64_t indexDataSize = data->indexData.size() * sizeof(uint16_t);
+    createBuffer(context, &model->indexBuffer, indexDataSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    createBuffer(context, &model->vertexBuffer, data->vertexData.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    createBuffer(context, &model->positionBuffer, data->positionData.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    model->numIndices = data->indexData.size();
+    model->bounds = data->bounds;
+    model->nodes = std::move(data->nodes);
+    model->albedoTexture = std::move(data->albedoTexture);
+    createStreamedTextureImage(context, &model->albedoTexture);
+
+    StreamedTexture* texture = &model->albedoTexture;
+    uint64_t textureDataSize = getMipChainSize(texture, texture->tailMip);
+    upload->indexOffset = 0;
+    upload->vertexOffset = alignStagingOffset(upload->indexOffset + indexDataSize);
+    upload->positionOffset = alignStagingOffset(upload->vertexOffset + data->vertexData.size());
+    upload->textureOffset = alignStagingOffset(upload->positionOffset + data->positionData.size());
+    upload->size = upload->textureOffset + textureDataSize;
+    upload->vertexSize = data->vertexData.size();
+    upload->positionSize = data->positionData.size();
+    createBuffer(context, &upload->stagingBuffer, upload->size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    uint8_t* mapped;
+    VKA(vkMapMemory(context->device, upload->stagingBuffer.memory, 0, upload->size, 0, (void**)&mapped));
+    memcpy(mapped + upload->indexOffset, data->indexData.data(), indexDataSize);
+    memcpy(mapped + upload->vertexOffset, data->vertexData.data(), data->vertexData.size());
+    memcpy(mapped + upload->positionOffset, data->positionData.data(), data->positionData.size());
+    memcpy(mapped + upload->textureOffset, texture->mipData.data() + texture->mipOffsets[texture->tailMip], textureDataSize);
+    VK(vkUnmapMemory(context->device, upload->stagingBuffer.memory));
+}
+
+void recordModelUpload(VkCommandBuffer commandBuffer, Model* model, ModelUpload* upload) {
+    VkBufferCopy indexRegion = {upload->indexOffset, 0, model->numIndices * sizeof(uint16_t)};
+    vkCmdCopyBuffer(commandBuffer, upload->stagingBuffer.buffer, model->indexBuffer.buffer, 1, &indexRegion);
+    VkBufferCopy vertexRegion = {upload->vertexOffset, 0, upload->vertexSize};
+    vkCmdCopyBuffer(commandBuffer, upload->stagingBuffer.buffer, model->vertexBuffer.buffer, 1, &vertexRegion);
+    VkBufferCopy positionRegion = {upload->positionOffset, 0, upload->positionSize};
+    vkCmdCopyBuffer(commandBuffer, upload->stagingBuffer.buffer, model->positionBuffer.buffer, 1, &positionRegion);
+    recordStreamedTextureUpload(commandBuffer, &model->albedoTexture, upload->stagingBuffer.buffer, upload->textureOffset);
+
+    VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0, 0, 0, 0);
 }
 
 void destroyModel(VulkanContext* context, Model* model) {
     destroyBuffer(context, &model->vertexBuffer);
+    destroyBuffer(context, &model->positionBuffer);
     destroyBuffer(context, &model->indexBuffer);
-    destroyImage(context, &model->albedoTexture);
+    destroyStreamedTexture(context, &model->albedoTexture);
     *model = {};
 }
\ No newline at end of file
@@ -1,11 +1,51 @@
+#pragma once
 #include "vulkan_base/vulkan_base.h"
+#include "scene.h"
+#include "bvh.h"
+#include "texture_streaming.h"
 
 struct Model {
     VulkanBuffer vertexBuffer;
+    // Only the positions of vertexBuffer, tightly packed for the depth prepass
+    VulkanBuffer positionBuffer;
     VulkanBuffer indexBuffer;
     uint64_t numIndices;
-    VulkanImage albedoTexture;
+    // Mip levels stream in with the texel density feedback of the scene
+    StreamedTexture albedoTexture;
+    // Of the vertex positions, in mesh space
+    Aabb bounds;
+    // Node hierarchy of the default scene, breadth first. Nodes with a mesh draw this model
+    std::vector<SceneNode> nodes;
 };
 
-Model createModel(VulkanContext* context, const char* filename);
+// Contents of a model file in system memory
+struct ModelData {
+    std::vector<uint8_t> vertexData;
+    std::vector<uint8_t> positionData;
+    std::vector<uint16_t> indexData;
+    Aabb bounds;
+    std::vector<SceneNode> nodes;
+    // With its mip chain, but without an image
+    StreamedTexture albedoTexture;
+};
+
+// Staging buffer with the contents of a model, it has to live until the commands of recordModelUpload have executed
+struct ModelUpload {
+    VulkanBuffer stagingBuffer;
+    uint64_t size;
+    uint64_t indexOffset;
+    uint64_t vertexOffset;
+    uint64_t vertexSize;
+    uint64_t positionOffset;
+    uint64_t positionSize;
+    uint64_t textureOffset;
+};
+
+// Parses the file and decodes the texture with its mip chain. Makes no Vulkan calls, so it can run on any thread
+bool loadModelData(const char* filename, ModelData* data);
+// Creates the buffers and the image of the model and fills the staging buffer. Nothing is recorded, so it can run on any thread.
+// Moves the nodes and the texture out of data
+void createModelResources(VulkanContext* context, ModelData* data, Model* model, ModelUpload* upload);
+// Copies the staging buffer into the model. The model can be drawn once these commands have executed
+void recordModelUpload(VkCommandBuffer commandBuffer, Model* model, ModelUpload* upload);
 void destroyModel(VulkanContext* context, Model* model);
\ No newline at end of file
@@ -0,0 +1,205 @@
+#include "model_loader.h"
+#include "profiler.h"
+
+static void runModelWorker(ModelLoader* loader) {
+    PROFILE_THREAD("Model loader");
+    for(;;) {
+        ModelLoad* load;
+        {
+            std::unique_lock<std::mutex> lock(loader->mutex);
+            while(!loader->stopping && loader->queued.empty()) {
+                loader->queuedCondition.wait(lock);
+            }
+            // Queued loads are dropped, destroyModelLoader cleans them up
+            if(loader->stopping) {
+                return;
+            }
+            load = loader->queued.front();
+            loader->queued.pop_front();
+            load->state = MODEL_LOAD_PARSING;
+        }
+
+        bool loaded;
+        {
+            PROFILE_ZONE("Load model");
+            ModelData data;
+            loaded = loadModelData(load->filename.c_str(), &data);
+            if(loaded) {
+                createModelResources(loader->context, &data, &load->model, &load->upload);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(loader->mutex);
+            load->state = loaded ? MODEL_LOAD_UPLOADING : MODEL_LOAD_FAILED;
+            load->parsedTime = cpuProfilerNow();
+            loader->parsed.push_back(load);
+        }
+        loader->parsedCondition.notify_one();
+    }
+}
+
+void createModelLoader(VulkanContext* context, ModelLoader* loader, uint32_t workerCount) {
+    loader->context = context;
+    loader->stopping = false;
+    loader->pendingCount = 0;
+    VkCommandPoolCreateInfo createInfo = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    createInfo.queueFamilyIndex = context->graphicsQueue.familyIndex;
+    VKA(vkCreateCommandPool(context->device, &createInfo, 0, &loader->commandPool));
+
+    workerCount = glm::clamp(workerCount, 1u, (uint32_t)MODEL_LOADER_MAX_WORKERS);
+    for(uint32_t i = 0; i < workerCount; ++i) {
+        loader->workers.push_back(std::thread(runModelWorker, loader));
+    }
+}
+
+// Every copy has to be completed, like after vkDeviceWaitIdle
+void destroyModelLoader(ModelLoader* loader) {
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        loader->stopping = true;
+    }
+    loader->queuedCondition.notify_all();
+    for(uint32_t i = 0; i < loader->workers.size(); ++i) {
+        loader->workers[i].join();
+    }
+    loader->workers.clear();
+
+    VulkanContext* context = loader->context;
+    for(uint32_t i = 0; i < loader->loads.size(); ++i) {
+        ModelLoad* load = loader->loads[i];
+        if(load->state == MODEL_LOAD_UPLOADING) {
+            destroyBuffer(context, &load->upload.stagingBuffer);
+            destroyModel(context, &load->model);
+        }
+        delete load;
+    }
+    loader->loads.clear();
+    loader->queued.clear();
+    loader->parsed.clear();
+    loader->uploading.clear();
+    VK(vkDestroyCommandPool(context->device, loader->commandPool, 0));
+    loader->commandPool = 0;
+}
+
+ModelHandle loadModelAsync(ModelLoader* loader, const char* filename) {
+    ModelLoad* load = new ModelLoad();
+    load->handle = (ModelHandle)loader->loads.size();
+    load->filename = filename;
+    load->state = MODEL_LOAD_QUEUED;
+    load->requestTime = cpuProfilerNow();
+    loader->loads.push_back(load);
+    loader->pendingCount++;
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        loader->queued.push_back(load);
+    }
+    loader->queuedCondition.notify_one();
+    return load->handle;
+}
+
+void updateModelLoader(ModelLoader* loader, std::vector<ModelHandle>* finished) {
+    PROFILE_ZONE("updateModelLoader");
+    VulkanContext* context = loader->context;
+
+    // Copies that completed since the last update
+    uint64_t completedValue = pollCompletedValue(context);
+    for(uint32_t i = 0; i < loader->uploading.size();) {
+        ModelLoad* load = loader->uploading[i];
+        if(load->uploadValue > completedValue) {
+            ++i;
+            continue;
+        }
+        VK(vkFreeCommandBuffers(context->device, loader->commandPool, 1, &load->commandBuffer));
+        destroyBuffer(context, &load->upload.stagingBuffer);
+        {
+            std::lock_guard<std::mutex> lock(loader->mutex);
+            load->state = MODEL_LOAD_RESIDENT;
+        }
+        load->residentTime = cpuProfilerNow();
+        LOG_INFO("Loaded ", load->filename.c_str(), " in ", (load->residentTime - load->requestTime) * 1e-6, "ms, ",
+                 (load->parsedTime - load->requestTime) * 1e-6, "ms until it was parsed");
+        finished->push_back(load->handle);
+        loader->pendingCount--;
+        loader->uploading[i] = loader->uploading.back();
+        loader->uploading.pop_back();
+    }
+
+    // Parsed loads in the order they finished, as many as the upload limit allows
+    std::vector<ModelLoad*> submitted;
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        uint64_t uploadBytes = 0;
+        uint32_t taken = 0;
+        for(; taken < loader->parsed.size(); ++taken) {
+            ModelLoad* load = loader->parsed[taken];
+            if(load->state == MODEL_LOAD_FAILED) {
+                finished->push_back(load->handle);
+                loader->pendingCount--;
+                continue;
+            }
+            if(uploadBytes > 0 && uploadBytes + load->upload.size > MODEL_LOADER_UPLOAD_BYTES) {
+                break;
+            }
+            uploadBytes += load->upload.size;
+            submitted.push_back(load);
+        }
+        loader->parsed.erase(loader->parsed.begin(), loader->parsed.begin() + taken);
+    }
+    if(submitted.empty()) {
+        return;
+    }
+
+    std::vector<VkCommandBuffer> commandBuffers(submitted.size());
+    VkCommandBufferAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    allocateInfo.commandPool = loader->commandPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocateInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+    VKA(vkAllocateCommandBuffers(context->device, &allocateInfo, commandBuffers.data()));
+    for(uint32_t i = 0; i < submitted.size(); ++i) {
+        VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VKA(vkBeginCommandBuffer(commandBuffers[i], &beginInfo));
+        recordModelUpload(commandBuffers[i], &submitted[i]->model, &submitted[i]->upload);
+        VKA(vkEndCommandBuffer(commandBuffers[i]));
+        submitted[i]->commandBuffer = commandBuffers[i];
+    }
+    // Nothing waits on it, the frames only use a model after its value was seen completed
+    VkSubmitInfo submitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+    submitInfo.pCommandBuffers = commandBuffers.data();
+    uint64_t value = submitWithValue(context, &context->graphicsQueue, &submitInfo);
+    for(uint32_t i = 0; i < submitted.size(); ++i) {
+        submitted[i]->uploadValue = value;
+        loader->uploading.push_back(submitted[i]);
+    }
+}
+
+void finishModelLoads(ModelLoader* loader, std::vector<ModelHandle>* finished) {
+    PROFILE_ZONE("finishModelLoads");
+    for(;;) {
+        updateModelLoader(loader, finished);
+        if(!loader->pendingCount) {
+            return;
+        }
+        if(!loader->uploading.empty()) {
+            waitForValue(loader->context, loader->uploading.back()->uploadValue);
+        } else {
+            std::unique_lock<std::mutex> lock(loader->mutex);
+            while(loader->parsed.empty()) {
+                loader->parsedCondition.wait(lock);
+            }
+        }
+    }
+}
+
+ModelLoadState getModelLoadState(ModelLoader* loader, ModelHandle handle) {
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    return loader->loads[handle]->state;
+}
+
+Model* getLoadedModel(ModelLoader* loader, ModelHandle handle) {
+    assert(getModelLoadState(loader, handle) == MODEL_LOAD_RESIDENT);
+    return &loader->loads[handle]->model;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "model.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Loads models in the background. loadModelAsync only queues the file and returns a handle. Worker threads parse it,
+// decode and filter the texture, create the buffers and images and fill a staging buffer. updateModelLoader, called once
+// per frame on the main thread, submits the copies of finished loads on the graphics queue without waiting for them and
+// hands a model out once the scheduler value of its copies is completed. The frame loop never blocks on a load
+
+#define MODEL_LOADER_MAX_WORKERS 4
+// Staging bytes submitted per update. A model that is larger still gets submitted, alone
+#define MODEL_LOADER_UPLOAD_BYTES (64ull << 20)
+
+typedef uint32_t ModelHandle;
+
+enum ModelLoadState {
+    MODEL_LOAD_QUEUED,
+    MODEL_LOAD_PARSING,
+    // Parsed and waiting for its copies to be submitted and executed
+    MODEL_LOAD_UPLOADING,
+    MODEL_LOAD_RESIDENT,
+    MODEL_LOAD_FAILED,
+};
+
+struct ModelLoad {
+    ModelHandle handle;
+    std::string filename;
+    ModelLoadState state;
+    Model model;
+    ModelUpload upload;
+    VkCommandBuffer commandBuffer;
+    uint64_t uploadValue;
+    // cpuProfilerNow when the load was requested, a worker finished it and its copies were seen completed
+    uint64_t requestTime;
+    uint64_t parsedTime;
+    uint64_t residentTime;
+};
+
+struct ModelLoader {
+    VulkanContext* context;
+    std::vector<std::thread> workers;
+    // Guards queued, parsed, stopping and the state of the loads
+    std::mutex mutex;
+    std::condition_variable queuedCondition;
+    std::condition_variable parsedCondition;
+    std::deque<ModelLoad*> queued;
+    std::vector<ModelLoad*> parsed;
+    bool stopping;
+    // Everything below is only touched by the main thread. Indexed by handle
+    std::vector<ModelLoad*> loads;
+    std::vector<ModelLoad*> uploading;
+    VkCommandPool commandPool;
+    // Loads that are neither resident nor failed
+    uint32_t pendingCount;
+};
+
+void createModelLoader(VulkanContext* context, ModelLoader* loader, uint32_t workerCount);
+// Joins the workers. Models that were handed out belong to the caller, everything else is destroyed
+void destroyModelLoader(ModelLoader* loader);
+ModelHandle loadModelAsync(ModelLoader* loader, const char* filename);
+// Submits the copies of parsed models and appends the handles of loads that became resident or failed since the last
+// update to finished. Resident models are taken with getLoadedModel
+void updateModelLoader(ModelLoader* loader, std::vector<ModelHandle>* finished);
+// Blocks until every load is resident or failed, for callers that need all models before the first frame
+void finishModelLoads(ModelLoader* loader, std::vector<ModelHandle>* finished);
+ModelLoadState getModelLoadState(ModelLoader* loader, ModelHandle handle);
+// Valid once the load is resident. The model belongs to the caller from then on
+Model* getLoadedModel(ModelLoader* loader, ModelHandle handle);
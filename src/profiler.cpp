@@ -0,0 +1,117 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+// Single producer ring buffer. Only the owning thread writes, only cpuProfilerEndFrame reads. The owner does not wait
+// for the reader, so it can overwrite slots while they are copied. The reader checks writeIndex again afterwards and
+// drops those zones, like a seqlock
+struct CpuProfilerThread {
+    // Can be renamed while the main thread draws the profiler
+    std::atomic<const char*> name;
+    char generatedName[32];
+    std::atomic<uint64_t> writeIndex;
+    uint64_t readIndex;
+    CpuProfilerZone zones[CPU_PROFILER_RING_SIZE];
+};
+
+static CpuProfilerThread threads[CPU_PROFILER_MAX_THREADS];
+static std::atomic<uint32_t> threadCount(0);
+static thread_local CpuProfilerThread* currentThread = 0;
+thread_local uint32_t cpuProfilerDepth = 0;
+
+static CpuProfilerFrame frames[2];
+static uint32_t lastFrame = 0;
+static uint64_t frameBegin = 0;
+
+void cpuProfilerRegisterThread(const char* name) {
+    if(currentThread) {
+        currentThread->name.store(name ? name : currentThread->generatedName, std::memory_order_release);
+        return;
+    }
+    uint32_t index = threadCount.fetch_add(1);
+    if(index >= CPU_PROFILER_MAX_THREADS) {
+        // Zones of this thread are dropped
+        threadCount.store(CPU_PROFILER_MAX_THREADS);
+        return;
+    }
+    CpuProfilerThread* thread = &threads[index];
+    snprintf(thread->generatedName, sizeof(thread->generatedName), "Thread %u", index);
+    thread->name.store(name ? name : thread->generatedName, std::memory_order_release);
+    currentThread = thread;
+}
+
+const char* cpuProfilerThreadName(uint32_t thread) {
+    const char* name = threads[thread].name.load(std::memory_order_acquire);
+    // Counted but not named yet
+    return name ? name : "";
+}
+
+void cpuProfilerPushZone(const char* name, uint64_t beginNs, uint64_t endNs, uint32_t depth) {
+    if(!currentThread) {
+        cpuProfilerRegisterThread(0);
+        if(!currentThread) {
+            return;
+        }
+    }
+    uint64_t index = currentThread->writeIndex.load(std::memory_order_relaxed);
+    // A reader that sees any of the writes below also sees writeIndex == index, and with it that the slot is reused
+    std::atomic_thread_fence(std::memory_order_release);
+    CpuProfilerZone* zone = &currentThread->zones[index & (CPU_PROFILER_RING_SIZE - 1)];
+    zone->name = name;
+    zone->beginNs = beginNs;
+    zone->endNs = endNs;
+    zone->depth = depth;
+    zone->thread = (uint32_t)(currentThread - threads);
+    currentThread->writeIndex.store(index + 1, std::memory_order_release);
+}
+
+static bool compareZones(const CpuProfilerZone& a, const CpuProfilerZone& b) {
+    if(a.thread != b.thread) {
+        return a.thread < b.thread;
+    }
+    return a.beginNs < b.beginNs;
+}
+
+void cpuProfilerEndFrame() {
+    uint64_t now = cpuProfilerNow();
+    CpuProfilerFrame* frame = &frames[lastFrame ^ 1];
+    frame->beginNs = frameBegin ? frameBegin : now;
+    frame->endNs = now;
+    frame->zoneCount = 0;
+    frameBegin = now;
+
+    uint32_t count = std::min(threadCount.load(), (uint32_t)CPU_PROFILER_MAX_THREADS);
+    for(uint32_t i = 0; i < count; ++i) {
+        CpuProfilerThread* thread = &threads[i];
+        uint64_t writeIndex = thread->writeIndex.load(std::memory_order_acquire);
+        if(writeIndex - thread->readIndex > CPU_PROFILER_RING_SIZE) {
+            // The writer lapped us, the oldest zones are lost
+            thread->readIndex = writeIndex - CPU_PROFILER_RING_SIZE;
+        }
+        uint32_t first = frame->zoneCount;
+        uint64_t readIndex = thread->readIndex;
+        for(uint64_t index = readIndex; index < writeIndex && frame->zoneCount < CPU_PROFILER_MAX_FRAME_ZONES; ++index) {
+            frame->zones[frame->zoneCount++] = thread->zones[index & (CPU_PROFILER_RING_SIZE - 1)];
+        }
+        thread->readIndex = writeIndex;
+
+        // The owner may be writing the slot of zone ownerIndex, so zones up to ownerIndex - CPU_PROFILER_RING_SIZE can be torn
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t ownerIndex = thread->writeIndex.load(std::memory_order_relaxed);
+        if(ownerIndex >= readIndex + CPU_PROFILER_RING_SIZE) {
+            uint32_t copied = frame->zoneCount - first;
+            uint32_t overwritten = (uint32_t)std::min(ownerIndex - CPU_PROFILER_RING_SIZE + 1 - readIndex, (uint64_t)copied);
+            memmove(frame->zones + first, frame->zones + first + overwritten, (copied - overwritten) * sizeof(CpuProfilerZone));
+            frame->zoneCount -= overwritten;
+        }
+    }
+    std::sort(frame->zones, frame->zones + frame->zoneCount, compareZones);
+    lastFrame ^= 1;
+}
+
+const CpuProfilerFrame* cpuProfilerLastFrame() {
+    return &frames[lastFrame];
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <stdint.h>
+#include <chrono>
+
+// Define to compile all PROFILE_ZONE and PROFILE_THREAD markers out
+//#define PROFILER_DISABLE
+
+// The job threads, the model loader workers, the log writer and some room for threads of libraries. Zones of threads
+// beyond it are dropped
+#define CPU_PROFILER_MAX_THREADS 80
+// Must be a power of two
+#define CPU_PROFILER_RING_SIZE 2048
+#define CPU_PROFILER_MAX_FRAME_ZONES 1024
+
+#ifdef PROFILER_DISABLE
+#define PROFILE_ZONE(name)
+#define PROFILE_THREAD(name)
+#else
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+#define PROFILE_ZONE(name) CpuProfilerScope PROFILER_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_THREAD(name) cpuProfilerRegisterThread(name)
+#endif
+
+struct CpuProfilerZone {
+    const char* name;
+    uint64_t beginNs;
+    uint64_t endNs;
+    uint32_t depth;
+    uint32_t thread;
+};
+
+// All zones that ended between two calls of cpuProfilerEndFrame, sorted by thread and begin time
+struct CpuProfilerFrame {
+    uint64_t beginNs;
+    uint64_t endNs;
+    uint32_t zoneCount;
+    CpuProfilerZone zones[CPU_PROFILER_MAX_FRAME_ZONES];
+};
+
+// Nanoseconds. steady_clock is CLOCK_MONOTONIC on Linux and QueryPerformanceCounter on Windows,
+// the same host time domains the GPU profiler calibrates against
+inline uint64_t cpuProfilerNow() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Threads that are not registered get a generic name on their first zone
+void cpuProfilerRegisterThread(const char* name);
+const char* cpuProfilerThreadName(uint32_t thread);
+void cpuProfilerPushZone(const char* name, uint64_t beginNs, uint64_t endNs, uint32_t depth);
+// Collects the zones of all threads. Call once per frame from the main thread
+void cpuProfilerEndFrame();
+const CpuProfilerFrame* cpuProfilerLastFrame();
+
+extern thread_local uint32_t cpuProfilerDepth;
+
+struct CpuProfilerScope {
+    const char* name;
+    uint64_t beginNs;
+
+    CpuProfilerScope(const char* name) : name(name) {
+        cpuProfilerDepth++;
+        beginNs = cpuProfilerNow();
+    }
+    ~CpuProfilerScope() {
+        uint64_t endNs = cpuProfilerNow();
+        cpuProfilerPushZone(name, beginNs, endNs, --cpuProfilerDepth);
+    }
+};
@@ -0,0 +1,80 @@
+#include "resolution_scaling.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Replays GPU frame times recorded with --gpu-times through the resolution scaler, without a GPU. Every line of the
+// file is the GPU time of one frame in milliseconds and the render scale it was rendered at. The times are normalized
+// to scale 1 and scaled again by the square of the scale the controller picks, with the same delay of frames in flight
+// as in the renderer. Frames over the budget are counted for the recorded and the replayed times
+
+static void report(const char* name, std::vector<float> times, float targetMs) {
+    std::sort(times.begin(), times.end());
+    double sum = 0.0;
+    uint32_t overBudget = 0;
+    for(size_t i = 0; i < times.size(); ++i) {
+        sum += times[i];
+        overBudget += times[i] > targetMs;
+    }
+    size_t count = times.size();
+    fprintf(stderr, "%s: avg %.3fms, p50 %.3fms, p99 %.3fms, max %.3fms, %u of %u frames over %.2fms\n", name,
+            sum / count, times[count / 2], times[(count * 99) / 100], times[count - 1], overBudget, (uint32_t)count, targetMs);
+}
+
+int main(int argc, char** argv) {
+    if(argc < 3) {
+        fprintf(stderr, "Usage: %s gpu_times.txt target_ms [frames_in_flight] [min_scale]\n", argv[0]);
+        return 1;
+    }
+    FILE* file = fopen(argv[1], "r");
+    if(!file) {
+        fprintf(stderr, "Could not open %s\n", argv[1]);
+        return 1;
+    }
+    float targetMs = (float)atof(argv[2]);
+    uint32_t framesInFlight = (argc > 3) ? (uint32_t)std::max(atoi(argv[3]), 1) : 2;
+    float minScale = (argc > 4) ? (float)atof(argv[4]) : 0.5f;
+
+    std::vector<float> recordedTimes;
+    std::vector<float> fullScaleTimes;
+    float gpuMs, scale;
+    while(fscanf(file, "%f %f", &gpuMs, &scale) == 2) {
+        recordedTimes.push_back(gpuMs);
+        fullScaleTimes.push_back(gpuMs / (scale * scale));
+    }
+    fclose(file);
+    if(recordedTimes.empty()) {
+        fprintf(stderr, "No frames in %s\n", argv[1]);
+        return 1;
+    }
+
+    ResolutionScaler scaler;
+    initResolutionScaler(&scaler, targetMs, minScale, 1.0f);
+    uint32_t frameCount = (uint32_t)fullScaleTimes.size();
+    std::vector<float> scales(frameCount);
+    std::vector<float> replayedTimes(frameCount);
+    uint32_t scaleChanges = 0;
+    for(uint32_t i = 0; i < frameCount; ++i) {
+        // The frame rendered framesInFlight frames ago finished before this one is recorded
+        if(i >= framesInFlight) {
+            uint32_t finished = i - framesInFlight;
+            updateResolutionScaler(&scaler, replayedTimes[finished], scales[finished]);
+        }
+        scales[i] = scaler.scale;
+        scaleChanges += (i > 0 && scales[i] != scales[i - 1]);
+        replayedTimes[i] = fullScaleTimes[i] * scales[i] * scales[i];
+    }
+
+    report("Recorded", recordedTimes, targetMs);
+    report("Replayed", replayedTimes, targetMs);
+    std::vector<float> sortedScales = scales;
+    std::sort(sortedScales.begin(), sortedScales.end());
+    double scaleSum = 0.0;
+    for(uint32_t i = 0; i < frameCount; ++i) {
+        scaleSum += scales[i];
+    }
+    fprintf(stderr, "Render scale: avg %.3f, min %.3f, p50 %.3f, %u changes\n", scaleSum / frameCount, sortedScales[0], sortedScales[frameCount / 2], scaleChanges);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#include "resolution_scaling.h"
+
+#include <math.h>
+
+void initResolutionScaler(ResolutionScaler* scaler, float targetMs, float minScale, float maxScale) {
+    scaler->targetMs = targetMs;
+    scaler->minScale = minScale;
+    scaler->maxScale = maxScale;
+    scaler->scale = maxScale;
+    scaler->fullScaleMs = -1.0f;
+}
+
+float updateResolutionScaler(ResolutionScaler* scaler, float gpuMs, float renderedScale) {
+    if(gpuMs <= 0.0f || renderedScale <= 0.0f) {
+        return scaler->scale;
+    }
+    float normalizedMs = gpuMs / (renderedScale * renderedScale);
+    if(scaler->fullScaleMs < 0.0f) {
+        scaler->fullScaleMs = normalizedMs;
+    } else {
+        float smoothing = (normalizedMs > scaler->fullScaleMs) ? RESOLUTION_SMOOTHING_UP : RESOLUTION_SMOOTHING_DOWN;
+        scaler->fullScaleMs += (normalizedMs - scaler->fullScaleMs) * smoothing;
+    }
+
+    float targetScale = sqrtf(scaler->targetMs * RESOLUTION_HEADROOM / scaler->fullScaleMs);
+    targetScale = fminf(fmaxf(targetScale, scaler->minScale), scaler->maxScale);
+    if(targetScale < scaler->scale) {
+        // Over budget, drop right away
+        scaler->scale = targetScale;
+    } else if(targetScale - scaler->scale >= RESOLUTION_DEADBAND || targetScale == scaler->maxScale) {
+        scaler->scale = fminf(scaler->scale + RESOLUTION_MAX_INCREASE, targetScale);
+    }
+    return scaler->scale;
+}
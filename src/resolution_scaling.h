@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+
+// Chooses the render scale, the part of the swapchain width and height that the scene is rendered at, from measured GPU
+// frame times. The GPU time is assumed to grow with the pixel count, so every sample is normalized to scale 1 and the
+// scale that fits the budget is the square root of the budget over the normalized time. Samples arrive frames in flight
+// late, so every sample carries the scale its frame was rendered with instead of assuming the current one
+
+// Part of the budget the controller aims for, the rest absorbs noise
+#define RESOLUTION_HEADROOM 0.9f
+// The scale only grows if it is at least this far below the target scale, and then by at most this much per frame
+#define RESOLUTION_DEADBAND 0.02f
+#define RESOLUTION_MAX_INCREASE 0.01f
+// Smoothing of the normalized time. Slower frames are followed quickly, faster frames only slowly
+#define RESOLUTION_SMOOTHING_UP 0.3f
+#define RESOLUTION_SMOOTHING_DOWN 0.05f
+
+struct ResolutionScaler {
+    float targetMs;
+    float minScale;
+    float maxScale;
+    float scale;
+    // Smoothed GPU time at scale 1, negative before the first sample
+    float fullScaleMs;
+};
+
+void initResolutionScaler(ResolutionScaler* scaler, float targetMs, float minScale, float maxScale);
+// Feeds the GPU time of a frame rendered at renderedScale and returns the scale for the next frame
+float updateResolutionScaler(ResolutionScaler* scaler, float gpuMs, float renderedScale);
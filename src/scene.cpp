@@ -0,0 +1,166 @@
+#include "scene.h"
+#include "profiler.h"
+
+#include <cassert>
+
+static SceneChunk* getChunk(Scene* scene, uint32_t entity) {
+    return scene->chunks[entity / SCENE_CHUNK_SIZE];
+}
+
+void initScene(Scene* scene) {
+    *scene = {};
+}
+
+void destroyScene(Scene* scene) {
+    for(uint32_t i = 0; i < scene->chunks.size(); ++i) {
+        delete scene->chunks[i];
+    }
+    *scene = {};
+}
+
+uint32_t createEntity(Scene* scene, uint32_t parent, uint32_t model, glm::vec3 position, glm::quat rotation, glm::vec3 scale) {
+    uint32_t entity = scene->entityCount++;
+    assert(parent == SCENE_NO_PARENT || parent < entity);
+    uint32_t chunkIndex = entity / SCENE_CHUNK_SIZE;
+    if(chunkIndex == scene->chunks.size()) {
+        scene->chunks.push_back(new SceneChunk());
+        scene->dirtyChunks.push_back(0);
+    }
+    SceneChunk* chunk = scene->chunks[chunkIndex];
+    uint32_t i = entity % SCENE_CHUNK_SIZE;
+    chunk->positions[i] = position;
+    chunk->rotations[i] = rotation;
+    chunk->scales[i] = scale;
+    chunk->parents[i] = parent;
+    chunk->models[i] = model;
+    chunk->dirty[i] = 1;
+    chunk->updateStamps[i] = 0;
+    scene->dirtyChunks[chunkIndex] = 1;
+    if(model != SCENE_NO_MODEL) {
+        scene->renderableCount++;
+    }
+
+    if(parent != SCENE_NO_PARENT) {
+        // Entities are only appended, so a new child chunk is always the highest one so far
+        std::vector<uint32_t>& childChunks = getChunk(scene, parent)->childChunks;
+        uint32_t parentChunkIndex = parent / SCENE_CHUNK_SIZE;
+        if(chunkIndex != parentChunkIndex && (childChunks.empty() || childChunks.back() != chunkIndex)) {
+            childChunks.push_back(chunkIndex);
+        }
+    }
+    return entity;
+}
+
+uint32_t instantiateNodes(Scene* scene, const SceneNode* nodes, uint32_t nodeCount, uint32_t parent, uint32_t model) {
+    uint32_t firstEntity = scene->entityCount;
+    for(uint32_t i = 0; i < nodeCount; ++i) {
+        const SceneNode* node = &nodes[i];
+        uint32_t nodeParent = (node->parent == SCENE_NO_PARENT) ? parent : firstEntity + node->parent;
+        createEntity(scene, nodeParent, node->hasMesh ? model : SCENE_NO_MODEL, node->position, node->rotation, node->scale);
+    }
+    return nodeCount;
+}
+
+void setEntityTransform(Scene* scene, uint32_t entity, glm::vec3 position, glm::quat rotation, glm::vec3 scale) {
+    SceneChunk* chunk = getChunk(scene, entity);
+    uint32_t i = entity % SCENE_CHUNK_SIZE;
+    chunk->positions[i] = position;
+    chunk->rotations[i] = rotation;
+    chunk->scales[i] = scale;
+    chunk->dirty[i] = 1;
+    scene->dirtyChunks[entity / SCENE_CHUNK_SIZE] = 1;
+}
+
+void setEntityRotation(Scene* scene, uint32_t entity, glm::quat rotation) {
+    SceneChunk* chunk = getChunk(scene, entity);
+    uint32_t i = entity % SCENE_CHUNK_SIZE;
+    chunk->rotations[i] = rotation;
+    chunk->dirty[i] = 1;
+    scene->dirtyChunks[entity / SCENE_CHUNK_SIZE] = 1;
+}
+
+// translate * rotate * scale without the full matrix products
+static glm::mat4 composeTransform(glm::vec3 position, glm::quat rotation, glm::vec3 scale) {
+    glm::mat3 rotationMatrix = glm::mat3_cast(rotation);
+    glm::mat4 result;
+    result[0] = glm::vec4(rotationMatrix[0] * scale.x, 0.0f);
+    result[1] = glm::vec4(rotationMatrix[1] * scale.y, 0.0f);
+    result[2] = glm::vec4(rotationMatrix[2] * scale.z, 0.0f);
+    result[3] = glm::vec4(position, 1.0f);
+    return result;
+}
+
+uint32_t updateScene(Scene* scene) {
+    PROFILE_ZONE("updateScene");
+    uint32_t stamp = ++scene->updateStamp;
+    uint32_t updatedCount = 0;
+    for(uint32_t c = 0; c < scene->chunks.size(); ++c) {
+        // Clean chunks without updated parents are skipped entirely, static parts of the scene cost nothing
+        if(!scene->dirtyChunks[c]) {
+            continue;
+        }
+        scene->dirtyChunks[c] = 0;
+        SceneChunk* chunk = scene->chunks[c];
+        uint32_t count = glm::min(scene->entityCount - c * SCENE_CHUNK_SIZE, (uint32_t)SCENE_CHUNK_SIZE);
+        bool updated = false;
+        for(uint32_t i = 0; i < count; ++i) {
+            uint32_t parent = chunk->parents[i];
+            SceneChunk* parentChunk = (parent != SCENE_NO_PARENT) ? getChunk(scene, parent) : 0;
+            uint32_t parentIndex = parent % SCENE_CHUNK_SIZE;
+            bool parentUpdated = parentChunk && parentChunk->updateStamps[parentIndex] == stamp;
+            if(!chunk->dirty[i] && !parentUpdated) {
+                continue;
+            }
+            glm::mat4 local = composeTransform(chunk->positions[i], chunk->rotations[i], chunk->scales[i]);
+            chunk->worldMatrices[i] = parentChunk ? parentChunk->worldMatrices[parentIndex] * local : local;
+            chunk->dirty[i] = 0;
+            chunk->updateStamps[i] = stamp;
+            updated = true;
+            updatedCount++;
+        }
+        if(updated) {
+            for(uint32_t i = 0; i < chunk->childChunks.size(); ++i) {
+                scene->dirtyChunks[chunk->childChunks[i]] = 1;
+            }
+        }
+    }
+    return updatedCount;
+}
+
+const glm::mat4& getEntityWorldMatrix(Scene* scene, uint32_t entity) {
+    return getChunk(scene, entity)->worldMatrices[entity % SCENE_CHUNK_SIZE];
+}
+
+bool isEntityUpdated(Scene* scene, uint32_t entity) {
+    return getChunk(scene, entity)->updateStamps[entity % SCENE_CHUNK_SIZE] == scene->updateStamp;
+}
+
+void collectSceneInstances(Scene* scene, uint32_t modelCount, SceneInstances* instances) {
+    PROFILE_ZONE("collectSceneInstances");
+    // Counting sort by model
+    instances->modelOffsets.assign(modelCount + 1, 0);
+    for(uint32_t c = 0; c < scene->chunks.size(); ++c) {
+        SceneChunk* chunk = scene->chunks[c];
+        uint32_t count = glm::min(scene->entityCount - c * SCENE_CHUNK_SIZE, (uint32_t)SCENE_CHUNK_SIZE);
+        for(uint32_t i = 0; i < count; ++i) {
+            if(chunk->models[i] != SCENE_NO_MODEL) {
+                assert(chunk->models[i] < modelCount);
+                instances->modelOffsets[chunk->models[i] + 1]++;
+            }
+        }
+    }
+    for(uint32_t m = 0; m < modelCount; ++m) {
+        instances->modelOffsets[m + 1] += instances->modelOffsets[m];
+    }
+    instances->entities.resize(instances->modelOffsets[modelCount]);
+    std::vector<uint32_t> cursors(instances->modelOffsets.begin(), instances->modelOffsets.end() - 1);
+    for(uint32_t c = 0; c < scene->chunks.size(); ++c) {
+        SceneChunk* chunk = scene->chunks[c];
+        uint32_t count = glm::min(scene->entityCount - c * SCENE_CHUNK_SIZE, (uint32_t)SCENE_CHUNK_SIZE);
+        for(uint32_t i = 0; i < count; ++i) {
+            if(chunk->models[i] != SCENE_NO_MODEL) {
+                instances->entities[cursors[chunk->models[i]]++] = c * SCENE_CHUNK_SIZE + i;
+            }
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/quaternion.hpp>
+
+#include <stdint.h>
+#include <vector>
+
+// Entities are indices into chunks of SCENE_CHUNK_SIZE entities, every component is its own array inside a chunk.
+// A parent always has a lower index than its children, so a single sweep in index order updates parents first.
+// Model imports create their nodes breadth first, which keeps siblings and levels next to each other
+
+// Must be a power of two
+#define SCENE_CHUNK_SIZE 1024
+#define SCENE_NO_PARENT UINT32_MAX
+#define SCENE_NO_MODEL UINT32_MAX
+
+struct SceneChunk {
+    glm::vec3 positions[SCENE_CHUNK_SIZE];
+    glm::quat rotations[SCENE_CHUNK_SIZE];
+    glm::vec3 scales[SCENE_CHUNK_SIZE];
+    uint32_t parents[SCENE_CHUNK_SIZE];
+    uint32_t models[SCENE_CHUNK_SIZE];
+    glm::mat4 worldMatrices[SCENE_CHUNK_SIZE];
+    // Local transform changed since the last updateScene
+    uint8_t dirty[SCENE_CHUNK_SIZE];
+    // Value of Scene::updateStamp when the world matrix was last recomputed
+    uint32_t updateStamps[SCENE_CHUNK_SIZE];
+    // Later chunks with children of entities in this chunk, ascending
+    std::vector<uint32_t> childChunks;
+};
+
+struct Scene {
+    std::vector<SceneChunk*> chunks;
+    // Chunk has dirty entities or children of entities updated in an earlier chunk
+    std::vector<uint8_t> dirtyChunks;
+    uint32_t entityCount;
+    uint32_t renderableCount;
+    uint32_t updateStamp;
+};
+
+// Node of an imported model, parents come before their children
+struct SceneNode {
+    uint32_t parent;
+    glm::vec3 position;
+    glm::quat rotation;
+    glm::vec3 scale;
+    bool hasMesh;
+};
+
+// Renderable entities grouped by model. The entities of model m are entities[modelOffsets[m]] to entities[modelOffsets[m + 1] - 1]
+struct SceneInstances {
+    std::vector<uint32_t> entities;
+    std::vector<uint32_t> modelOffsets;
+};
+
+void initScene(Scene* scene);
+void destroyScene(Scene* scene);
+// parent must already exist. model is SCENE_NO_MODEL for entities that only carry a transform
+uint32_t createEntity(Scene* scene, uint32_t parent, uint32_t model, glm::vec3 position, glm::quat rotation, glm::vec3 scale);
+// Creates an entity for every node below parent and returns the number of created entities. Nodes with a mesh render model
+uint32_t instantiateNodes(Scene* scene, const SceneNode* nodes, uint32_t nodeCount, uint32_t parent, uint32_t model);
+void setEntityTransform(Scene* scene, uint32_t entity, glm::vec3 position, glm::quat rotation, glm::vec3 scale);
+void setEntityRotation(Scene* scene, uint32_t entity, glm::quat rotation);
+// Recomputes the world matrices of dirty entities and their subtrees. Returns the number of updated entities
+uint32_t updateScene(Scene* scene);
+// Valid after updateScene
+const glm::mat4& getEntityWorldMatrix(Scene* scene, uint32_t entity);
+// True if the last updateScene recomputed the world matrix
+bool isEntityUpdated(Scene* scene, uint32_t entity);
+void collectSceneInstances(Scene* scene, uint32_t modelCount, SceneInstances* instances);
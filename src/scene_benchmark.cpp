@@ -0,0 +1,95 @@
+#include "scene.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+// Transform propagation of 1M static and 10k moving entities. Every group is a root with GROUP_CHILDREN children,
+// like a small imported model. The moving groups are measured once created after the static ones, as dynamic objects
+// usually are, and once scattered through the static groups, where every touched chunk has to be swept
+
+#define STATIC_ENTITIES 1000000
+#define MOVING_ENTITIES 10000
+#define GROUP_CHILDREN 3
+#define BENCHMARK_FRAMES 200
+
+static uint32_t createGroup(Scene* scene, uint32_t index) {
+    glm::vec3 position((float)(index % 1000), 0.0f, (float)(index / 1000));
+    uint32_t root = createEntity(scene, SCENE_NO_PARENT, SCENE_NO_MODEL, position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+    for(uint32_t i = 0; i < GROUP_CHILDREN; ++i) {
+        createEntity(scene, root, i % 2, glm::vec3(0.0f, (float)i, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.5f));
+    }
+    return root;
+}
+
+static void report(const char* name, std::vector<double>& times, uint32_t updated) {
+    std::sort(times.begin(), times.end());
+    double sum = 0.0;
+    for(size_t i = 0; i < times.size(); ++i) {
+        sum += times[i];
+    }
+    size_t count = times.size();
+    fprintf(stderr, "%s: %u entities updated per frame, avg %.3fms, p50 %.3fms, p99 %.3fms, max %.3fms\n", name, updated,
+            sum / count, times[count / 2], times[(count * 99) / 100], times[count - 1]);
+}
+
+// Moves the given roots every frame and measures updateScene
+static void measure(const char* name, Scene* scene, std::vector<uint32_t>& movingRoots) {
+    std::vector<double> times(BENCHMARK_FRAMES);
+    uint32_t updated = 0;
+    for(uint32_t frame = 0; frame < BENCHMARK_FRAMES; ++frame) {
+        glm::quat rotation = glm::angleAxis(frame * 0.01f, glm::vec3(0.0f, 1.0f, 0.0f));
+        for(uint32_t i = 0; i < movingRoots.size(); ++i) {
+            setEntityRotation(scene, movingRoots[i], rotation);
+        }
+        uint64_t begin = cpuProfilerNow();
+        updated = updateScene(scene);
+        times[frame] = (cpuProfilerNow() - begin) * 1e-6;
+    }
+    report(name, times, updated);
+}
+
+int main() {
+    Scene scene;
+    initScene(&scene);
+
+    uint32_t groupSize = GROUP_CHILDREN + 1;
+    uint32_t staticGroups = STATIC_ENTITIES / groupSize;
+    uint32_t movingGroups = MOVING_ENTITIES / groupSize;
+    std::vector<uint32_t> staticRoots(staticGroups);
+    std::vector<uint32_t> movingRoots(movingGroups);
+    for(uint32_t i = 0; i < staticGroups; ++i) {
+        staticRoots[i] = createGroup(&scene, i);
+    }
+    for(uint32_t i = 0; i < movingGroups; ++i) {
+        movingRoots[i] = createGroup(&scene, staticGroups + i);
+    }
+
+    uint64_t begin = cpuProfilerNow();
+    uint32_t updated = updateScene(&scene);
+    fprintf(stderr, "Initial update of %u entities in %u chunks: %.3fms\n", updated, (uint32_t)scene.chunks.size(), (cpuProfilerNow() - begin) * 1e-6);
+
+    std::vector<uint32_t> noRoots;
+    measure("Static only", &scene, noRoots);
+    measure("10k moving, contiguous", &scene, movingRoots);
+
+    // Same number of moving groups, spread evenly over the static ones
+    std::vector<uint32_t> scatteredRoots(movingGroups);
+    for(uint32_t i = 0; i < movingGroups; ++i) {
+        scatteredRoots[i] = staticRoots[(uint64_t)i * staticGroups / movingGroups];
+    }
+    measure("10k moving, scattered", &scene, scatteredRoots);
+
+    std::vector<double> times(BENCHMARK_FRAMES);
+    SceneInstances instances;
+    for(uint32_t frame = 0; frame < BENCHMARK_FRAMES; ++frame) {
+        uint64_t collectBegin = cpuProfilerNow();
+        collectSceneInstances(&scene, 2, &instances);
+        times[frame] = (cpuProfilerNow() - collectBegin) * 1e-6;
+    }
+    report("collectSceneInstances", times, (uint32_t)instances.entities.size());
+
+    destroyScene(&scene);
+    return 0;
+}
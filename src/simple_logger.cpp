@@ -1,4 +1,10 @@
+#include "binary_log.h"
+
+#include <atomic>
 #include <iostream>
+#include <vector>
+
+static std::atomic<uint64_t> writtenMessages(0);
 
 void initLogger() {
     // Nothing to do
@@ -9,14 +15,48 @@ void exitLogger() {
     std::cout << std::flush;
 }
 
-void logInfo(size_t lineNumber, const char* file, const char* message, size_t messageLength) {
+void logInfo(size_t lineNumber, const char* file, const char* message, size_t) {
+    writtenMessages.fetch_add(1, std::memory_order_relaxed);
     std::cout << '[' << file << ':' << lineNumber << "]: " << message << std::endl;
 }
 
-void logWarn(size_t lineNumber, const char* file, const char* message, size_t messageLength) {
+void logWarn(size_t lineNumber, const char* file, const char* message, size_t) {
+    writtenMessages.fetch_add(1, std::memory_order_relaxed);
     std::cout << "\033[33m[" << file << ':' << lineNumber << "]: " << message << "\033[0m" << std::endl;
 }
 
-void logError(size_t lineNumber, const char* file, const char* message, size_t messageLength) {
+void logError(size_t lineNumber, const char* file, const char* message, size_t) {
+    writtenMessages.fetch_add(1, std::memory_order_relaxed);
     std::cout << "\033[31m[" << file << ':' << lineNumber << "]: " << message << "\033[0m" << std::endl;
-}
\ No newline at end of file
+}
+
+static thread_local std::vector<uint8_t> binaryRecord;
+
+uint8_t* logBinaryReserve(size_t size) {
+    binaryRecord.resize(size);
+    return binaryRecord.data();
+}
+
+// Formats right away, this backend has no thread to defer to
+void logBinaryCommit(uint8_t* record) {
+    const LogRecord* header = (const LogRecord*)record;
+    std::string text;
+    formatLogArguments(text, header->types, record + sizeof(LogRecord), header->size);
+    switch(header->site->level) {
+    case LOG_LEVEL_INFO:
+        logInfo(header->site->line, header->site->file, text.c_str(), text.size());
+        break;
+    case LOG_LEVEL_WARN:
+        logWarn(header->site->line, header->site->file, text.c_str(), text.size());
+        break;
+    default:
+        logError(header->site->line, header->site->file, text.c_str(), text.size());
+        break;
+    }
+}
+
+// Writes synchronously, nothing is ever dropped
+void getLoggerStats(uint64_t* written, uint64_t* dropped) {
+    *written = writtenMessages.load();
+    *dropped = 0;
+}
@@ -0,0 +1,346 @@
+#include "texture_streaming.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <math.h>
+
+#define SRGB_LINEAR_STEPS 4096
+
+struct SrgbTables {
+    float toLinear[256];
+    uint8_t fromLinear[SRGB_LINEAR_STEPS];
+};
+
+static SrgbTables createSrgbTables() {
+    SrgbTables tables;
+    for(uint32_t i = 0; i < 256; ++i) {
+        float c = i / 255.0f;
+        tables.toLinear[i] = (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for(uint32_t i = 0; i < SRGB_LINEAR_STEPS; ++i) {
+        float c = i / (float)(SRGB_LINEAR_STEPS - 1);
+        float srgb = (c <= 0.0031308f) ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+        tables.fromLinear[i] = (uint8_t)(srgb * 255.0f + 0.5f);
+    }
+    return tables;
+}
+
+static const SrgbTables& getSrgbTables() {
+    static SrgbTables tables = createSrgbTables();
+    return tables;
+}
+
+static uint32_t getMipSize(uint32_t size, uint32_t level) {
+    return std::max(size >> level, 1u);
+}
+
+// 2x2 box filter. Odd sizes repeat their last row or column
+static void downsample(const uint8_t* source, uint32_t sourceWidth, uint32_t sourceHeight, uint8_t* destination, uint32_t width, uint32_t height, bool srgb) {
+    const SrgbTables& tables = getSrgbTables();
+    for(uint32_t y = 0; y < height; ++y) {
+        uint32_t y0 = std::min(y * 2, sourceHeight - 1);
+        uint32_t y1 = std::min(y * 2 + 1, sourceHeight - 1);
+        for(uint32_t x = 0; x < width; ++x) {
+            uint32_t x0 = std::min(x * 2, sourceWidth - 1);
+            uint32_t x1 = std::min(x * 2 + 1, sourceWidth - 1);
+            const uint8_t* texels[4] = {
+                source + (y0 * sourceWidth + x0) * 4, source + (y0 * sourceWidth + x1) * 4,
+                source + (y1 * sourceWidth + x0) * 4, source + (y1 * sourceWidth + x1) * 4,
+            };
+            uint8_t* output = destination + (y * width + x) * 4;
+            for(uint32_t c = 0; c < 4; ++c) {
+                if(srgb && c < 3) {
+                    float sum = tables.toLinear[texels[0][c]] + tables.toLinear[texels[1][c]] + tables.toLinear[texels[2][c]] + tables.toLinear[texels[3][c]];
+                    output[c] = tables.fromLinear[(uint32_t)(sum * 0.25f * (SRGB_LINEAR_STEPS - 1) + 0.5f)];
+                } else {
+                    output[c] = (uint8_t)((texels[0][c] + texels[1][c] + texels[2][c] + texels[3][c] + 2) / 4);
+                }
+            }
+        }
+    }
+}
+
+void initStreamedTexture(StreamedTexture* texture, const uint8_t* pixels, uint32_t width, uint32_t height, VkFormat format, float texelsPerUnit) {
+    PROFILE_ZONE("initStreamedTexture");
+    assert(width > 0 && height > 0);
+    *texture = {};
+    texture->format = format;
+    texture->width = width;
+    texture->height = height;
+    texture->texelsPerUnit = texelsPerUnit;
+    texture->mipCount = 1;
+    while((std::max(width, height) >> texture->mipCount) > 0) {
+        texture->mipCount++;
+    }
+    assert(texture->mipCount <= TEXTURE_MAX_MIPS);
+
+    uint64_t offset = 0;
+    for(uint32_t level = 0; level < texture->mipCount; ++level) {
+        texture->mipOffsets[level] = offset;
+        offset += (uint64_t)getMipSize(width, level) * getMipSize(height, level) * 4;
+    }
+    texture->mipOffsets[texture->mipCount] = offset;
+    texture->mipData.resize(offset);
+    memcpy(texture->mipData.data(), pixels, (size_t)width * height * 4);
+    bool srgb = format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB;
+    for(uint32_t level = 1; level < texture->mipCount; ++level) {
+        downsample(texture->mipData.data() + texture->mipOffsets[level - 1], getMipSize(width, level - 1), getMipSize(height, level - 1),
+                   texture->mipData.data() + texture->mipOffsets[level], getMipSize(width, level), getMipSize(height, level), srgb);
+    }
+
+    texture->tailMip = 0;
+    while(texture->tailMip + 1 < texture->mipCount && std::max(getMipSize(width, texture->tailMip), getMipSize(height, texture->tailMip)) > TEXTURE_STREAMING_MIN_SIZE) {
+        texture->tailMip++;
+    }
+    texture->residentMip = texture->tailMip;
+    texture->requestedMip = texture->mipCount;
+    texture->generation = 0;
+}
+
+void createStreamedTextureImage(VulkanContext* context, StreamedTexture* texture) {
+    createImage(context, &texture->image, getMipSize(texture->width, texture->tailMip), getMipSize(texture->height, texture->tailMip), texture->format,
+                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_SAMPLE_COUNT_1_BIT, texture->mipCount - texture->tailMip);
+}
+
+void recordStreamedTextureUpload(VkCommandBuffer commandBuffer, StreamedTexture* texture, VkBuffer source, VkDeviceSize sourceOffset) {
+    recordImageUpload(commandBuffer, &texture->image, source, sourceOffset, getMipSize(texture->width, texture->tailMip), getMipSize(texture->height, texture->tailMip),
+                      texture->mipCount - texture->tailMip, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+void destroyStreamedTexture(VulkanContext* context, StreamedTexture* texture) {
+    destroyImage(context, &texture->image);
+    if(texture->pendingImage.image) {
+        destroyImage(context, &texture->pendingImage);
+    }
+    *texture = {};
+}
+
+uint64_t getMipChainSize(StreamedTexture* texture, uint32_t firstMip) {
+    return texture->mipOffsets[texture->mipCount] - texture->mipOffsets[std::min(firstMip, texture->mipCount)];
+}
+
+uint32_t getRequiredMip(StreamedTexture* texture, float pixelsPerUnit) {
+    float texelsPerPixel = texture->texelsPerUnit / pixelsPerUnit;
+    if(!(texelsPerPixel > 1.0f)) {
+        return 0;
+    }
+    // Rounded down, the finer level rather than a blurry one
+    return std::min((uint32_t)log2f(texelsPerPixel), texture->mipCount - 1);
+}
+
+static void recordLevelBarrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t levelCount, VkImageLayout oldLayout, VkImageLayout newLayout,
+                               VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask) {
+    VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+    imageBarrier.srcAccessMask = srcAccessMask;
+    imageBarrier.dstAccessMask = dstAccessMask;
+    imageBarrier.oldLayout = oldLayout;
+    imageBarrier.newLayout = newLayout;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = image;
+    imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, 0, 0, 0, 1, &imageBarrier);
+}
+
+// For the levels mip to mipCount - 1, in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+static void createLevelImage(VulkanContext* context, StreamedTexture* texture, uint32_t mip, VulkanImage* image, VkCommandBuffer commandBuffer) {
+    uint32_t levelCount = texture->mipCount - mip;
+    createImage(context, image, getMipSize(texture->width, mip), getMipSize(texture->height, mip), texture->format,
+                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_SAMPLE_COUNT_1_BIT, levelCount);
+    recordLevelBarrier(commandBuffer, image->image, levelCount, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+}
+
+// Copies the resident levels from firstMip on into image, which starts at level mip, and makes it the resident image.
+// Frames that were recorded before still sample the old image, it is retired with this one
+static void replaceResidentImage(TextureStreamer* streamer, StreamedTexture* texture, VulkanImage* image, uint32_t mip, uint32_t firstMip, VkCommandBuffer commandBuffer) {
+    recordLevelBarrier(commandBuffer, texture->image.image, texture->mipCount - texture->residentMip, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       0, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    VkImageCopy regions[TEXTURE_MAX_MIPS];
+    uint32_t regionCount = 0;
+    for(uint32_t level = firstMip; level < texture->mipCount; ++level) {
+        VkImageCopy* region = &regions[regionCount++];
+        *region = {};
+        region->srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - texture->residentMip, 0, 1};
+        region->dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - mip, 0, 1};
+        region->extent = {getMipSize(texture->width, level), getMipSize(texture->height, level), 1};
+    }
+    vkCmdCopyImage(commandBuffer, texture->image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions);
+    recordLevelBarrier(commandBuffer, image->image, texture->mipCount - mip, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                       VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+    streamer->retiredImages.push_back(texture->image);
+    texture->image = *image;
+    texture->residentMip = mip;
+    texture->generation++;
+}
+
+// Drops the pending level with the rows uploaded so far
+static void cancelPendingLevel(TextureStreamer* streamer, StreamedTexture* texture) {
+    if(texture->pendingImage.image) {
+        streamer->retiredImages.push_back(texture->pendingImage);
+        texture->pendingImage = {};
+    }
+}
+
+// Levels from this one on are resident or being uploaded
+static uint32_t getCommittedMip(StreamedTexture* texture) {
+    return texture->pendingImage.image ? texture->pendingMip : texture->residentMip;
+}
+
+// Keeps the levels mip to mipCount - 1, nothing is uploaded
+static void evictLevels(VulkanContext* context, TextureStreamer* streamer, StreamedTexture* texture, uint32_t mip, VkCommandBuffer commandBuffer) {
+    cancelPendingLevel(streamer, texture);
+    VulkanImage image;
+    createLevelImage(context, texture, mip, &image, commandBuffer);
+    replaceResidentImage(streamer, texture, &image, mip, mip, commandBuffer);
+}
+
+// Uploads the next rows of the level above the resident ones, up to maxBytes but at least one row. Once the level is
+// complete it becomes resident with the levels below it. Returns true then
+static bool streamInRows(VulkanContext* context, TextureStreamer* streamer, StreamedTexture* texture, uint64_t maxBytes, VkCommandBuffer commandBuffer) {
+    uint32_t mip = texture->residentMip - 1;
+    if(!texture->pendingImage.image) {
+        createLevelImage(context, texture, mip, &texture->pendingImage, commandBuffer);
+        texture->pendingMip = mip;
+        texture->pendingRows = 0;
+    }
+    assert(texture->pendingMip == mip);
+    uint32_t width = getMipSize(texture->width, mip);
+    uint32_t height = getMipSize(texture->height, mip);
+    uint64_t rowBytes = (uint64_t)width * 4;
+    uint32_t rows = (uint32_t)std::min((uint64_t)(height - texture->pendingRows), std::max(maxBytes / rowBytes, (uint64_t)1));
+    uint64_t size = rowBytes * rows;
+
+    VulkanBuffer stagingBuffer;
+    createBuffer(context, &stagingBuffer, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    void* mapped;
+    VKA(vkMapMemory(context->device, stagingBuffer.memory, 0, size, 0, &mapped));
+    memcpy(mapped, texture->mipData.data() + texture->mipOffsets[mip] + texture->pendingRows * rowBytes, size);
+    VK(vkUnmapMemory(context->device, stagingBuffer.memory));
+    // Rows of earlier updates are not touched, the copies need no barrier between them
+    VkBufferImageCopy region = {};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageOffset = {0, (int32_t)texture->pendingRows, 0};
+    region.imageExtent = {width, rows, 1};
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer.buffer, texture->pendingImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    streamer->retiredBuffers.push_back(stagingBuffer);
+    streamer->uploadedBytes += size;
+    streamer->totalUploadedBytes += size;
+
+    texture->pendingRows += rows;
+    if(texture->pendingRows < height) {
+        return false;
+    }
+    replaceResidentImage(streamer, texture, &texture->pendingImage, mip, texture->residentMip, commandBuffer);
+    texture->pendingImage = {};
+    return true;
+}
+
+void updateTextureStreaming(VulkanContext* context, TextureStreamer* streamer, StreamedTexture** textures, uint32_t textureCount, VkCommandBuffer commandBuffer) {
+    PROFILE_ZONE("updateTextureStreaming");
+    streamer->uploadedBytes = 0;
+    streamer->streamedIn = 0;
+    streamer->evicted = 0;
+
+    // Targets that fit the budget, the levels from tailMip on are always in it
+    std::vector<uint32_t> targets(textureCount);
+    uint64_t targetBytes = 0;
+    for(uint32_t i = 0; i < textureCount; ++i) {
+        targets[i] = std::min(textures[i]->requestedMip, textures[i]->tailMip);
+        targetBytes += getMipChainSize(textures[i], targets[i]);
+    }
+    while(targetBytes > streamer->budgetBytes) {
+        uint32_t largest = UINT32_MAX;
+        uint64_t largestBytes = 0;
+        for(uint32_t i = 0; i < textureCount; ++i) {
+            uint64_t levelBytes = getMipChainSize(textures[i], targets[i]) - getMipChainSize(textures[i], targets[i] + 1);
+            if(targets[i] < textures[i]->tailMip && levelBytes > largestBytes) {
+                largest = i;
+                largestBytes = levelBytes;
+            }
+        }
+        if(largest == UINT32_MAX) {
+            break;
+        }
+        targets[largest]++;
+        targetBytes -= largestBytes;
+    }
+
+    // Levels finer than the target stay resident as long as the missing levels of other textures fit next to them.
+    // A pending level counts as resident, unless the texture no longer needs it
+    uint64_t residentBytes = 0;
+    uint64_t incomingBytes = 0;
+    for(uint32_t i = 0; i < textureCount; ++i) {
+        if(targets[i] >= textures[i]->residentMip) {
+            cancelPendingLevel(streamer, textures[i]);
+        }
+        uint64_t resident = getMipChainSize(textures[i], getCommittedMip(textures[i]));
+        residentBytes += resident;
+        if(targets[i] < getCommittedMip(textures[i])) {
+            incomingBytes += getMipChainSize(textures[i], targets[i]) - resident;
+        }
+    }
+    while(residentBytes + incomingBytes > streamer->budgetBytes) {
+        uint32_t largest = UINT32_MAX;
+        uint64_t largestBytes = 0;
+        for(uint32_t i = 0; i < textureCount; ++i) {
+            if(textures[i]->residentMip < targets[i]) {
+                uint64_t excessBytes = getMipChainSize(textures[i], textures[i]->residentMip) - getMipChainSize(textures[i], targets[i]);
+                if(excessBytes > largestBytes) {
+                    largest = i;
+                    largestBytes = excessBytes;
+                }
+            }
+        }
+        if(largest == UINT32_MAX) {
+            break;
+        }
+        evictLevels(context, streamer, textures[largest], targets[largest], commandBuffer);
+        residentBytes -= largestBytes;
+        streamer->evicted++;
+    }
+
+    // One level per texture and update, so a close texture sharpens step by step instead of after one large upload.
+    // Pending levels go first, so the upload limit finishes them instead of starting new ones
+    std::vector<uint32_t> missing;
+    for(uint32_t i = 0; i < textureCount; ++i) {
+        if(targets[i] < textures[i]->residentMip) {
+            missing.push_back(i);
+        }
+    }
+    std::sort(missing.begin(), missing.end(), [&](uint32_t a, uint32_t b) {
+        bool pendingA = textures[a]->pendingImage.image != VK_NULL_HANDLE;
+        bool pendingB = textures[b]->pendingImage.image != VK_NULL_HANDLE;
+        if(pendingA != pendingB) {
+            return pendingA;
+        }
+        return textures[a]->residentMip - targets[a] > textures[b]->residentMip - targets[b];
+    });
+    for(uint32_t i = 0; i < missing.size() && streamer->uploadedBytes < TEXTURE_STREAMING_UPLOAD_BYTES; ++i) {
+        StreamedTexture* texture = textures[missing[i]];
+        if(!texture->pendingImage.image) {
+            uint64_t levelBytes = getMipChainSize(texture, texture->residentMip - 1) - getMipChainSize(texture, texture->residentMip);
+            if(residentBytes + levelBytes > streamer->budgetBytes) {
+                // Waits for the eviction of levels above other targets in a later update
+                continue;
+            }
+            residentBytes += levelBytes;
+        }
+        if(streamInRows(context, streamer, texture, TEXTURE_STREAMING_UPLOAD_BYTES - streamer->uploadedBytes, commandBuffer)) {
+            streamer->streamedIn++;
+        }
+    }
+    streamer->residentBytes = residentBytes;
+}
+
+void retireStreamingResources(TextureStreamer* streamer, VulkanDeletionQueue* deletionQueue, uint64_t value) {
+    for(uint32_t i = 0; i < streamer->retiredImages.size(); ++i) {
+        retireImage(deletionQueue, &streamer->retiredImages[i], value);
+    }
+    for(uint32_t i = 0; i < streamer->retiredBuffers.size(); ++i) {
+        retireBuffer(deletionQueue, &streamer->retiredBuffers[i], value);
+    }
+    streamer->retiredImages.clear();
+    streamer->retiredBuffers.clear();
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "vulkan_base/vulkan_base.h"
+
+#include <stdint.h>
+#include <vector>
+
+// Mip level residency of textures under a GPU memory budget. Every texture keeps its full mip chain in system memory and
+// only the levels from residentMip down to 1x1 on the GPU, in an image of exactly that size. The view always starts at the
+// finest resident level, so sampling can not reach levels that are not there. Changing the residency creates a new image,
+// copies the levels it keeps from the old one on the GPU and retires the old image with the frame, the CPU never waits
+// for it. Only a new level is uploaded, in rows over as many updates as the upload limit needs, into a pending image
+// that replaces the resident one once the level is complete.
+// Textures start with their small levels and stream in finer ones one level per update as the feedback requests them
+
+#define TEXTURE_MAX_MIPS 16
+// Levels up to this size are uploaded at creation and never evicted
+#define TEXTURE_STREAMING_MIN_SIZE 64
+// Upload limit per update in bytes. Larger levels are split across updates
+#define TEXTURE_STREAMING_UPLOAD_BYTES (16ull << 20)
+
+struct StreamedTexture {
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipCount;
+    // All levels in system memory, tightly packed with the largest first. 4 bytes per texel
+    std::vector<uint8_t> mipData;
+    uint64_t mipOffsets[TEXTURE_MAX_MIPS + 1];
+    // Texels of level 0 per mesh space unit, the feedback compares it with the pixels per unit on screen
+    float texelsPerUnit;
+    // Holds the levels residentMip to mipCount - 1
+    VulkanImage image;
+    uint32_t residentMip;
+    // Levels from tailMip on are always resident
+    uint32_t tailMip;
+    // Finest level the feedback asks for, mipCount if the texture is not visible
+    uint32_t requestedMip;
+    // Holds the levels pendingMip to mipCount - 1 while the level pendingMip is uploaded, the other levels are copied into
+    // it when the upload is complete. VK_NULL_HANDLE if no level is pending
+    VulkanImage pendingImage;
+    uint32_t pendingMip;
+    // Rows of level pendingMip that were uploaded
+    uint32_t pendingRows;
+    // Incremented whenever image changes, so descriptors can tell that they are out of date
+    uint32_t generation;
+};
+
+struct TextureStreamer {
+    uint64_t budgetBytes;
+    // Of the resident and pending levels of all textures, after the last update
+    uint64_t residentBytes;
+    // Of the last update
+    uint64_t uploadedBytes;
+    uint64_t totalUploadedBytes;
+    // Levels that were completed and evicted by the last update
+    uint32_t streamedIn;
+    uint32_t evicted;
+    // Images replaced and staging buffers used by the last update, retired once it is submitted
+    std::vector<VulkanImage> retiredImages;
+    std::vector<VulkanBuffer> retiredBuffers;
+};
+
+// Builds the mip chain of RGBA8 pixels in system memory, sRGB formats are filtered in linear space. Makes no Vulkan calls
+void initStreamedTexture(StreamedTexture* texture, const uint8_t* pixels, uint32_t width, uint32_t height, VkFormat format, float texelsPerUnit);
+// Creates the image for the levels from tailMip on. Their contents come from recordStreamedTextureUpload
+void createStreamedTextureImage(VulkanContext* context, StreamedTexture* texture);
+// source holds getMipChainSize(texture, texture->tailMip) bytes from mipData at sourceOffset
+void recordStreamedTextureUpload(VkCommandBuffer commandBuffer, StreamedTexture* texture, VkBuffer source, VkDeviceSize sourceOffset);
+void destroyStreamedTexture(VulkanContext* context, StreamedTexture* texture);
+// Bytes of the levels firstMip to mipCount - 1
+uint64_t getMipChainSize(StreamedTexture* texture, uint32_t firstMip);
+// Finest level needed where one mesh space unit covers pixelsPerUnit pixels
+uint32_t getRequiredMip(StreamedTexture* texture, float pixelsPerUnit);
+// Fits the requested levels into the budget by dropping the finest levels of the largest textures first. Evicts levels
+// above that only while the budget needs the memory, then streams in the missing levels, pending ones and then the largest
+// gap first. The uploads and copies are recorded into commandBuffer, which must be outside of a render pass
+void updateTextureStreaming(VulkanContext* context, TextureStreamer* streamer, StreamedTexture** textures, uint32_t textureCount, VkCommandBuffer commandBuffer);
+// value is the scheduler value of the submission with the command buffer of the last update
+void retireStreamingResources(TextureStreamer* streamer, VulkanDeletionQueue* deletionQueue, uint64_t value);
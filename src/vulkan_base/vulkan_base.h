@@ -22,13 +22,60 @@ struct VulkanQueue {
 	uint32_t familyIndex;
 };
 
+// A submission and the scheduler value it signals. The fence is only used without timeline semaphores
+struct VulkanSubmission {
+	uint64_t value;
+	VkFence fence;
+};
+
+struct VulkanQueueTimeline {
+	VkQueue queue;
+	// Timeline semaphore, signaled with the value of every submission on this queue
+	VkSemaphore semaphore;
+	// Unfinished submissions in submission order
+	std::vector<VulkanSubmission> pending;
+};
+
+#define VULKAN_SCHEDULER_MAX_QUEUES 2
+#define VULKAN_SCHEDULER_MAX_SIGNALS 8
+
+// Every submission on every queue gets the next value of a single counter. A value is completed once it and all lower values
+// have finished on the GPU. Uses one timeline semaphore per queue with VK_KHR_timeline_semaphore and a fence per submission otherwise
+struct VulkanScheduler {
+	bool useTimelineSemaphores;
+	VulkanQueueTimeline timelines[VULKAN_SCHEDULER_MAX_QUEUES];
+	uint32_t timelineCount;
+	uint64_t submittedValue;
+	uint64_t completedValue;
+	std::vector<VkFence> freeFences;
+	PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue;
+	PFN_vkWaitSemaphoresKHR waitSemaphores;
+};
+
 struct VulkanSwapchain {
 	VkSwapchainKHR swapchain;
 	uint32_t width;
 	uint32_t height;
 	VkFormat format;
+	// Offscreen swapchains never wait for a display and report IMMEDIATE
+	VkPresentModeKHR presentMode;
 	std::vector<VkImage> images;
 	std::vector<VkImageView> imageViews;
+	// Only used by offscreen swapchains, which have no VkSwapchainKHR
+	std::vector<VkDeviceMemory> memories;
+};
+
+#define VULKAN_MAX_INPUT_ATTACHMENTS 4
+
+// Attachment indices into the attachment array of the render pass. VK_ATTACHMENT_UNUSED if not present
+struct VulkanSubpass {
+	uint32_t colorAttachment;
+	// Written next to colorAttachment, never resolved
+	uint32_t secondColorAttachment;
+	uint32_t depthAttachment;
+	uint32_t resolveAttachment;
+	uint32_t inputAttachmentCount;
+	uint32_t inputAttachments[VULKAN_MAX_INPUT_ATTACHMENTS];
 };
 
 struct VulkanPipeline {
@@ -36,15 +83,67 @@ struct VulkanPipeline {
 	VkPipelineLayout pipelineLayout;
 };
 
+// Fixed function state that differs between the pipelines of one render pass
+struct VulkanPipelineState {
+	VkPipelineDepthStencilStateCreateInfo depthStencil;
+	// Of the single color attachment
+	VkPipelineColorBlendAttachmentState colorBlend;
+	// Attachment formats, only used for dynamic rendering without a render pass. VK_FORMAT_UNDEFINED if not present
+	VkFormat colorFormat;
+	VkFormat depthFormat;
+	// Format of a second color attachment, written without blending. Unlike the others also needed with a render pass,
+	// VK_FORMAT_UNDEFINED if the pass has a single color attachment
+	VkFormat secondColorFormat;
+};
+
+// What the selected device supports and has enabled. Fast paths branch on these, everything else has a fallback.
+// Extensions that are core in apiVersion are not enabled as extensions but count as supported
+struct VulkanCapabilities {
+	// Minimum of the instance and device version, at most 1.3
+	uint32_t apiVersion;
+	// VK_EXT_calibrated_timestamps
+	bool calibratedTimestamps;
+	// VK_EXT_memory_budget
+	bool memoryBudget;
+	// VK_KHR_timeline_semaphore, core in 1.2
+	bool timelineSemaphores;
+	// VK_KHR_dynamic_rendering, core in 1.3, see beginRendering
+	bool dynamicRendering;
+	// VK_KHR_imageless_framebuffer, core in 1.2, see createImagelessFramebuffer
+	bool imagelessFramebuffer;
+	// VK_KHR_synchronization2, core in 1.3
+	bool synchronization2;
+	// VK_EXT_descriptor_indexing, core in 1.2. Partially bound, update after bind and non uniform indexing of sampled image arrays
+	bool descriptorIndexing;
+	// Core features
+	bool multiDrawIndirect;
+	bool drawIndirectFirstInstance;
+	bool samplerAnisotropy;
+};
+
 struct VulkanContext {
 	VkInstance instance;
 	VkPhysicalDevice physicalDevice;
 	VkPhysicalDeviceProperties physicalDeviceProperties;
 	VkDevice device;
 	VulkanQueue graphicsQueue;
+	// Separate queue for async compute if available. Otherwise identical to graphicsQueue
+	VulkanQueue computeQueue;
+	VulkanCapabilities capabilities;
+	PFN_vkCmdBeginRenderingKHR cmdBeginRendering;
+	PFN_vkCmdEndRenderingKHR cmdEndRendering;
+	VulkanScheduler scheduler;
 	VkDebugUtilsMessengerEXT debugCallback;
 };
 
+struct VulkanMemoryHeap {
+	VkDeviceSize size;
+	// Zero without VK_EXT_memory_budget
+	VkDeviceSize usage;
+	VkDeviceSize budget;
+	bool deviceLocal;
+};
+
 struct VulkanBuffer {
 	VkBuffer buffer;
 	VkDeviceMemory memory;
@@ -58,25 +157,178 @@ struct VulkanImage {
 
 VulkanContext* initVulkan(uint32_t instanceExtensionCount, const char** instanceExtensions, uint32_t deviceExtensionCount, const char** deviceExtensions);
 void exitVulkan(VulkanContext* context);
+// Loads the core entry point if apiVersion has it, the alias of the extension otherwise
+PFN_vkVoidFunction getInstanceFunction(VulkanContext* context, const char* coreName, const char* extensionName, uint32_t promotedVersion);
+PFN_vkVoidFunction getDeviceFunction(VulkanContext* context, const char* coreName, const char* extensionName, uint32_t promotedVersion);
 
-VulkanSwapchain createSwapchain(VulkanContext* context, VkSurfaceKHR surface, VkImageUsageFlags usage, VulkanSwapchain* oldSwapchain = 0);
+// Falls back to FIFO if presentMode is not supported. imageCount is clamped to the surface capabilities
+VulkanSwapchain createSwapchain(VulkanContext* context, VkSurfaceKHR surface, VkImageUsageFlags usage, VulkanSwapchain* oldSwapchain = 0,
+								VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR, uint32_t imageCount = 3);
+// Ring of plain images for rendering without a surface. Images are handed out round robin instead of acquired
+VulkanSwapchain createOffscreenSwapchain(VulkanContext* context, uint32_t width, uint32_t height, VkImageUsageFlags usage, uint32_t imageCount);
 void destroySwapchain(VulkanContext* context, VulkanSwapchain* swapchain);
 
+void createScheduler(VulkanContext* context, VulkanScheduler* scheduler);
+void destroyScheduler(VulkanContext* context, VulkanScheduler* scheduler);
+// vkQueueSubmit of a single batch that additionally signals the returned scheduler value
+uint64_t submitWithValue(VulkanContext* context, VulkanQueue* queue, VkSubmitInfo* submitInfo);
+// Returns the value up to which all submissions have finished
+uint64_t pollCompletedValue(VulkanContext* context);
+// Blocks until all submissions up to value have finished. Only waits on the queues that have such submissions pending
+void waitForValue(VulkanContext* context, uint64_t value);
+
 VkRenderPass createRenderPass(VulkanContext* context, VkFormat format, VkSampleCountFlagBits sampleCount, bool useDepth, VkImageLayout finalLayout);
+// Subpass i may read the outputs of subpass i-1 through its input attachments
+VkRenderPass createRenderPass(VulkanContext* context, VkAttachmentDescription* attachments, uint32_t numAttachments, VulkanSubpass* subpasses, uint32_t numSubpasses, VkImageLayout finalLayout);
 void destroyRenderpass(VulkanContext* context, VkRenderPass renderPass);
+// Only fixes the size, usage and format of the attachments. The views are passed with VkRenderPassAttachmentBeginInfoKHR
+// when the render pass begins, so one framebuffer serves every swapchain image. The usage has to match the images exactly
+VkFramebuffer createImagelessFramebuffer(VulkanContext* context, VkRenderPass renderPass, uint32_t width, uint32_t height,
+										 uint32_t numAttachments, VkFormat* formats, VkImageUsageFlags* usages);
+// Dynamic rendering into a color, an optional depth and an optional second color attachment, all cleared with clearValues
+// in that order. The attachments have to be in VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL and VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+// there are no layout transitions
+void beginRendering(VulkanContext* context, VkCommandBuffer commandBuffer, VkImageView colorView, VkImageView depthView, VkRect2D renderArea, VkClearValue* clearValues,
+					VkImageView secondColorView = VK_NULL_HANDLE);
+void endRendering(VulkanContext* context, VkCommandBuffer commandBuffer);
 
+uint32_t findMemoryType(VulkanContext* context, uint32_t typeFilter, VkMemoryPropertyFlags memoryProperties);
 void createBuffer(VulkanContext* context, VulkanBuffer* buffer, uint64_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties);
 void uploadDataToBuffer(VulkanContext* context, VulkanBuffer* buffer, void* data, size_t size);
 void destroyBuffer(VulkanContext* context, VulkanBuffer* buffer);
 
-void createImage(VulkanContext* context, VulkanImage* image, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT);
-void uploadDataToImage(VulkanContext* context, VulkanImage* image, void* data, size_t size, uint32_t width, uint32_t height, VkImageLayout finalLayout, VkAccessFlags dstAccessMask);
+void createImage(VulkanContext* context, VulkanImage* image, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT, uint32_t mipLevels = 1);
+// data holds mipLevels levels, tightly packed with the largest first
+void uploadDataToImage(VulkanContext* context, VulkanImage* image, void* data, size_t size, uint32_t width, uint32_t height, VkImageLayout finalLayout, VkAccessFlags dstAccessMask, uint32_t mipLevels = 1);
+// Records the copy of all levels from source into the image, which is transitioned from undefined to finalLayout for fragment shader reads
+void recordImageUpload(VkCommandBuffer commandBuffer, VulkanImage* image, VkBuffer source, VkDeviceSize sourceOffset, uint32_t width, uint32_t height, uint32_t mipLevels, VkImageLayout finalLayout);
+// Fills up to VK_MAX_MEMORY_HEAPS heaps and returns the heap count
+uint32_t getMemoryHeaps(VulkanContext* context, VulkanMemoryHeap* heaps);
+
+// Copies a single mip color image into data. The image is left in the given layout
+void downloadDataFromImage(VulkanContext* context, VkImage image, void* data, size_t size, uint32_t width, uint32_t height, VkImageLayout layout);
 void destroyImage(VulkanContext* context, VulkanImage* image);
 
+enum VulkanDeletionType {
+	VULKAN_DELETION_IMAGE_VIEW,
+	VULKAN_DELETION_IMAGE,
+	VULKAN_DELETION_BUFFER,
+	VULKAN_DELETION_MEMORY,
+	VULKAN_DELETION_FRAMEBUFFER,
+	VULKAN_DELETION_RENDER_PASS,
+	VULKAN_DELETION_SWAPCHAIN,
+};
+
+struct VulkanDeletion {
+	VulkanDeletionType type;
+	uint64_t handle;
+	// Scheduler value of the last submission that may still use the handle
+	uint64_t value;
+};
+
+// Handles that submissions in flight may still use. They are destroyed once the scheduler value they were retired with is completed
+struct VulkanDeletionQueue {
+	std::vector<VulkanDeletion> deletions;
+};
+
+void retireHandle(VulkanDeletionQueue* queue, VulkanDeletionType type, uint64_t handle, uint64_t value);
+void retireImage(VulkanDeletionQueue* queue, VulkanImage* image, uint64_t value);
+void retireBuffer(VulkanDeletionQueue* queue, VulkanBuffer* buffer, uint64_t value);
+void retireSwapchain(VulkanDeletionQueue* queue, VulkanSwapchain* swapchain, uint64_t value);
+// Destroys all handles retired with a value up to completedValue and returns their count. UINT64_MAX flushes everything
+uint32_t flushDeletionQueue(VulkanContext* context, VulkanDeletionQueue* queue, uint64_t completedValue);
+
+// Reversed Z depth test and write, alpha blending
+VulkanPipelineState getDefaultPipelineState();
+// fragmentShaderFilename may be 0 for depth only pipelines. Without a state the default state is used.
+// Without a render pass the pipeline is created for dynamic rendering with the attachment formats of the state
 VulkanPipeline createPipeline(VulkanContext* context, const char* vertexShaderFilename, const char* fragmentShaderFilename, VkRenderPass renderPass, uint32_t width, uint32_t height,
-							  VkVertexInputAttributeDescription* attributes, uint32_t numAttributes, VkVertexInputBindingDescription* binding, uint32_t numSetLayouts, VkDescriptorSetLayout* setLayouts, VkPushConstantRange* pushConstant, uint32_t subpassIndex = 0, VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT, VkSpecializationInfo* specializationInfo = 0, VkPipelineCache pipelineCache = 0);
+							  VkVertexInputAttributeDescription* attributes, uint32_t numAttributes, VkVertexInputBindingDescription* binding, uint32_t numSetLayouts, VkDescriptorSetLayout* setLayouts, VkPushConstantRange* pushConstant, uint32_t subpassIndex = 0, VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT, VkSpecializationInfo* specializationInfo = 0, VkPipelineCache pipelineCache = 0, VulkanPipelineState* state = 0);
 VulkanPipeline createComputePipeline(VulkanContext* context, const char* shaderFilename,
 							  		 uint32_t numSetLayouts, VkDescriptorSetLayout* setLayouts, VkPushConstantRange* pushConstant, VkSpecializationInfo* specializationInfo, VkPipelineCache pipelineCache = 0);
 void destroyPipeline(VulkanContext* context, VulkanPipeline* pipeline);
 VkPipelineCache createPipelineCache(VulkanContext* context, const char* filename);
-void destroyPipelineCache(VulkanContext* context, VkPipelineCache cache, const char* filename);
\ No newline at end of file
+void destroyPipelineCache(VulkanContext* context, VkPipelineCache cache, const char* filename);
+
+#define GPU_PROFILER_MAX_FRAMES 4
+#define GPU_PROFILER_MAX_SCOPES 32
+#define GPU_PROFILER_HISTORY 256
+// Trace tracks 0 and 1 are the graphics and compute queue, CPU thread i is GPU_PROFILER_CPU_TRACK + i
+#define GPU_PROFILER_CPU_TRACK 2
+// Scope stack entry of a scope on a queue without timestamps
+#define GPU_PROFILER_NO_SCOPE UINT32_MAX
+
+struct GpuProfilerScope {
+	const char* name;
+	uint32_t depth;
+	// Trace track, 0 for the graphics queue and 1 for the compute queue
+	uint32_t track;
+};
+
+// Queries of one frame in flight. Scope i uses the queries 2*i and 2*i+1
+struct GpuProfilerFrame {
+	VkQueryPool queryPool;
+	uint32_t scopeCount;
+	GpuProfilerScope scopes[GPU_PROFILER_MAX_SCOPES];
+	// Host time in nanoseconds when recording started. Used to place the frame without calibrated timestamps
+	uint64_t hostTime;
+};
+
+// Timings of one named scope over the last GPU_PROFILER_HISTORY frames in milliseconds
+struct GpuProfilerStats {
+	const char* name;
+	uint32_t depth;
+	float history[GPU_PROFILER_HISTORY];
+	uint32_t historyCount;
+	uint32_t historyNext;
+	float min, avg, max, p99;
+	// Last resolved frame. Negative if the scope was not recorded in that frame
+	double lastTime;
+	double lastBegin;
+	double lastEnd;
+};
+
+struct GpuProfilerTraceEvent {
+	const char* name;
+	uint64_t beginNs;
+	uint64_t endNs;
+	uint32_t track;
+};
+
+struct GpuProfiler {
+	GpuProfilerFrame frames[GPU_PROFILER_MAX_FRAMES];
+	uint32_t frameCount;
+	uint32_t currentFrame;
+	uint32_t scopeStack[GPU_PROFILER_MAX_SCOPES];
+	uint32_t stackDepth;
+	GpuProfilerStats stats[GPU_PROFILER_MAX_SCOPES];
+	uint32_t statsCount;
+	// Nanoseconds per timestamp tick
+	double timestampPeriod;
+	// Valid timestamp bits of the queue family of each queue track. 0 if the family has no timestamps, its scopes are skipped
+	uint64_t timestampMasks[GPU_PROFILER_CPU_TRACK];
+	// hostNs = gpuTicks * timestampPeriod + gpuToHostOffset
+	bool calibrated;
+	double gpuToHostOffset;
+	VkTimeDomainEXT hostDomain;
+	PFN_vkGetCalibratedTimestampsEXT getCalibratedTimestamps;
+	// Host time in nanoseconds when the last scope of the last resolved frame ended. 0 without calibration
+	uint64_t lastFrameEndHostNs;
+	uint32_t captureFramesLeft;
+	const char* captureFilename;
+	std::vector<GpuProfilerTraceEvent> trace;
+};
+
+void createGpuProfiler(VulkanContext* context, GpuProfiler* profiler, uint32_t framesInFlight);
+void destroyGpuProfiler(VulkanContext* context, GpuProfiler* profiler);
+// Resolves the queries of the previous use of frameIndex and resets them. That frame must have finished, see waitForValue
+void beginGpuProfilerFrame(VulkanContext* context, GpuProfiler* profiler, VkCommandBuffer commandBuffer, uint32_t frameIndex);
+void beginGpuScope(GpuProfiler* profiler, VkCommandBuffer commandBuffer, const char* name, uint32_t track = 0);
+void endGpuScope(GpuProfiler* profiler, VkCommandBuffer commandBuffer);
+// Null if the scope was never recorded
+GpuProfilerStats* getGpuProfilerStats(GpuProfiler* profiler, const char* name);
+// Adds the CPU zones of a frame to a running trace capture
+struct CpuProfilerFrame;
+void addProfilerCpuFrame(GpuProfiler* profiler, const CpuProfilerFrame* frame);
+// Writes the next frameCount frames as Chrome trace JSON (chrome://tracing, Perfetto)
+void captureProfilerTrace(GpuProfiler* profiler, uint32_t frameCount, const char* filename);
@@ -0,0 +1,80 @@
+#include "vulkan_base.h"
+
+void retireHandle(VulkanDeletionQueue* queue, VulkanDeletionType type, uint64_t handle, uint64_t value) {
+	if(!handle) {
+		return;
+	}
+	VulkanDeletion deletion = {type, handle, value};
+	queue->deletions.push_back(deletion);
+}
+
+void retireImage(VulkanDeletionQueue* queue, VulkanImage* image, uint64_t value) {
+	retireHandle(queue, VULKAN_DELETION_IMAGE_VIEW, (uint64_t)image->view, value);
+	retireHandle(queue, VULKAN_DELETION_IMAGE, (uint64_t)image->image, value);
+	retireHandle(queue, VULKAN_DELETION_MEMORY, (uint64_t)image->memory, value);
+	*image = {};
+}
+
+void retireBuffer(VulkanDeletionQueue* queue, VulkanBuffer* buffer, uint64_t value) {
+	retireHandle(queue, VULKAN_DELETION_BUFFER, (uint64_t)buffer->buffer, value);
+	retireHandle(queue, VULKAN_DELETION_MEMORY, (uint64_t)buffer->memory, value);
+	*buffer = {};
+}
+
+void retireSwapchain(VulkanDeletionQueue* queue, VulkanSwapchain* swapchain, uint64_t value) {
+	for(uint32_t i = 0; i < swapchain->imageViews.size(); ++i) {
+		retireHandle(queue, VULKAN_DELETION_IMAGE_VIEW, (uint64_t)swapchain->imageViews[i], value);
+	}
+	if(swapchain->swapchain) {
+		retireHandle(queue, VULKAN_DELETION_SWAPCHAIN, (uint64_t)swapchain->swapchain, value);
+	} else {
+		for(uint32_t i = 0; i < swapchain->images.size(); ++i) {
+			retireHandle(queue, VULKAN_DELETION_IMAGE, (uint64_t)swapchain->images[i], value);
+			retireHandle(queue, VULKAN_DELETION_MEMORY, (uint64_t)swapchain->memories[i], value);
+		}
+	}
+	*swapchain = {};
+}
+
+static void destroyHandle(VulkanContext* context, VulkanDeletion* deletion) {
+	switch(deletion->type) {
+	case VULKAN_DELETION_IMAGE_VIEW:
+		VK(vkDestroyImageView(context->device, (VkImageView)deletion->handle, 0));
+		break;
+	case VULKAN_DELETION_IMAGE:
+		VK(vkDestroyImage(context->device, (VkImage)deletion->handle, 0));
+		break;
+	case VULKAN_DELETION_BUFFER:
+		VK(vkDestroyBuffer(context->device, (VkBuffer)deletion->handle, 0));
+		break;
+	case VULKAN_DELETION_MEMORY:
+		VK(vkFreeMemory(context->device, (VkDeviceMemory)deletion->handle, 0));
+		break;
+	case VULKAN_DELETION_FRAMEBUFFER:
+		VK(vkDestroyFramebuffer(context->device, (VkFramebuffer)deletion->handle, 0));
+		break;
+	case VULKAN_DELETION_RENDER_PASS:
+		VK(vkDestroyRenderPass(context->device, (VkRenderPass)deletion->handle, 0));
+		break;
+	case VULKAN_DELETION_SWAPCHAIN:
+		VK(vkDestroySwapchainKHR(context->device, (VkSwapchainKHR)deletion->handle, 0));
+		break;
+	}
+}
+
+uint32_t flushDeletionQueue(VulkanContext* context, VulkanDeletionQueue* queue, uint64_t completedValue) {
+	// Entries are destroyed in the order they were retired, so views go before their images and images before their memory
+	uint32_t destroyed = 0;
+	uint32_t kept = 0;
+	for(uint32_t i = 0; i < queue->deletions.size(); ++i) {
+		VulkanDeletion* deletion = &queue->deletions[i];
+		if(deletion->value <= completedValue) {
+			destroyHandle(context, deletion);
+			destroyed++;
+		} else {
+			queue->deletions[kept++] = *deletion;
+		}
+	}
+	queue->deletions.resize(kept);
+	return destroyed;
+}
@@ -1,5 +1,9 @@
 #include "vulkan_base.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
 VkBool32 VKAPI_CALL debugReportCallback(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT messageTypes, const VkDebugUtilsMessengerCallbackDataEXT* callbackData, void* userData) {
 	if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
 		LOG_ERROR(callbackData->pMessage);
@@ -23,18 +27,85 @@ VkDebugUtilsMessengerEXT registerDebugCallback(VkInstance instance) {
 	return callback;
 }
 
+// Newest version this code knows the features of
+#define VULKAN_MAX_API_VERSION VK_API_VERSION_1_3
+// Promoted version of extensions that are not part of any core version
+#define VULKAN_NOT_PROMOTED UINT32_MAX
+
+static void getDeviceExtensions(VkPhysicalDevice physicalDevice, std::vector<VkExtensionProperties>* extensions) {
+	uint32_t extensionCount = 0;
+	VKA(vkEnumerateDeviceExtensionProperties(physicalDevice, 0, &extensionCount, 0));
+	extensions->resize(extensionCount);
+	VKA(vkEnumerateDeviceExtensionProperties(physicalDevice, 0, &extensionCount, extensions->data()));
+}
+
+static bool hasExtension(const std::vector<VkExtensionProperties>& extensions, const char* name) {
+	for (size_t i = 0; i < extensions.size(); ++i) {
+		if (strcmp(extensions[i].extensionName, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Core in apiVersion or available as extension
+static bool isExtensionAvailable(const std::vector<VkExtensionProperties>& extensions, const char* name, uint32_t apiVersion, uint32_t promotedVersion) {
+	return apiVersion >= promotedVersion || hasExtension(extensions, name);
+}
+
+// Adds the extension once, unless it is core in apiVersion
+static void enableExtension(std::vector<const char*>* enabledExtensions, const char* name, uint32_t apiVersion, uint32_t promotedVersion) {
+	if (apiVersion >= promotedVersion) {
+		return;
+	}
+	for (size_t i = 0; i < enabledExtensions->size(); ++i) {
+		if (strcmp((*enabledExtensions)[i], name) == 0) {
+			return;
+		}
+	}
+	enabledExtensions->push_back(name);
+}
+
+// pNext chain of feature structs, only the last struct is tracked
+struct VulkanFeatureChain {
+	VkBaseOutStructure* last;
+};
+
+static void appendFeatures(VulkanFeatureChain* chain, void* features) {
+	VkBaseOutStructure* structure = (VkBaseOutStructure*)features;
+	structure->pNext = 0;
+	chain->last->pNext = structure;
+	chain->last = structure;
+}
+
+PFN_vkVoidFunction getInstanceFunction(VulkanContext* context, const char* coreName, const char* extensionName, uint32_t promotedVersion) {
+	return vkGetInstanceProcAddr(context->instance, (context->capabilities.apiVersion >= promotedVersion) ? coreName : extensionName);
+}
+
+PFN_vkVoidFunction getDeviceFunction(VulkanContext* context, const char* coreName, const char* extensionName, uint32_t promotedVersion) {
+	return vkGetDeviceProcAddr(context->device, (context->capabilities.apiVersion >= promotedVersion) ? coreName : extensionName);
+}
+
 bool initVulkanInstance(VulkanContext* context, uint32_t instanceExtensionCount, const char** instanceExtensions) {
 	uint32_t layerPropertyCount = 0;
 	VKA(vkEnumerateInstanceLayerProperties(&layerPropertyCount, 0));
 	VkLayerProperties* layerProperties = new VkLayerProperties[layerPropertyCount];
 	VKA(vkEnumerateInstanceLayerProperties(&layerPropertyCount, layerProperties));
+	// CI machines often only have a driver installed, so run without validation there
+	bool hasValidationLayer = false;
 	for (uint32_t i = 0; i < layerPropertyCount; ++i) {
 #ifdef VULKAN_INFO_OUTPUT
 		LOG_INFO(layerProperties[i].layerName);
 		LOG_INFO(layerProperties[i].description);
 #endif
+		if (strcmp(layerProperties[i].layerName, "VK_LAYER_KHRONOS_validation") == 0) {
+			hasValidationLayer = true;
+		}
 	}
 	delete[] layerProperties;
+	if (!hasValidationLayer) {
+		LOG_WARN("VK_LAYER_KHRONOS_validation not available, running without validation");
+	}
 
 	const char* enabledLayers[] = {
 		"VK_LAYER_KHRONOS_validation",
@@ -49,41 +120,134 @@ bool initVulkanInstance(VulkanContext* context, uint32_t instanceExtensionCount,
 	validationFeatures.enabledValidationFeatureCount = ARRAY_COUNT(enableValidationFeatures);
 	validationFeatures.pEnabledValidationFeatures = enableValidationFeatures;
 
-#ifdef VULKAN_INFO_OUTPUT
 	uint32_t availableInstanceExtensionCount;
 	VKA(vkEnumerateInstanceExtensionProperties(0, &availableInstanceExtensionCount, 0));
-	VkExtensionProperties* instanceExtensionProperties = new VkExtensionProperties[availableInstanceExtensionCount];
-	VKA(vkEnumerateInstanceExtensionProperties(0, &availableInstanceExtensionCount, instanceExtensionProperties));
-	for (uint32_t i = 0; i < availableInstanceExtensionCount; ++i) {
+	std::vector<VkExtensionProperties> instanceExtensionProperties(availableInstanceExtensionCount);
+	VKA(vkEnumerateInstanceExtensionProperties(0, &availableInstanceExtensionCount, instanceExtensionProperties.data()));
+	if (hasValidationLayer) {
+		// Validation features and debug utils are also provided by the layer itself
+		uint32_t layerExtensionCount;
+		VKA(vkEnumerateInstanceExtensionProperties("VK_LAYER_KHRONOS_validation", &layerExtensionCount, 0));
+		instanceExtensionProperties.resize(availableInstanceExtensionCount + layerExtensionCount);
+		VKA(vkEnumerateInstanceExtensionProperties("VK_LAYER_KHRONOS_validation", &layerExtensionCount, instanceExtensionProperties.data() + availableInstanceExtensionCount));
+	}
+#ifdef VULKAN_INFO_OUTPUT
+	for (uint32_t i = 0; i < instanceExtensionProperties.size(); ++i) {
 		LOG_INFO(instanceExtensionProperties[i].extensionName);
 	}
-	delete[] instanceExtensionProperties;
 #endif
+
+	// Drop requested extensions that are not available instead of failing instance creation
+	std::vector<const char*> enabledExtensions;
+	bool hasDebugUtils = false;
+	bool hasValidationFeatures = false;
+	for (uint32_t i = 0; i < instanceExtensionCount; ++i) {
+		bool available = false;
+		for (uint32_t j = 0; j < instanceExtensionProperties.size(); ++j) {
+			if (strcmp(instanceExtensions[i], instanceExtensionProperties[j].extensionName) == 0) {
+				available = true;
+				break;
+			}
+		}
+		if (!available) {
+			LOG_WARN("Instance extension ", instanceExtensions[i], " not available");
+			continue;
+		}
+		hasDebugUtils |= strcmp(instanceExtensions[i], VK_EXT_DEBUG_UTILS_EXTENSION_NAME) == 0;
+		hasValidationFeatures |= strcmp(instanceExtensions[i], VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME) == 0;
+		enabledExtensions.push_back(instanceExtensions[i]);
+	}
 	
 	VkApplicationInfo applicationInfo = {VK_STRUCTURE_TYPE_APPLICATION_INFO};
 	applicationInfo.pApplicationName = "Vulkan Tutorial";
 	applicationInfo.applicationVersion = VK_MAKE_VERSION(0, 0, 1); // 0.0.1
-	applicationInfo.apiVersion = VK_API_VERSION_1_0;
+	// The newest version both the loader and this code know. A 1.0 loader fails instance creation for anything else
+	uint32_t instanceVersion = VK_API_VERSION_1_0;
+	PFN_vkEnumerateInstanceVersion enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(0, "vkEnumerateInstanceVersion");
+	if (enumerateInstanceVersion) {
+		VKA(enumerateInstanceVersion(&instanceVersion));
+	}
+	instanceVersion = std::min(VK_MAKE_API_VERSION(0, VK_API_VERSION_MAJOR(instanceVersion), VK_API_VERSION_MINOR(instanceVersion), 0), VULKAN_MAX_API_VERSION);
+	applicationInfo.apiVersion = instanceVersion;
+	context->capabilities.apiVersion = instanceVersion;
 	
 	VkInstanceCreateInfo createInfo = { VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO };
-	createInfo.pNext = &validationFeatures;
+	if (hasValidationLayer && hasValidationFeatures) {
+		createInfo.pNext = &validationFeatures;
+	}
 	createInfo.pApplicationInfo = &applicationInfo;
-	createInfo.enabledLayerCount = ARRAY_COUNT(enabledLayers);
-	createInfo.ppEnabledLayerNames = enabledLayers;
-	createInfo.enabledExtensionCount = instanceExtensionCount;
-	createInfo.ppEnabledExtensionNames = instanceExtensions;
+	if (hasValidationLayer) {
+		createInfo.enabledLayerCount = ARRAY_COUNT(enabledLayers);
+		createInfo.ppEnabledLayerNames = enabledLayers;
+	}
+	createInfo.enabledExtensionCount = (uint32_t)enabledExtensions.size();
+	createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 	if (VK(vkCreateInstance(&createInfo, 0, &context->instance)) != VK_SUCCESS) {
 		LOG_ERROR("Error creating vulkan instance");
 		return false;
 	}
 
-	context->debugCallback = registerDebugCallback(context->instance);
+	if (hasDebugUtils) {
+		context->debugCallback = registerDebugCallback(context->instance);
+	}
 
 	return true;
 }
 
-bool selectPhysicalDevice(VulkanContext* context) {
+static const char* getDeviceTypeName(VkPhysicalDeviceType type) {
+	switch (type) {
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+	case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+	default: return "other";
+	}
+}
+
+// Higher is better, 0 if the renderer can not run on the device. The device type dominates, the API version and the
+// amount of device local memory only decide between devices of the same type
+static uint64_t scorePhysicalDevice(VkPhysicalDevice physicalDevice, const VkPhysicalDeviceProperties& properties, uint32_t deviceExtensionCount, const char** deviceExtensions) {
+	uint32_t numQueueFamilies = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &numQueueFamilies, 0);
+	std::vector<VkQueueFamilyProperties> queueFamilies(numQueueFamilies);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &numQueueFamilies, queueFamilies.data());
+	bool hasGraphicsQueue = false;
+	for (uint32_t i = 0; i < numQueueFamilies; ++i) {
+		hasGraphicsQueue |= queueFamilies[i].queueCount > 0 && (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT);
+	}
+	if (!hasGraphicsQueue) {
+		return 0;
+	}
+	std::vector<VkExtensionProperties> extensions;
+	getDeviceExtensions(physicalDevice, &extensions);
+	for (uint32_t i = 0; i < deviceExtensionCount; ++i) {
+		if (!hasExtension(extensions, deviceExtensions[i])) {
+			return 0;
+		}
+	}
+
+	uint64_t typeScore = 1;
+	switch (properties.deviceType) {
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: typeScore = 4; break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: typeScore = 3; break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: typeScore = 2; break;
+	default: break;
+	}
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VK(vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties));
+	uint64_t deviceLocalMegabytes = 0;
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+		if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+			deviceLocalMegabytes += memoryProperties.memoryHeaps[i].size >> 20;
+		}
+	}
+	uint64_t minorVersion = VK_API_VERSION_MINOR(properties.apiVersion);
+	return (typeScore << 48) | ((minorVersion & 0xFF) << 40) | (deviceLocalMegabytes & 0xFFFFFFFFFF);
+}
+
+// The device with the highest score is used. VULKAN_DEVICE selects another one by index or by a part of its name
+bool selectPhysicalDevice(VulkanContext* context, uint32_t deviceExtensionCount, const char** deviceExtensions) {
 	uint32_t numDevices = 0;
 	VKA(vkEnumeratePhysicalDevices(context->instance, &numDevices, 0));
 	if (numDevices == 0) {
@@ -91,20 +255,56 @@ bool selectPhysicalDevice(VulkanContext* context) {
 		context->physicalDevice = 0;
 		return false;
 	}
-	VkPhysicalDevice* physicalDevices = new VkPhysicalDevice[numDevices];
-	VKA(vkEnumeratePhysicalDevices(context->instance, &numDevices, physicalDevices));
+	std::vector<VkPhysicalDevice> physicalDevices(numDevices);
+	VKA(vkEnumeratePhysicalDevices(context->instance, &numDevices, physicalDevices.data()));
+	std::vector<VkPhysicalDeviceProperties> properties(numDevices);
+	std::vector<uint64_t> scores(numDevices);
 	LOG_INFO("Found ", numDevices, " GPU(s):");
-	for(uint32_t i = 0; i < numDevices; ++i) {
-		VkPhysicalDeviceProperties properties = {};
-		VK(vkGetPhysicalDeviceProperties(physicalDevices[i], &properties));
-		LOG_INFO("GPU", i, ": ", properties.deviceName);
+	uint32_t selected = UINT32_MAX;
+	for (uint32_t i = 0; i < numDevices; ++i) {
+		VK(vkGetPhysicalDeviceProperties(physicalDevices[i], &properties[i]));
+		scores[i] = scorePhysicalDevice(physicalDevices[i], properties[i], deviceExtensionCount, deviceExtensions);
+		LOG_INFO("GPU", i, ": ", properties[i].deviceName, " (", getDeviceTypeName(properties[i].deviceType), ", Vulkan ",
+				 VK_API_VERSION_MAJOR(properties[i].apiVersion), ".", VK_API_VERSION_MINOR(properties[i].apiVersion), ", score ", scores[i], ")");
+		if (scores[i] > 0 && (selected == UINT32_MAX || scores[i] > scores[selected])) {
+			selected = i;
+		}
 	}
 
-	context->physicalDevice = physicalDevices[0];
-	VK(vkGetPhysicalDeviceProperties(context->physicalDevice, &context->physicalDeviceProperties));
-	LOG_INFO("Selected GPU: ", context->physicalDeviceProperties.deviceName);
+	const char* deviceOverride = getenv("VULKAN_DEVICE");
+	if (deviceOverride && deviceOverride[0]) {
+		uint32_t overrideIndex = UINT32_MAX;
+		char* end = 0;
+		unsigned long index = strtoul(deviceOverride, &end, 10);
+		if (*end == 0) {
+			overrideIndex = (uint32_t)index;
+		} else {
+			for (uint32_t i = 0; i < numDevices; ++i) {
+				if (strstr(properties[i].deviceName, deviceOverride)) {
+					overrideIndex = i;
+					break;
+				}
+			}
+		}
+		if (overrideIndex < numDevices && scores[overrideIndex] > 0) {
+			selected = overrideIndex;
+		} else {
+			LOG_WARN("VULKAN_DEVICE=", deviceOverride, " does not name a usable GPU, ignoring it");
+		}
+	}
+	if (selected == UINT32_MAX) {
+		LOG_ERROR("No GPU supports graphics and the required extensions");
+		context->physicalDevice = 0;
+		return false;
+	}
 
-	delete[] physicalDevices;
+	context->physicalDevice = physicalDevices[selected];
+	context->physicalDeviceProperties = properties[selected];
+	// Device features of a newer version than the instance can not be used
+	context->capabilities.apiVersion = std::min(context->capabilities.apiVersion, context->physicalDeviceProperties.apiVersion);
+	context->capabilities.apiVersion = std::min(context->capabilities.apiVersion, VULKAN_MAX_API_VERSION);
+	LOG_INFO("Selected GPU: ", context->physicalDeviceProperties.deviceName, ", Vulkan ",
+			 VK_API_VERSION_MAJOR(context->capabilities.apiVersion), ".", VK_API_VERSION_MINOR(context->capabilities.apiVersion));
 
 	return true;
 }
@@ -127,22 +327,150 @@ bool createLogicalDevice(VulkanContext* context, uint32_t deviceExtensionCount,
 		}
 	}
 
-	float priorities[] = { 1.0f };
-	VkDeviceQueueCreateInfo queueCreateInfo = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
-	queueCreateInfo.queueFamilyIndex = graphicsQueueIndex;
-	queueCreateInfo.queueCount = 1;
-	queueCreateInfo.pQueuePriorities = priorities;
+	// Prefer a dedicated compute family for async compute. Otherwise try a second queue of the graphics family
+	uint32_t computeQueueIndex = graphicsQueueIndex;
+	uint32_t computeQueueSlot = 0;
+	for (uint32_t i = 0; i < numQueueFamilies; ++i) {
+		VkQueueFamilyProperties queueFamily = queueFamilies[i];
+		if (queueFamily.queueCount > 0 && queueFamily.timestampValidBits > 0) {
+			if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+				computeQueueIndex = i;
+				break;
+			}
+		}
+	}
+	if (computeQueueIndex == graphicsQueueIndex && queueFamilies[graphicsQueueIndex].queueCount > 1) {
+		computeQueueSlot = 1;
+	}
+
+	float priorities[] = { 1.0f, 1.0f };
+	VkDeviceQueueCreateInfo queueCreateInfos[2];
+	uint32_t queueCreateInfoCount = 1;
+	queueCreateInfos[0] = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
+	queueCreateInfos[0].queueFamilyIndex = graphicsQueueIndex;
+	queueCreateInfos[0].queueCount = 1 + computeQueueSlot;
+	queueCreateInfos[0].pQueuePriorities = priorities;
+	if (computeQueueIndex != graphicsQueueIndex) {
+		queueCreateInfos[1] = queueCreateInfos[0];
+		queueCreateInfos[1].queueFamilyIndex = computeQueueIndex;
+		queueCreateInfos[1].queueCount = 1;
+		queueCreateInfoCount++;
+	}
 
+	// Optional features and extensions are only enabled if the device supports them. Extensions that were promoted to the
+	// core version of the device need not be enabled, their feature structs are the same
+	VulkanCapabilities* capabilities = &context->capabilities;
+	uint32_t apiVersion = capabilities->apiVersion;
+	VkPhysicalDeviceFeatures supportedFeatures;
+	VK(vkGetPhysicalDeviceFeatures(context->physicalDevice, &supportedFeatures));
+	// GPU culling writes indirect draws with firstInstance as instance index, ideally one multi draw per model
 	VkPhysicalDeviceFeatures enabledFeatures = {};
+	enabledFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	enabledFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+	enabledFeatures.samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+	capabilities->multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	capabilities->drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+	capabilities->samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+
+	std::vector<VkExtensionProperties> availableExtensions;
+	getDeviceExtensions(context->physicalDevice, &availableExtensions);
+	std::vector<const char*> enabledExtensions(deviceExtensions, deviceExtensions + deviceExtensionCount);
+
+	bool timelineSemaphoreAvailable = isExtensionAvailable(availableExtensions, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_2);
+	bool dynamicRenderingAvailable = isExtensionAvailable(availableExtensions, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_3) &&
+									 isExtensionAvailable(availableExtensions, VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_2) &&
+									 isExtensionAvailable(availableExtensions, VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_2) &&
+									 isExtensionAvailable(availableExtensions, VK_KHR_MULTIVIEW_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_1) &&
+									 isExtensionAvailable(availableExtensions, VK_KHR_MAINTENANCE2_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_1);
+	bool imagelessFramebufferAvailable = isExtensionAvailable(availableExtensions, VK_KHR_IMAGELESS_FRAMEBUFFER_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_2) &&
+										 isExtensionAvailable(availableExtensions, VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_2) &&
+										 isExtensionAvailable(availableExtensions, VK_KHR_MAINTENANCE2_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_1);
+	bool synchronization2Available = isExtensionAvailable(availableExtensions, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_3);
+	bool descriptorIndexingAvailable = isExtensionAvailable(availableExtensions, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_2) &&
+									   isExtensionAvailable(availableExtensions, VK_KHR_MAINTENANCE3_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_1);
+	capabilities->calibratedTimestamps = isExtensionAvailable(availableExtensions, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME, apiVersion, VULKAN_NOT_PROMOTED);
+	capabilities->memoryBudget = isExtensionAvailable(availableExtensions, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME, apiVersion, VULKAN_NOT_PROMOTED);
+
+	// The extension alone is not enough, the feature has to be supported and enabled as well. Only structs the device knows are queried
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR };
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR };
+	VkPhysicalDeviceImagelessFramebufferFeaturesKHR imagelessFramebufferFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGELESS_FRAMEBUFFER_FEATURES_KHR };
+	VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR };
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT };
+	PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(context->instance,
+		(apiVersion >= VK_API_VERSION_1_1) ? "vkGetPhysicalDeviceFeatures2" : "vkGetPhysicalDeviceFeatures2KHR");
+	if (getFeatures2) {
+		VkPhysicalDeviceFeatures2 features2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+		VulkanFeatureChain queryChain = { (VkBaseOutStructure*)&features2 };
+		if (timelineSemaphoreAvailable) appendFeatures(&queryChain, &timelineSemaphoreFeatures);
+		if (dynamicRenderingAvailable) appendFeatures(&queryChain, &dynamicRenderingFeatures);
+		if (imagelessFramebufferAvailable) appendFeatures(&queryChain, &imagelessFramebufferFeatures);
+		if (synchronization2Available) appendFeatures(&queryChain, &synchronization2Features);
+		if (descriptorIndexingAvailable) appendFeatures(&queryChain, &descriptorIndexingFeatures);
+		VK(getFeatures2(context->physicalDevice, &features2));
+	}
+	capabilities->timelineSemaphores = timelineSemaphoreFeatures.timelineSemaphore;
+	capabilities->dynamicRendering = dynamicRenderingFeatures.dynamicRendering;
+	capabilities->imagelessFramebuffer = imagelessFramebufferFeatures.imagelessFramebuffer;
+	capabilities->synchronization2 = synchronization2Features.synchronization2;
+	// Enough for a bindless array of sampled images that is filled while in use
+	capabilities->descriptorIndexing = descriptorIndexingFeatures.runtimeDescriptorArray && descriptorIndexingFeatures.descriptorBindingPartiallyBound &&
+									   descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing && descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+									   descriptorIndexingFeatures.descriptorBindingUpdateUnusedWhilePending;
+
+	// Only the enabled features are chained into the device creation
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT enabledDescriptorIndexingFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT };
+	enabledDescriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+	enabledDescriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+	enabledDescriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	enabledDescriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	enabledDescriptorIndexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+	VkBaseOutStructure enabledChainHead = {};
+	VulkanFeatureChain enabledChain = { &enabledChainHead };
+	if (capabilities->timelineSemaphores) {
+		appendFeatures(&enabledChain, &timelineSemaphoreFeatures);
+		enableExtension(&enabledExtensions, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_2);
+	}
+	if (capabilities->dynamicRendering) {
+		appendFeatures(&enabledChain, &dynamicRenderingFeatures);
+		enableExtension(&enabledExtensions, VK_KHR_MAINTENANCE2_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_1);
+		enableExtension(&enabledExtensions, VK_KHR_MULTIVIEW_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_1);
+		enableExtension(&enabledExtensions, VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_2);
+		enableExtension(&enabledExtensions, VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_2);
+		enableExtension(&enabledExtensions, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_3);
+	}
+	if (capabilities->imagelessFramebuffer) {
+		appendFeatures(&enabledChain, &imagelessFramebufferFeatures);
+		enableExtension(&enabledExtensions, VK_KHR_MAINTENANCE2_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_1);
+		enableExtension(&enabledExtensions, VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_2);
+		enableExtension(&enabledExtensions, VK_KHR_IMAGELESS_FRAMEBUFFER_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_2);
+	}
+	if (capabilities->synchronization2) {
+		appendFeatures(&enabledChain, &synchronization2Features);
+		enableExtension(&enabledExtensions, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_3);
+	}
+	if (capabilities->descriptorIndexing) {
+		appendFeatures(&enabledChain, &enabledDescriptorIndexingFeatures);
+		enableExtension(&enabledExtensions, VK_KHR_MAINTENANCE3_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_1);
+		enableExtension(&enabledExtensions, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME, apiVersion, VK_API_VERSION_1_2);
+	}
+	if (capabilities->calibratedTimestamps) {
+		enableExtension(&enabledExtensions, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME, apiVersion, VULKAN_NOT_PROMOTED);
+	}
+	if (capabilities->memoryBudget) {
+		enableExtension(&enabledExtensions, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME, apiVersion, VULKAN_NOT_PROMOTED);
+	}
 
 	VkDeviceCreateInfo createInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
-	createInfo.queueCreateInfoCount = 1;
-	createInfo.pQueueCreateInfos = &queueCreateInfo;
-	createInfo.enabledExtensionCount = deviceExtensionCount;
-	createInfo.ppEnabledExtensionNames = deviceExtensions;
+	createInfo.queueCreateInfoCount = queueCreateInfoCount;
+	createInfo.pQueueCreateInfos = queueCreateInfos;
+	createInfo.enabledExtensionCount = (uint32_t)enabledExtensions.size();
+	createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 	createInfo.pEnabledFeatures = &enabledFeatures;
+	createInfo.pNext = enabledChainHead.pNext;
 
-	if (vkCreateDevice(context->physicalDevice, &createInfo, 0, &context->device)) {
+	VkResult result = vkCreateDevice(context->physicalDevice, &createInfo, 0, &context->device);
+	if (result != VK_SUCCESS) {
 		LOG_ERROR("Failed to create vulkan logical device");
 		return false;
 	}
@@ -150,6 +478,24 @@ bool createLogicalDevice(VulkanContext* context, uint32_t deviceExtensionCount,
 	// Acquire queues
 	context->graphicsQueue.familyIndex = graphicsQueueIndex;
 	VK(vkGetDeviceQueue(context->device, graphicsQueueIndex, 0, &context->graphicsQueue.queue));
+	context->computeQueue.familyIndex = computeQueueIndex;
+	VK(vkGetDeviceQueue(context->device, computeQueueIndex, computeQueueSlot, &context->computeQueue.queue));
+	if (context->computeQueue.queue == context->graphicsQueue.queue) {
+		LOG_WARN("No separate compute queue available. Async compute is disabled");
+	} else {
+		LOG_INFO("Using compute queue family ", computeQueueIndex, " queue ", computeQueueSlot, " for async compute");
+	}
+
+	if (capabilities->dynamicRendering) {
+		context->cmdBeginRendering = (PFN_vkCmdBeginRenderingKHR)getDeviceFunction(context, "vkCmdBeginRendering", "vkCmdBeginRenderingKHR", VK_API_VERSION_1_3);
+		context->cmdEndRendering = (PFN_vkCmdEndRenderingKHR)getDeviceFunction(context, "vkCmdEndRendering", "vkCmdEndRenderingKHR", VK_API_VERSION_1_3);
+	}
+	LOG_INFO("Timeline semaphores: ", capabilities->timelineSemaphores, ", dynamic rendering: ", capabilities->dynamicRendering,
+			 ", imageless framebuffers: ", capabilities->imagelessFramebuffer, ", synchronization2: ", capabilities->synchronization2,
+			 ", descriptor indexing: ", capabilities->descriptorIndexing, ", calibrated timestamps: ", capabilities->calibratedTimestamps,
+			 ", memory budget: ", capabilities->memoryBudget);
+
+	createScheduler(context, &context->scheduler);
 
 	VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
 	VK(vkGetPhysicalDeviceMemoryProperties(context->physicalDevice, &deviceMemoryProperties));
@@ -166,13 +512,13 @@ bool createLogicalDevice(VulkanContext* context, uint32_t deviceExtensionCount,
 }
 
 VulkanContext* initVulkan(uint32_t instanceExtensionCount, const char** instanceExtensions, uint32_t deviceExtensionCount, const char** deviceExtensions) {
-	VulkanContext* context = new VulkanContext;
+	VulkanContext* context = new VulkanContext();
 
 	if (!initVulkanInstance(context, instanceExtensionCount, instanceExtensions)) {
 		return 0;
 	}
 
-	if (!selectPhysicalDevice(context)) {
+	if (!selectPhysicalDevice(context, deviceExtensionCount, deviceExtensions)) {
 		return 0;
 	}
 
@@ -185,6 +531,7 @@ VulkanContext* initVulkan(uint32_t instanceExtensionCount, const char** instance
 
 void exitVulkan(VulkanContext* context) {
 	VKA(vkDeviceWaitIdle(context->device));
+	destroyScheduler(context, &context->scheduler);
 	VK(vkDestroyDevice(context->device, 0));
 
 	if (context->debugCallback) {
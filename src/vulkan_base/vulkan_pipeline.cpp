@@ -27,10 +27,39 @@ VkShaderModule createShaderModule(VulkanContext* context, const char* shaderFile
 	return result;
 }
 
+VulkanPipelineState getDefaultPipelineState() {
+	VulkanPipelineState state = {};
+	state.depthStencil = {VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
+	state.depthStencil.depthTestEnable = VK_TRUE;
+	state.depthStencil.depthWriteEnable = VK_TRUE;
+	state.depthStencil.depthCompareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
+	state.depthStencil.minDepthBounds = 0.0f;
+	state.depthStencil.maxDepthBounds = 1.0f;
+
+	state.colorBlend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	state.colorBlend.blendEnable = VK_TRUE;
+	state.colorBlend.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	state.colorBlend.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	state.colorBlend.colorBlendOp = VK_BLEND_OP_ADD;
+	state.colorBlend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	state.colorBlend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	state.colorBlend.alphaBlendOp = VK_BLEND_OP_ADD;
+
+	state.colorFormat = VK_FORMAT_UNDEFINED;
+	state.depthFormat = VK_FORMAT_UNDEFINED;
+	state.secondColorFormat = VK_FORMAT_UNDEFINED;
+	return state;
+}
+
 VulkanPipeline createPipeline(VulkanContext* context, const char* vertexShaderFilename, const char* fragmentShaderFilename, VkRenderPass renderPass, uint32_t width, uint32_t height,
-							  VkVertexInputAttributeDescription* attributes, uint32_t numAttributes, VkVertexInputBindingDescription* binding, uint32_t numSetLayouts, VkDescriptorSetLayout* setLayouts, VkPushConstantRange* pushConstant, uint32_t subpassIndex, VkSampleCountFlagBits sampleCount, VkSpecializationInfo* specializationInfo, VkPipelineCache pipelineCache) {
+							  VkVertexInputAttributeDescription* attributes, uint32_t numAttributes, VkVertexInputBindingDescription* binding, uint32_t numSetLayouts, VkDescriptorSetLayout* setLayouts, VkPushConstantRange* pushConstant, uint32_t subpassIndex, VkSampleCountFlagBits sampleCount, VkSpecializationInfo* specializationInfo, VkPipelineCache pipelineCache, VulkanPipelineState* state) {
+	VulkanPipelineState defaultState = getDefaultPipelineState();
+	if(!state) {
+		state = &defaultState;
+	}
 	VkShaderModule vertexShaderModule = createShaderModule(context, vertexShaderFilename);
-	VkShaderModule fragmentShaderModule = createShaderModule(context, fragmentShaderFilename);
+	// Depth only pipelines have no fragment shader
+	VkShaderModule fragmentShaderModule = fragmentShaderFilename ? createShaderModule(context, fragmentShaderFilename) : VK_NULL_HANDLE;
 
 	VkPipelineShaderStageCreateInfo shaderStages[2];
 	shaderStages[0] = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
@@ -67,25 +96,15 @@ VulkanPipeline createPipeline(VulkanContext* context, const char* vertexShaderFi
 	VkPipelineMultisampleStateCreateInfo multisampleState = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
 	multisampleState.rasterizationSamples = sampleCount;
 
-	VkPipelineDepthStencilStateCreateInfo depthStencilState = {VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
-	depthStencilState.depthTestEnable = VK_TRUE;
-	depthStencilState.depthWriteEnable = VK_TRUE;
-	depthStencilState.depthCompareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
-	depthStencilState.minDepthBounds = 0.0f;
-	depthStencilState.maxDepthBounds = 1.0f;
-
-	VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-	colorBlendAttachment.blendEnable = VK_TRUE;
-	colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-	colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-	colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-	colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-	colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-	colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+	// The second attachment is written as is, or not at all if the first is not written either
+	bool secondColor = state->secondColorFormat != VK_FORMAT_UNDEFINED;
+	VkPipelineColorBlendAttachmentState colorBlends[2];
+	colorBlends[0] = state->colorBlend;
+	colorBlends[1] = {};
+	colorBlends[1].colorWriteMask = state->colorBlend.colorWriteMask ? (VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT) : 0;
 	VkPipelineColorBlendStateCreateInfo colorBlendState = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
-	colorBlendState.attachmentCount = 1;
-	colorBlendState.pAttachments = &colorBlendAttachment;
+	colorBlendState.attachmentCount = secondColor ? 2 : 1;
+	colorBlendState.pAttachments = colorBlends;
 
 	VkPipelineDynamicStateCreateInfo dynamicState = {VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO};
 	VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
@@ -102,17 +121,28 @@ VulkanPipeline createPipeline(VulkanContext* context, const char* vertexShaderFi
 		VKA(vkCreatePipelineLayout(context->device, &createInfo, 0, &pipelineLayout));
 	}
 
+	// Only read without a render pass
+	VkPipelineRenderingCreateInfoKHR renderingCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR };
+	VkFormat colorFormats[] = {state->colorFormat, state->secondColorFormat};
+	renderingCreateInfo.colorAttachmentCount = (state->colorFormat != VK_FORMAT_UNDEFINED) ? (secondColor ? 2 : 1) : 0;
+	renderingCreateInfo.pColorAttachmentFormats = colorFormats;
+	renderingCreateInfo.depthAttachmentFormat = state->depthFormat;
+
 	VkPipeline pipeline;
 	{
 		VkGraphicsPipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
-		createInfo.stageCount = ARRAY_COUNT(shaderStages);
+		if(!renderPass) {
+			assert(context->capabilities.dynamicRendering);
+			createInfo.pNext = &renderingCreateInfo;
+		}
+		createInfo.stageCount = fragmentShaderModule ? 2 : 1;
 		createInfo.pStages = shaderStages;
 		createInfo.pVertexInputState = &vertexInputState;
 		createInfo.pInputAssemblyState = &inputAssemblyState;
 		createInfo.pViewportState = &viewportState;
 		createInfo.pRasterizationState = &rasterizationState;
 		createInfo.pMultisampleState = &multisampleState;
-		createInfo.pDepthStencilState = &depthStencilState;
+		createInfo.pDepthStencilState = &state->depthStencil;
 		createInfo.pColorBlendState = &colorBlendState;
 		createInfo.pDynamicState = &dynamicState;
 		createInfo.layout = pipelineLayout;
@@ -123,7 +153,9 @@ VulkanPipeline createPipeline(VulkanContext* context, const char* vertexShaderFi
 
 	// Module can be destroyed after pipeline creation
 	VK(vkDestroyShaderModule(context->device, vertexShaderModule, 0));
-	VK(vkDestroyShaderModule(context->device, fragmentShaderModule, 0));
+	if(fragmentShaderModule) {
+		VK(vkDestroyShaderModule(context->device, fragmentShaderModule, 0));
+	}
 
 	VulkanPipeline result = {};
 	result.pipeline = pipeline;
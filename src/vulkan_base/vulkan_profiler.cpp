@@ -0,0 +1,299 @@
+#include "vulkan_base.h"
+#include "../profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+// Host timestamps come from cpuProfilerNow so GPU and CPU zones share one timeline
+#ifdef _WIN32
+static VkTimeDomainEXT hostTimeDomain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+
+static uint64_t hostTicksToNs(uint64_t ticks) {
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return uint64_t(double(ticks) * 1e9 / double(frequency.QuadPart));
+}
+#else
+static VkTimeDomainEXT hostTimeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+
+static uint64_t hostTicksToNs(uint64_t ticks) {
+	return ticks;
+}
+#endif
+
+static void calibrateGpuProfiler(VulkanContext* context, GpuProfiler* profiler) {
+	VkCalibratedTimestampInfoEXT timestampInfos[2];
+	timestampInfos[0] = {VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT};
+	timestampInfos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+	timestampInfos[1] = {VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT};
+	timestampInfos[1].timeDomain = profiler->hostDomain;
+	uint64_t timestamps[2];
+	uint64_t maxDeviation;
+	if(VK(profiler->getCalibratedTimestamps(context->device, ARRAY_COUNT(timestampInfos), timestampInfos, timestamps, &maxDeviation)) == VK_SUCCESS) {
+		profiler->gpuToHostOffset = double(hostTicksToNs(timestamps[1])) - double(timestamps[0] & profiler->timestampMasks[0]) * profiler->timestampPeriod;
+	}
+}
+
+void createGpuProfiler(VulkanContext* context, GpuProfiler* profiler, uint32_t framesInFlight) {
+	assert(framesInFlight <= GPU_PROFILER_MAX_FRAMES);
+	*profiler = {};
+	profiler->frameCount = framesInFlight;
+	profiler->timestampPeriod = context->physicalDeviceProperties.limits.timestampPeriod;
+
+	uint32_t numQueueFamilies = 0;
+	VK(vkGetPhysicalDeviceQueueFamilyProperties(context->physicalDevice, &numQueueFamilies, 0));
+	VkQueueFamilyProperties* queueFamilies = new VkQueueFamilyProperties[numQueueFamilies];
+	VK(vkGetPhysicalDeviceQueueFamilyProperties(context->physicalDevice, &numQueueFamilies, queueFamilies));
+	// Same order as the queue tracks
+	uint32_t familyIndices[GPU_PROFILER_CPU_TRACK] = {context->graphicsQueue.familyIndex, context->computeQueue.familyIndex};
+	const char* queueNames[GPU_PROFILER_CPU_TRACK] = {"Graphics", "Compute"};
+	for(uint32_t i = 0; i < GPU_PROFILER_CPU_TRACK; ++i) {
+		uint32_t validBits = queueFamilies[familyIndices[i]].timestampValidBits;
+		profiler->timestampMasks[i] = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+		if(validBits == 0) {
+			LOG_WARN(queueNames[i], " queue does not support timestamps. Its GPU scopes are not measured");
+		}
+	}
+	delete[] queueFamilies;
+
+	for(uint32_t i = 0; i < profiler->frameCount; ++i) {
+		VkQueryPoolCreateInfo createInfo = {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+		createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		createInfo.queryCount = GPU_PROFILER_MAX_SCOPES * 2;
+		VKA(vkCreateQueryPool(context->device, &createInfo, 0, &profiler->frames[i].queryPool));
+	}
+
+	if(context->capabilities.calibratedTimestamps) {
+		PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT getTimeDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(context->instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+		profiler->getCalibratedTimestamps = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(context->device, "vkGetCalibratedTimestampsEXT");
+		if(getTimeDomains && profiler->getCalibratedTimestamps) {
+			uint32_t timeDomainCount = 0;
+			VKA(getTimeDomains(context->physicalDevice, &timeDomainCount, 0));
+			VkTimeDomainEXT* timeDomains = new VkTimeDomainEXT[timeDomainCount];
+			VKA(getTimeDomains(context->physicalDevice, &timeDomainCount, timeDomains));
+			bool hasDevice = false;
+			bool hasHost = false;
+			for(uint32_t i = 0; i < timeDomainCount; ++i) {
+				hasDevice |= timeDomains[i] == VK_TIME_DOMAIN_DEVICE_EXT;
+				hasHost |= timeDomains[i] == hostTimeDomain;
+			}
+			delete[] timeDomains;
+			profiler->calibrated = hasDevice && hasHost;
+			profiler->hostDomain = hostTimeDomain;
+		}
+	}
+	if(profiler->calibrated) {
+		calibrateGpuProfiler(context, profiler);
+	} else {
+		LOG_INFO("No calibrated timestamps. GPU trace events are aligned to the CPU submission time");
+	}
+}
+
+void destroyGpuProfiler(VulkanContext* context, GpuProfiler* profiler) {
+	for(uint32_t i = 0; i < profiler->frameCount; ++i) {
+		VK(vkDestroyQueryPool(context->device, profiler->frames[i].queryPool, 0));
+	}
+	profiler->trace.clear();
+}
+
+GpuProfilerStats* getGpuProfilerStats(GpuProfiler* profiler, const char* name) {
+	for(uint32_t i = 0; i < profiler->statsCount; ++i) {
+		if(strcmp(profiler->stats[i].name, name) == 0) {
+			return &profiler->stats[i];
+		}
+	}
+	return 0;
+}
+
+static void updateStats(GpuProfilerStats* stats, float time) {
+	stats->history[stats->historyNext] = time;
+	stats->historyNext = (stats->historyNext + 1) % GPU_PROFILER_HISTORY;
+	if(stats->historyCount < GPU_PROFILER_HISTORY) {
+		stats->historyCount++;
+	}
+
+	float sorted[GPU_PROFILER_HISTORY];
+	float sum = 0.0f;
+	for(uint32_t i = 0; i < stats->historyCount; ++i) {
+		sorted[i] = stats->history[i];
+		sum += sorted[i];
+	}
+	std::sort(sorted, sorted + stats->historyCount);
+	stats->min = sorted[0];
+	stats->max = sorted[stats->historyCount - 1];
+	stats->avg = sum / stats->historyCount;
+	stats->p99 = sorted[(stats->historyCount * 99) / 100];
+}
+
+static void writeTrace(GpuProfiler* profiler) {
+	FILE* file = fopen(profiler->captureFilename, "w");
+	if(!file) {
+		LOG_ERROR("Failed to write profiler trace ", profiler->captureFilename);
+		profiler->trace.clear();
+		return;
+	}
+
+	uint64_t start = ~0ull;
+	for(size_t i = 0; i < profiler->trace.size(); ++i) {
+		start = std::min(start, profiler->trace[i].beginNs);
+	}
+
+	const char* trackNames[] = {"GPU graphics queue", "GPU compute queue"};
+	uint32_t cpuThreadCount = 0;
+	for(size_t i = 0; i < profiler->trace.size(); ++i) {
+		if(profiler->trace[i].track >= GPU_PROFILER_CPU_TRACK) {
+			cpuThreadCount = std::max(cpuThreadCount, profiler->trace[i].track - GPU_PROFILER_CPU_TRACK + 1);
+		}
+	}
+	fprintf(file, "{\"traceEvents\":[\n");
+	for(uint32_t i = 0; i < ARRAY_COUNT(trackNames); ++i) {
+		fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}},\n", i, trackNames[i]);
+	}
+	for(uint32_t i = 0; i < cpuThreadCount; ++i) {
+		fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"CPU %s\"}},\n", GPU_PROFILER_CPU_TRACK + i, cpuProfilerThreadName(i));
+	}
+	for(size_t i = 0; i < profiler->trace.size(); ++i) {
+		GpuProfilerTraceEvent* event = &profiler->trace[i];
+		fprintf(file, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+				event->name, (event->track < GPU_PROFILER_CPU_TRACK) ? "gpu" : "cpu", event->track,
+				double(event->beginNs - start) * 1e-3, double(event->endNs - event->beginNs) * 1e-3,
+				(i + 1 < profiler->trace.size()) ? "," : "");
+	}
+	fprintf(file, "]}\n");
+	fclose(file);
+
+	LOG_INFO("Wrote profiler trace with ", profiler->trace.size(), " events to ", profiler->captureFilename);
+	profiler->trace.clear();
+}
+
+static void resolveGpuProfilerFrame(VulkanContext* context, GpuProfiler* profiler, GpuProfilerFrame* frame) {
+	for(uint32_t i = 0; i < profiler->statsCount; ++i) {
+		profiler->stats[i].lastTime = -1.0;
+	}
+	profiler->lastFrameEndHostNs = 0;
+	if(frame->scopeCount == 0) {
+		return;
+	}
+
+	uint64_t timestamps[GPU_PROFILER_MAX_SCOPES * 2];
+	uint32_t queryCount = frame->scopeCount * 2;
+	// This frame has finished on the GPU, so the results are available without waiting
+	VkResult result = VK(vkGetQueryPoolResults(context->device, frame->queryPool, 0, queryCount, sizeof(timestamps), timestamps, sizeof(timestamps[0]), VK_QUERY_RESULT_64_BIT));
+	if(result != VK_SUCCESS) {
+		return;
+	}
+
+	double gpuToHostOffset = profiler->gpuToHostOffset;
+	if(!profiler->calibrated) {
+		// Assume the GPU started with the first scope right when the CPU began recording
+		gpuToHostOffset = double(frame->hostTime) - double(timestamps[0] & profiler->timestampMasks[frame->scopes[0].track]) * profiler->timestampPeriod;
+	}
+
+	bool capture = profiler->captureFramesLeft > 0;
+	for(uint32_t i = 0; i < frame->scopeCount; ++i) {
+		GpuProfilerScope* scope = &frame->scopes[i];
+		// Masked with the family of the queue that wrote the queries
+		uint64_t mask = profiler->timestampMasks[scope->track];
+		double begin = double(timestamps[i * 2] & mask) * profiler->timestampPeriod;
+		double end = double(timestamps[i * 2 + 1] & mask) * profiler->timestampPeriod;
+
+		GpuProfilerStats* stats = getGpuProfilerStats(profiler, scope->name);
+		if(!stats) {
+			if(profiler->statsCount == GPU_PROFILER_MAX_SCOPES) {
+				continue;
+			}
+			stats = &profiler->stats[profiler->statsCount++];
+			*stats = {};
+			stats->name = scope->name;
+		}
+		stats->depth = scope->depth;
+		stats->lastBegin = begin * 1e-6;
+		stats->lastEnd = end * 1e-6;
+		stats->lastTime = stats->lastEnd - stats->lastBegin;
+		updateStats(stats, float(stats->lastTime));
+		if(profiler->calibrated && uint64_t(end + gpuToHostOffset) > profiler->lastFrameEndHostNs) {
+			profiler->lastFrameEndHostNs = uint64_t(end + gpuToHostOffset);
+		}
+
+		if(capture) {
+			GpuProfilerTraceEvent event;
+			event.name = scope->name;
+			event.beginNs = uint64_t(begin + gpuToHostOffset);
+			event.endNs = uint64_t(end + gpuToHostOffset);
+			event.track = scope->track;
+			profiler->trace.push_back(event);
+		}
+	}
+
+	if(capture && --profiler->captureFramesLeft == 0) {
+		writeTrace(profiler);
+	}
+}
+
+void beginGpuProfilerFrame(VulkanContext* context, GpuProfiler* profiler, VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	GpuProfilerFrame* frame = &profiler->frames[frameIndex];
+	if(profiler->calibrated) {
+		// Clocks drift apart, so recalibrate once per frame
+		calibrateGpuProfiler(context, profiler);
+	}
+	resolveGpuProfilerFrame(context, profiler, frame);
+
+	profiler->currentFrame = frameIndex;
+	profiler->stackDepth = 0;
+	frame->scopeCount = 0;
+	frame->hostTime = cpuProfilerNow();
+	VK(vkCmdResetQueryPool(commandBuffer, frame->queryPool, 0, GPU_PROFILER_MAX_SCOPES * 2));
+}
+
+void beginGpuScope(GpuProfiler* profiler, VkCommandBuffer commandBuffer, const char* name, uint32_t track) {
+	GpuProfilerFrame* frame = &profiler->frames[profiler->currentFrame];
+	assert(track < GPU_PROFILER_CPU_TRACK);
+	if(!profiler->timestampMasks[track]) {
+		// Writing a timestamp on such a queue is invalid, endGpuScope skips the matching end
+		profiler->scopeStack[profiler->stackDepth++] = GPU_PROFILER_NO_SCOPE;
+		return;
+	}
+	assert(frame->scopeCount < GPU_PROFILER_MAX_SCOPES);
+	uint32_t scopeIndex = frame->scopeCount++;
+	frame->scopes[scopeIndex].name = name;
+	frame->scopes[scopeIndex].depth = profiler->stackDepth;
+	frame->scopes[scopeIndex].track = track;
+	profiler->scopeStack[profiler->stackDepth++] = scopeIndex;
+	VK(vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->queryPool, scopeIndex * 2));
+}
+
+void endGpuScope(GpuProfiler* profiler, VkCommandBuffer commandBuffer) {
+	GpuProfilerFrame* frame = &profiler->frames[profiler->currentFrame];
+	assert(profiler->stackDepth > 0);
+	uint32_t scopeIndex = profiler->scopeStack[--profiler->stackDepth];
+	if(scopeIndex == GPU_PROFILER_NO_SCOPE) {
+		return;
+	}
+	VK(vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->queryPool, scopeIndex * 2 + 1));
+}
+
+void addProfilerCpuFrame(GpuProfiler* profiler, const CpuProfilerFrame* frame) {
+	if(profiler->captureFramesLeft == 0) {
+		return;
+	}
+	for(uint32_t i = 0; i < frame->zoneCount; ++i) {
+		GpuProfilerTraceEvent event;
+		event.name = frame->zones[i].name;
+		event.beginNs = frame->zones[i].beginNs;
+		event.endNs = frame->zones[i].endNs;
+		event.track = GPU_PROFILER_CPU_TRACK + frame->zones[i].thread;
+		profiler->trace.push_back(event);
+	}
+}
+
+void captureProfilerTrace(GpuProfiler* profiler, uint32_t frameCount, const char* filename) {
+	profiler->trace.clear();
+	profiler->captureFramesLeft = frameCount;
+	profiler->captureFilename = filename;
+}
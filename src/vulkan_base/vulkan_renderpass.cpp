@@ -1,8 +1,88 @@
 #include "vulkan_base.h"
 
-VkRenderPass createRenderPass(VulkanContext* context, VkFormat format, VkSampleCountFlagBits sampleCount, bool useDepth, VkImageLayout finalLayout) {
+VkRenderPass createRenderPass(VulkanContext* context, VkAttachmentDescription* attachments, uint32_t numAttachments, VulkanSubpass* subpasses, uint32_t numSubpasses, VkImageLayout finalLayout) {
 	VkRenderPass renderPass;
 
+	VkSubpassDescription* subpassDescriptions = new VkSubpassDescription[numSubpasses];
+	// Two color, two resolve and the depth reference per subpass, then its input attachments
+	VkAttachmentReference* references = new VkAttachmentReference[numSubpasses * (5 + VULKAN_MAX_INPUT_ATTACHMENTS)];
+	// Each input attachment is produced by the subpass before it. One dependency per subpass plus the external one
+	VkSubpassDependency* dependencies = new VkSubpassDependency[numSubpasses];
+	uint32_t numDependencies = 0;
+
+	for(uint32_t i = 0; i < numSubpasses; ++i) {
+		VulkanSubpass* subpass = &subpasses[i];
+		assert(subpass->inputAttachmentCount <= VULKAN_MAX_INPUT_ATTACHMENTS);
+		VkAttachmentReference* colorReference = &references[i * (5 + VULKAN_MAX_INPUT_ATTACHMENTS)];
+		VkAttachmentReference* resolveTargetReference = colorReference + 2;
+		VkAttachmentReference* depthStencilReference = colorReference + 4;
+		VkAttachmentReference* inputReferences = colorReference + 5;
+		uint32_t colorCount = (subpass->secondColorAttachment != VK_ATTACHMENT_UNUSED) ? 2 : 1;
+		colorReference[0] = { subpass->colorAttachment, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		colorReference[1] = { subpass->secondColorAttachment, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		*depthStencilReference = { subpass->depthAttachment, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+		resolveTargetReference[0] = { subpass->resolveAttachment, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		resolveTargetReference[1] = { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+		for(uint32_t j = 0; j < subpass->inputAttachmentCount; ++j) {
+			inputReferences[j] = { subpass->inputAttachments[j], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		}
+
+		subpassDescriptions[i] = {};
+		subpassDescriptions[i].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpassDescriptions[i].colorAttachmentCount = colorCount;
+		subpassDescriptions[i].pColorAttachments = colorReference;
+		subpassDescriptions[i].inputAttachmentCount = subpass->inputAttachmentCount;
+		subpassDescriptions[i].pInputAttachments = inputReferences;
+		if(subpass->depthAttachment != VK_ATTACHMENT_UNUSED) {
+			subpassDescriptions[i].pDepthStencilAttachment = depthStencilReference;
+		}
+		if(subpass->resolveAttachment != VK_ATTACHMENT_UNUSED) {
+			subpassDescriptions[i].pResolveAttachments = resolveTargetReference;
+		}
+
+		if(i > 0 && subpass->inputAttachmentCount > 0) {
+			// Only the pixel at the same location is read, so the dependency can be by region.
+			// This lets tile based renderers keep the intermediate results in tile memory
+			VkSubpassDependency* dependency = &dependencies[numDependencies++];
+			*dependency = {};
+			dependency->srcSubpass = i - 1;
+			dependency->srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			dependency->srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			dependency->dstSubpass = i;
+			dependency->dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+			dependency->dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+			dependency->dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+		}
+	}
+
+	if(finalLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+		VkSubpassDependency* dependency = &dependencies[numDependencies++];
+		*dependency = {};
+		dependency->srcSubpass = numSubpasses - 1;
+		dependency->srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependency->srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependency->dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependency->dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dependency->dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	}
+
+	VkRenderPassCreateInfo createInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+	createInfo.attachmentCount = numAttachments;
+	createInfo.pAttachments = attachments;
+	createInfo.subpassCount = numSubpasses;
+	createInfo.pSubpasses = subpassDescriptions;
+	createInfo.dependencyCount = numDependencies;
+	createInfo.pDependencies = dependencies;
+	VKA(vkCreateRenderPass(context->device, &createInfo, 0, &renderPass));
+
+	delete[] dependencies;
+	delete[] references;
+	delete[] subpassDescriptions;
+
+	return renderPass;
+}
+
+VkRenderPass createRenderPass(VulkanContext* context, VkFormat format, VkSampleCountFlagBits sampleCount, bool useDepth, VkImageLayout finalLayout) {
 	VkAttachmentDescription attachmentDescriptions[3];
 	attachmentDescriptions[0] = {};
 	attachmentDescriptions[0].format = format;
@@ -26,51 +106,97 @@ VkRenderPass createRenderPass(VulkanContext* context, VkFormat format, VkSampleC
 	attachmentDescriptions[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	attachmentDescriptions[2].finalLayout = finalLayout;
 
-	VkAttachmentReference attachmentReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-	VkAttachmentReference depthStencilReference = {1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
-	VkAttachmentReference resolveTargetReference = {2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-
-	VkSubpassDescription subpass = {};
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
-	subpass.pColorAttachments = &attachmentReference;
+	VulkanSubpass subpass = {};
+	subpass.colorAttachment = 0;
+	subpass.secondColorAttachment = VK_ATTACHMENT_UNUSED;
+	subpass.depthAttachment = VK_ATTACHMENT_UNUSED;
+	subpass.resolveAttachment = VK_ATTACHMENT_UNUSED;
 	uint32_t usedAttachmentCount = 1;
 	if(useDepth) {
 		usedAttachmentCount++;
-		subpass.pDepthStencilAttachment = &depthStencilReference;
+		subpass.depthAttachment = 1;
 	}
 	if(sampleCount != VK_SAMPLE_COUNT_1_BIT) {
 		if(!useDepth) {
 			attachmentDescriptions[1] = attachmentDescriptions[2];
-			resolveTargetReference.attachment = 1;
 		}
+		subpass.resolveAttachment = usedAttachmentCount;
 		usedAttachmentCount++;
-		subpass.pResolveAttachments = &resolveTargetReference;
 	}
 
-	VkSubpassDescription subpasses[] = {subpass};
-	VkSubpassDependency subpassDependency = {};
-	subpassDependency.srcSubpass = 0;
-	subpassDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	subpassDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-	subpassDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
-	subpassDependency.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	subpassDependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	return createRenderPass(context, attachmentDescriptions, usedAttachmentCount, &subpass, 1, finalLayout);
+}
 
-	VkRenderPassCreateInfo createInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
-	createInfo.attachmentCount = usedAttachmentCount;
-	createInfo.pAttachments = attachmentDescriptions;
-	createInfo.subpassCount = ARRAY_COUNT(subpasses);
-	createInfo.pSubpasses = subpasses;
-	if(finalLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-		createInfo.dependencyCount = 1;
-		createInfo.pDependencies = &subpassDependency;
+void destroyRenderpass(VulkanContext* context, VkRenderPass renderPass) {
+	VK(vkDestroyRenderPass(context->device, renderPass, 0));
+}
+
+VkFramebuffer createImagelessFramebuffer(VulkanContext* context, VkRenderPass renderPass, uint32_t width, uint32_t height,
+										 uint32_t numAttachments, VkFormat* formats, VkImageUsageFlags* usages) {
+	VkFramebufferAttachmentImageInfoKHR* imageInfos = new VkFramebufferAttachmentImageInfoKHR[numAttachments];
+	for(uint32_t i = 0; i < numAttachments; ++i) {
+		imageInfos[i] = { VK_STRUCTURE_TYPE_FRAMEBUFFER_ATTACHMENT_IMAGE_INFO_KHR };
+		imageInfos[i].usage = usages[i];
+		imageInfos[i].width = width;
+		imageInfos[i].height = height;
+		imageInfos[i].layerCount = 1;
+		imageInfos[i].viewFormatCount = 1;
+		imageInfos[i].pViewFormats = &formats[i];
 	}
-	VKA(vkCreateRenderPass(context->device, &createInfo, 0, &renderPass));
+	VkFramebufferAttachmentsCreateInfoKHR attachmentsInfo = { VK_STRUCTURE_TYPE_FRAMEBUFFER_ATTACHMENTS_CREATE_INFO_KHR };
+	attachmentsInfo.attachmentImageInfoCount = numAttachments;
+	attachmentsInfo.pAttachmentImageInfos = imageInfos;
 
-	return renderPass;
+	VkFramebufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
+	createInfo.pNext = &attachmentsInfo;
+	createInfo.flags = VK_FRAMEBUFFER_CREATE_IMAGELESS_BIT_KHR;
+	createInfo.renderPass = renderPass;
+	createInfo.attachmentCount = numAttachments;
+	createInfo.width = width;
+	createInfo.height = height;
+	createInfo.layers = 1;
+	VkFramebuffer framebuffer;
+	VKA(vkCreateFramebuffer(context->device, &createInfo, 0, &framebuffer));
+
+	delete[] imageInfos;
+
+	return framebuffer;
 }
 
-void destroyRenderpass(VulkanContext* context, VkRenderPass renderPass) {
-	VK(vkDestroyRenderPass(context->device, renderPass, 0));
-}
\ No newline at end of file
+void beginRendering(VulkanContext* context, VkCommandBuffer commandBuffer, VkImageView colorView, VkImageView depthView, VkRect2D renderArea, VkClearValue* clearValues,
+					VkImageView secondColorView) {
+	VkRenderingAttachmentInfoKHR colorAttachments[2];
+	colorAttachments[0] = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR };
+	colorAttachments[0].imageView = colorView;
+	colorAttachments[0].imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachments[0].clearValue = clearValues[0];
+	colorAttachments[1] = colorAttachments[0];
+	colorAttachments[1].imageView = secondColorView;
+	if(secondColorView) {
+		colorAttachments[1].clearValue = clearValues[depthView ? 2 : 1];
+	}
+	VkRenderingAttachmentInfoKHR depthAttachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR };
+	depthAttachment.imageView = depthView;
+	depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	if(depthView) {
+		depthAttachment.clearValue = clearValues[1];
+	}
+
+	VkRenderingInfoKHR renderingInfo = { VK_STRUCTURE_TYPE_RENDERING_INFO_KHR };
+	renderingInfo.renderArea = renderArea;
+	renderingInfo.layerCount = 1;
+	renderingInfo.colorAttachmentCount = secondColorView ? 2 : 1;
+	renderingInfo.pColorAttachments = colorAttachments;
+	if(depthView) {
+		renderingInfo.pDepthAttachment = &depthAttachment;
+	}
+	context->cmdBeginRendering(commandBuffer, &renderingInfo);
+}
+
+void endRendering(VulkanContext* context, VkCommandBuffer commandBuffer) {
+	context->cmdEndRendering(commandBuffer);
+}
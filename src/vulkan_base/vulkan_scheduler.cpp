@@ -0,0 +1,174 @@
+#include "vulkan_base.h"
+
+void createScheduler(VulkanContext* context, VulkanScheduler* scheduler) {
+	*scheduler = {};
+	scheduler->useTimelineSemaphores = context->capabilities.timelineSemaphores;
+	if(scheduler->useTimelineSemaphores) {
+		scheduler->getSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)getDeviceFunction(context, "vkGetSemaphoreCounterValue", "vkGetSemaphoreCounterValueKHR", VK_API_VERSION_1_2);
+		scheduler->waitSemaphores = (PFN_vkWaitSemaphoresKHR)getDeviceFunction(context, "vkWaitSemaphores", "vkWaitSemaphoresKHR", VK_API_VERSION_1_2);
+		if(!scheduler->getSemaphoreCounterValue || !scheduler->waitSemaphores) {
+			scheduler->useTimelineSemaphores = false;
+		}
+	}
+	if(!scheduler->useTimelineSemaphores) {
+		LOG_WARN("Timeline semaphores not available, falling back to a fence per submission");
+	}
+
+	VkQueue queues[] = { context->graphicsQueue.queue, context->computeQueue.queue };
+	for(uint32_t i = 0; i < ARRAY_COUNT(queues); ++i) {
+		// Without a separate compute queue both are the same VkQueue and share one timeline
+		if(i > 0 && queues[i] == queues[0]) {
+			continue;
+		}
+		VulkanQueueTimeline* timeline = &scheduler->timelines[scheduler->timelineCount++];
+		timeline->queue = queues[i];
+		if(scheduler->useTimelineSemaphores) {
+			VkSemaphoreTypeCreateInfoKHR typeCreateInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR };
+			typeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+			typeCreateInfo.initialValue = 0;
+			VkSemaphoreCreateInfo createInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+			createInfo.pNext = &typeCreateInfo;
+			VKA(vkCreateSemaphore(context->device, &createInfo, 0, &timeline->semaphore));
+		}
+	}
+}
+
+void destroyScheduler(VulkanContext* context, VulkanScheduler* scheduler) {
+	for(uint32_t i = 0; i < scheduler->timelineCount; ++i) {
+		VulkanQueueTimeline* timeline = &scheduler->timelines[i];
+		for(uint32_t j = 0; j < timeline->pending.size(); ++j) {
+			if(timeline->pending[j].fence) {
+				VK(vkDestroyFence(context->device, timeline->pending[j].fence, 0));
+			}
+		}
+		if(timeline->semaphore) {
+			VK(vkDestroySemaphore(context->device, timeline->semaphore, 0));
+		}
+	}
+	for(uint32_t i = 0; i < scheduler->freeFences.size(); ++i) {
+		VK(vkDestroyFence(context->device, scheduler->freeFences[i], 0));
+	}
+	*scheduler = {};
+}
+
+static VulkanQueueTimeline* getQueueTimeline(VulkanScheduler* scheduler, VkQueue queue) {
+	for(uint32_t i = 0; i < scheduler->timelineCount; ++i) {
+		if(scheduler->timelines[i].queue == queue) {
+			return &scheduler->timelines[i];
+		}
+	}
+	assert(false);
+	return 0;
+}
+
+uint64_t submitWithValue(VulkanContext* context, VulkanQueue* queue, VkSubmitInfo* submitInfo) {
+	VulkanScheduler* scheduler = &context->scheduler;
+	VulkanQueueTimeline* timeline = getQueueTimeline(scheduler, queue->queue);
+	VulkanSubmission submission = { ++scheduler->submittedValue, 0 };
+
+	if(scheduler->useTimelineSemaphores) {
+		assert(submitInfo->signalSemaphoreCount < VULKAN_SCHEDULER_MAX_SIGNALS);
+		VkSemaphore signalSemaphores[VULKAN_SCHEDULER_MAX_SIGNALS];
+		// Values of binary semaphores are ignored
+		uint64_t signalValues[VULKAN_SCHEDULER_MAX_SIGNALS] = {};
+		uint32_t signalCount = submitInfo->signalSemaphoreCount;
+		for(uint32_t i = 0; i < signalCount; ++i) {
+			signalSemaphores[i] = submitInfo->pSignalSemaphores[i];
+		}
+		signalSemaphores[signalCount] = timeline->semaphore;
+		signalValues[signalCount] = submission.value;
+		signalCount++;
+
+		VkTimelineSemaphoreSubmitInfoKHR timelineInfo = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR };
+		timelineInfo.pNext = submitInfo->pNext;
+		timelineInfo.signalSemaphoreValueCount = signalCount;
+		timelineInfo.pSignalSemaphoreValues = signalValues;
+		VkSubmitInfo info = *submitInfo;
+		info.pNext = &timelineInfo;
+		info.signalSemaphoreCount = signalCount;
+		info.pSignalSemaphores = signalSemaphores;
+		VKA(vkQueueSubmit(queue->queue, 1, &info, 0));
+	} else {
+		if(scheduler->freeFences.empty()) {
+			VkFenceCreateInfo createInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+			VKA(vkCreateFence(context->device, &createInfo, 0, &submission.fence));
+		} else {
+			submission.fence = scheduler->freeFences.back();
+			scheduler->freeFences.pop_back();
+		}
+		VKA(vkQueueSubmit(queue->queue, 1, submitInfo, submission.fence));
+	}
+
+	timeline->pending.push_back(submission);
+	return submission.value;
+}
+
+uint64_t pollCompletedValue(VulkanContext* context) {
+	VulkanScheduler* scheduler = &context->scheduler;
+	uint64_t completedValue = scheduler->submittedValue;
+	for(uint32_t i = 0; i < scheduler->timelineCount; ++i) {
+		VulkanQueueTimeline* timeline = &scheduler->timelines[i];
+		uint32_t finished = 0;
+		if(scheduler->useTimelineSemaphores) {
+			uint64_t counter = 0;
+			VKA(scheduler->getSemaphoreCounterValue(context->device, timeline->semaphore, &counter));
+			while(finished < timeline->pending.size() && timeline->pending[finished].value <= counter) {
+				finished++;
+			}
+		} else {
+			// Submissions of one queue finish in order, so stop at the first unsignaled fence
+			while(finished < timeline->pending.size() && VK(vkGetFenceStatus(context->device, timeline->pending[finished].fence)) == VK_SUCCESS) {
+				VKA(vkResetFences(context->device, 1, &timeline->pending[finished].fence));
+				scheduler->freeFences.push_back(timeline->pending[finished].fence);
+				finished++;
+			}
+		}
+		timeline->pending.erase(timeline->pending.begin(), timeline->pending.begin() + finished);
+		if(!timeline->pending.empty() && timeline->pending[0].value - 1 < completedValue) {
+			completedValue = timeline->pending[0].value - 1;
+		}
+	}
+	scheduler->completedValue = completedValue;
+	return completedValue;
+}
+
+void waitForValue(VulkanContext* context, uint64_t value) {
+	VulkanScheduler* scheduler = &context->scheduler;
+	assert(value <= scheduler->submittedValue);
+	if(value <= scheduler->completedValue) {
+		return;
+	}
+
+	// Submissions on a queue finish in order, so waiting for the last one up to value is enough on every queue
+	VkSemaphore semaphores[VULKAN_SCHEDULER_MAX_QUEUES];
+	uint64_t values[VULKAN_SCHEDULER_MAX_QUEUES];
+	VkFence fences[VULKAN_SCHEDULER_MAX_QUEUES];
+	uint32_t waitCount = 0;
+	for(uint32_t i = 0; i < scheduler->timelineCount; ++i) {
+		VulkanQueueTimeline* timeline = &scheduler->timelines[i];
+		VulkanSubmission* last = 0;
+		for(uint32_t j = 0; j < timeline->pending.size() && timeline->pending[j].value <= value; ++j) {
+			last = &timeline->pending[j];
+		}
+		if(!last) {
+			continue;
+		}
+		semaphores[waitCount] = timeline->semaphore;
+		values[waitCount] = last->value;
+		fences[waitCount] = last->fence;
+		waitCount++;
+	}
+
+	if(waitCount) {
+		if(scheduler->useTimelineSemaphores) {
+			VkSemaphoreWaitInfoKHR waitInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR };
+			waitInfo.semaphoreCount = waitCount;
+			waitInfo.pSemaphores = semaphores;
+			waitInfo.pValues = values;
+			VKA(scheduler->waitSemaphores(context->device, &waitInfo, UINT64_MAX));
+		} else {
+			VKA(vkWaitForFences(context->device, waitCount, fences, VK_TRUE, UINT64_MAX));
+		}
+	}
+	pollCompletedValue(context);
+}
@@ -1,6 +1,6 @@
 #include "vulkan_base.h"
 
-VulkanSwapchain createSwapchain(VulkanContext* context, VkSurfaceKHR surface, VkImageUsageFlags usage, VulkanSwapchain* oldSwapchain) {
+VulkanSwapchain createSwapchain(VulkanContext* context, VkSurfaceKHR surface, VkImageUsageFlags usage, VulkanSwapchain* oldSwapchain, VkPresentModeKHR presentMode, uint32_t imageCount) {
 	VulkanSwapchain result = {};
 
 	VkBool32 supportsPresent = 0;
@@ -47,23 +47,55 @@ VulkanSwapchain createSwapchain(VulkanContext* context, VkSurfaceKHR surface, Vk
 	if (surfaceCapabilities.maxImageCount == 0) {
 		surfaceCapabilities.maxImageCount = 8;
 	}
+	uint32_t minImageCount = imageCount;
+	if (minImageCount < surfaceCapabilities.minImageCount) {
+		minImageCount = surfaceCapabilities.minImageCount;
+	}
+	if (minImageCount > surfaceCapabilities.maxImageCount) {
+		minImageCount = surfaceCapabilities.maxImageCount;
+	}
+
+	// FIFO is the only mode that is guaranteed to be supported
+	uint32_t numPresentModes = 0;
+	VKA(vkGetPhysicalDeviceSurfacePresentModesKHR(context->physicalDevice, surface, &numPresentModes, 0));
+	std::vector<VkPresentModeKHR> presentModes(numPresentModes);
+	VKA(vkGetPhysicalDeviceSurfacePresentModesKHR(context->physicalDevice, surface, &numPresentModes, presentModes.data()));
+	VkPresentModeKHR selectedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+	for (uint32_t i = 0; i < numPresentModes; ++i) {
+		if (presentModes[i] == presentMode) {
+			selectedPresentMode = presentMode;
+			break;
+		}
+	}
+	if (selectedPresentMode != presentMode) {
+		LOG_WARN("Requested present mode not supported, falling back to FIFO");
+	}
 
 	VkSwapchainCreateInfoKHR createInfo = { VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR };
 	createInfo.surface = surface;
-	createInfo.minImageCount = 3;
+	createInfo.minImageCount = minImageCount;
 	createInfo.imageFormat = format;
 	createInfo.imageColorSpace = colorSpace;
 	createInfo.imageExtent = surfaceCapabilities.currentExtent;
 	createInfo.imageArrayLayers = 1;
 	createInfo.imageUsage = usage;
 	createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	// Async compute writes the swapchain images which are then presented from the graphics queue.
+	// Concurrent sharing saves the queue family ownership transfers for this
+	uint32_t queueFamilyIndices[] = { context->graphicsQueue.familyIndex, context->computeQueue.familyIndex };
+	if (context->computeQueue.familyIndex != context->graphicsQueue.familyIndex) {
+		createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+		createInfo.queueFamilyIndexCount = ARRAY_COUNT(queueFamilyIndices);
+		createInfo.pQueueFamilyIndices = queueFamilyIndices;
+	}
 	createInfo.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
 	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-	createInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+	createInfo.presentMode = selectedPresentMode;
 	createInfo.oldSwapchain = oldSwapchain ? oldSwapchain->swapchain : 0;
 	VKA(vkCreateSwapchainKHR(context->device, &createInfo, 0, &result.swapchain));
 
 	result.format = format;
+	result.presentMode = selectedPresentMode;
 	result.width = surfaceCapabilities.currentExtent.width;
 	result.height = surfaceCapabilities.currentExtent.height;
 
@@ -90,9 +122,85 @@ VulkanSwapchain createSwapchain(VulkanContext* context, VkSurfaceKHR surface, Vk
 	return result;
 }
 
+VulkanSwapchain createOffscreenSwapchain(VulkanContext* context, uint32_t width, uint32_t height, VkImageUsageFlags usage, uint32_t imageCount) {
+	VulkanSwapchain result = {};
+
+	// rgba8 matches the storage image format of the compute shaders
+	VkFormat candidateFormats[] = { VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_B8G8R8A8_UNORM };
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	for (uint32_t i = 0; i < ARRAY_COUNT(candidateFormats); ++i) {
+		VkImageFormatProperties formatProperties;
+		VkResult formatResult = vkGetPhysicalDeviceImageFormatProperties(context->physicalDevice, candidateFormats[i], VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_OPTIMAL, usage, 0, &formatProperties);
+		if (formatResult == VK_SUCCESS) {
+			format = candidateFormats[i];
+			break;
+		}
+	}
+	if (format == VK_FORMAT_UNDEFINED) {
+		LOG_ERROR("No offscreen swapchain format supports the requested usage flags");
+		return result;
+	}
+
+	result.format = format;
+	result.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+	result.width = width;
+	result.height = height;
+	result.images.resize(imageCount);
+	result.imageViews.resize(imageCount);
+	result.memories.resize(imageCount);
+
+	// Same sharing as the real swapchain, see createSwapchain
+	uint32_t queueFamilyIndices[] = { context->graphicsQueue.familyIndex, context->computeQueue.familyIndex };
+	for (uint32_t i = 0; i < imageCount; ++i) {
+		VkImageCreateInfo createInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+		createInfo.imageType = VK_IMAGE_TYPE_2D;
+		createInfo.extent = { width, height, 1 };
+		createInfo.mipLevels = 1;
+		createInfo.arrayLayers = 1;
+		createInfo.format = format;
+		createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		createInfo.usage = usage;
+		createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if (context->computeQueue.familyIndex != context->graphicsQueue.familyIndex) {
+			createInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+			createInfo.queueFamilyIndexCount = ARRAY_COUNT(queueFamilyIndices);
+			createInfo.pQueueFamilyIndices = queueFamilyIndices;
+		}
+		VKA(vkCreateImage(context->device, &createInfo, 0, &result.images[i]));
+
+		VkMemoryRequirements memoryRequirements;
+		VK(vkGetImageMemoryRequirements(context->device, result.images[i], &memoryRequirements));
+		VkMemoryAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+		allocateInfo.allocationSize = memoryRequirements.size;
+		allocateInfo.memoryTypeIndex = findMemoryType(context, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VKA(vkAllocateMemory(context->device, &allocateInfo, 0, &result.memories[i]));
+		VKA(vkBindImageMemory(context->device, result.images[i], result.memories[i], 0));
+
+		VkImageViewCreateInfo viewCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+		viewCreateInfo.image = result.images[i];
+		viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCreateInfo.format = format;
+		viewCreateInfo.components = {};
+		viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		VKA(vkCreateImageView(context->device, &viewCreateInfo, 0, &result.imageViews[i]));
+	}
+
+	return result;
+}
+
 void destroySwapchain(VulkanContext* context, VulkanSwapchain* swapchain) {
 	for (uint32_t i = 0; i < swapchain->imageViews.size(); ++i) {
 		VK(vkDestroyImageView(context->device, swapchain->imageViews[i], 0));
 	}
-	VK(vkDestroySwapchainKHR(context->device, swapchain->swapchain, 0));
+	if (swapchain->swapchain) {
+		VK(vkDestroySwapchainKHR(context->device, swapchain->swapchain, 0));
+	} else {
+		// Offscreen swapchain owns its images
+		for (uint32_t i = 0; i < swapchain->images.size(); ++i) {
+			VK(vkDestroyImage(context->device, swapchain->images[i], 0));
+			VK(vkFreeMemory(context->device, swapchain->memories[i], 0));
+		}
+	}
 }
\ No newline at end of file
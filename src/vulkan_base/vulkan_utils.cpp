@@ -1,6 +1,7 @@
 #include "vulkan_base.h"
 
-uint32_t findMemoryType(VulkanContext* context, uint32_t typeFilter, VkMemoryPropertyFlags memoryProperties) {
+// Returns UINT32_MAX if there is no such memory type
+static uint32_t findOptionalMemoryType(VulkanContext* context, uint32_t typeFilter, VkMemoryPropertyFlags memoryProperties) {
 	VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
 	VK(vkGetPhysicalDeviceMemoryProperties(context->physicalDevice, &deviceMemoryProperties));
 
@@ -15,10 +16,36 @@ uint32_t findMemoryType(VulkanContext* context, uint32_t typeFilter, VkMemoryPro
 			}
 		}
 	}
+	return UINT32_MAX;
+}
 
+uint32_t findMemoryType(VulkanContext* context, uint32_t typeFilter, VkMemoryPropertyFlags memoryProperties) {
+	uint32_t memoryIndex = findOptionalMemoryType(context, typeFilter, memoryProperties);
 	// No matching avaialble memory type found
-	assert(false);
-	return UINT32_MAX;
+	assert(memoryIndex != UINT32_MAX);
+	return memoryIndex;
+}
+
+uint32_t getMemoryHeaps(VulkanContext* context, VulkanMemoryHeap* heaps) {
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT };
+	VkPhysicalDeviceMemoryProperties2 memoryProperties2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2 };
+	VkPhysicalDeviceMemoryProperties* memoryProperties = &memoryProperties2.memoryProperties;
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)getInstanceFunction(context, "vkGetPhysicalDeviceMemoryProperties2", "vkGetPhysicalDeviceMemoryProperties2KHR", VK_API_VERSION_1_1);
+	bool hasBudget = context->capabilities.memoryBudget && getMemoryProperties2;
+	if (hasBudget) {
+		memoryProperties2.pNext = &budgetProperties;
+		VK(getMemoryProperties2(context->physicalDevice, &memoryProperties2));
+	} else {
+		VK(vkGetPhysicalDeviceMemoryProperties(context->physicalDevice, memoryProperties));
+	}
+
+	for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; ++i) {
+		heaps[i].size = memoryProperties->memoryHeaps[i].size;
+		heaps[i].usage = hasBudget ? budgetProperties.heapUsage[i] : 0;
+		heaps[i].budget = hasBudget ? budgetProperties.heapBudget[i] : 0;
+		heaps[i].deviceLocal = (memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+	}
+	return memoryProperties->memoryHeapCount;
 }
 
 void createBuffer(VulkanContext* context, VulkanBuffer* buffer, uint64_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties) {
@@ -85,8 +112,8 @@ void uploadDataToBuffer(VulkanContext* context, VulkanBuffer* buffer, void* data
 	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
-	VKA(vkQueueSubmit(queue->queue, 1, &submitInfo, VK_NULL_HANDLE));
-	VKA(vkQueueWaitIdle(queue->queue));
+	// Only waits for this upload, not for frames that are still in flight on the same queue
+	waitForValue(context, submitWithValue(context, queue, &submitInfo));
 
 	VK(vkDestroyCommandPool(context->device, commandPool, 0));
 	destroyBuffer(context, &stagingBuffer);
@@ -99,14 +126,14 @@ void destroyBuffer(VulkanContext* context, VulkanBuffer* buffer) {
 	VK(vkFreeMemory(context->device, buffer->memory, 0));
 }
 
-void createImage(VulkanContext* context, VulkanImage* image, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkSampleCountFlagBits sampleCount) {
+void createImage(VulkanContext* context, VulkanImage* image, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkSampleCountFlagBits sampleCount, uint32_t mipLevels) {
 	{
 		VkImageCreateInfo createInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
 		createInfo.imageType = VK_IMAGE_TYPE_2D;
 		createInfo.extent.width = width;
 		createInfo.extent.height = height;
 		createInfo.extent.depth = 1;
-		createInfo.mipLevels = 1;
+		createInfo.mipLevels = mipLevels;
 		createInfo.arrayLayers = 1;
 		createInfo.format = format;
 		createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
@@ -121,7 +148,15 @@ void createImage(VulkanContext* context, VulkanImage* image, uint32_t width, uin
 	VK(vkGetImageMemoryRequirements(context->device, image->image, &memoryRequirements));
 	VkMemoryAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
 	allocateInfo.allocationSize = memoryRequirements.size;
-	allocateInfo.memoryTypeIndex = findMemoryType(context, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	allocateInfo.memoryTypeIndex = UINT32_MAX;
+	if(usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) {
+		// Tile based GPUs keep transient attachments in tile memory and only back them with memory if they run out.
+		// Desktop GPUs usually have no such memory type
+		allocateInfo.memoryTypeIndex = findOptionalMemoryType(context, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+	}
+	if(allocateInfo.memoryTypeIndex == UINT32_MAX) {
+		allocateInfo.memoryTypeIndex = findMemoryType(context, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	}
 	VKA(vkAllocateMemory(context->device, &allocateInfo, 0, &image->memory));
 	VKA(vkBindImageMemory(context->device, image->image, image->memory, 0));
 
@@ -136,13 +171,63 @@ void createImage(VulkanContext* context, VulkanImage* image, uint32_t width, uin
 		createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 		createInfo.format = format;
 		createInfo.subresourceRange.aspectMask = aspect;
-		createInfo.subresourceRange.levelCount = 1;
+		createInfo.subresourceRange.levelCount = mipLevels;
 		createInfo.subresourceRange.layerCount = 1;
 		VKA(vkCreateImageView(context->device, &createInfo, 0, &image->view));
 	}
 }
 
-void uploadDataToImage(VulkanContext* context, VulkanImage* image, void* data, size_t size, uint32_t width, uint32_t height, VkImageLayout finalLayout, VkAccessFlags dstAccessMask) {
+// The levels are tightly packed in source, the largest first
+void recordImageUpload(VkCommandBuffer commandBuffer, VulkanImage* image, VkBuffer source, VkDeviceSize sourceOffset, uint32_t width, uint32_t height, uint32_t mipLevels, VkImageLayout finalLayout) {
+	{
+		VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = image->image;
+		imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		imageBarrier.subresourceRange.levelCount = mipLevels;
+		imageBarrier.subresourceRange.layerCount = 1;
+		imageBarrier.srcAccessMask = 0;
+		imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
+	}
+
+	VkBufferImageCopy regions[16];
+	assert(mipLevels <= ARRAY_COUNT(regions));
+	VkDeviceSize offset = sourceOffset;
+	for (uint32_t level = 0; level < mipLevels; ++level) {
+		uint32_t levelWidth = width >> level ? width >> level : 1;
+		uint32_t levelHeight = height >> level ? height >> level : 1;
+		regions[level] = {};
+		regions[level].bufferOffset = offset;
+		regions[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		regions[level].imageSubresource.mipLevel = level;
+		regions[level].imageSubresource.layerCount = 1;
+		regions[level].imageExtent = {levelWidth, levelHeight, 1};
+		// Only 4 byte formats are uploaded
+		offset += (VkDeviceSize)levelWidth * levelHeight * 4;
+	}
+	VK(vkCmdCopyBufferToImage(commandBuffer, source, image->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, regions));
+
+	{
+		VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrier.newLayout = finalLayout;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = image->image;
+		imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		imageBarrier.subresourceRange.levelCount = mipLevels;
+		imageBarrier.subresourceRange.layerCount = 1;
+		imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
+	}
+}
+
+void uploadDataToImage(VulkanContext* context, VulkanImage* image, void* data, size_t size, uint32_t width, uint32_t height, VkImageLayout finalLayout, VkAccessFlags dstAccessMask, uint32_t mipLevels) {
 	// Upload with staging buffer
 	VulkanQueue* queue = &context->graphicsQueue;
 	VkCommandPool commandPool;
@@ -171,40 +256,88 @@ void uploadDataToImage(VulkanContext* context, VulkanImage* image, void* data, s
 	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 	VKA(vkBeginCommandBuffer(commandBuffer, &beginInfo));
 
+	recordImageUpload(commandBuffer, image, stagingBuffer.buffer, 0, width, height, mipLevels, finalLayout);
+
+	VKA(vkEndCommandBuffer(commandBuffer));
+
+	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	waitForValue(context, submitWithValue(context, queue, &submitInfo));
+
+	VK(vkDestroyCommandPool(context->device, commandPool, 0));
+	destroyBuffer(context, &stagingBuffer);
+}
+
+void downloadDataFromImage(VulkanContext* context, VkImage image, void* data, size_t size, uint32_t width, uint32_t height, VkImageLayout layout) {
+	// Download with staging buffer
+	VulkanQueue* queue = &context->graphicsQueue;
+	VkCommandPool commandPool;
+	VkCommandBuffer commandBuffer;
+	VulkanBuffer stagingBuffer;
+	createBuffer(context, &stagingBuffer, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	{
+		VkCommandPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+		createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		createInfo.queueFamilyIndex = queue->familyIndex;
+		VKA(vkCreateCommandPool(context->device, &createInfo, 0, &commandPool));
+	}
+	{
+		VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+		allocateInfo.commandPool = commandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = 1;
+		VKA(vkAllocateCommandBuffers(context->device, &allocateInfo, &commandBuffer));
+	}
+
+	VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VKA(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
 	{
 		VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
-		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrier.oldLayout = layout;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		imageBarrier.image = image->image;
+		imageBarrier.image = image;
 		imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 		imageBarrier.subresourceRange.levelCount = 1;
 		imageBarrier.subresourceRange.layerCount = 1;
-		imageBarrier.srcAccessMask = 0;
-		imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
+		imageBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
 	}
 
 	VkBufferImageCopy region = {};
 	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	region.imageSubresource.layerCount = 1;
 	region.imageExtent = {width, height, 1};
-	VK(vkCmdCopyBufferToImage(commandBuffer, stagingBuffer.buffer, image->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region));
+	VK(vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, stagingBuffer.buffer, 1, &region));
 
 	{
 		VkImageMemoryBarrier imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
-		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		imageBarrier.newLayout = finalLayout;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		imageBarrier.newLayout = layout;
 		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		imageBarrier.image = image->image;
+		imageBarrier.image = image;
 		imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 		imageBarrier.subresourceRange.levelCount = 1;
 		imageBarrier.subresourceRange.layerCount = 1;
-		imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
+		imageBarrier.srcAccessMask = 0;
+		imageBarrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, 0, 0, 0, 1, &imageBarrier);
+	}
+	{
+		VkBufferMemoryBarrier bufferBarrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+		bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.buffer = stagingBuffer.buffer;
+		bufferBarrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, 0, 1, &bufferBarrier, 0, 0);
 	}
 
 	VKA(vkEndCommandBuffer(commandBuffer));
@@ -212,8 +345,12 @@ void uploadDataToImage(VulkanContext* context, VulkanImage* image, void* data, s
 	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
-	VKA(vkQueueSubmit(queue->queue, 1, &submitInfo, VK_NULL_HANDLE));
-	VKA(vkQueueWaitIdle(queue->queue));
+	waitForValue(context, submitWithValue(context, queue, &submitInfo));
+
+	void* mapped;
+	VKA(vkMapMemory(context->device, stagingBuffer.memory, 0, size, 0, &mapped));
+	memcpy(data, mapped, size);
+	VK(vkUnmapMemory(context->device, stagingBuffer.memory));
 
 	VK(vkDestroyCommandPool(context->device, commandPool, 0));
 	destroyBuffer(context, &stagingBuffer);